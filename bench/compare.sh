@@ -0,0 +1,185 @@
+#!/usr/bin/env bash
+#
+# Builds the C, C++, Go and Java ports, checks that they produce identical
+# ciphertext and MACs for the same input, key, S-box and IV, and prints a
+# throughput table per port, mode and message size.
+#
+# Usage: bench/compare.sh [-s "sizes in KB"] [-r repeats] [-p "ports"] [-o result.json]
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+SIZES="64 1024 16384"
+REPEATS=5
+PORTS="c cpp go java"
+MODES="ecb ctr cfb mac"
+JSON=""
+# Go needs the 0x prefix, and C/C++ count it against their 16-digit limit
+IV="0x123456789abcde"
+
+while getopts "s:r:p:o:" opt; do
+    case $opt in
+        s) SIZES=$OPTARG ;;
+        r) REPEATS=$OPTARG ;;
+        p) PORTS=$OPTARG ;;
+        o) JSON=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+
+build() {
+    local port available=""
+
+    for port in $PORTS; do
+        case $port in
+            c)
+                make -s -C "$ROOT/c" gost_file_c && available="$available c" ;;
+            cpp)
+                make -s -C "$ROOT/c" gost_file && available="$available cpp" ;;
+            go)
+                command -v go > /dev/null &&
+                    (cd "$ROOT/go" && GO111MODULE=off go build -o "$WORK/gost_file_go" gost_file.go) &&
+                    available="$available go" ;;
+            java)
+                command -v javac > /dev/null &&
+                    "$ROOT/java/test.sh" > /dev/null &&
+                    javac -d "$WORK/java" "$ROOT/java/Gost89.java" "$ROOT/java/GostFile.java" &&
+                    available="$available java" ;;
+        esac
+    done
+
+    PORTS=$available
+}
+
+run_port() {
+    local port=$1
+    shift
+
+    case $port in
+        c)    "$ROOT/c/gost_file_c" "$@" ;;
+        cpp)  "$ROOT/c/gost_file" "$@" ;;
+        go)   "$WORK/gost_file_go" "$@" ;;
+        java) java -cp "$WORK/java" GostFile "$@" ;;
+    esac
+}
+
+# Runs one mode; prints the MAC line if any
+run_mode() {
+    local port=$1 mode=$2 in=$3 out=$4
+
+    if [ "$mode" = "mac" ]; then
+        run_port "$port" -a -s "$WORK/sbox" -k "$WORK/key" "$in"
+    else
+        run_port "$port" -e -a -m "$mode" -s "$WORK/sbox" -k "$WORK/key" -i "$IV" "$in" "$out"
+    fi | tr -d '\r' | grep '^MAC:' | tr -d ' \t'
+}
+
+# Median wall time in nanoseconds of REPEATS runs
+time_mode() {
+    local port=$1 mode=$2 in=$3 i t0 t1
+
+    for i in $(seq "$REPEATS"); do
+        t0=$(date +%s%N)
+        run_mode "$port" "$mode" "$in" "$WORK/out" > /dev/null
+        t1=$(date +%s%N)
+        echo $((t1 - t0))
+    done | sort -n | sed -n "$(( (REPEATS + 1) / 2 ))p"
+}
+
+generate() {
+    local size
+
+    # The test parameter set from c/gost_test.c and a fixed key
+    printf '\x04\x0a\x09\x02\x0d\x08\x00\x0e\x06\x0b\x01\x0c\x07\x0f\x05\x03' > "$WORK/sbox"
+    printf '\x0e\x0b\x04\x0c\x06\x0d\x0f\x0a\x02\x03\x08\x01\x00\x07\x05\x09' >> "$WORK/sbox"
+    printf '\x05\x08\x01\x0d\x0a\x03\x04\x02\x0e\x0f\x0c\x07\x06\x00\x09\x0b' >> "$WORK/sbox"
+    printf '\x07\x0d\x0a\x01\x00\x08\x09\x0f\x0e\x04\x06\x0c\x0b\x02\x05\x03' >> "$WORK/sbox"
+    printf '\x06\x0c\x07\x01\x05\x0f\x0d\x08\x04\x0a\x09\x0e\x00\x03\x0b\x02' >> "$WORK/sbox"
+    printf '\x04\x0b\x0a\x00\x07\x02\x01\x0d\x03\x06\x08\x05\x09\x0c\x0f\x0e' >> "$WORK/sbox"
+    printf '\x0d\x0b\x04\x01\x03\x0f\x05\x09\x00\x0a\x0e\x07\x06\x08\x02\x0c' >> "$WORK/sbox"
+    printf '\x01\x0f\x0d\x00\x05\x07\x0a\x04\x09\x02\x03\x0e\x06\x0b\x08\x0c' >> "$WORK/sbox"
+    printf '01234567890123456789012345678912' > "$WORK/key"
+
+    # Inputs are the C++ port's CTR keystream, so every run sees the same bytes
+    printf 'x' > "$WORK/startup"
+    for size in $SIZES; do
+        head -c $((size * 1024)) /dev/zero > "$WORK/zero"
+        "$ROOT/c/gost_file" -e -m ctr -s "$WORK/sbox" -k "$WORK/key" -i 0x5eed "$WORK/zero" "$WORK/in.$size" > /dev/null
+    done
+    rm -f "$WORK/zero"
+}
+
+verify() {
+    local size mode port ref mac status=0
+
+    for size in $SIZES; do
+        for mode in $MODES; do
+            ref=$(run_mode cpp "$mode" "$WORK/in.$size" "$WORK/ref")
+
+            for port in $PORTS; do
+                mac=$(run_mode "$port" "$mode" "$WORK/in.$size" "$WORK/out")
+
+                if [ "$mac" != "$ref" ]; then
+                    echo "MAC mismatch: $port $mode ${size}K: $mac != $ref" >&2
+                    status=1
+                fi
+
+                if [ "$mode" != "mac" ] && ! cmp -s "$WORK/ref" "$WORK/out"; then
+                    echo "Ciphertext mismatch: $port $mode ${size}K" >&2
+                    status=1
+                fi
+            done
+        done
+    done
+
+    return $status
+}
+
+report() {
+    local size mode port startup ns mbps first=1
+
+    printf "%-6s %-5s %10s %12s %10s\n" "port" "mode" "size" "MB/s" "startup"
+    [ -n "$JSON" ] && echo "[" > "$JSON"
+
+    for port in $PORTS; do
+        # Process startup, measured on a one-byte input, is subtracted from every run
+        startup=$(time_mode "$port" mac "$WORK/startup")
+
+        for mode in $MODES; do
+            for size in $SIZES; do
+                ns=$(time_mode "$port" "$mode" "$WORK/in.$size")
+                ns=$((ns > startup ? ns - startup : 1))
+                mbps=$(awk -v b=$((size * 1024)) -v ns="$ns" 'BEGIN { printf "%.2f", b / 1048576 / (ns / 1e9) }')
+
+                printf "%-6s %-5s %9sK %12s %8sms\n" "$port" "$mode" "$size" "$mbps" $((startup / 1000000))
+
+                if [ -n "$JSON" ]; then
+                    [ $first = 1 ] || echo "," >> "$JSON"
+                    printf '  {"port": "%s", "mode": "%s", "size": %d, "mbps": %s, "startup_ns": %d}' \
+                        "$port" "$mode" $((size * 1024)) "$mbps" "$startup" >> "$JSON"
+                    first=0
+                fi
+            done
+        done
+    done
+
+    [ -n "$JSON" ] && printf "\n]\n" >> "$JSON"
+    return 0
+}
+
+build
+echo "Ports:$PORTS"
+
+generate
+
+if ! verify; then
+    echo "Ports disagree, not benchmarking" >&2
+    exit 1
+fi
+echo "Ciphertext and MACs identical across ports"
+echo
+
+report
@@ -2,7 +2,189 @@
 #include <stdint.h>
 #include <string.h>
 
+#if !defined(GOST89_NO_STATS) && !defined(__GNUC__)
+    #define GOST89_NO_STATS
+#endif
+
+#ifndef GOST89_NO_STATS
+    #include <pthread.h>
+#endif
+
 #include "gost89.h"
+#include "gost89_probes.h"
+
+#if _MSC_VER
+    #define GOST89_INLINE __forceinline
+#elif __GNUC__
+    #define GOST89_INLINE inline __attribute__((always_inline))
+#else
+    #define GOST89_INLINE inline
+#endif
+
+/* Blocks per call of the multi-block kernels in the mode functions, unless tuned */
+#define GOST89_BATCH 32
+#define GOST89_BATCH_MAX 256
+
+#ifndef GOST89_NO_STATS
+/*
+ * Every thread counts into a slot of its own with plain stores, and the
+ * snapshot sums all slots with relaxed loads. Slots are never freed: when
+ * a thread exits its slot is released, counts included, for the next new
+ * thread to take over, so the sums stay monotonic.
+ */
+typedef struct gost89_stats_slot {
+    gost89_stats counters;
+    struct gost89_stats_slot *next;
+    int in_use;
+} gost89_stats_slot;
+
+static int gost89_stats_enabled;
+static gost89_stats_slot *gost89_stats_slots;
+static __thread gost89_stats_slot *gost89_stats_current;
+static pthread_key_t gost89_stats_key;
+static pthread_once_t gost89_stats_once = PTHREAD_ONCE_INIT;
+
+#define gost89_stats_add(counter, n) \
+    __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+static void gost89_stats_release(void *slot) {
+    __atomic_store_n(&((gost89_stats_slot*)slot)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void gost89_stats_init_key() {
+    pthread_key_create(&gost89_stats_key, gost89_stats_release);
+}
+
+static gost89_stats_slot *gost89_stats_acquire() {
+    gost89_stats_slot *slot;
+    int free;
+
+    for (slot = __atomic_load_n(&gost89_stats_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&slot->in_use, &free, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!slot) {
+        slot = (gost89_stats_slot*)calloc(1, sizeof(gost89_stats_slot));
+        if (!slot) {
+            return NULL;
+        }
+        slot->in_use = 1;
+        slot->next = __atomic_load_n(&gost89_stats_slots, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&gost89_stats_slots, &slot->next, slot, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    pthread_once(&gost89_stats_once, gost89_stats_init_key);
+    pthread_setspecific(gost89_stats_key, slot);
+
+    return slot;
+}
+
+static GOST89_INLINE gost89_stats *gost89_stats_counters() {
+    if (!__atomic_load_n(&gost89_stats_enabled, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+
+    if (!gost89_stats_current) {
+        gost89_stats_current = gost89_stats_acquire();
+        if (!gost89_stats_current) {
+            return NULL;
+        }
+    }
+
+    return &gost89_stats_current->counters;
+}
+
+/* Once per mode function call, not per block */
+static void gost89_stats_mode(int mode, int kernel, unsigned size) {
+    gost89_stats *stats = gost89_stats_counters();
+    unsigned blocks = (size / sizeof(uint32_t) + 1) / 2;
+
+    if (!stats) {
+        return;
+    }
+
+    gost89_stats_add(stats->calls[mode], 1);
+    gost89_stats_add(stats->blocks[mode], blocks);
+    gost89_stats_add(stats->bytes[mode], size);
+    gost89_stats_add(stats->kernel_blocks[kernel], blocks);
+
+    if (size % 8) {
+        gost89_stats_add(stats->tails, 1);
+        if (size % 8 >= 4) {
+            gost89_stats_add(stats->padded_tails, 1);
+        }
+    }
+}
+
+#define gost89_count_mode(mode, kernel, size) \
+    (__atomic_load_n(&gost89_stats_enabled, __ATOMIC_RELAXED) ? gost89_stats_mode(mode, kernel, size) : (void)0)
+
+#define gost89_count(counter) do {                      \
+    gost89_stats *stats_ = gost89_stats_counters();     \
+    if (stats_) {                                       \
+        gost89_stats_add(stats_->counter, 1);           \
+    }                                                   \
+} while (0)
+
+void gost89_set_stats(int enable) {
+    __atomic_store_n(&gost89_stats_enabled, enable != 0, __ATOMIC_RELAXED);
+}
+
+void gost89_stats_snapshot(gost89_stats *stats) {
+    gost89_stats_slot *slot;
+    uint64_t *sum = (uint64_t*)stats, *counters;
+    unsigned i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (slot = __atomic_load_n(&gost89_stats_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        counters = (uint64_t*)&slot->counters;
+        for (i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++) {
+            sum[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+#else
+#define gost89_count_mode(mode, kernel, size) ((void)0)
+#define gost89_count(counter) ((void)0)
+
+void gost89_set_stats(int enable) {
+}
+
+void gost89_stats_snapshot(gost89_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+#endif
+
+/* CFB and CTR switch to a new key after every GOST89_MESH_SIZE bytes when key meshing is on */
+#define GOST89_MESH_SIZE 1024
+
+/* RFC 4357, 2.3.2: the new key is this constant decrypted with the current one */
+static const uint8_t gost89_mesh_constant[32] = {
+    0x69, 0x00, 0x72, 0x22, 0x64, 0xC9, 0x04, 0x23,
+    0x8D, 0x3A, 0xDB, 0x96, 0x46, 0xE9, 0x2A, 0xC4,
+    0x18, 0xFE, 0xAC, 0x94, 0x00, 0xED, 0x07, 0x12,
+    0xC0, 0x86, 0xDC, 0xC2, 0xEF, 0x4C, 0xA9, 0x2B
+};
+
+static const char *gost89_kernel_names[GOST89_KERNEL_COUNT] = {
+    "auto",
+    "sbox4",
+    "sbox8",
+    "sbox8x4"
+};
+
+/*
+ * Kernel and batch of each mode function, zero for the built-in defaults.
+ * The kernel only applies to contexts on GOST89_KERNEL_AUTO. Filled in from
+ * the tuning cache (gost89_tune.c) before any context is in use.
+ */
+static int gost89_mode_kernels[GOST89_MODE_COUNT];
+static unsigned gost89_mode_batches[GOST89_MODE_COUNT];
 
 void gost89_expand_sbox(uint8_t (*sbox)[16], uint8_t (*sbox_x)[256]) {
     int i, j, k;
@@ -20,10 +202,23 @@ void gost89_expand_sbox(uint8_t (*sbox)[16], uint8_t (*sbox_x)[256]) {
 void gost89_set_sbox(gost89_context *ctx, uint8_t (*sbox)[16]) {
     memcpy(ctx->sbox, sbox, sizeof(ctx->sbox));
     gost89_expand_sbox(ctx->sbox, ctx->sbox_x);
+    GOST89_PROBE1(set_sbox, ctx);
+    gost89_count(sbox_setups);
 }
 
+/*
+ * A new key also puts the kernel and key meshing back to their defaults, so
+ * that a context set up with set_sbox, set_key and set_iv alone is complete
+ * whatever memory it was in. Those options are set after the key.
+ */
 void gost89_set_key(gost89_context *ctx, void *key) {
     memcpy(ctx->key, key, sizeof(ctx->key));
+    ctx->kernel = GOST89_KERNEL_AUTO;
+    ctx->key_meshing = 0;
+    ctx->mesh_size = GOST89_MESH_SIZE;
+    ctx->mesh_count = 0;
+    GOST89_PROBE1(set_key, ctx);
+    gost89_count(key_setups);
 }
 
 void gost89_set_iv(gost89_context *ctx, void *iv) {
@@ -44,6 +239,83 @@ void gost89_set_mac(gost89_context *ctx, void *mac) {
     }
 }
 
+void gost89_set_key_meshing(gost89_context *ctx, int enable) {
+    ctx->key_meshing = enable;
+    ctx->mesh_size = GOST89_MESH_SIZE;
+    ctx->mesh_count = 0;
+}
+
+void gost89_set_kernel(gost89_context *ctx, int kernel) {
+    if (kernel < 0 || kernel >= GOST89_KERNEL_COUNT) {
+        kernel = GOST89_KERNEL_AUTO;
+    }
+
+    ctx->kernel = kernel;
+}
+
+/* Anything out of range, from a context that was never set up, counts as auto */
+int gost89_get_kernel(gost89_context *ctx) {
+    if (ctx->kernel <= GOST89_KERNEL_AUTO || ctx->kernel >= GOST89_KERNEL_COUNT) {
+        return GOST89_KERNEL_SBOX8_X4;
+    }
+
+    return ctx->kernel;
+}
+
+void gost89_set_mode_tuning(int mode, int kernel, unsigned batch) {
+    if (mode < 0 || mode >= GOST89_MODE_COUNT) {
+        return;
+    }
+
+    if (kernel < 0 || kernel >= GOST89_KERNEL_COUNT) {
+        kernel = GOST89_KERNEL_AUTO;
+    }
+    if (batch > GOST89_BATCH_MAX) {
+        batch = GOST89_BATCH_MAX;
+    }
+
+    gost89_mode_kernels[mode] = kernel;
+    gost89_mode_batches[mode] = batch;
+}
+
+/* The kernel a mode function runs with on ctx */
+int gost89_get_mode_kernel(gost89_context *ctx, int mode) {
+    if ((ctx->kernel > GOST89_KERNEL_AUTO && ctx->kernel < GOST89_KERNEL_COUNT) ||
+        mode < 0 || mode >= GOST89_MODE_COUNT || !gost89_mode_kernels[mode]) {
+        return gost89_get_kernel(ctx);
+    }
+
+    return gost89_mode_kernels[mode];
+}
+
+unsigned gost89_get_mode_batch(int mode) {
+    if (mode < 0 || mode >= GOST89_MODE_COUNT || !gost89_mode_batches[mode]) {
+        return GOST89_BATCH;
+    }
+
+    return gost89_mode_batches[mode];
+}
+
+const char *gost89_kernel_name(int kernel) {
+    if (kernel < 0 || kernel >= GOST89_KERNEL_COUNT) {
+        return NULL;
+    }
+
+    return gost89_kernel_names[kernel];
+}
+
+int gost89_kernel_by_name(const char *name) {
+    int i;
+
+    for (i = 0; i < GOST89_KERNEL_COUNT; i++) {
+        if (!strcmp(name, gost89_kernel_names[i])) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 #define gost89_round_0(block, key) (            \
     t = block + key,                            \
     t = ctx->sbox[0][t & 0xF] |                 \
@@ -66,14 +338,18 @@ void gost89_set_mac(gost89_context *ctx, void *mac) {
     t << 11 | t >> 21                           \
 )
 
-#define gost89_round gost89_round_1
+/* kernel is a constant in the inlined block functions, so the choice is folded away */
+#define gost89_round(block, key) (              \
+    kernel == GOST89_KERNEL_SBOX4 ?             \
+        gost89_round_0(block, key) :            \
+        gost89_round_1(block, key)              \
+)
 
-void gost89_encrypt(gost89_context *ctx, void *plain, void *encrypted) {
+static GOST89_INLINE void gost89_encrypt_key_block(gost89_context *ctx, int kernel, const uint32_t *k, void *plain, void *encrypted) {
     int i;
     uint32_t t;
     uint32_t a = ((uint32_t*)plain)[0];
     uint32_t b = ((uint32_t*)plain)[1];
-    uint32_t *k = ctx->key;
 
     for (i = 0; i < 3; i++) {
         b ^= gost89_round(a, k[0]);
@@ -99,12 +375,11 @@ void gost89_encrypt(gost89_context *ctx, void *plain, void *encrypted) {
     ((uint32_t*)encrypted)[1] = a;
 }
 
-void gost89_decrypt(gost89_context *ctx, void *encrypted, void *plain) {
+static GOST89_INLINE void gost89_decrypt_key_block(gost89_context *ctx, int kernel, const uint32_t *k, void *encrypted, void *plain) {
     int i;
     uint32_t t;
     uint32_t a = ((uint32_t*)encrypted)[0];
     uint32_t b = ((uint32_t*)encrypted)[1];
-    uint32_t *k = ctx->key;
 
     b ^= gost89_round(a, k[0]);
     a ^= gost89_round(b, k[1]);
@@ -130,12 +405,19 @@ void gost89_decrypt(gost89_context *ctx, void *encrypted, void *plain) {
     ((uint32_t*)plain)[1] = a;
 }
 
-void gost89_encrypt_16(gost89_context *ctx, void *plain, void *encrypted) {
+static GOST89_INLINE void gost89_encrypt_block(gost89_context *ctx, int kernel, void *plain, void *encrypted) {
+    gost89_encrypt_key_block(ctx, kernel, ctx->key, plain, encrypted);
+}
+
+static GOST89_INLINE void gost89_decrypt_block(gost89_context *ctx, int kernel, void *encrypted, void *plain) {
+    gost89_decrypt_key_block(ctx, kernel, ctx->key, encrypted, plain);
+}
+
+static GOST89_INLINE void gost89_encrypt_16_key_block(gost89_context *ctx, int kernel, const uint32_t *k, void *plain, void *encrypted) {
     int i;
     uint32_t t;
     uint32_t a = ((uint32_t*)plain)[0];
     uint32_t b = ((uint32_t*)plain)[1];
-    uint32_t *k = ctx->key;
 
     for (i = 0; i < 2; i++) {
         b ^= gost89_round(a, k[0]);
@@ -152,7 +434,11 @@ void gost89_encrypt_16(gost89_context *ctx, void *plain, void *encrypted) {
     ((uint32_t*)encrypted)[1] = b;
 }
 
-void gost89_decrypt_16(gost89_context *ctx, void *encrypted, void *plain) {
+static GOST89_INLINE void gost89_encrypt_16_block(gost89_context *ctx, int kernel, void *plain, void *encrypted) {
+    gost89_encrypt_16_key_block(ctx, kernel, ctx->key, plain, encrypted);
+}
+
+static GOST89_INLINE void gost89_decrypt_16_block(gost89_context *ctx, int kernel, void *encrypted, void *plain) {
     int i;
     uint32_t t;
     uint32_t a = ((uint32_t*)encrypted)[0];
@@ -174,31 +460,434 @@ void gost89_decrypt_16(gost89_context *ctx, void *encrypted, void *plain) {
     ((uint32_t*)plain)[1] = b;
 }
 
-void gost89_encrypt_ecb(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
-    unsigned i, l = size / sizeof(uint32_t);
+/* Four independent blocks with their rounds interleaved, to hide the latency of the table lookups */
+#define gost89_round_x4(x, y, key) (            \
+    y##0 ^= gost89_round(x##0, key),            \
+    y##1 ^= gost89_round(x##1, key),            \
+    y##2 ^= gost89_round(x##2, key),            \
+    y##3 ^= gost89_round(x##3, key)             \
+)
 
-    for (i = 0; i < l; i += 2) {
-        gost89_encrypt(ctx, (uint32_t*)plain + i, (uint32_t*)encrypted + i);
+static GOST89_INLINE void gost89_encrypt_x4_block(gost89_context *ctx, int kernel, uint32_t *plain, uint32_t *encrypted) {
+    int i;
+    uint32_t t;
+    uint32_t a0 = plain[0], a1 = plain[2], a2 = plain[4], a3 = plain[6];
+    uint32_t b0 = plain[1], b1 = plain[3], b2 = plain[5], b3 = plain[7];
+    uint32_t *k = ctx->key;
+
+    for (i = 0; i < 3; i++) {
+        gost89_round_x4(a, b, k[0]);
+        gost89_round_x4(b, a, k[1]);
+        gost89_round_x4(a, b, k[2]);
+        gost89_round_x4(b, a, k[3]);
+        gost89_round_x4(a, b, k[4]);
+        gost89_round_x4(b, a, k[5]);
+        gost89_round_x4(a, b, k[6]);
+        gost89_round_x4(b, a, k[7]);
     }
+
+    gost89_round_x4(a, b, k[7]);
+    gost89_round_x4(b, a, k[6]);
+    gost89_round_x4(a, b, k[5]);
+    gost89_round_x4(b, a, k[4]);
+    gost89_round_x4(a, b, k[3]);
+    gost89_round_x4(b, a, k[2]);
+    gost89_round_x4(a, b, k[1]);
+    gost89_round_x4(b, a, k[0]);
+
+    encrypted[0] = b0; encrypted[1] = a0;
+    encrypted[2] = b1; encrypted[3] = a1;
+    encrypted[4] = b2; encrypted[5] = a2;
+    encrypted[6] = b3; encrypted[7] = a3;
 }
 
-void gost89_decrypt_ecb(gost89_context *ctx, void *encrypted, void *plain, unsigned size) {
-    unsigned i, l = size / sizeof(uint32_t);
+static GOST89_INLINE void gost89_decrypt_x4_block(gost89_context *ctx, int kernel, uint32_t *encrypted, uint32_t *plain) {
+    int i;
+    uint32_t t;
+    uint32_t a0 = encrypted[0], a1 = encrypted[2], a2 = encrypted[4], a3 = encrypted[6];
+    uint32_t b0 = encrypted[1], b1 = encrypted[3], b2 = encrypted[5], b3 = encrypted[7];
+    uint32_t *k = ctx->key;
 
-    for (i = 0; i < l; i += 2) {
-        gost89_decrypt(ctx, (uint32_t*)encrypted + i, (uint32_t*)plain + i);
+    gost89_round_x4(a, b, k[0]);
+    gost89_round_x4(b, a, k[1]);
+    gost89_round_x4(a, b, k[2]);
+    gost89_round_x4(b, a, k[3]);
+    gost89_round_x4(a, b, k[4]);
+    gost89_round_x4(b, a, k[5]);
+    gost89_round_x4(a, b, k[6]);
+    gost89_round_x4(b, a, k[7]);
+
+    for (i = 0; i < 3; i++) {
+        gost89_round_x4(a, b, k[7]);
+        gost89_round_x4(b, a, k[6]);
+        gost89_round_x4(a, b, k[5]);
+        gost89_round_x4(b, a, k[4]);
+        gost89_round_x4(a, b, k[3]);
+        gost89_round_x4(b, a, k[2]);
+        gost89_round_x4(a, b, k[1]);
+        gost89_round_x4(b, a, k[0]);
     }
+
+    plain[0] = b0; plain[1] = a0;
+    plain[2] = b1; plain[3] = a1;
+    plain[4] = b2; plain[5] = a2;
+    plain[6] = b3; plain[7] = a3;
+}
+
+/* Like gost89_round_x4, but every block has its own key */
+#define gost89_round_x4k(x, y, i) (             \
+    y##0 ^= gost89_round(x##0, k0[i]),          \
+    y##1 ^= gost89_round(x##1, k1[i]),          \
+    y##2 ^= gost89_round(x##2, k2[i]),          \
+    y##3 ^= gost89_round(x##3, k3[i])           \
+)
+
+static GOST89_INLINE void gost89_encrypt_x4k_block(gost89_context *ctx, int kernel, const uint32_t (*keys)[8], uint32_t *plain, uint32_t *encrypted) {
+    int i;
+    uint32_t t;
+    uint32_t a0 = plain[0], a1 = plain[2], a2 = plain[4], a3 = plain[6];
+    uint32_t b0 = plain[1], b1 = plain[3], b2 = plain[5], b3 = plain[7];
+    const uint32_t *k0 = keys[0], *k1 = keys[1], *k2 = keys[2], *k3 = keys[3];
+
+    for (i = 0; i < 3; i++) {
+        gost89_round_x4k(a, b, 0);
+        gost89_round_x4k(b, a, 1);
+        gost89_round_x4k(a, b, 2);
+        gost89_round_x4k(b, a, 3);
+        gost89_round_x4k(a, b, 4);
+        gost89_round_x4k(b, a, 5);
+        gost89_round_x4k(a, b, 6);
+        gost89_round_x4k(b, a, 7);
+    }
+
+    gost89_round_x4k(a, b, 7);
+    gost89_round_x4k(b, a, 6);
+    gost89_round_x4k(a, b, 5);
+    gost89_round_x4k(b, a, 4);
+    gost89_round_x4k(a, b, 3);
+    gost89_round_x4k(b, a, 2);
+    gost89_round_x4k(a, b, 1);
+    gost89_round_x4k(b, a, 0);
+
+    encrypted[0] = b0; encrypted[1] = a0;
+    encrypted[2] = b1; encrypted[3] = a1;
+    encrypted[4] = b2; encrypted[5] = a2;
+    encrypted[6] = b3; encrypted[7] = a3;
+}
+
+static GOST89_INLINE void gost89_decrypt_x4k_block(gost89_context *ctx, int kernel, const uint32_t (*keys)[8], uint32_t *encrypted, uint32_t *plain) {
+    int i;
+    uint32_t t;
+    uint32_t a0 = encrypted[0], a1 = encrypted[2], a2 = encrypted[4], a3 = encrypted[6];
+    uint32_t b0 = encrypted[1], b1 = encrypted[3], b2 = encrypted[5], b3 = encrypted[7];
+    const uint32_t *k0 = keys[0], *k1 = keys[1], *k2 = keys[2], *k3 = keys[3];
+
+    gost89_round_x4k(a, b, 0);
+    gost89_round_x4k(b, a, 1);
+    gost89_round_x4k(a, b, 2);
+    gost89_round_x4k(b, a, 3);
+    gost89_round_x4k(a, b, 4);
+    gost89_round_x4k(b, a, 5);
+    gost89_round_x4k(a, b, 6);
+    gost89_round_x4k(b, a, 7);
+
+    for (i = 0; i < 3; i++) {
+        gost89_round_x4k(a, b, 7);
+        gost89_round_x4k(b, a, 6);
+        gost89_round_x4k(a, b, 5);
+        gost89_round_x4k(b, a, 4);
+        gost89_round_x4k(a, b, 3);
+        gost89_round_x4k(b, a, 2);
+        gost89_round_x4k(a, b, 1);
+        gost89_round_x4k(b, a, 0);
+    }
+
+    plain[0] = b0; plain[1] = a0;
+    plain[2] = b1; plain[3] = a1;
+    plain[4] = b2; plain[5] = a2;
+    plain[6] = b3; plain[7] = a3;
+}
+
+/* The 16 rounds of the MAC; unlike the full cipher the halves are not swapped at the end */
+static GOST89_INLINE void gost89_encrypt_16_x4k_block(gost89_context *ctx, int kernel, const uint32_t (*keys)[8], uint32_t *plain, uint32_t *encrypted) {
+    int i;
+    uint32_t t;
+    uint32_t a0 = plain[0], a1 = plain[2], a2 = plain[4], a3 = plain[6];
+    uint32_t b0 = plain[1], b1 = plain[3], b2 = plain[5], b3 = plain[7];
+    const uint32_t *k0 = keys[0], *k1 = keys[1], *k2 = keys[2], *k3 = keys[3];
+
+    for (i = 0; i < 2; i++) {
+        gost89_round_x4k(a, b, 0);
+        gost89_round_x4k(b, a, 1);
+        gost89_round_x4k(a, b, 2);
+        gost89_round_x4k(b, a, 3);
+        gost89_round_x4k(a, b, 4);
+        gost89_round_x4k(b, a, 5);
+        gost89_round_x4k(a, b, 6);
+        gost89_round_x4k(b, a, 7);
+    }
+
+    encrypted[0] = a0; encrypted[1] = b0;
+    encrypted[2] = a1; encrypted[3] = b1;
+    encrypted[4] = a2; encrypted[5] = b2;
+    encrypted[6] = a3; encrypted[7] = b3;
+}
+
+/* Single blocks for the mode functions: the interleaved kernel has nothing to interleave */
+static GOST89_INLINE int gost89_single_kernel(int kernel) {
+    return kernel == GOST89_KERNEL_SBOX4 ? GOST89_KERNEL_SBOX4 : GOST89_KERNEL_SBOX8;
+}
+
+static GOST89_INLINE void gost89_encrypt_kernel(gost89_context *ctx, int kernel, void *plain, void *encrypted) {
+    if (kernel == GOST89_KERNEL_SBOX4) {
+        gost89_encrypt_block(ctx, GOST89_KERNEL_SBOX4, plain, encrypted);
+    } else {
+        gost89_encrypt_block(ctx, GOST89_KERNEL_SBOX8, plain, encrypted);
+    }
+}
+
+static GOST89_INLINE void gost89_encrypt_16_kernel(gost89_context *ctx, int kernel, void *plain, void *encrypted) {
+    if (kernel == GOST89_KERNEL_SBOX4) {
+        gost89_encrypt_16_block(ctx, GOST89_KERNEL_SBOX4, plain, encrypted);
+    } else {
+        gost89_encrypt_16_block(ctx, GOST89_KERNEL_SBOX8, plain, encrypted);
+    }
+}
+
+void gost89_encrypt(gost89_context *ctx, void *plain, void *encrypted) {
+    if (ctx->kernel == GOST89_KERNEL_SBOX4) {
+        gost89_encrypt_block(ctx, GOST89_KERNEL_SBOX4, plain, encrypted);
+    } else {
+        gost89_encrypt_block(ctx, GOST89_KERNEL_SBOX8, plain, encrypted);
+    }
+}
+
+void gost89_decrypt(gost89_context *ctx, void *encrypted, void *plain) {
+    if (ctx->kernel == GOST89_KERNEL_SBOX4) {
+        gost89_decrypt_block(ctx, GOST89_KERNEL_SBOX4, encrypted, plain);
+    } else {
+        gost89_decrypt_block(ctx, GOST89_KERNEL_SBOX8, encrypted, plain);
+    }
+}
+
+void gost89_encrypt_16(gost89_context *ctx, void *plain, void *encrypted) {
+    if (ctx->kernel == GOST89_KERNEL_SBOX4) {
+        gost89_encrypt_16_block(ctx, GOST89_KERNEL_SBOX4, plain, encrypted);
+    } else {
+        gost89_encrypt_16_block(ctx, GOST89_KERNEL_SBOX8, plain, encrypted);
+    }
+}
+
+void gost89_decrypt_16(gost89_context *ctx, void *encrypted, void *plain) {
+    if (ctx->kernel == GOST89_KERNEL_SBOX4) {
+        gost89_decrypt_16_block(ctx, GOST89_KERNEL_SBOX4, encrypted, plain);
+    } else {
+        gost89_decrypt_16_block(ctx, GOST89_KERNEL_SBOX8, encrypted, plain);
+    }
+}
+
+static void gost89_encrypt_kernel_blocks(gost89_context *ctx, int kernel, void *plain, void *encrypted, unsigned n) {
+    unsigned i = 0;
+    uint32_t *p = (uint32_t*)plain, *e = (uint32_t*)encrypted;
+
+    switch (kernel) {
+        case GOST89_KERNEL_SBOX4:
+            for (; i < n; i++) {
+                gost89_encrypt_block(ctx, GOST89_KERNEL_SBOX4, p + i * 2, e + i * 2);
+            }
+            break;
+
+        case GOST89_KERNEL_SBOX8_X4:
+            for (; i + 4 <= n; i += 4) {
+                gost89_encrypt_x4_block(ctx, GOST89_KERNEL_SBOX8, p + i * 2, e + i * 2);
+            }
+            /* fall through */
+
+        default:
+            for (; i < n; i++) {
+                gost89_encrypt_block(ctx, GOST89_KERNEL_SBOX8, p + i * 2, e + i * 2);
+            }
+    }
+}
+
+static void gost89_decrypt_kernel_blocks(gost89_context *ctx, int kernel, void *encrypted, void *plain, unsigned n) {
+    unsigned i = 0;
+    uint32_t *e = (uint32_t*)encrypted, *p = (uint32_t*)plain;
+
+    switch (kernel) {
+        case GOST89_KERNEL_SBOX4:
+            for (; i < n; i++) {
+                gost89_decrypt_block(ctx, GOST89_KERNEL_SBOX4, e + i * 2, p + i * 2);
+            }
+            break;
+
+        case GOST89_KERNEL_SBOX8_X4:
+            for (; i + 4 <= n; i += 4) {
+                gost89_decrypt_x4_block(ctx, GOST89_KERNEL_SBOX8, e + i * 2, p + i * 2);
+            }
+            /* fall through */
+
+        default:
+            for (; i < n; i++) {
+                gost89_decrypt_block(ctx, GOST89_KERNEL_SBOX8, e + i * 2, p + i * 2);
+            }
+    }
+}
+
+void gost89_encrypt_blocks(gost89_context *ctx, void *plain, void *encrypted, unsigned n) {
+    gost89_encrypt_kernel_blocks(ctx, gost89_get_kernel(ctx), plain, encrypted, n);
+}
+
+void gost89_decrypt_blocks(gost89_context *ctx, void *encrypted, void *plain, unsigned n) {
+    gost89_decrypt_kernel_blocks(ctx, gost89_get_kernel(ctx), encrypted, plain, n);
+}
+
+/*
+ * Block i is encrypted with keys[i] instead of ctx->key; only the S-box and
+ * the kernel are taken from ctx. With the interleaved kernel four blocks
+ * with unrelated keys run side by side.
+ */
+void gost89_encrypt_lanes(gost89_context *ctx, uint32_t (*keys)[8], void *plain, void *encrypted, unsigned n) {
+    unsigned i = 0;
+    uint32_t *p = (uint32_t*)plain, *e = (uint32_t*)encrypted;
+
+    switch (gost89_get_kernel(ctx)) {
+        case GOST89_KERNEL_SBOX4:
+            for (; i < n; i++) {
+                gost89_encrypt_key_block(ctx, GOST89_KERNEL_SBOX4, keys[i], p + i * 2, e + i * 2);
+            }
+            break;
+
+        case GOST89_KERNEL_SBOX8_X4:
+            for (; i + 4 <= n; i += 4) {
+                gost89_encrypt_x4k_block(ctx, GOST89_KERNEL_SBOX8, (const uint32_t (*)[8])keys + i, p + i * 2, e + i * 2);
+            }
+            /* fall through */
+
+        default:
+            for (; i < n; i++) {
+                gost89_encrypt_key_block(ctx, GOST89_KERNEL_SBOX8, keys[i], p + i * 2, e + i * 2);
+            }
+    }
+}
+
+void gost89_decrypt_lanes(gost89_context *ctx, uint32_t (*keys)[8], void *encrypted, void *plain, unsigned n) {
+    unsigned i = 0;
+    uint32_t *e = (uint32_t*)encrypted, *p = (uint32_t*)plain;
+
+    switch (gost89_get_kernel(ctx)) {
+        case GOST89_KERNEL_SBOX4:
+            for (; i < n; i++) {
+                gost89_decrypt_key_block(ctx, GOST89_KERNEL_SBOX4, keys[i], e + i * 2, p + i * 2);
+            }
+            break;
+
+        case GOST89_KERNEL_SBOX8_X4:
+            for (; i + 4 <= n; i += 4) {
+                gost89_decrypt_x4k_block(ctx, GOST89_KERNEL_SBOX8, (const uint32_t (*)[8])keys + i, e + i * 2, p + i * 2);
+            }
+            /* fall through */
+
+        default:
+            for (; i < n; i++) {
+                gost89_decrypt_key_block(ctx, GOST89_KERNEL_SBOX8, keys[i], e + i * 2, p + i * 2);
+            }
+    }
+}
+
+/* gost89_encrypt_16 with a key per block, for MACs of many messages under different keys */
+void gost89_encrypt_16_lanes(gost89_context *ctx, uint32_t (*keys)[8], void *plain, void *encrypted, unsigned n) {
+    unsigned i = 0;
+    uint32_t *p = (uint32_t*)plain, *e = (uint32_t*)encrypted;
+
+    switch (gost89_get_kernel(ctx)) {
+        case GOST89_KERNEL_SBOX4:
+            for (; i < n; i++) {
+                gost89_encrypt_16_key_block(ctx, GOST89_KERNEL_SBOX4, keys[i], p + i * 2, e + i * 2);
+            }
+            break;
+
+        case GOST89_KERNEL_SBOX8_X4:
+            for (; i + 4 <= n; i += 4) {
+                gost89_encrypt_16_x4k_block(ctx, GOST89_KERNEL_SBOX8, (const uint32_t (*)[8])keys + i, p + i * 2, e + i * 2);
+            }
+            /* fall through */
+
+        default:
+            for (; i < n; i++) {
+                gost89_encrypt_16_key_block(ctx, GOST89_KERNEL_SBOX8, keys[i], p + i * 2, e + i * 2);
+            }
+    }
+}
+
+/* Replaces only the key and transforms the IV in place; the S-box tables are left as they are */
+void gost89_key_meshing(gost89_context *ctx) {
+    uint32_t key[8];
+
+    memcpy(key, gost89_mesh_constant, sizeof(key));
+    gost89_decrypt_blocks(ctx, key, key, 4);
+    memcpy(ctx->key, key, sizeof(ctx->key));
+
+    gost89_encrypt(ctx, ctx->iv, ctx->iv);
+
+    GOST89_PROBE1(key_meshing, ctx);
+    gost89_count(key_meshings);
+}
+
+/*
+ * Limits a run of n blocks so that it does not cross a mesh point, meshing
+ * first if one has been reached, and accounts for the blocks returned.
+ */
+static GOST89_INLINE unsigned gost89_mesh_blocks(gost89_context *ctx, unsigned n) {
+    unsigned left;
+
+    if (!ctx->key_meshing || ctx->mesh_size < 8) {
+        return n;
+    }
+
+    if (ctx->mesh_count >= ctx->mesh_size) {
+        gost89_key_meshing(ctx);
+        ctx->mesh_count = 0;
+    }
+
+    left = (ctx->mesh_size - ctx->mesh_count) / 8;
+    if (n > left) {
+        n = left;
+    }
+
+    ctx->mesh_count += n * 8;
+
+    return n;
+}
+
+void gost89_encrypt_ecb(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
+    int kernel = gost89_get_mode_kernel(ctx, GOST89_MODE_ECB_ENCRYPT);
+
+    GOST89_PROBE3(mode_entry, ctx, GOST89_MODE_ECB_ENCRYPT, size);
+    gost89_count_mode(GOST89_MODE_ECB_ENCRYPT, kernel, size);
+    gost89_encrypt_kernel_blocks(ctx, kernel, plain, encrypted, (size / sizeof(uint32_t) + 1) / 2);
+    GOST89_PROBE3(mode_return, ctx, GOST89_MODE_ECB_ENCRYPT, size);
+}
+
+void gost89_decrypt_ecb(gost89_context *ctx, void *encrypted, void *plain, unsigned size) {
+    int kernel = gost89_get_mode_kernel(ctx, GOST89_MODE_ECB_DECRYPT);
+
+    GOST89_PROBE3(mode_entry, ctx, GOST89_MODE_ECB_DECRYPT, size);
+    gost89_count_mode(GOST89_MODE_ECB_DECRYPT, kernel, size);
+    gost89_decrypt_kernel_blocks(ctx, kernel, encrypted, plain, (size / sizeof(uint32_t) + 1) / 2);
+    GOST89_PROBE3(mode_return, ctx, GOST89_MODE_ECB_DECRYPT, size);
 }
 
 void gost89_init_ctr(gost89_context *ctx) {
     gost89_encrypt(ctx, ctx->iv, ctx->iv);
 }
 
-void gost89_encrypt_ctr(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
-    unsigned i, l = size / sizeof(uint32_t);
-    uint32_t t[2];
+/* Writes the next n counter values and advances ctx->iv past them; key meshing is left to the caller */
+void gost89_ctr_counters(gost89_context *ctx, void *counters, unsigned n) {
+    uint32_t *t = (uint32_t*)counters;
+    unsigned j;
 
-    for (i = 0; i < l; i += 2) {
+    for (j = 0; j < n; j++) {
         ctx->iv[0] += 0x1010101;
 
         if (ctx->iv[1] > 0xFFFFFFFF - 0x1010104) {
@@ -207,18 +896,48 @@ void gost89_encrypt_ctr(gost89_context *ctx, void *plain, void *encrypted, unsig
             ctx->iv[1] += 0x1010104;
         }
 
-        gost89_encrypt(ctx, ctx->iv, t);
+        t[j * 2] = ctx->iv[0];
+        t[j * 2 + 1] = ctx->iv[1];
+    }
+}
+
+void gost89_encrypt_ctr(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
+    unsigned i, j, n, l = size / sizeof(uint32_t);
+    unsigned batch = gost89_get_mode_batch(GOST89_MODE_CTR);
+    int kernel = gost89_get_mode_kernel(ctx, GOST89_MODE_CTR);
+    uint32_t t[GOST89_BATCH_MAX * 2];
 
-        ((uint32_t*)encrypted)[i] = ((uint32_t*)plain)[i] ^ t[0];
-        ((uint32_t*)encrypted)[i + 1] = ((uint32_t*)plain)[i + 1] ^ t[1];
+    GOST89_PROBE3(mode_entry, ctx, GOST89_MODE_CTR, size);
+    gost89_count_mode(GOST89_MODE_CTR, kernel, size);
+
+    for (i = 0; i < l; i += n * 2) {
+        n = (l - i + 1) / 2;
+        if (n > batch) {
+            n = batch;
+        }
+        n = gost89_mesh_blocks(ctx, n);
+
+        gost89_ctr_counters(ctx, t, n);
+        gost89_encrypt_kernel_blocks(ctx, kernel, t, t, n);
+
+        for (j = 0; j < n * 2; j++) {
+            ((uint32_t*)encrypted)[i + j] = ((uint32_t*)plain)[i + j] ^ t[j];
+        }
     }
+
+    GOST89_PROBE3(mode_return, ctx, GOST89_MODE_CTR, size);
 }
 
 void gost89_encrypt_cfb(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
     unsigned i, l = size / sizeof(uint32_t);
+    int kernel = gost89_single_kernel(gost89_get_mode_kernel(ctx, GOST89_MODE_CFB_ENCRYPT));
+
+    GOST89_PROBE3(mode_entry, ctx, GOST89_MODE_CFB_ENCRYPT, size);
+    gost89_count_mode(GOST89_MODE_CFB_ENCRYPT, kernel, size);
 
     for (i = 0; i < l; i += 2) {
-        gost89_encrypt(ctx, ctx->iv, ctx->iv);
+        gost89_mesh_blocks(ctx, 1);
+        gost89_encrypt_kernel(ctx, kernel, ctx->iv, ctx->iv);
 
         ((uint32_t*)encrypted)[i] = ((uint32_t*)plain)[i] ^ ctx->iv[0];
         ((uint32_t*)encrypted)[i + 1] = ((uint32_t*)plain)[i + 1] ^ ctx->iv[1];
@@ -226,31 +945,108 @@ void gost89_encrypt_cfb(gost89_context *ctx, void *plain, void *encrypted, unsig
         ctx->iv[0] = ((uint32_t*)encrypted)[i];
         ctx->iv[1] = ((uint32_t*)encrypted)[i + 1];
     }
+
+    GOST89_PROBE3(mode_return, ctx, GOST89_MODE_CFB_ENCRYPT, size);
 }
 
 void gost89_decrypt_cfb(gost89_context *ctx, void *encrypted, void *plain, unsigned size) {
+    unsigned i, j, n, l = size / sizeof(uint32_t);
+    unsigned batch = gost89_get_mode_batch(GOST89_MODE_CFB_DECRYPT);
+    int kernel = gost89_get_mode_kernel(ctx, GOST89_MODE_CFB_DECRYPT);
+    uint32_t t[GOST89_BATCH_MAX * 2];
+
+    GOST89_PROBE3(mode_entry, ctx, GOST89_MODE_CFB_DECRYPT, size);
+    gost89_count_mode(GOST89_MODE_CFB_DECRYPT, kernel, size);
+
+    /* Every gamma block is the encryption of a known ciphertext block, so they are batched */
+    for (i = 0; i < l; i += n * 2) {
+        n = (l - i + 1) / 2;
+        if (n > batch) {
+            n = batch;
+        }
+        n = gost89_mesh_blocks(ctx, n);
+
+        t[0] = ctx->iv[0];
+        t[1] = ctx->iv[1];
+        memcpy(t + 2, (uint32_t*)encrypted + i, (n - 1) * 2 * sizeof(uint32_t));
+
+        ctx->iv[0] = ((uint32_t*)encrypted)[i + n * 2 - 2];
+        ctx->iv[1] = ((uint32_t*)encrypted)[i + n * 2 - 1];
+
+        gost89_encrypt_kernel_blocks(ctx, kernel, t, t, n);
+
+        for (j = 0; j < n * 2; j++) {
+            ((uint32_t*)plain)[i + j] = ((uint32_t*)encrypted)[i + j] ^ t[j];
+        }
+    }
+
+    GOST89_PROBE3(mode_return, ctx, GOST89_MODE_CFB_DECRYPT, size);
+}
+
+void gost89_encrypt_cbc(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
     unsigned i, l = size / sizeof(uint32_t);
-    uint32_t a;
-    uint32_t b;
+    int kernel = gost89_single_kernel(gost89_get_mode_kernel(ctx, GOST89_MODE_CBC_ENCRYPT));
+
+    GOST89_PROBE3(mode_entry, ctx, GOST89_MODE_CBC_ENCRYPT, size);
+    gost89_count_mode(GOST89_MODE_CBC_ENCRYPT, kernel, size);
 
     for (i = 0; i < l; i += 2) {
-        a = ((uint32_t*)encrypted)[i];
-        b = ((uint32_t*)encrypted)[i + 1];
+        ctx->iv[0] ^= ((uint32_t*)plain)[i];
+        ctx->iv[1] ^= ((uint32_t*)plain)[i + 1];
 
-        gost89_encrypt(ctx, ctx->iv, ctx->iv);
+        gost89_encrypt_kernel(ctx, kernel, ctx->iv, ctx->iv);
 
-        ((uint32_t*)plain)[i] = a ^ ctx->iv[0];
-        ((uint32_t*)plain)[i + 1] = b ^ ctx->iv[1];
+        ((uint32_t*)encrypted)[i] = ctx->iv[0];
+        ((uint32_t*)encrypted)[i + 1] = ctx->iv[1];
+    }
 
-        ctx->iv[0] = a;
-        ctx->iv[1] = b;
+    GOST89_PROBE3(mode_return, ctx, GOST89_MODE_CBC_ENCRYPT, size);
+}
+
+void gost89_decrypt_cbc(gost89_context *ctx, void *encrypted, void *plain, unsigned size) {
+    unsigned i, j, n, l = size / sizeof(uint32_t);
+    unsigned batch = gost89_get_mode_batch(GOST89_MODE_CBC_DECRYPT);
+    int kernel = gost89_get_mode_kernel(ctx, GOST89_MODE_CBC_DECRYPT);
+    uint32_t t[GOST89_BATCH_MAX * 2], iv[2];
+    uint32_t *e = (uint32_t*)encrypted, *p = (uint32_t*)plain;
+
+    GOST89_PROBE3(mode_entry, ctx, GOST89_MODE_CBC_DECRYPT, size);
+    gost89_count_mode(GOST89_MODE_CBC_DECRYPT, kernel, size);
+
+    /* Blocks do not depend on each other on decryption, so they are batched */
+    for (i = 0; i < l; i += n * 2) {
+        n = (l - i + 1) / 2;
+        if (n > batch) {
+            n = batch;
+        }
+
+        iv[0] = e[i + n * 2 - 2];
+        iv[1] = e[i + n * 2 - 1];
+
+        gost89_decrypt_kernel_blocks(ctx, kernel, e + i, t, n);
+
+        /* Backwards, so that decrypting in place does not clobber the previous ciphertext */
+        for (j = n * 2 - 1; j >= 2; j--) {
+            p[i + j] = t[j] ^ e[i + j - 2];
+        }
+        p[i] = t[0] ^ ctx->iv[0];
+        p[i + 1] = t[1] ^ ctx->iv[1];
+
+        ctx->iv[0] = iv[0];
+        ctx->iv[1] = iv[1];
     }
+
+    GOST89_PROBE3(mode_return, ctx, GOST89_MODE_CBC_DECRYPT, size);
 }
 
 void gost89_mac(gost89_context *ctx, void *plain, unsigned size) {
     unsigned i, l = size / sizeof(uint32_t);
+    int kernel = gost89_single_kernel(gost89_get_mode_kernel(ctx, GOST89_MODE_MAC));
     uint32_t t[2];
 
+    GOST89_PROBE3(mode_entry, ctx, GOST89_MODE_MAC, size);
+    gost89_count_mode(GOST89_MODE_MAC, kernel, size);
+
     t[0] = ctx->mac[0];
     t[1] = ctx->mac[1];
 
@@ -258,9 +1054,11 @@ void gost89_mac(gost89_context *ctx, void *plain, unsigned size) {
         t[0] ^= ((uint32_t*)plain)[i];
         t[1] ^= ((uint32_t*)plain)[i + 1];
 
-        gost89_encrypt_16(ctx, t, t);
+        gost89_encrypt_16_kernel(ctx, kernel, t, t);
     }
 
     ctx->mac[0] = t[0];
     ctx->mac[1] = t[1];
+
+    GOST89_PROBE3(mode_return, ctx, GOST89_MODE_MAC, size);
 }
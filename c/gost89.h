@@ -3,12 +3,57 @@
 
 #include <stdint.h>
 
+/* Block kernels: table layout used by the round function */
+#define GOST89_KERNEL_AUTO  0   /* library default */
+#define GOST89_KERNEL_SBOX4 1   /* eight 16-entry nibble tables */
+#define GOST89_KERNEL_SBOX8 2   /* four 256-entry expanded tables */
+#define GOST89_KERNEL_SBOX8_X4 3    /* expanded tables, four blocks interleaved */
+#define GOST89_KERNEL_COUNT 4
+
+/* Mode functions, for per-mode tuning of the kernel and batch size */
+#define GOST89_MODE_ECB_ENCRYPT 0
+#define GOST89_MODE_ECB_DECRYPT 1
+#define GOST89_MODE_CTR         2
+#define GOST89_MODE_CFB_ENCRYPT 3
+#define GOST89_MODE_CFB_DECRYPT 4
+#define GOST89_MODE_CBC_ENCRYPT 5
+#define GOST89_MODE_CBC_DECRYPT 6
+#define GOST89_MODE_MAC         7
+#define GOST89_MODE_COUNT       8
+
+/*
+ * Runtime counters of the gost89.c functions, summed over all threads by
+ * gost89_stats_snapshot. Counting is off until gost89_set_stats(1), and is
+ * compiled out with GOST89_NO_STATS (or on compilers without thread-local
+ * storage and atomic builtins), in which case snapshots are all zero.
+ *
+ * A block is eight bytes as the mode functions count them: a call of size
+ * bytes processes (size / 4 + 1) / 2 blocks. A tail is a call whose size
+ * is not a multiple of 8; it is padded when the last block has 4 to 7 bytes
+ * and is therefore read and written whole.
+ */
+typedef struct gost89_stats {
+    uint64_t calls[GOST89_MODE_COUNT];
+    uint64_t blocks[GOST89_MODE_COUNT];
+    uint64_t bytes[GOST89_MODE_COUNT];
+    uint64_t kernel_blocks[GOST89_KERNEL_COUNT];    /* blocks by the kernel that ran them */
+    uint64_t tails;
+    uint64_t padded_tails;
+    uint64_t key_setups;
+    uint64_t sbox_setups;
+    uint64_t key_meshings;
+} gost89_stats;
+
 typedef struct gost89_context {
     uint8_t sbox[8][16];
     uint8_t sbox_x[4][256];
     uint32_t key[8];
     uint32_t iv[2];
     uint32_t mac[2];
+    int kernel;
+    int key_meshing;
+    unsigned mesh_size;
+    unsigned mesh_count;
 } gost89_context;
 
 #ifdef __cplusplus
@@ -20,14 +65,33 @@ extern void gost89_set_sbox(gost89_context *ctx, uint8_t (*sbox)[16]);
 extern void gost89_set_key(gost89_context *ctx, void *key);
 extern void gost89_set_iv(gost89_context *ctx, void *iv);
 extern void gost89_set_mac(gost89_context *ctx, void *mac);
+extern void gost89_set_key_meshing(gost89_context *ctx, int enable);
+extern void gost89_key_meshing(gost89_context *ctx);
+extern void gost89_set_kernel(gost89_context *ctx, int kernel);
+extern int gost89_get_kernel(gost89_context *ctx);
+extern void gost89_set_mode_tuning(int mode, int kernel, unsigned batch);
+extern int gost89_get_mode_kernel(gost89_context *ctx, int mode);
+extern unsigned gost89_get_mode_batch(int mode);
+extern void gost89_set_stats(int enable);
+extern void gost89_stats_snapshot(gost89_stats *stats);
+extern const char *gost89_kernel_name(int kernel);
+extern int gost89_kernel_by_name(const char *name);
 extern void gost89_encrypt(gost89_context *ctx, void *plain, void *encrypted);
 extern void gost89_decrypt(gost89_context *ctx, void *encrypted, void *plain);
+extern void gost89_encrypt_blocks(gost89_context *ctx, void *plain, void *encrypted, unsigned n);
+extern void gost89_decrypt_blocks(gost89_context *ctx, void *encrypted, void *plain, unsigned n);
+extern void gost89_encrypt_lanes(gost89_context *ctx, uint32_t (*keys)[8], void *plain, void *encrypted, unsigned n);
+extern void gost89_decrypt_lanes(gost89_context *ctx, uint32_t (*keys)[8], void *encrypted, void *plain, unsigned n);
+extern void gost89_encrypt_16_lanes(gost89_context *ctx, uint32_t (*keys)[8], void *plain, void *encrypted, unsigned n);
 extern void gost89_encrypt_ecb(gost89_context *ctx, void *plain, void *encrypted, unsigned size);
 extern void gost89_decrypt_ecb(gost89_context *ctx, void *encrypted, void *plain, unsigned size);
 extern void gost89_init_ctr(gost89_context *ctx);
+extern void gost89_ctr_counters(gost89_context *ctx, void *counters, unsigned n);
 extern void gost89_encrypt_ctr(gost89_context *ctx, void *plain, void *encrypted, unsigned size);
 extern void gost89_encrypt_cfb(gost89_context *ctx, void *plain, void *encrypted, unsigned size);
 extern void gost89_decrypt_cfb(gost89_context *ctx, void *encrypted, void *plain, unsigned size);
+extern void gost89_encrypt_cbc(gost89_context *ctx, void *plain, void *encrypted, unsigned size);
+extern void gost89_decrypt_cbc(gost89_context *ctx, void *encrypted, void *plain, unsigned size);
 extern void gost89_mac(gost89_context *ctx, void *plain, unsigned size);
 
 #ifdef __cplusplus
@@ -0,0 +1,396 @@
+#ifndef GOST89_HPP_
+#define GOST89_HPP_
+
+/*
+ * Header-only engine for S-boxes known at compile time.
+ *
+ * Cipher<SboxParams> builds four pre-rotated 256-entry tables with constexpr,
+ * so a round is four lookups and three XORs with no indirection through the
+ * context, and unrolls all rounds with their key order fixed at compile time.
+ * The drivers keep the semantics (and the gost89_context state) of the C
+ * mode functions in gost89.c, so they can be mixed with them freely.
+ *
+ * Requires C++17.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <utility>
+
+#include "gost89.h"
+
+#if _MSC_VER
+    #define GOST89_FORCEINLINE __forceinline
+#elif __GNUC__
+    #define GOST89_FORCEINLINE inline __attribute__((always_inline))
+#else
+    #define GOST89_FORCEINLINE inline
+#endif
+
+namespace gost89 {
+
+struct SboxTest {
+    static constexpr const char *name = "test";
+    static constexpr uint8_t sbox[8][16] = {
+        {4, 10, 9, 2, 13, 8, 0, 14, 6, 11, 1, 12, 7, 15, 5, 3},
+        {14, 11, 4, 12, 6, 13, 15, 10, 2, 3, 8, 1, 0, 7, 5, 9},
+        {5, 8, 1, 13, 10, 3, 4, 2, 14, 15, 12, 7, 6, 0, 9, 11},
+        {7, 13, 10, 1, 0, 8, 9, 15, 14, 4, 6, 12, 11, 2, 5, 3},
+        {6, 12, 7, 1, 5, 15, 13, 8, 4, 10, 9, 14, 0, 3, 11, 2},
+        {4, 11, 10, 0, 7, 2, 1, 13, 3, 6, 8, 5, 9, 12, 15, 14},
+        {13, 11, 4, 1, 3, 15, 5, 9, 0, 10, 14, 7, 6, 8, 2, 12},
+        {1, 15, 13, 0, 5, 7, 10, 4, 9, 2, 3, 14, 6, 11, 8, 12}
+    };
+};
+
+struct SboxCryptoProA {
+    static constexpr const char *name = "cryptopro-a";
+    static constexpr uint8_t sbox[8][16] = {
+        {9, 6, 3, 2, 8, 11, 1, 7, 10, 4, 14, 15, 12, 0, 13, 5},
+        {3, 7, 14, 9, 8, 10, 15, 0, 5, 2, 6, 12, 11, 4, 13, 1},
+        {14, 4, 6, 2, 11, 3, 13, 8, 12, 15, 5, 10, 0, 7, 1, 9},
+        {14, 7, 10, 12, 13, 1, 3, 9, 0, 2, 11, 4, 15, 8, 5, 6},
+        {11, 5, 1, 9, 8, 13, 15, 0, 14, 4, 2, 3, 12, 7, 10, 6},
+        {3, 10, 13, 12, 1, 2, 0, 11, 7, 5, 9, 4, 8, 15, 14, 6},
+        {1, 13, 2, 9, 7, 10, 6, 0, 8, 12, 4, 5, 15, 3, 11, 14},
+        {11, 10, 15, 5, 0, 12, 14, 8, 6, 2, 3, 9, 1, 7, 13, 4}
+    };
+};
+
+struct SboxCryptoProB {
+    static constexpr const char *name = "cryptopro-b";
+    static constexpr uint8_t sbox[8][16] = {
+        {8, 4, 11, 1, 3, 5, 0, 9, 2, 14, 10, 12, 13, 6, 7, 15},
+        {0, 1, 2, 10, 4, 13, 5, 12, 9, 7, 3, 15, 11, 8, 6, 14},
+        {14, 12, 0, 10, 9, 2, 13, 11, 7, 5, 8, 15, 3, 6, 1, 4},
+        {7, 5, 0, 13, 11, 6, 1, 2, 3, 10, 12, 15, 4, 14, 9, 8},
+        {2, 7, 12, 15, 9, 5, 10, 11, 1, 4, 0, 13, 6, 8, 14, 3},
+        {8, 3, 2, 6, 4, 13, 14, 11, 12, 1, 7, 15, 10, 0, 9, 5},
+        {5, 2, 10, 11, 9, 1, 12, 3, 7, 4, 13, 0, 6, 15, 8, 14},
+        {0, 4, 11, 14, 8, 3, 7, 1, 10, 2, 9, 6, 15, 13, 5, 12}
+    };
+};
+
+struct SboxCryptoProC {
+    static constexpr const char *name = "cryptopro-c";
+    static constexpr uint8_t sbox[8][16] = {
+        {1, 11, 12, 2, 9, 13, 0, 15, 4, 5, 8, 14, 10, 7, 6, 3},
+        {0, 1, 7, 13, 11, 4, 5, 2, 8, 14, 15, 12, 9, 10, 6, 3},
+        {8, 2, 5, 0, 4, 9, 15, 10, 3, 7, 12, 13, 6, 14, 1, 11},
+        {3, 6, 0, 1, 5, 13, 10, 8, 11, 2, 9, 7, 14, 15, 12, 4},
+        {8, 13, 11, 0, 4, 5, 1, 2, 9, 3, 12, 14, 6, 15, 10, 7},
+        {12, 9, 11, 1, 8, 14, 2, 4, 7, 3, 6, 5, 10, 0, 15, 13},
+        {10, 9, 6, 8, 13, 14, 2, 0, 15, 3, 5, 11, 4, 1, 12, 7},
+        {7, 4, 0, 5, 10, 2, 15, 14, 12, 6, 1, 11, 13, 9, 3, 8}
+    };
+};
+
+struct SboxCryptoProD {
+    static constexpr const char *name = "cryptopro-d";
+    static constexpr uint8_t sbox[8][16] = {
+        {15, 12, 2, 10, 6, 4, 5, 0, 7, 9, 14, 13, 1, 11, 8, 3},
+        {11, 6, 3, 4, 12, 15, 14, 2, 7, 13, 8, 0, 5, 10, 9, 1},
+        {1, 12, 11, 0, 15, 14, 6, 5, 10, 13, 4, 8, 9, 3, 7, 2},
+        {1, 5, 14, 12, 10, 7, 0, 13, 6, 2, 11, 4, 9, 3, 15, 8},
+        {0, 12, 8, 9, 13, 2, 10, 11, 7, 3, 6, 5, 4, 14, 15, 1},
+        {8, 0, 15, 3, 2, 5, 14, 11, 1, 10, 4, 7, 12, 9, 13, 6},
+        {3, 0, 6, 15, 1, 14, 9, 2, 13, 8, 12, 4, 11, 10, 5, 7},
+        {1, 10, 6, 8, 15, 11, 0, 4, 12, 3, 5, 9, 7, 13, 2, 14}
+    };
+};
+
+struct SboxTC26Z {
+    static constexpr const char *name = "tc26-z";
+    static constexpr uint8_t sbox[8][16] = {
+        {12, 4, 6, 2, 10, 5, 11, 9, 14, 8, 13, 7, 0, 3, 15, 1},
+        {6, 8, 2, 3, 9, 10, 5, 12, 1, 14, 4, 7, 11, 13, 0, 15},
+        {11, 3, 5, 8, 2, 15, 10, 13, 14, 1, 7, 4, 12, 9, 6, 0},
+        {12, 8, 2, 1, 13, 4, 15, 6, 7, 0, 10, 5, 3, 14, 9, 11},
+        {7, 15, 5, 10, 8, 1, 6, 13, 0, 9, 3, 14, 11, 4, 2, 12},
+        {5, 13, 15, 6, 9, 2, 12, 10, 11, 7, 8, 1, 4, 3, 14, 0},
+        {8, 14, 2, 5, 6, 9, 1, 12, 15, 4, 11, 0, 13, 10, 3, 7},
+        {1, 7, 14, 13, 0, 5, 8, 3, 4, 15, 10, 6, 9, 12, 11, 2}
+    };
+};
+
+/* S-box lookup and the 11-bit rotation folded into four 32-bit tables */
+template <class SboxParams>
+struct Tables {
+    uint32_t t[4][256];
+
+    constexpr Tables() : t() {
+        for (int i = 0; i < 256; i++) {
+            for (int k = 0; k < 4; k++) {
+                uint32_t x = (uint32_t)(SboxParams::sbox[2 * k + 1][i >> 4] << 4 | SboxParams::sbox[2 * k][i & 0xF]) << 8 * k;
+                t[k][i] = x << 11 | x >> 21;
+            }
+        }
+    }
+};
+
+enum Schedule {
+    SCHEDULE_ENCRYPT,
+    SCHEDULE_DECRYPT,
+    SCHEDULE_MAC
+};
+
+/* Key word used in round r */
+constexpr int keyIndex(Schedule schedule, int r) {
+    return
+        schedule == SCHEDULE_ENCRYPT ? (r < 24 ? r % 8 : 7 - r % 8) :
+        schedule == SCHEDULE_DECRYPT ? (r < 8 ? r : 7 - r % 8) :
+        r % 8;
+}
+
+template <class SboxParams>
+class Cipher {
+public:
+    static constexpr Tables<SboxParams> tables = Tables<SboxParams>();
+
+    static GOST89_FORCEINLINE uint32_t f(uint32_t x) {
+        return
+            tables.t[0][x & 0xFF] ^
+            tables.t[1][x >> 8 & 0xFF] ^
+            tables.t[2][x >> 16 & 0xFF] ^
+            tables.t[3][x >> 24];
+    }
+
+    template <Schedule S, int R>
+    static GOST89_FORCEINLINE void round(const uint32_t *k, uint32_t &a, uint32_t &b) {
+        if (R % 2 == 0) {
+            b ^= f(a + k[keyIndex(S, R)]);
+        } else {
+            a ^= f(b + k[keyIndex(S, R)]);
+        }
+    }
+
+    template <Schedule S, int... R>
+    static GOST89_FORCEINLINE void rounds(const uint32_t *k, uint32_t &a, uint32_t &b, std::integer_sequence<int, R...>) {
+        (round<S, R>(k, a, b), ...);
+    }
+
+    static GOST89_FORCEINLINE void encrypt(const uint32_t *k, const uint32_t *in, uint32_t *out) {
+        uint32_t a = in[0], b = in[1];
+
+        rounds<SCHEDULE_ENCRYPT>(k, a, b, std::make_integer_sequence<int, 32>());
+
+        out[0] = b;
+        out[1] = a;
+    }
+
+    static GOST89_FORCEINLINE void decrypt(const uint32_t *k, const uint32_t *in, uint32_t *out) {
+        uint32_t a = in[0], b = in[1];
+
+        rounds<SCHEDULE_DECRYPT>(k, a, b, std::make_integer_sequence<int, 32>());
+
+        out[0] = b;
+        out[1] = a;
+    }
+
+    static GOST89_FORCEINLINE void encrypt16(const uint32_t *k, const uint32_t *in, uint32_t *out) {
+        uint32_t a = in[0], b = in[1];
+
+        rounds<SCHEDULE_MAC>(k, a, b, std::make_integer_sequence<int, 16>());
+
+        out[0] = a;
+        out[1] = b;
+    }
+
+    /* Drivers with the signatures and semantics of the gost89.c mode functions */
+
+    static void encryptEcb(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
+        unsigned i, l = size / sizeof(uint32_t);
+        uint32_t k[8];
+
+        loadKey(ctx, k);
+
+        for (i = 0; i < l; i += 2) {
+            encrypt(k, (uint32_t*)plain + i, (uint32_t*)encrypted + i);
+        }
+    }
+
+    static void decryptEcb(gost89_context *ctx, void *encrypted, void *plain, unsigned size) {
+        unsigned i, l = size / sizeof(uint32_t);
+        uint32_t k[8];
+
+        loadKey(ctx, k);
+
+        for (i = 0; i < l; i += 2) {
+            decrypt(k, (uint32_t*)encrypted + i, (uint32_t*)plain + i);
+        }
+    }
+
+    static void initCtr(gost89_context *ctx) {
+        encrypt(ctx->key, ctx->iv, ctx->iv);
+    }
+
+    static void encryptCtr(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
+        unsigned i, l = size / sizeof(uint32_t);
+        uint32_t k[8], n[2], t[2];
+
+        /* Key meshing changes the key mid-stream, which is left to gost89.c */
+        if (ctx->key_meshing) {
+            gost89_encrypt_ctr(ctx, plain, encrypted, size);
+            return;
+        }
+
+        loadKey(ctx, k);
+        n[0] = ctx->iv[0];
+        n[1] = ctx->iv[1];
+
+        for (i = 0; i < l; i += 2) {
+            n[0] += 0x1010101;
+            n[1] += 0x1010104;
+            if (n[1] < 0x1010104) {
+                n[1]++;
+            }
+
+            encrypt(k, n, t);
+
+            ((uint32_t*)encrypted)[i] = ((uint32_t*)plain)[i] ^ t[0];
+            ((uint32_t*)encrypted)[i + 1] = ((uint32_t*)plain)[i + 1] ^ t[1];
+        }
+
+        ctx->iv[0] = n[0];
+        ctx->iv[1] = n[1];
+    }
+
+    static void encryptCfb(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
+        unsigned i, l = size / sizeof(uint32_t);
+        uint32_t k[8], n[2];
+
+        if (ctx->key_meshing) {
+            gost89_encrypt_cfb(ctx, plain, encrypted, size);
+            return;
+        }
+
+        loadKey(ctx, k);
+        n[0] = ctx->iv[0];
+        n[1] = ctx->iv[1];
+
+        for (i = 0; i < l; i += 2) {
+            encrypt(k, n, n);
+
+            n[0] ^= ((uint32_t*)plain)[i];
+            n[1] ^= ((uint32_t*)plain)[i + 1];
+
+            ((uint32_t*)encrypted)[i] = n[0];
+            ((uint32_t*)encrypted)[i + 1] = n[1];
+        }
+
+        ctx->iv[0] = n[0];
+        ctx->iv[1] = n[1];
+    }
+
+    static void decryptCfb(gost89_context *ctx, void *encrypted, void *plain, unsigned size) {
+        unsigned i, l = size / sizeof(uint32_t);
+        uint32_t k[8], n[2], a, b;
+
+        if (ctx->key_meshing) {
+            gost89_decrypt_cfb(ctx, encrypted, plain, size);
+            return;
+        }
+
+        loadKey(ctx, k);
+        n[0] = ctx->iv[0];
+        n[1] = ctx->iv[1];
+
+        for (i = 0; i < l; i += 2) {
+            a = ((uint32_t*)encrypted)[i];
+            b = ((uint32_t*)encrypted)[i + 1];
+
+            encrypt(k, n, n);
+
+            ((uint32_t*)plain)[i] = a ^ n[0];
+            ((uint32_t*)plain)[i + 1] = b ^ n[1];
+
+            n[0] = a;
+            n[1] = b;
+        }
+
+        ctx->iv[0] = n[0];
+        ctx->iv[1] = n[1];
+    }
+
+    static void encryptCbc(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
+        unsigned i, l = size / sizeof(uint32_t);
+        uint32_t k[8], n[2];
+
+        loadKey(ctx, k);
+        n[0] = ctx->iv[0];
+        n[1] = ctx->iv[1];
+
+        for (i = 0; i < l; i += 2) {
+            n[0] ^= ((uint32_t*)plain)[i];
+            n[1] ^= ((uint32_t*)plain)[i + 1];
+
+            encrypt(k, n, n);
+
+            ((uint32_t*)encrypted)[i] = n[0];
+            ((uint32_t*)encrypted)[i + 1] = n[1];
+        }
+
+        ctx->iv[0] = n[0];
+        ctx->iv[1] = n[1];
+    }
+
+    static void decryptCbc(gost89_context *ctx, void *encrypted, void *plain, unsigned size) {
+        unsigned i, l = size / sizeof(uint32_t);
+        uint32_t k[8], n[2], a, b;
+
+        loadKey(ctx, k);
+        n[0] = ctx->iv[0];
+        n[1] = ctx->iv[1];
+
+        for (i = 0; i < l; i += 2) {
+            a = ((uint32_t*)encrypted)[i];
+            b = ((uint32_t*)encrypted)[i + 1];
+
+            decrypt(k, (uint32_t*)encrypted + i, (uint32_t*)plain + i);
+
+            ((uint32_t*)plain)[i] ^= n[0];
+            ((uint32_t*)plain)[i + 1] ^= n[1];
+
+            n[0] = a;
+            n[1] = b;
+        }
+
+        ctx->iv[0] = n[0];
+        ctx->iv[1] = n[1];
+    }
+
+    static void mac(gost89_context *ctx, void *plain, unsigned size) {
+        unsigned i, l = size / sizeof(uint32_t);
+        uint32_t k[8], t[2];
+
+        loadKey(ctx, k);
+        t[0] = ctx->mac[0];
+        t[1] = ctx->mac[1];
+
+        for (i = 0; i < l; i += 2) {
+            t[0] ^= ((uint32_t*)plain)[i];
+            t[1] ^= ((uint32_t*)plain)[i + 1];
+
+            encrypt16(k, t, t);
+        }
+
+        ctx->mac[0] = t[0];
+        ctx->mac[1] = t[1];
+    }
+
+    /* Fills the context's S-box so that it can also be used with gost89.c */
+    static void setSbox(gost89_context *ctx) {
+        gost89_set_sbox(ctx, (uint8_t (*)[16])SboxParams::sbox);
+    }
+
+protected:
+    static GOST89_FORCEINLINE void loadKey(gost89_context *ctx, uint32_t *k) {
+        for (int i = 0; i < 8; i++) {
+            k[i] = ctx->key[i];
+        }
+    }
+};
+
+}
+
+#endif /* GOST89_HPP_ */
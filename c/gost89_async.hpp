@@ -0,0 +1,420 @@
+#ifndef GOST89_ASYNC_HPP_
+#define GOST89_ASYNC_HPP_
+
+/*
+ * Awaitable mode functions for C++20 coroutines.
+ *
+ *     gost89_init_ctr(&ctx);
+ *     AsyncResult r = co_await gost89::encrypt_async(&ctx, in, out);
+ *
+ * An operation of up to AsyncOptions::inlineSize bytes runs inline and does
+ * not suspend. A larger one is split into chunks of chunkSize bytes that run
+ * one after another on a WorkerPool; after every chunk the coroutine state
+ * goes back to the caller's executor, which checks the stop token and
+ * submits the next chunk, and the coroutine is finally resumed there.
+ * Without an executor (none given and Executor::current() not set) the
+ * chunks follow each other on the workers and the coroutine resumes on one.
+ *
+ * The results and the context state afterwards are those of one call of
+ * the corresponding gost89.c function (chunks are whole blocks, and the
+ * context carries IV, MAC and key meshing state between them). The context
+ * must not be used elsewhere until the operation completes. As with those
+ * functions, a size with 4 to 7 bytes in its last block reads and writes
+ * that whole block.
+ *
+ * Cancellation is checked before every chunk: a cancelled operation
+ * completes with ASYNC_CANCELLED and the number of bytes transformed, the
+ * context being left as after that many bytes. Interactive chunks are
+ * taken by the workers before bulk ones, and the pool runs at most
+ * bulkSlots bulk operations at a time; further bulk operations wait for a
+ * slot, suspended, so that bulk work cannot fill the pool.
+ *
+ * Requires C++20.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <coroutine>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "gost89.h"
+
+namespace gost89 {
+
+enum AsyncStatus {
+    ASYNC_OK,
+    ASYNC_CANCELLED
+};
+
+enum AsyncMode {
+    ASYNC_ECB,
+    ASYNC_CTR,
+    ASYNC_CFB,
+    ASYNC_CBC
+};
+
+enum AsyncPriority {
+    ASYNC_INTERACTIVE,
+    ASYNC_BULK
+};
+
+struct AsyncResult {
+    AsyncStatus status;
+    size_t size;
+};
+
+/* Where coroutines are resumed: typically the event loop of the calling thread */
+class Executor {
+public:
+    virtual ~Executor() {}
+    virtual void post(std::function<void()> func) = 0;
+
+    /* The executor of the calling thread, set by its event loop */
+    static Executor *&current() {
+        thread_local Executor *executor = nullptr;
+        return executor;
+    }
+};
+
+/* Single-threaded executor: run() executes posted functions until stop() */
+class EventLoop : public Executor {
+public:
+    void post(std::function<void()> func) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(func));
+        cond.notify_one();
+    }
+
+    void run() {
+        Executor *previous = current();
+        std::function<void()> func;
+
+        current() = this;
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [this] { return stopped || !queue.empty(); });
+                if (queue.empty()) {
+                    stopped = false;
+                    break;
+                }
+                func = std::move(queue.front());
+                queue.pop_front();
+            }
+            func();
+        }
+
+        current() = previous;
+    }
+
+    /* run() returns once the functions already posted are done */
+    void stop() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+        cond.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::function<void()>> queue;
+    bool stopped = false;
+};
+
+/* Fixed set of threads with an interactive and a bulk queue */
+class WorkerPool {
+public:
+    /* threads = 0 uses the number of CPUs, bulkSlots = 0 half the threads */
+    explicit WorkerPool(unsigned threads = 0, unsigned bulkSlots = 0) {
+        if (!threads) {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (!threads) {
+            threads = 1;
+        }
+
+        slots = bulkSlots ? bulkSlots : (threads + 1) / 2;
+
+        for (unsigned i = 0; i < threads; i++) {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            cond.notify_all();
+        }
+
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    static WorkerPool &shared() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    void submit(AsyncPriority priority, std::function<void()> func) {
+        std::lock_guard<std::mutex> lock(mutex);
+        (priority == ASYNC_INTERACTIVE ? interactive : bulk).push_back(std::move(func));
+        cond.notify_one();
+    }
+
+    /* Takes a bulk slot now (true), or calls start when one is released */
+    bool acquireBulk(std::function<void()> start) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (slots) {
+            slots--;
+            return true;
+        }
+
+        waiting.push_back(std::move(start));
+        return false;
+    }
+
+    void releaseBulk() {
+        std::function<void()> start;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (waiting.empty()) {
+                slots++;
+                return;
+            }
+            start = std::move(waiting.front());
+            waiting.pop_front();
+        }
+
+        start();
+    }
+
+    size_t bulkWaiting() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return waiting.size();
+    }
+
+private:
+    void run() {
+        std::function<void()> func;
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [this] { return stopping || !interactive.empty() || !bulk.empty(); });
+                if (!interactive.empty()) {
+                    func = std::move(interactive.front());
+                    interactive.pop_front();
+                } else if (!bulk.empty()) {
+                    func = std::move(bulk.front());
+                    bulk.pop_front();
+                } else {
+                    break;
+                }
+            }
+            func();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::function<void()>> interactive;
+    std::deque<std::function<void()>> bulk;
+    std::deque<std::function<void()>> waiting;
+    std::vector<std::thread> workers;
+    unsigned slots;
+    bool stopping = false;
+};
+
+struct AsyncOptions {
+    AsyncMode mode = ASYNC_CTR;
+    AsyncPriority priority = ASYNC_INTERACTIVE;
+    std::stop_token stop;
+    size_t chunkSize = 256 * 1024;
+    size_t inlineSize = 16 * 1024;
+    WorkerPool *pool = nullptr;
+    Executor *executor = nullptr;
+};
+
+typedef void (*AsyncFunc)(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size);
+
+/* The awaitable: lives in the awaiting coroutine's frame until it is resumed */
+class AsyncOperation {
+public:
+    AsyncOperation(gost89_context *ctx, AsyncFunc func, const uint8_t *in, uint8_t *out, size_t size, const AsyncOptions &options) :
+        ctx(ctx), func(func), in(in), out(out), size(size), done(0), options(options), status(ASYNC_OK) {
+        /* Chunks must be whole blocks for the chained modes to continue where they stopped */
+        chunk = options.chunkSize / 8 * 8;
+        if (!chunk) {
+            chunk = 8;
+        }
+        pool = options.pool ? options.pool : &WorkerPool::shared();
+        executor = nullptr;
+    }
+
+    bool await_ready() {
+        if (options.stop.stop_requested()) {
+            status = ASYNC_CANCELLED;
+            return true;
+        }
+
+        if (size <= options.inlineSize) {
+            run(size);
+            return true;
+        }
+
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        caller = handle;
+        executor = options.executor ? options.executor : Executor::current();
+
+        if (options.priority == ASYNC_BULK && !pool->acquireBulk([this] { hop([this] { next(); }); })) {
+            return;
+        }
+
+        next();
+    }
+
+    AsyncResult await_resume() {
+        return AsyncResult{status, done};
+    }
+
+private:
+    void run(size_t n) {
+        while (n) {
+            unsigned part = n > 0x40000000 ? 0x40000000 : (unsigned)n;
+            func(ctx, in + done, out ? out + done : nullptr, part);
+            done += part;
+            n -= part;
+        }
+    }
+
+    /* Runs func on the caller's executor, or here if there is none */
+    void hop(std::function<void()> f) {
+        if (executor) {
+            executor->post(std::move(f));
+        } else {
+            f();
+        }
+    }
+
+    void next() {
+        if (done == size) {
+            finish(ASYNC_OK);
+        } else if (options.stop.stop_requested()) {
+            finish(ASYNC_CANCELLED);
+        } else {
+            pool->submit(options.priority, [this] {
+                run(size - done < chunk ? size - done : chunk);
+                hop([this] { next(); });
+            });
+        }
+    }
+
+    /* Resuming the caller may destroy this object, so it is the last thing done */
+    void finish(AsyncStatus s) {
+        status = s;
+
+        if (options.priority == ASYNC_BULK) {
+            pool->releaseBulk();
+        }
+
+        caller.resume();
+    }
+
+    gost89_context *ctx;
+    AsyncFunc func;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t size;
+    size_t done;
+    size_t chunk;
+    AsyncOptions options;
+    AsyncStatus status;
+    WorkerPool *pool;
+    Executor *executor;
+    std::coroutine_handle<> caller;
+};
+
+namespace detail {
+
+inline void encryptEcb(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size) {
+    gost89_encrypt_ecb(ctx, (void*)in, out, size);
+}
+
+inline void decryptEcb(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size) {
+    gost89_decrypt_ecb(ctx, (void*)in, out, size);
+}
+
+inline void encryptCtr(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size) {
+    gost89_encrypt_ctr(ctx, (void*)in, out, size);
+}
+
+inline void encryptCfb(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size) {
+    gost89_encrypt_cfb(ctx, (void*)in, out, size);
+}
+
+inline void decryptCfb(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size) {
+    gost89_decrypt_cfb(ctx, (void*)in, out, size);
+}
+
+inline void encryptCbc(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size) {
+    gost89_encrypt_cbc(ctx, (void*)in, out, size);
+}
+
+inline void decryptCbc(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size) {
+    gost89_decrypt_cbc(ctx, (void*)in, out, size);
+}
+
+inline void mac(gost89_context *ctx, const uint8_t *in, uint8_t *, unsigned size) {
+    gost89_mac(ctx, (void*)in, size);
+}
+
+inline AsyncFunc modeFunc(AsyncMode mode, bool encrypt) {
+    switch (mode) {
+        case ASYNC_ECB:
+            return encrypt ? &encryptEcb : &decryptEcb;
+        case ASYNC_CFB:
+            return encrypt ? &encryptCfb : &decryptCfb;
+        case ASYNC_CBC:
+            return encrypt ? &encryptCbc : &decryptCbc;
+        default:
+            return &encryptCtr;
+    }
+}
+
+}
+
+/* out must be at least as long as in; in-place operation is allowed */
+inline AsyncOperation encrypt_async(gost89_context *ctx, std::span<const uint8_t> in, std::span<uint8_t> out, const AsyncOptions &options = AsyncOptions()) {
+    return AsyncOperation(ctx, detail::modeFunc(options.mode, true), in.data(), out.data(), in.size(), options);
+}
+
+inline AsyncOperation decrypt_async(gost89_context *ctx, std::span<const uint8_t> in, std::span<uint8_t> out, const AsyncOptions &options = AsyncOptions()) {
+    return AsyncOperation(ctx, detail::modeFunc(options.mode, false), in.data(), out.data(), in.size(), options);
+}
+
+/* Updates ctx->mac as gost89_mac does; options.mode is ignored */
+inline AsyncOperation mac_async(gost89_context *ctx, std::span<const uint8_t> in, const AsyncOptions &options = AsyncOptions()) {
+    return AsyncOperation(ctx, &detail::mac, in.data(), nullptr, in.size(), options);
+}
+
+}
+
+#endif /* GOST89_ASYNC_HPP_ */
@@ -0,0 +1,257 @@
+#ifndef GOST89_FAST_H_
+#define GOST89_FAST_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "gost89.h"
+
+/*
+ * Inline CTR for short messages such as session tokens.
+ *
+ *     gost89_fast_ctr(&ctx, iv, token, out, 24);
+ *
+ * is the same as gost89_set_iv, gost89_init_ctr and gost89_encrypt_ctr on a
+ * copy of ctx, without the calls and without writing to the context: the IV
+ * is passed in, the counter lives in registers and ctx is only read, so one
+ * context can serve any number of threads. Encryption and decryption are
+ * the same function.
+ *
+ * Exactly size bytes are read and written, a partial last block included
+ * (the library functions transform 4-byte words and may touch a whole last
+ * block). Up to four blocks are encrypted interleaved, and loads and stores
+ * go through memcpy, so in and out need no alignment and may be the same
+ * buffer.
+ *
+ * The rounds use the expanded S-box tables (ctx->sbox_x, filled in by
+ * gost89_set_sbox) whatever ctx->kernel says. The intended sizes are 8 to
+ * 64 bytes, beyond which gost89_encrypt_ctr is as fast. A context with key
+ * meshing on is handed to gost89_encrypt_ctr on a copy, through a local
+ * buffer, since the key changes along the message; the result is the same.
+ */
+
+#if _MSC_VER
+    #define GOST89_FAST_INLINE static __forceinline
+#elif __GNUC__
+    #define GOST89_FAST_INLINE static inline __attribute__((always_inline))
+#else
+    #define GOST89_FAST_INLINE static inline
+#endif
+
+#if _MSC_VER
+    #define GOST89_FAST_COLD static __declspec(noinline)
+#elif __GNUC__
+    #define GOST89_FAST_COLD static __attribute__((noinline, cold, unused))
+#else
+    #define GOST89_FAST_COLD static
+#endif
+
+#define gost89_fast_round(ctx, block, key, t) (     \
+    t = (block) + (key),                            \
+    t = (ctx)->sbox_x[0][t & 0xFF] |                \
+        (ctx)->sbox_x[1][t >> 8 & 0xFF] << 8 |      \
+        (ctx)->sbox_x[2][t >> 16 & 0xFF] << 16 |    \
+        (uint32_t)(ctx)->sbox_x[3][t >> 24] << 24,  \
+    t << 11 | t >> 21                               \
+)
+
+/* Eight rounds with the key words in order k0..k7 or k7..k0 */
+#define gost89_fast_up(ctx, x, y, k, t) (                                           \
+    y ^= gost89_fast_round(ctx, x, k[0], t), x ^= gost89_fast_round(ctx, y, k[1], t),   \
+    y ^= gost89_fast_round(ctx, x, k[2], t), x ^= gost89_fast_round(ctx, y, k[3], t),   \
+    y ^= gost89_fast_round(ctx, x, k[4], t), x ^= gost89_fast_round(ctx, y, k[5], t),   \
+    y ^= gost89_fast_round(ctx, x, k[6], t), x ^= gost89_fast_round(ctx, y, k[7], t)    \
+)
+
+#define gost89_fast_down(ctx, x, y, k, t) (                                         \
+    y ^= gost89_fast_round(ctx, x, k[7], t), x ^= gost89_fast_round(ctx, y, k[6], t),   \
+    y ^= gost89_fast_round(ctx, x, k[5], t), x ^= gost89_fast_round(ctx, y, k[4], t),   \
+    y ^= gost89_fast_round(ctx, x, k[3], t), x ^= gost89_fast_round(ctx, y, k[2], t),   \
+    y ^= gost89_fast_round(ctx, x, k[1], t), x ^= gost89_fast_round(ctx, y, k[0], t)    \
+)
+
+/* One block held in a, b (the two 32-bit halves as stored in memory), transformed in place */
+GOST89_FAST_INLINE void gost89_fast_encrypt_block(const gost89_context *ctx, uint32_t *a, uint32_t *b) {
+    const uint32_t *k = ctx->key;
+    uint32_t x = *a, y = *b, t;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        gost89_fast_up(ctx, x, y, k, t);
+    }
+    gost89_fast_down(ctx, x, y, k, t);
+
+    *a = y;
+    *b = x;
+}
+
+/* Independent blocks with their rounds interleaved, to hide the latency of the table lookups */
+#define gost89_fast_round_x2(ctx, x, y, key) (      \
+    y##0 ^= gost89_fast_round(ctx, x##0, key, t0),  \
+    y##1 ^= gost89_fast_round(ctx, x##1, key, t1)   \
+)
+
+#define gost89_fast_round_x4(ctx, x, y, key) (      \
+    y##0 ^= gost89_fast_round(ctx, x##0, key, t0),  \
+    y##1 ^= gost89_fast_round(ctx, x##1, key, t1),  \
+    y##2 ^= gost89_fast_round(ctx, x##2, key, t2),  \
+    y##3 ^= gost89_fast_round(ctx, x##3, key, t3)   \
+)
+
+#define gost89_fast_up_x(round, ctx, k) (                                   \
+    round(ctx, x, y, k[0]), round(ctx, y, x, k[1]),                         \
+    round(ctx, x, y, k[2]), round(ctx, y, x, k[3]),                         \
+    round(ctx, x, y, k[4]), round(ctx, y, x, k[5]),                         \
+    round(ctx, x, y, k[6]), round(ctx, y, x, k[7])                          \
+)
+
+#define gost89_fast_down_x(round, ctx, k) (                                 \
+    round(ctx, x, y, k[7]), round(ctx, y, x, k[6]),                         \
+    round(ctx, x, y, k[5]), round(ctx, y, x, k[4]),                         \
+    round(ctx, x, y, k[3]), round(ctx, y, x, k[2]),                         \
+    round(ctx, x, y, k[1]), round(ctx, y, x, k[0])                          \
+)
+
+GOST89_FAST_INLINE void gost89_fast_encrypt_x2(const gost89_context *ctx, uint32_t *a, uint32_t *b) {
+    const uint32_t *k = ctx->key;
+    uint32_t x0 = a[0], y0 = b[0], x1 = a[1], y1 = b[1], t0, t1;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        gost89_fast_up_x(gost89_fast_round_x2, ctx, k);
+    }
+    gost89_fast_down_x(gost89_fast_round_x2, ctx, k);
+
+    a[0] = y0;
+    b[0] = x0;
+    a[1] = y1;
+    b[1] = x1;
+}
+
+GOST89_FAST_INLINE void gost89_fast_encrypt_x4(const gost89_context *ctx, uint32_t *a, uint32_t *b) {
+    const uint32_t *k = ctx->key;
+    uint32_t x0 = a[0], y0 = b[0], x1 = a[1], y1 = b[1], t0, t1;
+    uint32_t x2 = a[2], y2 = b[2], x3 = a[3], y3 = b[3], t2, t3;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        gost89_fast_up_x(gost89_fast_round_x4, ctx, k);
+    }
+    gost89_fast_down_x(gost89_fast_round_x4, ctx, k);
+
+    a[0] = y0;
+    b[0] = x0;
+    a[1] = y1;
+    b[1] = x1;
+    a[2] = y2;
+    b[2] = x2;
+    a[3] = y3;
+    b[3] = x3;
+}
+
+/* Next counter value, as gost89_ctr_counters computes it */
+GOST89_FAST_INLINE void gost89_fast_ctr_next(uint32_t *n0, uint32_t *n1) {
+    *n0 += 0x1010101;
+
+    if (*n1 > 0xFFFFFFFF - 0x1010104) {
+        *n1 += 0x1010104 + 1;
+    } else {
+        *n1 += 0x1010104;
+    }
+}
+
+/* XORs size (at most 8) bytes of in with the keystream block a, b */
+GOST89_FAST_INLINE void gost89_fast_xor(const uint8_t *in, uint8_t *out, uint32_t a, uint32_t b, unsigned size) {
+    uint32_t w[2];
+    uint8_t ks[8];
+    unsigned j;
+
+    if (size == 8) {
+        memcpy(w, in, 8);
+        w[0] ^= a;
+        w[1] ^= b;
+        memcpy(out, w, 8);
+        return;
+    }
+
+    memcpy(ks, &a, 4);
+    memcpy(ks + 4, &b, 4);
+    for (j = 0; j < size; j++) {
+        out[j] = in[j] ^ ks[j];
+    }
+}
+
+/* Kept out of line so that the context copy does not weigh on the callers' stack frames */
+GOST89_FAST_COLD void gost89_fast_ctr_meshed(const gost89_context *ctx, const void *iv, const uint8_t *src, uint8_t *dst, unsigned size) {
+    gost89_context copy = *ctx;
+    uint32_t buffer[32];
+    unsigned n;
+
+    gost89_set_iv(&copy, (void*)iv);
+    gost89_init_ctr(&copy);
+
+    /* Whole blocks but for the last, so the counter and mesh position carry over between chunks */
+    while (size) {
+        n = size < sizeof(buffer) ? size : sizeof(buffer);
+
+        memset(buffer, 0, sizeof(buffer));
+        memcpy(buffer, src, n);
+        gost89_encrypt_ctr(&copy, buffer, buffer, (n + 7) / 8 * 8);
+        memcpy(dst, buffer, n);
+
+        src += n;
+        dst += n;
+        size -= n;
+    }
+}
+
+GOST89_FAST_INLINE void gost89_fast_ctr(const gost89_context *ctx, const void *iv, const void *in, void *out, unsigned size) {
+    const uint8_t *src = (const uint8_t*)in;
+    uint8_t *dst = (uint8_t*)out;
+    /* Three blocks run the four-lane kernel too, with a spare lane that must hold a defined value */
+    uint32_t n[2], a[4] = {0}, b[4] = {0};
+    unsigned blocks, i, j;
+
+    if (!size) {
+        return;
+    }
+    if (ctx->key_meshing) {
+        gost89_fast_ctr_meshed(ctx, iv, src, dst, size);
+        return;
+    }
+
+    memcpy(n, iv, 8);
+    gost89_fast_encrypt_block(ctx, &n[0], &n[1]);
+
+    /* Up to four blocks in flight; the first of them waits for the IV block anyway */
+    while (size) {
+        blocks = (size + 7) / 8;
+        if (blocks > 4) {
+            blocks = 4;
+        }
+
+        for (i = 0; i < blocks; i++) {
+            gost89_fast_ctr_next(&n[0], &n[1]);
+            a[i] = n[0];
+            b[i] = n[1];
+        }
+
+        if (blocks == 1) {
+            gost89_fast_encrypt_block(ctx, &a[0], &b[0]);
+        } else if (blocks == 2) {
+            gost89_fast_encrypt_x2(ctx, a, b);
+        } else {
+            gost89_fast_encrypt_x4(ctx, a, b);
+        }
+
+        for (i = 0; i < blocks; i++) {
+            j = size < 8 ? size : 8;
+            gost89_fast_xor(src, dst, a[i], b[i], j);
+            src += j;
+            dst += j;
+            size -= j;
+        }
+    }
+}
+
+#endif /* GOST89_FAST_H_ */
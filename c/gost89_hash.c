@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "gost89.h"
+#include "gost89_hash.h"
+
+uint8_t gost89_hash_sbox_test[8][16] = {
+    {4, 10, 9, 2, 13, 8, 0, 14, 6, 11, 1, 12, 7, 15, 5, 3},
+    {14, 11, 4, 12, 6, 13, 15, 10, 2, 3, 8, 1, 0, 7, 5, 9},
+    {5, 8, 1, 13, 10, 3, 4, 2, 14, 15, 12, 7, 6, 0, 9, 11},
+    {7, 13, 10, 1, 0, 8, 9, 15, 14, 4, 6, 12, 11, 2, 5, 3},
+    {6, 12, 7, 1, 5, 15, 13, 8, 4, 10, 9, 14, 0, 3, 11, 2},
+    {4, 11, 10, 0, 7, 2, 1, 13, 3, 6, 8, 5, 9, 12, 15, 14},
+    {13, 11, 4, 1, 3, 15, 5, 9, 0, 10, 14, 7, 6, 8, 2, 12},
+    {1, 15, 13, 0, 5, 7, 10, 4, 9, 2, 3, 14, 6, 11, 8, 12}
+};
+
+uint8_t gost89_hash_sbox_cryptopro[8][16] = {
+    {10, 4, 5, 6, 8, 1, 3, 7, 13, 12, 14, 0, 9, 2, 11, 15},
+    {5, 15, 4, 0, 2, 13, 11, 9, 1, 7, 6, 3, 12, 14, 10, 8},
+    {7, 15, 12, 14, 9, 4, 1, 0, 3, 11, 5, 2, 6, 10, 8, 13},
+    {4, 10, 7, 12, 0, 15, 2, 8, 14, 1, 6, 5, 13, 11, 9, 3},
+    {7, 6, 4, 11, 9, 12, 2, 10, 1, 8, 0, 14, 15, 13, 3, 5},
+    {7, 6, 2, 4, 13, 9, 15, 0, 10, 1, 5, 11, 8, 14, 12, 3},
+    {13, 14, 4, 1, 7, 0, 5, 10, 3, 12, 8, 15, 6, 2, 9, 11},
+    {1, 3, 10, 9, 5, 11, 4, 15, 8, 6, 7, 14, 13, 0, 2, 12}
+};
+
+/* The constant added to U before the third key, as 64-bit little-endian words */
+static const uint64_t gost89_hash_c3[4] = {
+    0xFF00FF00FF00FF00ULL,
+    0x00FF00FF00FF00FFULL,
+    0xFF0000FF00FFFF00ULL,
+    0xFF00FFFF000000FFULL
+};
+
+static uint64_t gost89_hash_load64(const uint8_t *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+           (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static void gost89_hash_store64(uint64_t x, uint8_t *p) {
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(x >> i * 8);
+    }
+}
+
+/* A: (x0, x1, x2, x3) -> (x1, x2, x3, x0 ^ x1) */
+static void gost89_hash_a(uint64_t *x) {
+    uint64_t t = x[0] ^ x[1];
+
+    x[0] = x[1];
+    x[1] = x[2];
+    x[2] = x[3];
+    x[3] = t;
+}
+
+/* P: byte j of word i goes to byte i of key word j */
+static void gost89_hash_p(const uint64_t *u, const uint64_t *v, uint32_t *key) {
+    uint64_t w0 = u[0] ^ v[0], w1 = u[1] ^ v[1], w2 = u[2] ^ v[2], w3 = u[3] ^ v[3];
+    int j;
+
+    for (j = 0; j < 8; j++) {
+        key[j] = (uint32_t)(w0 >> j * 8 & 0xFF) |
+                 (uint32_t)(w1 >> j * 8 & 0xFF) << 8 |
+                 (uint32_t)(w2 >> j * 8 & 0xFF) << 16 |
+                 (uint32_t)(w3 >> j * 8 & 0xFF) << 24;
+    }
+}
+
+/*
+ * Applies psi n times to the 16 words at x[0] and leaves the result at x[n];
+ * x has room for 16 + n words. Each new word is the feedback of the shift
+ * register, so nothing is moved.
+ */
+static void gost89_hash_psi(uint16_t *x, unsigned n) {
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        x[i + 16] = x[i] ^ x[i + 1] ^ x[i + 2] ^ x[i + 3] ^ x[i + 12] ^ x[i + 15];
+    }
+}
+
+static void gost89_hash_split(const uint64_t *w, uint16_t *x) {
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        x[i] = (uint16_t)(w[i / 4] >> (i % 4) * 16);
+    }
+}
+
+static void gost89_hash_join(const uint16_t *x, uint64_t *w) {
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        w[i] = (uint64_t)x[i * 4] | (uint64_t)x[i * 4 + 1] << 16 |
+               (uint64_t)x[i * 4 + 2] << 32 | (uint64_t)x[i * 4 + 3] << 48;
+    }
+}
+
+/* H = psi^61(H ^ psi(M ^ psi^12(E(H)))), with the four keys derived from H and M */
+static void gost89_hash_step(gost89_hash_context *hash, const uint64_t *m) {
+    uint32_t keys[4][8], s[8];
+    uint64_t u[4], v[4], w[4];
+    uint16_t x[16 + 61], y[16];
+    int i;
+
+    memcpy(u, hash->h, sizeof(u));
+    memcpy(v, m, sizeof(v));
+
+    gost89_hash_p(u, v, keys[0]);
+
+    for (i = 1; i < 4; i++) {
+        gost89_hash_a(u);
+        if (i == 2) {
+            u[0] ^= gost89_hash_c3[0];
+            u[1] ^= gost89_hash_c3[1];
+            u[2] ^= gost89_hash_c3[2];
+            u[3] ^= gost89_hash_c3[3];
+        }
+        gost89_hash_a(v);
+        gost89_hash_a(v);
+        gost89_hash_p(u, v, keys[i]);
+    }
+
+    for (i = 0; i < 4; i++) {
+        s[i * 2] = (uint32_t)hash->h[i];
+        s[i * 2 + 1] = (uint32_t)(hash->h[i] >> 32);
+    }
+
+    gost89_encrypt_lanes(hash->ctx, keys, s, s, 4);
+
+    for (i = 0; i < 4; i++) {
+        w[i] = (uint64_t)s[i * 2 + 1] << 32 | s[i * 2];
+    }
+
+    gost89_hash_split(w, x);
+    gost89_hash_psi(x, 12);
+    gost89_hash_split(m, y);
+    for (i = 0; i < 16; i++) {
+        x[i] = x[i + 12] ^ y[i];
+    }
+
+    gost89_hash_psi(x, 1);
+    gost89_hash_split(hash->h, y);
+    for (i = 0; i < 16; i++) {
+        x[i] = x[i + 1] ^ y[i];
+    }
+
+    gost89_hash_psi(x, 61);
+    gost89_hash_join(x + 61, hash->h);
+}
+
+/* Control sum of the message blocks modulo 2^256 */
+static void gost89_hash_add(gost89_hash_context *hash, const uint64_t *m) {
+    uint64_t carry = 0, t;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        t = hash->sum[i] + carry;
+        carry = t < carry;
+        hash->sum[i] = t + m[i];
+        carry += hash->sum[i] < t;
+    }
+}
+
+static void gost89_hash_block(gost89_hash_context *hash, const uint8_t *data) {
+    uint64_t m[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        m[i] = gost89_hash_load64(data + i * 8);
+    }
+
+    gost89_hash_step(hash, m);
+    gost89_hash_add(hash, m);
+}
+
+void gost89_hash_init(gost89_hash_context *hash, gost89_context *ctx) {
+    memset(hash, 0, sizeof(*hash));
+    hash->ctx = ctx;
+}
+
+void gost89_hash_update(gost89_hash_context *hash, void *data, unsigned size) {
+    const uint8_t *p = (const uint8_t*)data;
+    unsigned n;
+
+    hash->size += size;
+
+    if (hash->buffer_size) {
+        n = 32 - hash->buffer_size;
+        if (n > size) {
+            n = size;
+        }
+
+        memcpy(hash->buffer + hash->buffer_size, p, n);
+        hash->buffer_size += n;
+        p += n;
+        size -= n;
+
+        if (hash->buffer_size < 32) {
+            return;
+        }
+
+        gost89_hash_block(hash, hash->buffer);
+        hash->buffer_size = 0;
+    }
+
+    for (; size >= 32; p += 32, size -= 32) {
+        gost89_hash_block(hash, p);
+    }
+
+    memcpy(hash->buffer, p, size);
+    hash->buffer_size = size;
+}
+
+/* The last partial block is padded with zeros, then the length in bits and the control sum are hashed */
+void gost89_hash_final(gost89_hash_context *hash, uint8_t *digest) {
+    uint64_t l[4];
+    int i;
+
+    if (hash->buffer_size) {
+        memset(hash->buffer + hash->buffer_size, 0, 32 - hash->buffer_size);
+        gost89_hash_block(hash, hash->buffer);
+        hash->buffer_size = 0;
+    }
+
+    l[0] = hash->size << 3;
+    l[1] = hash->size >> 61;
+    l[2] = 0;
+    l[3] = 0;
+
+    gost89_hash_step(hash, l);
+    gost89_hash_step(hash, hash->sum);
+
+    for (i = 0; i < 4; i++) {
+        gost89_hash_store64(hash->h[i], digest + i * 8);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef GOST89_HASH_H_
+#define GOST89_HASH_H_
+
+#include <stdint.h>
+
+#include "gost89.h"
+
+/*
+ * GOST R 34.11-94 hash function.
+ *
+ * The step function runs on the block cipher of ctx: its S-box and kernel
+ * are used, its key is not. The four encryptions of a step are independent,
+ * so they are done in one gost89_encrypt_lanes call. Digests are 32 bytes,
+ * in the byte order of RFC 5831 implementations.
+ *
+ * The hash S-box is a parameter of the algorithm: gost89_hash_sbox_test is
+ * the test parameter set, gost89_hash_sbox_cryptopro is the one used with
+ * CryptoPro (id-GostR3411-94-CryptoProParamSet).
+ */
+typedef struct gost89_hash_context {
+    gost89_context *ctx;
+    uint64_t h[4];
+    uint64_t sum[4];
+    uint64_t size;
+    uint8_t buffer[32];
+    unsigned buffer_size;
+} gost89_hash_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern uint8_t gost89_hash_sbox_test[8][16];
+extern uint8_t gost89_hash_sbox_cryptopro[8][16];
+
+extern void gost89_hash_init(gost89_hash_context *hash, gost89_context *ctx);
+extern void gost89_hash_update(gost89_hash_context *hash, void *data, unsigned size);
+extern void gost89_hash_final(gost89_hash_context *hash, uint8_t *digest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOST89_HASH_H_ */
@@ -0,0 +1,397 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+    #include <process.h>
+    #define getpid _getpid
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "gost89.h"
+#include "gost89_keystore.h"
+
+#define GOST89_KEYSTORE_SBOX_SIZE 128
+
+/* Header and section bounds; entries are checked when they are looked up */
+static int gost89_keystore_check(gost89_keystore *ks) {
+    const gost89_keystore_header *h = (const gost89_keystore_header*)ks->data;
+    uint64_t index_end, sbox_end, record_end;
+
+    if (ks->size < sizeof(*h) || memcmp(h->magic, GOST89_KEYSTORE_MAGIC, sizeof(h->magic)) ||
+        h->version != GOST89_KEYSTORE_VERSION) {
+        return 0;
+    }
+
+    if ((h->index_offset | h->sbox_offset | h->record_offset) % 8) {
+        return 0;
+    }
+
+    index_end = h->index_offset + (uint64_t)h->key_count * sizeof(gost89_keystore_index);
+    sbox_end = h->sbox_offset + (uint64_t)h->sbox_count * GOST89_KEYSTORE_SBOX_SIZE;
+    record_end = h->record_offset + (uint64_t)h->key_count * sizeof(gost89_keystore_record);
+
+    if (h->index_offset < sizeof(*h) || h->sbox_offset < sizeof(*h) || h->record_offset < sizeof(*h) ||
+        index_end > ks->size || sbox_end > ks->size || record_end > ks->size) {
+        return 0;
+    }
+
+    ks->header = h;
+    ks->index = (const gost89_keystore_index*)(ks->data + h->index_offset);
+    ks->sboxes = (const uint8_t (*)[8][16])(ks->data + h->sbox_offset);
+    ks->records = (const gost89_keystore_record*)(ks->data + h->record_offset);
+
+    return 1;
+}
+
+int gost89_keystore_open(gost89_keystore *ks, const char *filename) {
+#ifdef _WIN32
+    FILE *f;
+    long size;
+    uint8_t *data;
+#else
+    struct stat st;
+    void *data;
+    int fd;
+#endif
+
+    memset(ks, 0, sizeof(*ks));
+
+#ifdef _WIN32
+    f = fopen(filename, "rb");
+    if (!f) {
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data = size > 0 ? (uint8_t*)malloc(size) : NULL;
+    if (!data || fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    ks->data = data;
+    ks->size = size;
+#else
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(gost89_keystore_header)) {
+        close(fd);
+        return 0;
+    }
+
+    /* The mapping outlives the descriptor, and the file if it is renamed over */
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    ks->data = (const uint8_t*)data;
+    ks->size = st.st_size;
+#endif
+
+    if (!gost89_keystore_check(ks)) {
+        gost89_keystore_close(ks);
+        return 0;
+    }
+
+    return 1;
+}
+
+void gost89_keystore_close(gost89_keystore *ks) {
+    if (ks->data) {
+#ifdef _WIN32
+        free((void*)ks->data);
+#else
+        munmap((void*)ks->data, ks->size);
+#endif
+    }
+
+    memset(ks, 0, sizeof(*ks));
+}
+
+static int gost89_keystore_pad_id(char *padded, const char *id) {
+    size_t length = strlen(id);
+
+    if (!length || length > GOST89_KEYSTORE_ID_SIZE) {
+        return 0;
+    }
+
+    memset(padded, 0, GOST89_KEYSTORE_ID_SIZE);
+    memcpy(padded, id, length);
+
+    return 1;
+}
+
+/* Position of the padded id in the index, or where it would go; found tells which */
+static uint32_t gost89_keystore_search(const gost89_keystore *ks, const char *padded, int *found) {
+    uint32_t low = 0, high = ks->header->key_count, mid;
+    int c;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        c = memcmp(padded, ks->index[mid].id, GOST89_KEYSTORE_ID_SIZE);
+        if (!c) {
+            *found = 1;
+            return mid;
+        }
+        if (c < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    *found = 0;
+    return low;
+}
+
+/* The record of an index entry, if it and its S-box are in range */
+static const gost89_keystore_record *gost89_keystore_entry(const gost89_keystore *ks, uint32_t i) {
+    const gost89_keystore_record *record;
+
+    if (ks->index[i].record >= ks->header->key_count) {
+        return NULL;
+    }
+
+    record = &ks->records[ks->index[i].record];
+    if (record->sbox >= ks->header->sbox_count) {
+        return NULL;
+    }
+
+    return record;
+}
+
+const gost89_keystore_record *gost89_keystore_find(const gost89_keystore *ks, const char *id, uint8_t (**sbox)[16]) {
+    const gost89_keystore_record *record;
+    char padded[GOST89_KEYSTORE_ID_SIZE];
+    uint32_t i;
+    int found;
+
+    if (!ks->header || !gost89_keystore_pad_id(padded, id)) {
+        return NULL;
+    }
+
+    i = gost89_keystore_search(ks, padded, &found);
+    if (!found) {
+        return NULL;
+    }
+
+    record = gost89_keystore_entry(ks, i);
+    if (record && sbox) {
+        *sbox = (uint8_t (*)[16])ks->sboxes[record->sbox];
+    }
+
+    return record;
+}
+
+int gost89_keystore_load(const gost89_keystore *ks, const char *id, gost89_context *ctx) {
+    const gost89_keystore_record *record;
+    uint8_t (*sbox)[16];
+
+    record = gost89_keystore_find(ks, id, &sbox);
+    if (!record) {
+        return 0;
+    }
+
+    gost89_set_sbox(ctx, sbox);
+    gost89_set_key(ctx, (void*)record->key);
+
+    return 1;
+}
+
+/* Index, S-box and record of every entry of the new file, the S-boxes each stored once */
+static int gost89_keystore_build(uint8_t *data, const char *ids, const uint8_t **keys, const uint8_t **sboxes, uint32_t count) {
+    gost89_keystore_header *h = (gost89_keystore_header*)data;
+    gost89_keystore_index *index;
+    gost89_keystore_record *records;
+    uint8_t *table;
+    uint32_t i, s, sbox_count = 0;
+
+    index = (gost89_keystore_index*)(data + sizeof(*h));
+    table = (uint8_t*)(index + count);
+
+    for (i = 0; i < count; i++) {
+        for (s = 0; s < sbox_count; s++) {
+            if (!memcmp(table + s * GOST89_KEYSTORE_SBOX_SIZE, sboxes[i], GOST89_KEYSTORE_SBOX_SIZE)) {
+                break;
+            }
+        }
+        if (s == sbox_count) {
+            memcpy(table + sbox_count++ * GOST89_KEYSTORE_SBOX_SIZE, sboxes[i], GOST89_KEYSTORE_SBOX_SIZE);
+        }
+
+        memcpy(index[i].id, ids + (size_t)i * GOST89_KEYSTORE_ID_SIZE, GOST89_KEYSTORE_ID_SIZE);
+        index[i].record = i;
+        /* The S-box number is kept in reserved until the records are placed after the table */
+        index[i].reserved = s;
+    }
+
+    records = (gost89_keystore_record*)(table + (size_t)sbox_count * GOST89_KEYSTORE_SBOX_SIZE);
+
+    for (i = 0; i < count; i++) {
+        memcpy(records[i].key, keys[i], sizeof(records[i].key));
+        records[i].sbox = index[i].reserved;
+        records[i].reserved = 0;
+        index[i].reserved = 0;
+    }
+
+    memcpy(h->magic, GOST89_KEYSTORE_MAGIC, sizeof(h->magic));
+    h->version = GOST89_KEYSTORE_VERSION;
+    h->key_count = count;
+    h->sbox_count = sbox_count;
+    h->index_offset = sizeof(*h);
+    h->sbox_offset = (uint32_t)(table - data);
+    h->record_offset = (uint32_t)((uint8_t*)records - data);
+
+    return (int)((uint8_t*)(records + count) - data);
+}
+
+/*
+ * The new file of gost89_keystore_put, readable by the owner only unless
+ * the keystore it replaces allows more. It must not exist yet, so that a
+ * link planted under the predictable name is not followed.
+ */
+static FILE *gost89_keystore_create(const char *tmp, const char *filename) {
+#ifdef _WIN32
+    (void)filename;
+    return fopen(tmp, "wb");
+#else
+    struct stat st;
+    mode_t mode = 0600;
+    FILE *f;
+    int fd;
+
+    if (!stat(filename, &st)) {
+        mode = st.st_mode & 0777;
+    }
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, mode);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        remove(tmp);
+    }
+
+    return f;
+#endif
+}
+
+int gost89_keystore_put(const char *filename, const char *id, const void *key, uint8_t (*sbox)[16]) {
+    gost89_keystore old;
+    const gost89_keystore_record *record;
+    const uint8_t **keys = NULL, **sboxes = NULL;
+    char padded[GOST89_KEYSTORE_ID_SIZE], *ids = NULL, tmp[1100];
+    uint8_t *data = NULL;
+    uint32_t old_count = 0, count = 0, pos = 0, i;
+    size_t size;
+    int found = 0, ok = 0, length;
+    FILE *f;
+
+    if (!gost89_keystore_pad_id(padded, id)) {
+        return 0;
+    }
+
+    /* A file that exists but is not a keystore is left alone */
+    errno = 0;
+    if (gost89_keystore_open(&old, filename)) {
+        old_count = old.header->key_count;
+        pos = gost89_keystore_search(&old, padded, &found);
+    } else if (errno != ENOENT) {
+        return 0;
+    }
+
+    ids = (char*)malloc(((size_t)old_count + 1) * GOST89_KEYSTORE_ID_SIZE);
+    keys = (const uint8_t**)malloc(((size_t)old_count + 1) * sizeof(*keys));
+    sboxes = (const uint8_t**)malloc(((size_t)old_count + 1) * sizeof(*sboxes));
+    size = sizeof(gost89_keystore_header) +
+           ((size_t)old_count + 1) * (sizeof(gost89_keystore_index) + GOST89_KEYSTORE_SBOX_SIZE + sizeof(gost89_keystore_record));
+    data = (uint8_t*)calloc(1, size);
+    if (!ids || !keys || !sboxes || !data) {
+        goto done;
+    }
+
+    for (i = 0; i <= old_count; i++) {
+        if (i == pos) {
+            memcpy(ids + (size_t)count * GOST89_KEYSTORE_ID_SIZE, padded, GOST89_KEYSTORE_ID_SIZE);
+            keys[count] = (const uint8_t*)key;
+            sboxes[count] = (const uint8_t*)sbox;
+            count++;
+            if (found) {
+                continue;
+            }
+        }
+        if (i == old_count) {
+            break;
+        }
+
+        record = gost89_keystore_entry(&old, i);
+        if (!record) {
+            goto done;
+        }
+        memcpy(ids + (size_t)count * GOST89_KEYSTORE_ID_SIZE, old.index[i].id, GOST89_KEYSTORE_ID_SIZE);
+        keys[count] = record->key;
+        sboxes[count] = (const uint8_t*)old.sboxes[record->sbox];
+        count++;
+    }
+
+    length = gost89_keystore_build(data, ids, keys, sboxes, count);
+
+    if (snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", filename, (long)getpid()) >= (int)sizeof(tmp)) {
+        goto done;
+    }
+
+    f = gost89_keystore_create(tmp, filename);
+    if (!f) {
+        goto done;
+    }
+
+    ok = fwrite(data, 1, length, f) == (size_t)length;
+    ok &= !fflush(f);
+#ifndef _WIN32
+    ok &= !fsync(fileno(f));
+#endif
+    ok &= !fclose(f);
+
+#ifdef _WIN32
+    remove(filename);
+#endif
+    if (!ok || rename(tmp, filename)) {
+        remove(tmp);
+        ok = 0;
+    }
+
+done:
+    if (old.data) {
+        gost89_keystore_close(&old);
+    }
+    free(ids);
+    free(keys);
+    free(sboxes);
+    free(data);
+
+    return ok;
+}
@@ -0,0 +1,89 @@
+#ifndef GOST89_KEYSTORE_H_
+#define GOST89_KEYSTORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gost89.h"
+
+/*
+ * Binary keystore: many keys with their S-boxes in one file that is mapped
+ * read-only and used in place, without parsing.
+ *
+ *     header      gost89_keystore_header
+ *     index       key_count gost89_keystore_index entries, sorted by id
+ *     S-boxes     sbox_count S-boxes of 8 x 16 values, each stored once
+ *     records     key_count gost89_keystore_record entries
+ *
+ * Numbers are in the byte order of the host that wrote the file, as the
+ * structures are used in place; a file written on a host of the other byte
+ * order fails the version check. Every section starts at a multiple of 8
+ * bytes. Ids are up to GOST89_KEYSTORE_ID_SIZE bytes, padded with zeros,
+ * and compared as bytes. Finding a key is a binary search of the index.
+ *
+ * Opening checks the header and that the sections fit in the file; the
+ * record and S-box numbers of an entry are checked when it is found.
+ *
+ * gost89_keystore_put adds or replaces a key. It writes a new file next to
+ * the old one, with the old one's permissions or else owner-only, and
+ * renames it over it. Readers that have the old file open
+ * keep their mapping of it. They see the update when they open the file
+ * again, and they never wait for a writer. Concurrent writers are not
+ * serialised: the last rename wins.
+ */
+
+#define GOST89_KEYSTORE_MAGIC "GOST89KS"
+#define GOST89_KEYSTORE_VERSION 1
+#define GOST89_KEYSTORE_ID_SIZE 32
+
+typedef struct gost89_keystore_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_count;
+    uint32_t sbox_count;
+    uint32_t index_offset;
+    uint32_t sbox_offset;
+    uint32_t record_offset;
+} gost89_keystore_header;
+
+typedef struct gost89_keystore_index {
+    char id[GOST89_KEYSTORE_ID_SIZE];
+    uint32_t record;
+    uint32_t reserved;
+} gost89_keystore_index;
+
+typedef struct gost89_keystore_record {
+    uint8_t key[32];
+    uint32_t sbox;
+    uint32_t reserved;
+} gost89_keystore_record;
+
+typedef struct gost89_keystore {
+    const uint8_t *data;
+    size_t size;
+    const gost89_keystore_header *header;
+    const gost89_keystore_index *index;
+    const uint8_t (*sboxes)[8][16];
+    const gost89_keystore_record *records;
+} gost89_keystore;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int gost89_keystore_open(gost89_keystore *ks, const char *filename);
+extern void gost89_keystore_close(gost89_keystore *ks);
+
+/* The record of id, or NULL; sbox, if not NULL, gets its S-box */
+extern const gost89_keystore_record *gost89_keystore_find(const gost89_keystore *ks, const char *id, uint8_t (**sbox)[16]);
+
+/* Sets the S-box and key of ctx from the record of id; 0 if there is none */
+extern int gost89_keystore_load(const gost89_keystore *ks, const char *id, gost89_context *ctx);
+
+extern int gost89_keystore_put(const char *filename, const char *id, const void *key, uint8_t (*sbox)[16]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOST89_KEYSTORE_H_ */
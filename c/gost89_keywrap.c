@@ -0,0 +1,276 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "gost89.h"
+#include "gost89_keywrap.h"
+
+#define GOST89_KEY_WRAP_THREADS 64
+
+typedef struct gost89_key_wrap_job {
+    gost89_context *kek;
+    int algorithm;
+    int unwrap;
+    uint8_t *ukm;
+    uint8_t *cek;
+    uint8_t *wrapped;
+    uint8_t *valid;
+    unsigned n;
+    unsigned failed;
+} gost89_key_wrap_job;
+
+/*
+ * RFC 4357, 6.5 for n keys at once: in each of the eight rounds the key is
+ * encrypted in CFB mode with itself, with an IV made of the sums of its
+ * words selected and not selected by the bits of one UKM byte. The four
+ * CFB steps of all lanes go through gost89_encrypt_lanes together.
+ */
+static void gost89_diversify_lanes(gost89_context *kek, const uint8_t *ukm, unsigned stride, uint32_t (*keys)[8], unsigned n) {
+    uint32_t data[GOST89_KEY_WRAP_LANES][8], iv[GOST89_KEY_WRAP_LANES][2];
+    unsigned i, j, b, l;
+
+    for (l = 0; l < n; l++) {
+        memcpy(keys[l], kek->key, sizeof(keys[l]));
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (l = 0; l < n; l++) {
+            iv[l][0] = 0;
+            iv[l][1] = 0;
+            for (j = 0; j < 8; j++) {
+                iv[l][ukm[l * stride + i] >> j & 1 ? 0 : 1] += keys[l][j];
+            }
+            memcpy(data[l], keys[l], sizeof(data[l]));
+        }
+
+        for (b = 0; b < 4; b++) {
+            gost89_encrypt_lanes(kek, keys, iv, iv, n);
+            for (l = 0; l < n; l++) {
+                iv[l][0] = data[l][b * 2] ^= iv[l][0];
+                iv[l][1] = data[l][b * 2 + 1] ^= iv[l][1];
+            }
+        }
+
+        for (l = 0; l < n; l++) {
+            memcpy(keys[l], data[l], sizeof(keys[l]));
+        }
+    }
+}
+
+/* Per-key KEKs: the KEK itself for 6.1, the diversified one for 6.3 */
+static void gost89_key_wrap_keys(gost89_key_wrap_job *job, const uint8_t *ukm, unsigned stride, uint32_t (*keys)[8], unsigned n) {
+    unsigned l;
+
+    if (job->algorithm == GOST89_KEY_WRAP_CRYPTOPRO) {
+        gost89_diversify_lanes(job->kek, ukm, stride, keys, n);
+        return;
+    }
+
+    for (l = 0; l < n; l++) {
+        memcpy(keys[l], job->kek->key, sizeof(keys[l]));
+    }
+}
+
+/* MAC of each content key, chained through the lanes four blocks deep */
+static void gost89_key_wrap_mac(gost89_context *kek, uint32_t (*keys)[8], const uint8_t *ukm, unsigned stride, uint32_t *cek, uint32_t (*mac)[2], unsigned n) {
+    unsigned b, l;
+
+    for (l = 0; l < n; l++) {
+        memcpy(mac[l], ukm + l * stride, sizeof(mac[l]));
+    }
+
+    for (b = 0; b < 4; b++) {
+        for (l = 0; l < n; l++) {
+            mac[l][0] ^= cek[l * 8 + b * 2];
+            mac[l][1] ^= cek[l * 8 + b * 2 + 1];
+        }
+        gost89_encrypt_16_lanes(kek, keys, mac, mac, n);
+    }
+}
+
+static void gost89_key_wrap_group(gost89_key_wrap_job *job, unsigned first, unsigned n) {
+    uint32_t keys[GOST89_KEY_WRAP_LANES][8], block_keys[GOST89_KEY_WRAP_LANES * 4][8];
+    uint32_t cek[GOST89_KEY_WRAP_LANES * 8], mac[GOST89_KEY_WRAP_LANES][2];
+    uint8_t *ukm = job->ukm + first * 8, *in = job->cek + first * 32, *out = job->wrapped + first * GOST89_KEY_WRAP_SIZE;
+    unsigned l, b;
+
+    gost89_key_wrap_keys(job, ukm, 8, keys, n);
+
+    memcpy(cek, in, n * 32);
+    gost89_key_wrap_mac(job->kek, keys, ukm, 8, cek, mac, n);
+
+    if (job->algorithm == GOST89_KEY_WRAP_CRYPTOPRO) {
+        for (l = 0; l < n; l++) {
+            for (b = 0; b < 4; b++) {
+                memcpy(block_keys[l * 4 + b], keys[l], sizeof(keys[l]));
+            }
+        }
+        gost89_encrypt_lanes(job->kek, block_keys, cek, cek, n * 4);
+    } else {
+        gost89_encrypt_blocks(job->kek, cek, cek, n * 4);
+    }
+
+    for (l = 0; l < n; l++) {
+        memcpy(out + l * GOST89_KEY_WRAP_SIZE, ukm + l * 8, 8);
+        memcpy(out + l * GOST89_KEY_WRAP_SIZE + 8, cek + l * 8, 32);
+        memcpy(out + l * GOST89_KEY_WRAP_SIZE + 40, mac[l], 4);
+    }
+}
+
+static void gost89_key_unwrap_group(gost89_key_wrap_job *job, unsigned first, unsigned n) {
+    uint32_t keys[GOST89_KEY_WRAP_LANES][8], block_keys[GOST89_KEY_WRAP_LANES * 4][8];
+    uint32_t cek[GOST89_KEY_WRAP_LANES * 8], mac[GOST89_KEY_WRAP_LANES][2];
+    uint8_t *in = job->wrapped + first * GOST89_KEY_WRAP_SIZE, *out = job->cek + first * 32;
+    unsigned l, b;
+    int ok;
+
+    gost89_key_wrap_keys(job, in, GOST89_KEY_WRAP_SIZE, keys, n);
+
+    for (l = 0; l < n; l++) {
+        memcpy(cek + l * 8, in + l * GOST89_KEY_WRAP_SIZE + 8, 32);
+    }
+
+    if (job->algorithm == GOST89_KEY_WRAP_CRYPTOPRO) {
+        for (l = 0; l < n; l++) {
+            for (b = 0; b < 4; b++) {
+                memcpy(block_keys[l * 4 + b], keys[l], sizeof(keys[l]));
+            }
+        }
+        gost89_decrypt_lanes(job->kek, block_keys, cek, cek, n * 4);
+    } else {
+        gost89_decrypt_blocks(job->kek, cek, cek, n * 4);
+    }
+
+    gost89_key_wrap_mac(job->kek, keys, in, GOST89_KEY_WRAP_SIZE, cek, mac, n);
+
+    for (l = 0; l < n; l++) {
+        ok = !memcmp(mac[l], in + l * GOST89_KEY_WRAP_SIZE + 40, 4);
+        if (ok) {
+            memcpy(out + l * 32, cek + l * 8, 32);
+        } else {
+            memset(out + l * 32, 0, 32);
+            job->failed++;
+        }
+        if (job->valid) {
+            job->valid[first + l] = (uint8_t)ok;
+        }
+    }
+
+    memset(cek, 0, sizeof(cek));
+}
+
+static void *gost89_key_wrap_run(void *arg) {
+    gost89_key_wrap_job *job = (gost89_key_wrap_job*)arg;
+    unsigned i, n;
+
+    for (i = 0; i < job->n; i += n) {
+        n = job->n - i;
+        if (n > GOST89_KEY_WRAP_LANES) {
+            n = GOST89_KEY_WRAP_LANES;
+        }
+
+        if (job->unwrap) {
+            gost89_key_unwrap_group(job, i, n);
+        } else {
+            gost89_key_wrap_group(job, i, n);
+        }
+    }
+
+    return NULL;
+}
+
+/* Splits the keys between threads in contiguous ranges; a range whose thread cannot be started runs here */
+static unsigned gost89_key_wrap_jobs(gost89_key_wrap_job *job, int threads) {
+    gost89_key_wrap_job jobs[GOST89_KEY_WRAP_THREADS];
+    pthread_t thread[GOST89_KEY_WRAP_THREADS];
+    int started[GOST89_KEY_WRAP_THREADS];
+    unsigned i, first = 0, per, failed = 0;
+
+    if (threads > GOST89_KEY_WRAP_THREADS) {
+        threads = GOST89_KEY_WRAP_THREADS;
+    }
+    if (threads < 1 || job->n <= GOST89_KEY_WRAP_LANES) {
+        threads = 1;
+    }
+
+    if (threads == 1) {
+        gost89_key_wrap_run(job);
+        return job->failed;
+    }
+
+    per = (job->n + threads - 1) / threads;
+
+    for (i = 0; i < (unsigned)threads; i++) {
+        jobs[i] = *job;
+        jobs[i].n = first < job->n ? (job->n - first < per ? job->n - first : per) : 0;
+        jobs[i].ukm = job->ukm ? job->ukm + first * 8 : NULL;
+        jobs[i].cek = job->cek + first * 32;
+        jobs[i].wrapped = job->wrapped + first * GOST89_KEY_WRAP_SIZE;
+        jobs[i].valid = job->valid ? job->valid + first : NULL;
+        first += jobs[i].n;
+
+        started[i] = i > 0 && !pthread_create(&thread[i], NULL, gost89_key_wrap_run, &jobs[i]);
+    }
+
+    for (i = 0; i < (unsigned)threads; i++) {
+        if (!started[i]) {
+            gost89_key_wrap_run(&jobs[i]);
+        }
+    }
+
+    for (i = 0; i < (unsigned)threads; i++) {
+        if (started[i]) {
+            pthread_join(thread[i], NULL);
+        }
+        failed += jobs[i].failed;
+    }
+
+    return failed;
+}
+
+/* Writes the 32-byte diversified key KEK(UKM) */
+void gost89_kek_diversify(gost89_context *kek, void *ukm, void *key) {
+    uint32_t keys[1][8];
+
+    gost89_diversify_lanes(kek, (const uint8_t*)ukm, 8, keys, 1);
+    memcpy(key, keys[0], sizeof(keys[0]));
+}
+
+void gost89_key_wrap(gost89_context *kek, int algorithm, void *ukm, void *cek, void *wrapped) {
+    gost89_key_wrap_batch(kek, algorithm, ukm, cek, wrapped, 1, 1);
+}
+
+/* Returns 1 if the MAC matches; otherwise cek is zeroed */
+int gost89_key_unwrap(gost89_context *kek, int algorithm, void *wrapped, void *cek) {
+    return !gost89_key_unwrap_batch(kek, algorithm, wrapped, cek, NULL, 1, 1);
+}
+
+/* ukm holds n 8-byte UKMs, cek n 32-byte keys, wrapped gets n GOST89_KEY_WRAP_SIZE-byte records */
+void gost89_key_wrap_batch(gost89_context *kek, int algorithm, void *ukm, void *cek, void *wrapped, unsigned n, int threads) {
+    gost89_key_wrap_job job;
+
+    memset(&job, 0, sizeof(job));
+    job.kek = kek;
+    job.algorithm = algorithm;
+    job.ukm = (uint8_t*)ukm;
+    job.cek = (uint8_t*)cek;
+    job.wrapped = (uint8_t*)wrapped;
+    job.n = n;
+
+    gost89_key_wrap_jobs(&job, threads);
+}
+
+unsigned gost89_key_unwrap_batch(gost89_context *kek, int algorithm, void *wrapped, void *cek, uint8_t *valid, unsigned n, int threads) {
+    gost89_key_wrap_job job;
+
+    memset(&job, 0, sizeof(job));
+    job.kek = kek;
+    job.algorithm = algorithm;
+    job.unwrap = 1;
+    job.cek = (uint8_t*)cek;
+    job.wrapped = (uint8_t*)wrapped;
+    job.valid = valid;
+    job.n = n;
+
+    return gost89_key_wrap_jobs(&job, threads);
+}
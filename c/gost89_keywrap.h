@@ -0,0 +1,47 @@
+#ifndef GOST89_KEYWRAP_H_
+#define GOST89_KEYWRAP_H_
+
+#include <stdint.h>
+
+#include "gost89.h"
+
+/*
+ * GOST 28147-89 and CryptoPro key wrap (RFC 4357, 6.1 - 6.5).
+ *
+ * A wrapped key is the UKM (8 bytes), the content key encrypted with the
+ * KEK in ECB mode (32 bytes) and its MAC with the UKM as the initial value
+ * (4 bytes). The CryptoPro algorithm first diversifies the KEK with the UKM.
+ * The KEK context provides the key, S-box and kernel and is only read.
+ *
+ * The batch functions take n keys under one KEK. Up to GOST89_KEY_WRAP_LANES
+ * keys are processed together, their block encryptions going through the
+ * lane kernels of gost89.c, and the key set is split between threads.
+ * Each thread takes a contiguous range of the caller's arrays and inherits
+ * the caller's CPU affinity, so a caller pinned to a NUMA node keeps the
+ * batch on that node.
+ * Unwrapping reports the number of keys whose MAC does not match; valid,
+ * if not NULL, gets a flag per key, and the content keys that fail are
+ * zeroed.
+ */
+
+#define GOST89_KEY_WRAP_GOST 0      /* RFC 4357, 6.1 */
+#define GOST89_KEY_WRAP_CRYPTOPRO 1 /* RFC 4357, 6.3 */
+
+#define GOST89_KEY_WRAP_SIZE 44
+#define GOST89_KEY_WRAP_LANES 16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void gost89_kek_diversify(gost89_context *kek, void *ukm, void *key);
+extern void gost89_key_wrap(gost89_context *kek, int algorithm, void *ukm, void *cek, void *wrapped);
+extern int gost89_key_unwrap(gost89_context *kek, int algorithm, void *wrapped, void *cek);
+extern void gost89_key_wrap_batch(gost89_context *kek, int algorithm, void *ukm, void *cek, void *wrapped, unsigned n, int threads);
+extern unsigned gost89_key_unwrap_batch(gost89_context *kek, int algorithm, void *wrapped, void *cek, uint8_t *valid, unsigned n, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOST89_KEYWRAP_H_ */
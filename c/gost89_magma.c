@@ -0,0 +1,603 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gost89.h"
+#include "gost89_magma.h"
+
+#if _MSC_VER
+    #define GOST89_INLINE __forceinline
+    #define GOST89_BSWAP64(x) _byteswap_uint64(x)
+    #define GOST89_LITTLE_ENDIAN 1
+#elif __GNUC__
+    #define GOST89_INLINE inline __attribute__((always_inline))
+    #define GOST89_BSWAP64(x) __builtin_bswap64(x)
+    #define GOST89_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#else
+    #define GOST89_INLINE inline
+    #define GOST89_LITTLE_ENDIAN 0
+#endif
+
+#if __GNUC__ && (__x86_64__ || __i386__)
+    #include <immintrin.h>
+    #define GOST89_CLMUL 1
+#else
+    #define GOST89_CLMUL 0
+#endif
+
+/* Blocks byte-swapped and encrypted per call of the multi-block kernels */
+#define GOST89_MAGMA_BATCH 32
+
+/* MGM data blocks per batch; their gamma and H blocks are encrypted in one call */
+#define GOST89_MGM_BATCH 16
+
+#define GOST89_MGM_AAD 0
+#define GOST89_MGM_ENCRYPT 1
+#define GOST89_MGM_DECRYPT 2
+
+/* id-tc26-gost-28147-param-Z, GOST R 34.12-2015 */
+static const uint8_t gost89_magma_sbox[8][16] = {
+    {12, 4, 6, 2, 10, 5, 11, 9, 14, 8, 13, 7, 0, 3, 15, 1},
+    {6, 8, 2, 3, 9, 10, 5, 12, 1, 14, 4, 7, 11, 13, 0, 15},
+    {11, 3, 5, 8, 2, 15, 10, 13, 14, 1, 7, 4, 12, 9, 6, 0},
+    {12, 8, 2, 1, 13, 4, 15, 6, 7, 0, 10, 5, 3, 14, 9, 11},
+    {7, 15, 5, 10, 8, 1, 6, 13, 0, 9, 3, 14, 11, 4, 2, 12},
+    {5, 13, 15, 6, 9, 2, 12, 10, 11, 7, 8, 1, 4, 3, 14, 0},
+    {8, 14, 2, 5, 6, 9, 1, 12, 15, 4, 11, 0, 13, 10, 3, 7},
+    {1, 7, 14, 13, 0, 5, 8, 3, 4, 15, 10, 6, 9, 12, 11, 2}
+};
+
+/* The same S-box expanded as by gost89_expand_sbox */
+static const uint8_t gost89_magma_sbox_x[4][256] = {
+    {
+        0x6C, 0x64, 0x66, 0x62, 0x6A, 0x65, 0x6B, 0x69, 0x6E, 0x68, 0x6D, 0x67, 0x60, 0x63, 0x6F, 0x61,
+        0x8C, 0x84, 0x86, 0x82, 0x8A, 0x85, 0x8B, 0x89, 0x8E, 0x88, 0x8D, 0x87, 0x80, 0x83, 0x8F, 0x81,
+        0x2C, 0x24, 0x26, 0x22, 0x2A, 0x25, 0x2B, 0x29, 0x2E, 0x28, 0x2D, 0x27, 0x20, 0x23, 0x2F, 0x21,
+        0x3C, 0x34, 0x36, 0x32, 0x3A, 0x35, 0x3B, 0x39, 0x3E, 0x38, 0x3D, 0x37, 0x30, 0x33, 0x3F, 0x31,
+        0x9C, 0x94, 0x96, 0x92, 0x9A, 0x95, 0x9B, 0x99, 0x9E, 0x98, 0x9D, 0x97, 0x90, 0x93, 0x9F, 0x91,
+        0xAC, 0xA4, 0xA6, 0xA2, 0xAA, 0xA5, 0xAB, 0xA9, 0xAE, 0xA8, 0xAD, 0xA7, 0xA0, 0xA3, 0xAF, 0xA1,
+        0x5C, 0x54, 0x56, 0x52, 0x5A, 0x55, 0x5B, 0x59, 0x5E, 0x58, 0x5D, 0x57, 0x50, 0x53, 0x5F, 0x51,
+        0xCC, 0xC4, 0xC6, 0xC2, 0xCA, 0xC5, 0xCB, 0xC9, 0xCE, 0xC8, 0xCD, 0xC7, 0xC0, 0xC3, 0xCF, 0xC1,
+        0x1C, 0x14, 0x16, 0x12, 0x1A, 0x15, 0x1B, 0x19, 0x1E, 0x18, 0x1D, 0x17, 0x10, 0x13, 0x1F, 0x11,
+        0xEC, 0xE4, 0xE6, 0xE2, 0xEA, 0xE5, 0xEB, 0xE9, 0xEE, 0xE8, 0xED, 0xE7, 0xE0, 0xE3, 0xEF, 0xE1,
+        0x4C, 0x44, 0x46, 0x42, 0x4A, 0x45, 0x4B, 0x49, 0x4E, 0x48, 0x4D, 0x47, 0x40, 0x43, 0x4F, 0x41,
+        0x7C, 0x74, 0x76, 0x72, 0x7A, 0x75, 0x7B, 0x79, 0x7E, 0x78, 0x7D, 0x77, 0x70, 0x73, 0x7F, 0x71,
+        0xBC, 0xB4, 0xB6, 0xB2, 0xBA, 0xB5, 0xBB, 0xB9, 0xBE, 0xB8, 0xBD, 0xB7, 0xB0, 0xB3, 0xBF, 0xB1,
+        0xDC, 0xD4, 0xD6, 0xD2, 0xDA, 0xD5, 0xDB, 0xD9, 0xDE, 0xD8, 0xDD, 0xD7, 0xD0, 0xD3, 0xDF, 0xD1,
+        0x0C, 0x04, 0x06, 0x02, 0x0A, 0x05, 0x0B, 0x09, 0x0E, 0x08, 0x0D, 0x07, 0x00, 0x03, 0x0F, 0x01,
+        0xFC, 0xF4, 0xF6, 0xF2, 0xFA, 0xF5, 0xFB, 0xF9, 0xFE, 0xF8, 0xFD, 0xF7, 0xF0, 0xF3, 0xFF, 0xF1
+    },
+    {
+        0xCB, 0xC3, 0xC5, 0xC8, 0xC2, 0xCF, 0xCA, 0xCD, 0xCE, 0xC1, 0xC7, 0xC4, 0xCC, 0xC9, 0xC6, 0xC0,
+        0x8B, 0x83, 0x85, 0x88, 0x82, 0x8F, 0x8A, 0x8D, 0x8E, 0x81, 0x87, 0x84, 0x8C, 0x89, 0x86, 0x80,
+        0x2B, 0x23, 0x25, 0x28, 0x22, 0x2F, 0x2A, 0x2D, 0x2E, 0x21, 0x27, 0x24, 0x2C, 0x29, 0x26, 0x20,
+        0x1B, 0x13, 0x15, 0x18, 0x12, 0x1F, 0x1A, 0x1D, 0x1E, 0x11, 0x17, 0x14, 0x1C, 0x19, 0x16, 0x10,
+        0xDB, 0xD3, 0xD5, 0xD8, 0xD2, 0xDF, 0xDA, 0xDD, 0xDE, 0xD1, 0xD7, 0xD4, 0xDC, 0xD9, 0xD6, 0xD0,
+        0x4B, 0x43, 0x45, 0x48, 0x42, 0x4F, 0x4A, 0x4D, 0x4E, 0x41, 0x47, 0x44, 0x4C, 0x49, 0x46, 0x40,
+        0xFB, 0xF3, 0xF5, 0xF8, 0xF2, 0xFF, 0xFA, 0xFD, 0xFE, 0xF1, 0xF7, 0xF4, 0xFC, 0xF9, 0xF6, 0xF0,
+        0x6B, 0x63, 0x65, 0x68, 0x62, 0x6F, 0x6A, 0x6D, 0x6E, 0x61, 0x67, 0x64, 0x6C, 0x69, 0x66, 0x60,
+        0x7B, 0x73, 0x75, 0x78, 0x72, 0x7F, 0x7A, 0x7D, 0x7E, 0x71, 0x77, 0x74, 0x7C, 0x79, 0x76, 0x70,
+        0x0B, 0x03, 0x05, 0x08, 0x02, 0x0F, 0x0A, 0x0D, 0x0E, 0x01, 0x07, 0x04, 0x0C, 0x09, 0x06, 0x00,
+        0xAB, 0xA3, 0xA5, 0xA8, 0xA2, 0xAF, 0xAA, 0xAD, 0xAE, 0xA1, 0xA7, 0xA4, 0xAC, 0xA9, 0xA6, 0xA0,
+        0x5B, 0x53, 0x55, 0x58, 0x52, 0x5F, 0x5A, 0x5D, 0x5E, 0x51, 0x57, 0x54, 0x5C, 0x59, 0x56, 0x50,
+        0x3B, 0x33, 0x35, 0x38, 0x32, 0x3F, 0x3A, 0x3D, 0x3E, 0x31, 0x37, 0x34, 0x3C, 0x39, 0x36, 0x30,
+        0xEB, 0xE3, 0xE5, 0xE8, 0xE2, 0xEF, 0xEA, 0xED, 0xEE, 0xE1, 0xE7, 0xE4, 0xEC, 0xE9, 0xE6, 0xE0,
+        0x9B, 0x93, 0x95, 0x98, 0x92, 0x9F, 0x9A, 0x9D, 0x9E, 0x91, 0x97, 0x94, 0x9C, 0x99, 0x96, 0x90,
+        0xBB, 0xB3, 0xB5, 0xB8, 0xB2, 0xBF, 0xBA, 0xBD, 0xBE, 0xB1, 0xB7, 0xB4, 0xBC, 0xB9, 0xB6, 0xB0
+    },
+    {
+        0x57, 0x5F, 0x55, 0x5A, 0x58, 0x51, 0x56, 0x5D, 0x50, 0x59, 0x53, 0x5E, 0x5B, 0x54, 0x52, 0x5C,
+        0xD7, 0xDF, 0xD5, 0xDA, 0xD8, 0xD1, 0xD6, 0xDD, 0xD0, 0xD9, 0xD3, 0xDE, 0xDB, 0xD4, 0xD2, 0xDC,
+        0xF7, 0xFF, 0xF5, 0xFA, 0xF8, 0xF1, 0xF6, 0xFD, 0xF0, 0xF9, 0xF3, 0xFE, 0xFB, 0xF4, 0xF2, 0xFC,
+        0x67, 0x6F, 0x65, 0x6A, 0x68, 0x61, 0x66, 0x6D, 0x60, 0x69, 0x63, 0x6E, 0x6B, 0x64, 0x62, 0x6C,
+        0x97, 0x9F, 0x95, 0x9A, 0x98, 0x91, 0x96, 0x9D, 0x90, 0x99, 0x93, 0x9E, 0x9B, 0x94, 0x92, 0x9C,
+        0x27, 0x2F, 0x25, 0x2A, 0x28, 0x21, 0x26, 0x2D, 0x20, 0x29, 0x23, 0x2E, 0x2B, 0x24, 0x22, 0x2C,
+        0xC7, 0xCF, 0xC5, 0xCA, 0xC8, 0xC1, 0xC6, 0xCD, 0xC0, 0xC9, 0xC3, 0xCE, 0xCB, 0xC4, 0xC2, 0xCC,
+        0xA7, 0xAF, 0xA5, 0xAA, 0xA8, 0xA1, 0xA6, 0xAD, 0xA0, 0xA9, 0xA3, 0xAE, 0xAB, 0xA4, 0xA2, 0xAC,
+        0xB7, 0xBF, 0xB5, 0xBA, 0xB8, 0xB1, 0xB6, 0xBD, 0xB0, 0xB9, 0xB3, 0xBE, 0xBB, 0xB4, 0xB2, 0xBC,
+        0x77, 0x7F, 0x75, 0x7A, 0x78, 0x71, 0x76, 0x7D, 0x70, 0x79, 0x73, 0x7E, 0x7B, 0x74, 0x72, 0x7C,
+        0x87, 0x8F, 0x85, 0x8A, 0x88, 0x81, 0x86, 0x8D, 0x80, 0x89, 0x83, 0x8E, 0x8B, 0x84, 0x82, 0x8C,
+        0x17, 0x1F, 0x15, 0x1A, 0x18, 0x11, 0x16, 0x1D, 0x10, 0x19, 0x13, 0x1E, 0x1B, 0x14, 0x12, 0x1C,
+        0x47, 0x4F, 0x45, 0x4A, 0x48, 0x41, 0x46, 0x4D, 0x40, 0x49, 0x43, 0x4E, 0x4B, 0x44, 0x42, 0x4C,
+        0x37, 0x3F, 0x35, 0x3A, 0x38, 0x31, 0x36, 0x3D, 0x30, 0x39, 0x33, 0x3E, 0x3B, 0x34, 0x32, 0x3C,
+        0xE7, 0xEF, 0xE5, 0xEA, 0xE8, 0xE1, 0xE6, 0xED, 0xE0, 0xE9, 0xE3, 0xEE, 0xEB, 0xE4, 0xE2, 0xEC,
+        0x07, 0x0F, 0x05, 0x0A, 0x08, 0x01, 0x06, 0x0D, 0x00, 0x09, 0x03, 0x0E, 0x0B, 0x04, 0x02, 0x0C
+    },
+    {
+        0x18, 0x1E, 0x12, 0x15, 0x16, 0x19, 0x11, 0x1C, 0x1F, 0x14, 0x1B, 0x10, 0x1D, 0x1A, 0x13, 0x17,
+        0x78, 0x7E, 0x72, 0x75, 0x76, 0x79, 0x71, 0x7C, 0x7F, 0x74, 0x7B, 0x70, 0x7D, 0x7A, 0x73, 0x77,
+        0xE8, 0xEE, 0xE2, 0xE5, 0xE6, 0xE9, 0xE1, 0xEC, 0xEF, 0xE4, 0xEB, 0xE0, 0xED, 0xEA, 0xE3, 0xE7,
+        0xD8, 0xDE, 0xD2, 0xD5, 0xD6, 0xD9, 0xD1, 0xDC, 0xDF, 0xD4, 0xDB, 0xD0, 0xDD, 0xDA, 0xD3, 0xD7,
+        0x08, 0x0E, 0x02, 0x05, 0x06, 0x09, 0x01, 0x0C, 0x0F, 0x04, 0x0B, 0x00, 0x0D, 0x0A, 0x03, 0x07,
+        0x58, 0x5E, 0x52, 0x55, 0x56, 0x59, 0x51, 0x5C, 0x5F, 0x54, 0x5B, 0x50, 0x5D, 0x5A, 0x53, 0x57,
+        0x88, 0x8E, 0x82, 0x85, 0x86, 0x89, 0x81, 0x8C, 0x8F, 0x84, 0x8B, 0x80, 0x8D, 0x8A, 0x83, 0x87,
+        0x38, 0x3E, 0x32, 0x35, 0x36, 0x39, 0x31, 0x3C, 0x3F, 0x34, 0x3B, 0x30, 0x3D, 0x3A, 0x33, 0x37,
+        0x48, 0x4E, 0x42, 0x45, 0x46, 0x49, 0x41, 0x4C, 0x4F, 0x44, 0x4B, 0x40, 0x4D, 0x4A, 0x43, 0x47,
+        0xF8, 0xFE, 0xF2, 0xF5, 0xF6, 0xF9, 0xF1, 0xFC, 0xFF, 0xF4, 0xFB, 0xF0, 0xFD, 0xFA, 0xF3, 0xF7,
+        0xA8, 0xAE, 0xA2, 0xA5, 0xA6, 0xA9, 0xA1, 0xAC, 0xAF, 0xA4, 0xAB, 0xA0, 0xAD, 0xAA, 0xA3, 0xA7,
+        0x68, 0x6E, 0x62, 0x65, 0x66, 0x69, 0x61, 0x6C, 0x6F, 0x64, 0x6B, 0x60, 0x6D, 0x6A, 0x63, 0x67,
+        0x98, 0x9E, 0x92, 0x95, 0x96, 0x99, 0x91, 0x9C, 0x9F, 0x94, 0x9B, 0x90, 0x9D, 0x9A, 0x93, 0x97,
+        0xC8, 0xCE, 0xC2, 0xC5, 0xC6, 0xC9, 0xC1, 0xCC, 0xCF, 0xC4, 0xCB, 0xC0, 0xCD, 0xCA, 0xC3, 0xC7,
+        0xB8, 0xBE, 0xB2, 0xB5, 0xB6, 0xB9, 0xB1, 0xBC, 0xBF, 0xB4, 0xBB, 0xB0, 0xBD, 0xBA, 0xB3, 0xB7,
+        0x28, 0x2E, 0x22, 0x25, 0x26, 0x29, 0x21, 0x2C, 0x2F, 0x24, 0x2B, 0x20, 0x2D, 0x2A, 0x23, 0x27
+    }
+};
+
+/* ACPKM: the next key is the encryption of these blocks under the current one */
+static const uint8_t gost89_magma_acpkm_d[32] = {
+    0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F,
+    0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F
+};
+
+static GOST89_INLINE uint64_t gost89_magma_load64(const uint8_t *in) {
+    uint64_t x;
+
+#if GOST89_LITTLE_ENDIAN
+    memcpy(&x, in, sizeof(x));
+    x = GOST89_BSWAP64(x);
+#else
+    int i;
+
+    for (x = 0, i = 0; i < 8; i++) {
+        x = x << 8 | in[i];
+    }
+#endif
+
+    return x;
+}
+
+static GOST89_INLINE void gost89_magma_store64(uint64_t x, uint8_t *out) {
+#if GOST89_LITTLE_ENDIAN
+    x = GOST89_BSWAP64(x);
+    memcpy(out, &x, sizeof(x));
+#else
+    int i;
+
+    for (i = 7; i >= 0; i--, x >>= 8) {
+        out[i] = (uint8_t)x;
+    }
+#endif
+}
+
+/*
+ * A big-endian block as the native words of gost89.c: the last four bytes
+ * of a Magma block are the half that is added to the key in round one.
+ */
+static GOST89_INLINE void gost89_magma_load(const uint8_t *in, uint32_t *block) {
+    uint64_t x = gost89_magma_load64(in);
+
+    block[0] = (uint32_t)x;
+    block[1] = (uint32_t)(x >> 32);
+}
+
+static GOST89_INLINE void gost89_magma_store(const uint32_t *block, uint8_t *out) {
+    gost89_magma_store64((uint64_t)block[1] << 32 | block[0], out);
+}
+
+void gost89_magma_set_sbox(gost89_context *ctx) {
+    memcpy(ctx->sbox, gost89_magma_sbox, sizeof(ctx->sbox));
+    memcpy(ctx->sbox_x, gost89_magma_sbox_x, sizeof(ctx->sbox_x));
+}
+
+static void gost89_magma_load_key(gost89_context *ctx, const uint8_t *k) {
+    int i;
+
+    for (i = 0; i < 8; i++, k += 4) {
+        ctx->key[i] = (uint32_t)k[0] << 24 | (uint32_t)k[1] << 16 | (uint32_t)k[2] << 8 | k[3];
+    }
+}
+
+/* As gost89_set_key, a new key resets the kernel and turns ACPKM off until gost89_magma_set_acpkm */
+void gost89_magma_set_key(gost89_context *ctx, void *key) {
+    gost89_magma_load_key(ctx, (const uint8_t*)key);
+
+    ctx->kernel = GOST89_KERNEL_AUTO;
+    ctx->key_meshing = 0;
+    ctx->mesh_size = 8;
+    ctx->mesh_count = 0;
+}
+
+/* section is in bytes and is rounded down to whole blocks; less than a block turns ACPKM off */
+void gost89_magma_set_acpkm(gost89_context *ctx, unsigned section) {
+    ctx->key_meshing = section >= 8;
+    if (ctx->key_meshing) {
+        ctx->mesh_size = section & ~7u;
+    }
+    ctx->mesh_count = 0;
+}
+
+void gost89_magma_acpkm(gost89_context *ctx) {
+    uint8_t key[32];
+
+    gost89_magma_encrypt_ecb(ctx, (void*)gost89_magma_acpkm_d, key, sizeof(key));
+    gost89_magma_load_key(ctx, key);
+    ctx->mesh_count = 0;
+}
+
+/* Same as gost89_mesh_blocks in gost89.c, with ACPKM at the section boundaries */
+static GOST89_INLINE unsigned gost89_magma_acpkm_blocks(gost89_context *ctx, unsigned n) {
+    unsigned left;
+
+    if (!ctx->key_meshing || ctx->mesh_size < 8) {
+        return n;
+    }
+
+    if (ctx->mesh_count >= ctx->mesh_size) {
+        gost89_magma_acpkm(ctx);
+        ctx->mesh_count = 0;
+    }
+
+    left = (ctx->mesh_size - ctx->mesh_count) / 8;
+    if (n > left) {
+        n = left;
+    }
+
+    ctx->mesh_count += n * 8;
+
+    return n;
+}
+
+void gost89_magma_encrypt(gost89_context *ctx, void *plain, void *encrypted) {
+    uint32_t t[2];
+
+    gost89_magma_load((const uint8_t*)plain, t);
+    gost89_encrypt(ctx, t, t);
+    gost89_magma_store(t, (uint8_t*)encrypted);
+}
+
+void gost89_magma_decrypt(gost89_context *ctx, void *encrypted, void *plain) {
+    uint32_t t[2];
+
+    gost89_magma_load((const uint8_t*)encrypted, t);
+    gost89_decrypt(ctx, t, t);
+    gost89_magma_store(t, (uint8_t*)plain);
+}
+
+/* Only whole blocks are processed; ECB messages have to be padded by the caller */
+static void gost89_magma_ecb(gost89_context *ctx, const uint8_t *in, uint8_t *out, unsigned size, int decrypt) {
+    unsigned i, j, n, blocks = size / 8;
+    uint32_t t[GOST89_MAGMA_BATCH * 2];
+
+    for (i = 0; i < blocks; i += n) {
+        n = blocks - i;
+        if (n > GOST89_MAGMA_BATCH) {
+            n = GOST89_MAGMA_BATCH;
+        }
+
+        for (j = 0; j < n; j++) {
+            gost89_magma_load(in + (i + j) * 8, t + j * 2);
+        }
+
+        if (decrypt) {
+            gost89_decrypt_blocks(ctx, t, t, n);
+        } else {
+            gost89_encrypt_blocks(ctx, t, t, n);
+        }
+
+        for (j = 0; j < n; j++) {
+            gost89_magma_store(t + j * 2, out + (i + j) * 8);
+        }
+    }
+}
+
+void gost89_magma_encrypt_ecb(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
+    gost89_magma_ecb(ctx, (const uint8_t*)plain, (uint8_t*)encrypted, size, 0);
+}
+
+void gost89_magma_decrypt_ecb(gost89_context *ctx, void *encrypted, void *plain, unsigned size) {
+    gost89_magma_ecb(ctx, (const uint8_t*)encrypted, (uint8_t*)plain, size, 1);
+}
+
+/* The counter starts at IV || 0 and is kept in ctx->iv, low word first */
+void gost89_magma_init_ctr(gost89_context *ctx) {
+    ctx->iv[1] = ctx->iv[0];
+    ctx->iv[0] = 0;
+}
+
+void gost89_magma_encrypt_ctr(gost89_context *ctx, void *plain, void *encrypted, unsigned size) {
+    const uint8_t *in = (const uint8_t*)plain;
+    uint8_t *out = (uint8_t*)encrypted;
+    unsigned i, j, k, n, offset, blocks = (size + 7) / 8;
+    uint32_t t[GOST89_MAGMA_BATCH * 2], p[2];
+    uint8_t gamma[8];
+
+    for (i = 0; i < blocks; i += n) {
+        n = blocks - i;
+        if (n > GOST89_MAGMA_BATCH) {
+            n = GOST89_MAGMA_BATCH;
+        }
+        n = gost89_magma_acpkm_blocks(ctx, n);
+
+        for (j = 0; j < n; j++) {
+            t[j * 2] = ctx->iv[0];
+            t[j * 2 + 1] = ctx->iv[1];
+
+            if (!++ctx->iv[0]) {
+                ctx->iv[1]++;
+            }
+        }
+
+        gost89_encrypt_blocks(ctx, t, t, n);
+
+        for (j = 0; j < n; j++) {
+            offset = (i + j) * 8;
+
+            if (offset + 8 <= size) {
+                gost89_magma_load(in + offset, p);
+                p[0] ^= t[j * 2];
+                p[1] ^= t[j * 2 + 1];
+                gost89_magma_store(p, out + offset);
+            } else {
+                /* A partial last block uses the leading bytes of the gamma */
+                gost89_magma_store(t + j * 2, gamma);
+                for (k = 0; offset + k < size; k++) {
+                    out[offset + k] = in[offset + k] ^ gamma[k];
+                }
+            }
+        }
+    }
+}
+
+void gost89_magma_omac(gost89_context *ctx, void *plain, unsigned size) {
+    const uint8_t *in = (const uint8_t*)plain;
+    unsigned i;
+    uint32_t t[2];
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        gost89_magma_load(in + i, t);
+
+        ctx->mac[0] ^= t[0];
+        ctx->mac[1] ^= t[1];
+
+        gost89_encrypt(ctx, ctx->mac, ctx->mac);
+    }
+}
+
+/* Doubling in GF(2^64) modulo x^64 + x^4 + x^3 + x + 1 */
+static void gost89_magma_omac_shift(uint32_t *k) {
+    uint32_t carry = k[1] >> 31;
+
+    k[1] = k[1] << 1 | k[0] >> 31;
+    k[0] = k[0] << 1 ^ (carry ? 0x1B : 0);
+}
+
+void gost89_magma_omac_final(gost89_context *ctx, void *plain, unsigned size) {
+    const uint8_t *in = (const uint8_t*)plain;
+    unsigned tail = size ? (size - 1) % 8 + 1 : 0;
+    uint32_t k[2] = {0, 0}, t[2];
+    uint8_t last[8];
+
+    gost89_magma_omac(ctx, plain, size - tail);
+
+    gost89_encrypt(ctx, k, k);
+    gost89_magma_omac_shift(k);
+
+    memset(last, 0, sizeof(last));
+    memcpy(last, in + size - tail, tail);
+
+    if (tail < 8) {
+        last[tail] = 0x80;
+        gost89_magma_omac_shift(k);
+    }
+
+    gost89_magma_load(last, t);
+
+    ctx->mac[0] ^= t[0] ^ k[0];
+    ctx->mac[1] ^= t[1] ^ k[1];
+
+    gost89_encrypt(ctx, ctx->mac, ctx->mac);
+}
+
+void gost89_magma_get_mac(gost89_context *ctx, uint8_t *mac) {
+    gost89_magma_store(ctx->mac, mac);
+}
+
+/* Reduces a 128-bit carry-less product modulo x^64 + x^4 + x^3 + x + 1 */
+static GOST89_INLINE uint64_t gost89_gf64_reduce(uint64_t hi, uint64_t lo) {
+    uint64_t o = hi >> 63 ^ hi >> 61 ^ hi >> 60;
+
+    lo ^= hi ^ hi << 1 ^ hi << 3 ^ hi << 4;
+
+    return lo ^ o ^ o << 1 ^ o << 3 ^ o << 4;
+}
+
+/* Carry-less 64x64-bit multiplication, four bits of b at a time */
+static GOST89_INLINE void gost89_gf64_clmul(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo) {
+    uint64_t tl[16], th[16], rl = 0, rh = 0;
+    int i, k;
+
+    tl[0] = th[0] = 0;
+    tl[1] = a;
+    th[1] = 0;
+
+    for (i = 2; i < 16; i += 2) {
+        tl[i] = tl[i / 2] << 1;
+        th[i] = th[i / 2] << 1 | tl[i / 2] >> 63;
+        tl[i + 1] = tl[i] ^ a;
+        th[i + 1] = th[i];
+    }
+
+    for (i = 60; i >= 0; i -= 4) {
+        rh = rh << 4 | rl >> 60;
+        rl <<= 4;
+
+        k = (int)(b >> i & 0xF);
+        rl ^= tl[k];
+        rh ^= th[k];
+    }
+
+    *hi = rh;
+    *lo = rl;
+}
+
+/* Sum of h[i] * x[i] in GF(2^64); the products are added unreduced and reduced once */
+static uint64_t gost89_mgm_sum(const uint64_t *h, const uint64_t *x, unsigned n) {
+    uint64_t hi = 0, lo = 0, ph, pl;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        gost89_gf64_clmul(h[i], x[i], &ph, &pl);
+        hi ^= ph;
+        lo ^= pl;
+    }
+
+    return gost89_gf64_reduce(hi, lo);
+}
+
+#if GOST89_CLMUL
+__attribute__((target("pclmul,sse2")))
+static uint64_t gost89_mgm_sum_clmul(const uint64_t *h, const uint64_t *x, unsigned n) {
+    __m128i sum = _mm_setzero_si128();
+    uint64_t p[2];
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        sum = _mm_xor_si128(sum, _mm_clmulepi64_si128(
+            _mm_set_epi64x(0, (long long)h[i]),
+            _mm_set_epi64x(0, (long long)x[i]),
+            0x00
+        ));
+    }
+
+    _mm_storeu_si128((__m128i*)p, sum);
+
+    return gost89_gf64_reduce(p[1], p[0]);
+}
+#endif
+
+static GOST89_INLINE void gost89_mgm_add(gost89_mgm_context *mgm, const uint64_t *h, const uint64_t *x, unsigned n) {
+#if GOST89_CLMUL
+    if (mgm->clmul) {
+        mgm->sum ^= gost89_mgm_sum_clmul(h, x, n);
+        return;
+    }
+#endif
+
+    mgm->sum ^= gost89_mgm_sum(h, x, n);
+}
+
+static GOST89_INLINE void gost89_mgm_put(uint32_t *t, uint64_t x) {
+    t[0] = (uint32_t)x;
+    t[1] = (uint32_t)(x >> 32);
+}
+
+static GOST89_INLINE uint64_t gost89_mgm_get(const uint32_t *t) {
+    return (uint64_t)t[1] << 32 | t[0];
+}
+
+void gost89_mgm_init(gost89_mgm_context *mgm, gost89_context *ctx, void *nonce) {
+    uint64_t icn = gost89_magma_load64((const uint8_t*)nonce) & ~((uint64_t)1 << 63);
+    uint32_t t[4];
+
+    mgm->ctx = ctx;
+
+    /* Y1 = E(0 || ICN), Z1 = E(1 || ICN) */
+    gost89_mgm_put(t, icn);
+    gost89_mgm_put(t + 2, icn | (uint64_t)1 << 63);
+    gost89_encrypt_blocks(ctx, t, t, 2);
+
+    mgm->y = gost89_mgm_get(t);
+    mgm->z = gost89_mgm_get(t + 2);
+    mgm->sum = 0;
+    mgm->aad_size = 0;
+    mgm->text_size = 0;
+
+#if GOST89_CLMUL
+    mgm->clmul = __builtin_cpu_supports("pclmul");
+#else
+    mgm->clmul = 0;
+#endif
+}
+
+static void gost89_mgm_blocks(gost89_mgm_context *mgm, const uint8_t *in, uint8_t *out, unsigned size, int op) {
+    uint32_t t[GOST89_MGM_BATCH * 4];
+    uint64_t h[GOST89_MGM_BATCH], x[GOST89_MGM_BATCH], p, c, mask;
+    uint8_t last[8];
+    unsigned i, j, n, g, len, offset, blocks = (size + 7) / 8;
+
+    for (i = 0; i < blocks; i += n) {
+        n = blocks - i;
+        if (n > GOST89_MGM_BATCH) {
+            n = GOST89_MGM_BATCH;
+        }
+        g = op == GOST89_MGM_AAD ? 0 : n;
+
+        /* Gamma counters advance in the right half, H counters in the left one */
+        for (j = 0; j < g; j++) {
+            gost89_mgm_put(t + j * 2, mgm->y);
+            mgm->y = (mgm->y & 0xFFFFFFFF00000000ULL) | (uint32_t)(mgm->y + 1);
+        }
+        for (j = 0; j < n; j++) {
+            gost89_mgm_put(t + (g + j) * 2, mgm->z);
+            mgm->z += (uint64_t)1 << 32;
+        }
+
+        gost89_encrypt_blocks(mgm->ctx, t, t, g + n);
+
+        for (j = 0; j < n; j++) {
+            offset = (i + j) * 8;
+            len = size - offset < 8 ? size - offset : 8;
+
+            /* A partial last block is padded with zeros on the right */
+            if (len == 8) {
+                p = gost89_magma_load64(in + offset);
+                mask = ~(uint64_t)0;
+            } else {
+                memset(last, 0, sizeof(last));
+                memcpy(last, in + offset, len);
+                p = gost89_magma_load64(last);
+                mask = ~(~(uint64_t)0 >> len * 8);
+            }
+
+            h[j] = gost89_mgm_get(t + (g + j) * 2);
+
+            if (op == GOST89_MGM_AAD) {
+                x[j] = p;
+                continue;
+            }
+
+            c = (p ^ gost89_mgm_get(t + j * 2)) & mask;
+            x[j] = op == GOST89_MGM_ENCRYPT ? c : p;
+
+            if (len == 8) {
+                gost89_magma_store64(c, out + offset);
+            } else {
+                gost89_magma_store64(c, last);
+                memcpy(out + offset, last, len);
+            }
+        }
+
+        gost89_mgm_add(mgm, h, x, n);
+    }
+}
+
+void gost89_mgm_aad(gost89_mgm_context *mgm, void *data, unsigned size) {
+    gost89_mgm_blocks(mgm, (const uint8_t*)data, NULL, size, GOST89_MGM_AAD);
+    mgm->aad_size += size;
+}
+
+void gost89_mgm_encrypt(gost89_mgm_context *mgm, void *plain, void *encrypted, unsigned size) {
+    gost89_mgm_blocks(mgm, (const uint8_t*)plain, (uint8_t*)encrypted, size, GOST89_MGM_ENCRYPT);
+    mgm->text_size += size;
+}
+
+void gost89_mgm_decrypt(gost89_mgm_context *mgm, void *encrypted, void *plain, unsigned size) {
+    gost89_mgm_blocks(mgm, (const uint8_t*)encrypted, (uint8_t*)plain, size, GOST89_MGM_DECRYPT);
+    mgm->text_size += size;
+}
+
+/* Lengths are in bits, 32 bits each, so A and C are limited to 512 MB each */
+void gost89_mgm_final(gost89_mgm_context *mgm, uint8_t *tag) {
+    uint64_t h, l = mgm->aad_size * 8 << 32 | (uint32_t)(mgm->text_size * 8);
+    uint32_t t[2];
+
+    gost89_mgm_put(t, mgm->z);
+    gost89_encrypt_blocks(mgm->ctx, t, t, 1);
+    h = gost89_mgm_get(t);
+
+    gost89_mgm_add(mgm, &h, &l, 1);
+
+    gost89_mgm_put(t, mgm->sum);
+    gost89_encrypt_blocks(mgm->ctx, t, t, 1);
+    gost89_magma_store64(gost89_mgm_get(t), tag);
+}
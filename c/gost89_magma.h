@@ -0,0 +1,77 @@
+#ifndef GOST89_MAGMA_H_
+#define GOST89_MAGMA_H_
+
+#include <stdint.h>
+
+#include "gost89.h"
+
+/*
+ * GOST R 34.12-2015 "Magma" and the GOST R 34.13-2015 modes for it.
+ *
+ * Magma is the 28147-89 cipher with the id-tc26-gost-28147-param-Z S-box,
+ * big-endian keys and big-endian blocks. These functions work on a regular
+ * gost89_context prepared with gost89_magma_set_sbox and gost89_magma_set_key
+ * and share the block kernels with gost89.c; data is byte-swapped on the way
+ * in and out.
+ *
+ * CTR takes its 32-bit IV from ctx->iv[0]. Messages may end with a partial
+ * block, but every call except the last one must be a multiple of 8 bytes.
+ * With gost89_magma_set_acpkm the key is replaced by ACPKM (R 1323565.1.017,
+ * RFC 8645) at the start of every section.
+ *
+ * OMAC keeps its chaining value in ctx->mac: gost89_magma_omac takes whole
+ * blocks, gost89_magma_omac_final takes the rest of the message, including
+ * its last block, and leaves the tag in ctx->mac (ctx->mac[1] holds its
+ * first four bytes).
+ */
+
+/*
+ * Multilinear Galois Mode (RFC 9058) for Magma.
+ *
+ * The nonce is eight bytes; its most significant bit is ignored. Associated
+ * data is passed before the text, and every call except the last one of
+ * each kind must be a multiple of 8 bytes. Both are limited to
+ * GOST89_MGM_MAX_SIZE bytes, their lengths are hashed as 32-bit bit counts.
+ * The GF(2^64) multiplications use PCLMULQDQ when the CPU has it (clmul may
+ * be cleared after gost89_mgm_init to force the portable code).
+ */
+#define GOST89_MGM_MAX_SIZE 0x1FFFFFFFu
+
+typedef struct gost89_mgm_context {
+    gost89_context *ctx;
+    uint64_t y;
+    uint64_t z;
+    uint64_t sum;
+    uint64_t aad_size;
+    uint64_t text_size;
+    int clmul;
+} gost89_mgm_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void gost89_magma_set_sbox(gost89_context *ctx);
+extern void gost89_magma_set_key(gost89_context *ctx, void *key);
+extern void gost89_magma_set_acpkm(gost89_context *ctx, unsigned section);
+extern void gost89_magma_acpkm(gost89_context *ctx);
+extern void gost89_magma_encrypt(gost89_context *ctx, void *plain, void *encrypted);
+extern void gost89_magma_decrypt(gost89_context *ctx, void *encrypted, void *plain);
+extern void gost89_magma_encrypt_ecb(gost89_context *ctx, void *plain, void *encrypted, unsigned size);
+extern void gost89_magma_decrypt_ecb(gost89_context *ctx, void *encrypted, void *plain, unsigned size);
+extern void gost89_magma_init_ctr(gost89_context *ctx);
+extern void gost89_magma_encrypt_ctr(gost89_context *ctx, void *plain, void *encrypted, unsigned size);
+extern void gost89_magma_omac(gost89_context *ctx, void *plain, unsigned size);
+extern void gost89_magma_omac_final(gost89_context *ctx, void *plain, unsigned size);
+extern void gost89_magma_get_mac(gost89_context *ctx, uint8_t *mac);
+extern void gost89_mgm_init(gost89_mgm_context *mgm, gost89_context *ctx, void *nonce);
+extern void gost89_mgm_aad(gost89_mgm_context *mgm, void *data, unsigned size);
+extern void gost89_mgm_encrypt(gost89_mgm_context *mgm, void *plain, void *encrypted, unsigned size);
+extern void gost89_mgm_decrypt(gost89_mgm_context *mgm, void *encrypted, void *plain, unsigned size);
+extern void gost89_mgm_final(gost89_mgm_context *mgm, uint8_t *tag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOST89_MAGMA_H_ */
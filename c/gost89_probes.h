@@ -0,0 +1,47 @@
+#ifndef GOST89_PROBES_H_
+#define GOST89_PROBES_H_
+
+/*
+ * USDT (statically defined tracing) probes of provider "gost89".
+ *
+ * With <sys/sdt.h> (systemtap-sdt-dev) available at build time every probe
+ * is a single nop plus a note in the binary, until a tracer attaches:
+ *
+ *     bpftrace -l 'usdt:./gost_file:gost89:*'
+ *     bpftrace -e 'usdt:./gost_file:gost89:mode_entry { @t[tid] = nsecs; }
+ *                  usdt:./gost_file:gost89:mode_return /@t[tid]/ {
+ *                      @ns[arg1] = hist(nsecs - @t[tid]); delete(@t[tid]); }'
+ *
+ * Without it, or with GOST89_NO_PROBES defined, the probes compile to nothing.
+ *
+ * Library probes (gost89.c):
+ *     set_sbox(ctx)
+ *     set_key(ctx)
+ *     key_meshing(ctx)
+ *     mode_entry(ctx, mode, size), mode_return(ctx, mode, size)
+ *         around every mode function, mode being a GOST89_MODE_* value
+ *
+ * gost_file, per chunk of File::encrypt and File::decrypt:
+ *     read_start(offset, length), read_done(offset, length)
+ *     transform_start(offset, length), transform_done(offset, length)
+ *     write_start(offset, length), write_done(offset, length)
+ */
+
+#if !defined(GOST89_NO_PROBES) && defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define GOST89_HAVE_PROBES 1
+    #endif
+#endif
+
+#ifdef GOST89_HAVE_PROBES
+    #define GOST89_PROBE1(name, a) DTRACE_PROBE1(gost89, name, a)
+    #define GOST89_PROBE2(name, a, b) DTRACE_PROBE2(gost89, name, a, b)
+    #define GOST89_PROBE3(name, a, b, c) DTRACE_PROBE3(gost89, name, a, b, c)
+#else
+    #define GOST89_PROBE1(name, a) ((void)0)
+    #define GOST89_PROBE2(name, a, b) ((void)0)
+    #define GOST89_PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#endif /* GOST89_PROBES_H_ */
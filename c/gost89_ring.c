@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "gost89.h"
+#include "gost89_ring.h"
+
+#define GOST89_RING_BATCH 64
+
+static void xor_keystream(uint8_t *out, const uint8_t *in, const uint8_t *keystream, unsigned size) {
+    unsigned i;
+    uint64_t a, b;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&a, in + i, 8);
+        memcpy(&b, keystream + i, 8);
+        a ^= b;
+        memcpy(out + i, &a, 8);
+    }
+
+    for (; i < size; i++) {
+        out[i] = in[i] ^ keystream[i];
+    }
+}
+
+int gost89_ctr_ring_init(gost89_ctr_ring *ring, gost89_context *ctx, unsigned blocks) {
+    memset(ring, 0, sizeof(*ring));
+
+    ring->keystream = (uint32_t*)malloc((size_t)blocks * 2 * sizeof(uint32_t));
+    if (!ring->keystream) {
+        return 0;
+    }
+    /* First touch on the consumer's thread puts the pages on its NUMA node */
+    memset(ring->keystream, 0, (size_t)blocks * 8);
+
+    ring->ctx = ctx;
+    ring->producer = *ctx;
+    ring->blocks = blocks;
+    ring->batch = blocks < GOST89_RING_BATCH ? blocks : GOST89_RING_BATCH;
+
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+
+    return 1;
+}
+
+void gost89_ctr_ring_free(gost89_ctr_ring *ring) {
+    gost89_ctr_ring_stop(ring);
+
+    pthread_cond_destroy(&ring->cond);
+    pthread_mutex_destroy(&ring->lock);
+
+    free(ring->keystream);
+    ring->keystream = NULL;
+}
+
+/* Produces up to blocks keystream blocks outside the lock; only one producer runs at a time */
+static unsigned ring_produce(gost89_ctr_ring *ring, unsigned blocks) {
+    unsigned start, n;
+
+    pthread_mutex_lock(&ring->lock);
+
+    n = ring->blocks - (unsigned)(ring->head - ring->tail);
+    start = (unsigned)(ring->head % ring->blocks);
+
+    if (n > ring->blocks - start) {
+        n = ring->blocks - start;
+    }
+    if (n > blocks) {
+        n = blocks;
+    }
+    if (ring->reserved || !n) {
+        pthread_mutex_unlock(&ring->lock);
+        return 0;
+    }
+
+    ring->reserved = n;
+    ring->producer.iv[0] = ring->ctx->iv[0];
+    ring->producer.iv[1] = ring->ctx->iv[1];
+    /* With key meshing the key changes along the counter as well */
+    memcpy(ring->producer.key, ring->ctx->key, sizeof(ring->producer.key));
+    ring->producer.mesh_count = ring->ctx->mesh_count;
+
+    pthread_mutex_unlock(&ring->lock);
+
+    memset(ring->keystream + start * 2, 0, n * 8);
+    gost89_encrypt_ctr(&ring->producer, ring->keystream + start * 2, ring->keystream + start * 2, n * 8);
+
+    pthread_mutex_lock(&ring->lock);
+
+    ring->ctx->iv[0] = ring->producer.iv[0];
+    ring->ctx->iv[1] = ring->producer.iv[1];
+    memcpy(ring->ctx->key, ring->producer.key, sizeof(ring->ctx->key));
+    ring->ctx->mesh_count = ring->producer.mesh_count;
+    ring->head += n;
+    ring->reserved = 0;
+
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+
+    return n;
+}
+
+unsigned gost89_ctr_ring_fill(gost89_ctr_ring *ring, unsigned blocks) {
+    unsigned n, total = 0;
+
+    while (total < blocks && (n = ring_produce(ring, blocks - total)) > 0) {
+        total += n;
+    }
+
+    return total;
+}
+
+static void *ring_thread(void *arg) {
+    gost89_ctr_ring *ring = (gost89_ctr_ring*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&ring->lock);
+        /* A fill on another thread holds the ring until ring_produce clears reserved and signals */
+        while (!ring->stop && (ring->reserved || ring->head - ring->tail == ring->blocks)) {
+            pthread_cond_wait(&ring->cond, &ring->lock);
+        }
+        if (ring->stop) {
+            pthread_mutex_unlock(&ring->lock);
+            break;
+        }
+        pthread_mutex_unlock(&ring->lock);
+
+        ring_produce(ring, ring->batch);
+    }
+
+    return NULL;
+}
+
+int gost89_ctr_ring_start(gost89_ctr_ring *ring) {
+    if (ring->running) {
+        return 1;
+    }
+
+    ring->stop = 0;
+    if (pthread_create(&ring->thread, NULL, ring_thread, ring)) {
+        return 0;
+    }
+
+    ring->running = 1;
+
+    return 1;
+}
+
+void gost89_ctr_ring_stop(gost89_ctr_ring *ring) {
+    if (!ring->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    ring->stop = 1;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+
+    pthread_join(ring->thread, NULL);
+    ring->running = 0;
+}
+
+unsigned gost89_ctr_ring_available(gost89_ctr_ring *ring) {
+    unsigned n;
+
+    pthread_mutex_lock(&ring->lock);
+    n = (unsigned)(ring->head - ring->tail);
+    pthread_mutex_unlock(&ring->lock);
+
+    return n;
+}
+
+/*
+ * Same output as gost89_encrypt_ctr on the ring's context. A trailing
+ * partial block consumes a whole keystream block and only its bytes are
+ * written.
+ */
+void gost89_ctr_ring_encrypt(gost89_ctr_ring *ring, void *plain, void *encrypted, unsigned size) {
+    uint8_t *in = (uint8_t*)plain, *out = (uint8_t*)encrypted;
+    uint8_t t[8];
+    unsigned need = (size + 7) / 8, n, start, bytes;
+
+    while (need) {
+        pthread_mutex_lock(&ring->lock);
+
+        while (ring->head == ring->tail && ring->reserved) {
+            pthread_cond_wait(&ring->cond, &ring->lock);
+        }
+
+        n = (unsigned)(ring->head - ring->tail);
+
+        if (!n) {
+            /* Ring is dry and no blocks are in flight: continue the counter inline */
+            bytes = size & ~7u;
+            gost89_encrypt_ctr(ring->ctx, in, out, bytes);
+
+            if (bytes < size) {
+                memset(t, 0, sizeof(t));
+                gost89_encrypt_ctr(ring->ctx, t, t, sizeof(t));
+                xor_keystream(out + bytes, in + bytes, t, size - bytes);
+            }
+
+            ring->head += need;
+            ring->tail += need;
+
+            pthread_mutex_unlock(&ring->lock);
+            return;
+        }
+
+        start = (unsigned)(ring->tail % ring->blocks);
+        if (n > ring->blocks - start) {
+            n = ring->blocks - start;
+        }
+        if (n > need) {
+            n = need;
+        }
+
+        pthread_mutex_unlock(&ring->lock);
+
+        bytes = n * 8 < size ? n * 8 : size;
+        xor_keystream(out, in, (uint8_t*)(ring->keystream + start * 2), bytes);
+
+        in += bytes;
+        out += bytes;
+        size -= bytes;
+        need -= n;
+
+        pthread_mutex_lock(&ring->lock);
+        ring->tail += n;
+        pthread_cond_broadcast(&ring->cond);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
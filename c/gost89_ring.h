@@ -0,0 +1,52 @@
+#ifndef GOST89_RING_H_
+#define GOST89_RING_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "gost89.h"
+
+/*
+ * CTR keystream produced ahead of use.
+ *
+ * The ring holds keystream blocks for the counter values following ctx->iv.
+ * It is filled either explicitly (gost89_ctr_ring_fill, e.g. while idle) or
+ * by a background thread (gost89_ctr_ring_start), and encryption XORs the
+ * data against it. When the ring runs dry the remaining blocks are generated
+ * inline, so the output is always identical to gost89_encrypt_ctr.
+ * The keystream is first touched by gost89_ctr_ring_init, placing it with
+ * the consumer, and the thread inherits the starting thread's CPU affinity.
+ */
+typedef struct gost89_ctr_ring {
+    gost89_context *ctx;
+    gost89_context producer;
+    uint32_t *keystream;
+    unsigned blocks;
+    unsigned batch;
+    uint64_t head;
+    uint64_t tail;
+    unsigned reserved;
+    int running;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} gost89_ctr_ring;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int gost89_ctr_ring_init(gost89_ctr_ring *ring, gost89_context *ctx, unsigned blocks);
+extern void gost89_ctr_ring_free(gost89_ctr_ring *ring);
+extern unsigned gost89_ctr_ring_fill(gost89_ctr_ring *ring, unsigned blocks);
+extern int gost89_ctr_ring_start(gost89_ctr_ring *ring);
+extern void gost89_ctr_ring_stop(gost89_ctr_ring *ring);
+extern unsigned gost89_ctr_ring_available(gost89_ctr_ring *ring);
+extern void gost89_ctr_ring_encrypt(gost89_ctr_ring *ring, void *plain, void *encrypted, unsigned size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOST89_RING_H_ */
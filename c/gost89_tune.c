@@ -0,0 +1,433 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+    #include <sys/stat.h>
+    #include <sys/types.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <cpuid.h>
+    #define HAVE_CPUID 1
+#endif
+
+#include "gost89.h"
+#include "gost89_tune.h"
+
+#define GOST89_TUNE_BUFFER 65536
+#define GOST89_TUNE_TIME 2000000    /* ns per measurement */
+#define GOST89_TUNE_REPEATS 3
+#define GOST89_TUNE_MARGIN 1.02     /* a candidate must beat the default by 2% */
+#define GOST89_TUNE_LINE 512
+
+static const char *gost89_tune_modes[GOST89_MODE_COUNT] = {
+    "ecb-enc",
+    "ecb-dec",
+    "ctr",
+    "cfb-enc",
+    "cfb-dec",
+    "cbc-enc",
+    "cbc-dec",
+    "mac"
+};
+
+static const unsigned gost89_tune_batches[] = {8, 16, 32, 64, 128, 256};
+
+static char gost89_tune_path[1024];
+
+const char *gost89_tune_mode_name(int mode) {
+    if (mode < 0 || mode >= GOST89_MODE_COUNT) {
+        return NULL;
+    }
+
+    return gost89_tune_modes[mode];
+}
+
+static int gost89_tune_mode_by_name(const char *name) {
+    int i;
+
+    for (i = 0; i < GOST89_MODE_COUNT; i++) {
+        if (!strcmp(name, gost89_tune_modes[i])) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Only the batched modes have a batch size worth tuning */
+static int gost89_tune_batched(int mode) {
+    return mode == GOST89_MODE_CTR || mode == GOST89_MODE_CFB_DECRYPT || mode == GOST89_MODE_CBC_DECRYPT;
+}
+
+static uint64_t gost89_tune_now() {
+#ifdef _WIN32
+    return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Tabs and line breaks would break the cache format */
+static void gost89_tune_clean(char *s) {
+    char *end;
+
+    for (end = s; *end; end++) {
+        if (*end == '\t' || *end == '\r' || *end == '\n') {
+            *end = ' ';
+        }
+    }
+
+    while (end > s && end[-1] == ' ') {
+        *--end = 0;
+    }
+}
+
+void gost89_tune_cpu_model(char *model, unsigned size) {
+    char line[GOST89_TUNE_LINE], *p;
+    FILE *f;
+#ifdef HAVE_CPUID
+    unsigned regs[12];
+    int i;
+#endif
+
+    strncpy(model, "unknown", size);
+    model[size - 1] = 0;
+
+    f = fopen("/proc/cpuinfo", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            if (!strncmp(line, "model name", 10) && (p = strchr(line, ':')) != NULL) {
+                for (p++; *p == ' '; p++) {
+                }
+                strncpy(model, p, size);
+                model[size - 1] = 0;
+                gost89_tune_clean(model);
+                fclose(f);
+                return;
+            }
+        }
+        fclose(f);
+    }
+
+#ifdef HAVE_CPUID
+    if (__get_cpuid_max(0x80000000, NULL) >= 0x80000004) {
+        for (i = 0; i < 3; i++) {
+            __get_cpuid(0x80000002 + i, &regs[i * 4], &regs[i * 4 + 1], &regs[i * 4 + 2], &regs[i * 4 + 3]);
+        }
+        memcpy(line, regs, sizeof(regs));
+        line[sizeof(regs)] = 0;
+        for (p = line; *p == ' '; p++) {
+        }
+        strncpy(model, p, size);
+        model[size - 1] = 0;
+        gost89_tune_clean(model);
+    }
+#endif
+}
+
+const char *gost89_tune_cache_path() {
+    const char *env;
+
+    env = getenv("GOST89_TUNE_CACHE");
+    if (env && *env) {
+        if (!strcmp(env, "off")) {
+            return NULL;
+        }
+        snprintf(gost89_tune_path, sizeof(gost89_tune_path), "%s", env);
+        return gost89_tune_path;
+    }
+
+    env = getenv("XDG_CACHE_HOME");
+    if (env && *env) {
+        snprintf(gost89_tune_path, sizeof(gost89_tune_path), "%s/gost89.tune", env);
+        return gost89_tune_path;
+    }
+
+    env = getenv("HOME");
+    if (env && *env) {
+        snprintf(gost89_tune_path, sizeof(gost89_tune_path), "%s/.cache/gost89.tune", env);
+        return gost89_tune_path;
+    }
+
+    return NULL;
+}
+
+static void gost89_tune_call(gost89_context *ctx, int mode, uint8_t *buffer) {
+    switch (mode) {
+        case GOST89_MODE_ECB_ENCRYPT:
+            gost89_encrypt_ecb(ctx, buffer, buffer, GOST89_TUNE_BUFFER);
+            break;
+        case GOST89_MODE_ECB_DECRYPT:
+            gost89_decrypt_ecb(ctx, buffer, buffer, GOST89_TUNE_BUFFER);
+            break;
+        case GOST89_MODE_CTR:
+            gost89_encrypt_ctr(ctx, buffer, buffer, GOST89_TUNE_BUFFER);
+            break;
+        case GOST89_MODE_CFB_ENCRYPT:
+            gost89_encrypt_cfb(ctx, buffer, buffer, GOST89_TUNE_BUFFER);
+            break;
+        case GOST89_MODE_CFB_DECRYPT:
+            gost89_decrypt_cfb(ctx, buffer, buffer, GOST89_TUNE_BUFFER);
+            break;
+        case GOST89_MODE_CBC_ENCRYPT:
+            gost89_encrypt_cbc(ctx, buffer, buffer, GOST89_TUNE_BUFFER);
+            break;
+        case GOST89_MODE_CBC_DECRYPT:
+            gost89_decrypt_cbc(ctx, buffer, buffer, GOST89_TUNE_BUFFER);
+            break;
+        case GOST89_MODE_MAC:
+            gost89_mac(ctx, buffer, GOST89_TUNE_BUFFER);
+            break;
+    }
+}
+
+/* Best of a few timed runs, in MB/s; the candidate is installed as the mode's tuning meanwhile */
+static double gost89_tune_measure(gost89_context *ctx, int mode, int kernel, unsigned batch, uint8_t *buffer) {
+    uint64_t start, elapsed, bytes;
+    double speed, best = 0;
+    int r;
+
+    gost89_set_mode_tuning(mode, kernel, batch);
+    gost89_tune_call(ctx, mode, buffer);
+
+    for (r = 0; r < GOST89_TUNE_REPEATS; r++) {
+        bytes = 0;
+        start = gost89_tune_now();
+        do {
+            gost89_tune_call(ctx, mode, buffer);
+            bytes += GOST89_TUNE_BUFFER;
+            elapsed = gost89_tune_now() - start;
+        } while (elapsed < GOST89_TUNE_TIME);
+
+        speed = bytes * 1e3 / elapsed;
+        if (speed > best) {
+            best = speed;
+        }
+    }
+
+    return best;
+}
+
+void gost89_tune_run(gost89_tune_result *result) {
+    static uint8_t sbox[8][16];
+    gost89_context ctx;
+    uint8_t *buffer, key[32];
+    unsigned b, batch, nbatches;
+    int mode, kernel, i;
+    double speed;
+
+    memset(result, 0, sizeof(*result));
+    gost89_tune_cpu_model(result->model, sizeof(result->model));
+
+    buffer = (uint8_t*)malloc(GOST89_TUNE_BUFFER);
+    if (!buffer) {
+        return;
+    }
+
+    for (i = 0; i < 128; i++) {
+        sbox[i / 16][i % 16] = (uint8_t)((i * 7 + i / 16) % 16);
+    }
+    for (i = 0; i < 32; i++) {
+        key[i] = (uint8_t)(i * 29 + 1);
+    }
+    for (i = 0; i < GOST89_TUNE_BUFFER; i++) {
+        buffer[i] = (uint8_t)i;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    gost89_set_sbox(&ctx, sbox);
+    gost89_set_key(&ctx, key);
+
+    for (mode = 0; mode < GOST89_MODE_COUNT; mode++) {
+        nbatches = gost89_tune_batched(mode) ? sizeof(gost89_tune_batches) / sizeof(gost89_tune_batches[0]) : 1;
+
+        /* The built-in default first, so that noise does not replace it with an equal choice */
+        result->kernel[mode] = GOST89_KERNEL_SBOX8_X4;
+        result->batch[mode] = 0;
+        result->speed[mode] = gost89_tune_measure(&ctx, mode, GOST89_KERNEL_SBOX8_X4, 0, buffer);
+
+        for (kernel = GOST89_KERNEL_SBOX4; kernel < GOST89_KERNEL_COUNT; kernel++) {
+            for (b = 0; b < nbatches; b++) {
+                batch = gost89_tune_batched(mode) ? gost89_tune_batches[b] : 0;
+                speed = gost89_tune_measure(&ctx, mode, kernel, batch, buffer);
+                if (speed > result->speed[mode] * GOST89_TUNE_MARGIN) {
+                    result->kernel[mode] = kernel;
+                    result->batch[mode] = batch;
+                    result->speed[mode] = speed;
+                }
+            }
+        }
+
+        gost89_set_mode_tuning(mode, GOST89_KERNEL_AUTO, 0);
+    }
+
+    free(buffer);
+}
+
+/* Parses one cache line into model, mode, kernel and batch; returns 0 if it is malformed */
+static int gost89_tune_parse(char *line, char **model, int *mode, int *kernel, unsigned *batch) {
+    char *fields[4], *p = line;
+    int i;
+
+    line[strcspn(line, "\r\n")] = 0;
+
+    for (i = 0; i < 4; i++) {
+        fields[i] = p;
+        p = strchr(p, '\t');
+        if (i < 3) {
+            if (!p) {
+                return 0;
+            }
+            *p++ = 0;
+        }
+    }
+
+    *model = fields[0];
+    *mode = gost89_tune_mode_by_name(fields[1]);
+    *kernel = gost89_kernel_by_name(fields[2]);
+    *batch = (unsigned)strtoul(fields[3], NULL, 10);
+
+    return *mode >= 0 && *kernel > GOST89_KERNEL_AUTO;
+}
+
+/* Returns 1 if the cache has every mode for this CPU */
+int gost89_tune_load(const char *path, gost89_tune_result *result) {
+    char line[GOST89_TUNE_LINE], *model;
+    int mode, kernel, found = 0;
+    unsigned batch;
+    FILE *f;
+
+    memset(result, 0, sizeof(*result));
+    gost89_tune_cpu_model(result->model, sizeof(result->model));
+
+    f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || !gost89_tune_parse(line, &model, &mode, &kernel, &batch)) {
+            continue;
+        }
+        if (strcmp(model, result->model)) {
+            continue;
+        }
+
+        if (!result->kernel[mode]) {
+            found++;
+        }
+        result->kernel[mode] = kernel;
+        result->batch[mode] = batch;
+    }
+
+    fclose(f);
+
+    return found == GOST89_MODE_COUNT;
+}
+
+/* Replaces the lines of this CPU and keeps the others; the file is replaced by rename */
+int gost89_tune_save(const char *path, const gost89_tune_result *result) {
+    char line[GOST89_TUNE_LINE], copy[GOST89_TUNE_LINE], tmp[1100], dir[1024], *model, *slash;
+    int mode, kernel, ok;
+    unsigned batch;
+    FILE *in, *out;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = 0;
+#ifndef _WIN32
+        mkdir(dir, 0755);
+#endif
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    out = fopen(tmp, "w");
+    if (!out) {
+        return 0;
+    }
+
+    fprintf(out, "# gost89 tuning cache: cpu model, mode, kernel, batch\n");
+
+    in = fopen(path, "r");
+    if (in) {
+        while (fgets(line, sizeof(line), in)) {
+            memcpy(copy, line, sizeof(copy));
+            if (line[0] == '#' || !gost89_tune_parse(copy, &model, &mode, &kernel, &batch)) {
+                continue;
+            }
+            if (strcmp(model, result->model)) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+
+    for (mode = 0; mode < GOST89_MODE_COUNT; mode++) {
+        fprintf(out, "%s\t%s\t%s\t%u\n", result->model, gost89_tune_modes[mode],
+                gost89_kernel_name(result->kernel[mode]), result->batch[mode]);
+    }
+
+    ok = !ferror(out);
+    ok &= !fclose(out);
+
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (!ok || rename(tmp, path)) {
+        remove(tmp);
+        return 0;
+    }
+
+    return 1;
+}
+
+void gost89_tune_apply(const gost89_tune_result *result) {
+    int mode;
+
+    for (mode = 0; mode < GOST89_MODE_COUNT; mode++) {
+        gost89_set_mode_tuning(mode, result->kernel[mode], result->batch[mode]);
+    }
+}
+
+/* Applies the cached result, tuning and saving first if there is none or retune is set; returns 1 if it tuned */
+int gost89_tune_init(int retune, gost89_tune_result *result) {
+    const char *path = gost89_tune_cache_path();
+
+    if (!retune && path && gost89_tune_load(path, result)) {
+        gost89_tune_apply(result);
+        return 0;
+    }
+
+    gost89_tune_run(result);
+    gost89_tune_apply(result);
+
+    if (path) {
+        gost89_tune_save(path, result);
+    }
+
+    return 1;
+}
+
+#ifdef __GNUC__
+__attribute__((constructor)) static void gost89_tune_startup() {
+    gost89_tune_result result;
+    const char *path = gost89_tune_cache_path();
+
+    if (path && gost89_tune_load(path, &result)) {
+        gost89_tune_apply(&result);
+    }
+}
+#endif
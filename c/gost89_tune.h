@@ -0,0 +1,53 @@
+#ifndef GOST89_TUNE_H_
+#define GOST89_TUNE_H_
+
+#include "gost89.h"
+
+/*
+ * Kernel and batch size autotuning.
+ *
+ * gost89_tune_run times every kernel, and for the batched modes (CTR, CFB
+ * and CBC decryption) every batch size, of each mode function on this host
+ * and keeps the fastest. Results are cached in a text file keyed by the CPU
+ * model, one line per model and mode, so a cache shared by a mixed fleet
+ * holds an entry for each model:
+ *
+ *     <cpu model> TAB <mode> TAB <kernel> TAB <batch>
+ *
+ * gost89_tune_apply hands a result to gost89_set_mode_tuning, after which
+ * contexts on GOST89_KERNEL_AUTO use it. When gost89_tune.c is linked in,
+ * the cache entry of this CPU, if any, is applied at startup. Like the
+ * setting itself, tuning and applying are meant for process startup,
+ * before contexts are in use by other threads.
+ *
+ * The cache is GOST89_TUNE_CACHE if set ("off" disables it), otherwise
+ * $XDG_CACHE_HOME/gost89.tune or ~/.cache/gost89.tune.
+ */
+
+#define GOST89_TUNE_MODEL_SIZE 128
+
+typedef struct gost89_tune_result {
+    char model[GOST89_TUNE_MODEL_SIZE];
+    int kernel[GOST89_MODE_COUNT];
+    unsigned batch[GOST89_MODE_COUNT];
+    double speed[GOST89_MODE_COUNT];    /* MB/s of the choice, 0 when loaded from the cache */
+} gost89_tune_result;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const char *gost89_tune_mode_name(int mode);
+extern void gost89_tune_cpu_model(char *model, unsigned size);
+extern const char *gost89_tune_cache_path();
+extern void gost89_tune_run(gost89_tune_result *result);
+extern int gost89_tune_load(const char *path, gost89_tune_result *result);
+extern int gost89_tune_save(const char *path, const gost89_tune_result *result);
+extern void gost89_tune_apply(const gost89_tune_result *result);
+extern int gost89_tune_init(int retune, gost89_tune_result *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOST89_TUNE_H_ */
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include "gost89.h"
+#include "gost89_async.hpp"
+
+static uint8_t test_sbox[8][16] = {
+    {4, 10, 9, 2, 13, 8, 0, 14, 6, 11, 1, 12, 7, 15, 5, 3},
+    {14, 11, 4, 12, 6, 13, 15, 10, 2, 3, 8, 1, 0, 7, 5, 9},
+    {5, 8, 1, 13, 10, 3, 4, 2, 14, 15, 12, 7, 6, 0, 9, 11},
+    {7, 13, 10, 1, 0, 8, 9, 15, 14, 4, 6, 12, 11, 2, 5, 3},
+    {6, 12, 7, 1, 5, 15, 13, 8, 4, 10, 9, 14, 0, 3, 11, 2},
+    {4, 11, 10, 0, 7, 2, 1, 13, 3, 6, 8, 5, 9, 12, 15, 14},
+    {13, 11, 4, 1, 3, 15, 5, 9, 0, 10, 14, 7, 6, 8, 2, 12},
+    {1, 15, 13, 0, 5, 7, 10, 4, 9, 2, 3, 14, 6, 11, 8, 12}
+};
+
+static char *test_key = (char*)"01234567890123456789012345678912";
+static char *test_iv = (char*)"\xFF\x00\x00\x00\x00\x00\x00\x00";
+
+/* Coroutine that starts at once and is not awaited */
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return Detached(); }
+        std::suspend_never initial_suspend() { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static gost89_context base;
+static std::atomic<int> pending;
+
+static void init_base() {
+    memset(&base, 0, sizeof(base));
+    gost89_set_sbox(&base, test_sbox);
+    gost89_set_key(&base, test_key);
+    gost89_set_iv(&base, test_iv);
+    gost89_set_key_meshing(&base, 1);
+}
+
+static void fill(std::vector<uint8_t> &data) {
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 13 + 7);
+    }
+}
+
+static void done(gost89::EventLoop &loop) {
+    if (--pending == 0) {
+        loop.stop();
+    }
+}
+
+/* Every mode against one library call, with a size that leaves a partial last chunk */
+static Detached modes(gost89::EventLoop &loop, int *ok) {
+    static const gost89::AsyncMode list[] = {gost89::ASYNC_ECB, gost89::ASYNC_CTR, gost89::ASYNC_CFB, gost89::ASYNC_CBC};
+    std::vector<uint8_t> plain(300 * 1024 + 3), expected(plain.size()), encrypted(plain.size());
+    std::thread::id loop_thread = std::this_thread::get_id();
+    gost89::AsyncOptions options;
+    gost89::AsyncResult r;
+    gost89_context ref, ctx;
+
+    fill(plain);
+    options.chunkSize = 64 * 1024 + 3;
+
+    for (gost89::AsyncMode mode : list) {
+        options.mode = mode;
+
+        ref = base;
+        ctx = base;
+        if (mode == gost89::ASYNC_CTR) {
+            gost89_init_ctr(&ref);
+            gost89_init_ctr(&ctx);
+        }
+
+        gost89::detail::modeFunc(mode, true)(&ref, plain.data(), expected.data(), plain.size());
+        r = co_await gost89::encrypt_async(&ctx, plain, encrypted, options);
+        *ok &= r.status == gost89::ASYNC_OK && r.size == plain.size();
+        *ok &= expected == encrypted && !memcmp(ref.iv, ctx.iv, sizeof(ref.iv));
+        *ok &= std::this_thread::get_id() == loop_thread;
+
+        if (mode == gost89::ASYNC_CTR) {
+            continue;
+        }
+
+        ctx = base;
+        r = co_await gost89::decrypt_async(&ctx, encrypted, encrypted, options);
+        *ok &= r.status == gost89::ASYNC_OK && !memcmp(plain.data(), encrypted.data(), plain.size() / 8 * 8);
+    }
+
+    ref = base;
+    ctx = base;
+    gost89_mac(&ref, plain.data(), plain.size());
+    r = co_await gost89::mac_async(&ctx, plain, options);
+    *ok &= r.status == gost89::ASYNC_OK && !memcmp(ref.mac, ctx.mac, sizeof(ref.mac));
+
+    done(loop);
+}
+
+/* Small operations complete without suspending */
+static Detached small(gost89::EventLoop &loop, int *ok) {
+    std::vector<uint8_t> data(1024);
+    gost89_context ctx = base;
+    gost89::AsyncResult r;
+
+    fill(data);
+    gost89_init_ctr(&ctx);
+
+    for (int i = 0; i < 100; i++) {
+        r = co_await gost89::encrypt_async(&ctx, data, data);
+        *ok &= r.status == gost89::ASYNC_OK && r.size == data.size();
+    }
+
+    done(loop);
+}
+
+/* A stop request lands between chunks; the context is left as after the reported size */
+static Detached cancel(gost89::EventLoop &loop, int *ok) {
+    std::vector<uint8_t> plain(4 << 20), expected(plain.size()), encrypted(plain.size());
+    gost89::AsyncOptions options;
+    gost89::AsyncResult r;
+    gost89_context ref, ctx;
+    std::stop_source source;
+
+    fill(plain);
+
+    options.stop = source.get_token();
+    options.chunkSize = 32 * 1024;
+    options.priority = gost89::ASYNC_BULK;
+
+    ctx = base;
+    gost89_init_ctr(&ctx);
+    ref = ctx;
+
+    loop.post([&source] { source.request_stop(); });
+    r = co_await gost89::encrypt_async(&ctx, plain, encrypted, options);
+    *ok &= r.status == gost89::ASYNC_CANCELLED && r.size < plain.size() && r.size % options.chunkSize == 0;
+
+    gost89_encrypt_ctr(&ref, plain.data(), expected.data(), r.size);
+    *ok &= !memcmp(expected.data(), encrypted.data(), r.size) && !memcmp(ref.iv, ctx.iv, sizeof(ref.iv));
+
+    r = co_await gost89::encrypt_async(&ctx, plain, encrypted, options);
+    *ok &= r.status == gost89::ASYNC_CANCELLED && r.size == 0;
+
+    done(loop);
+}
+
+/* More bulk operations than slots: the rest wait and all complete */
+static Detached bulk(gost89::EventLoop &loop, gost89::WorkerPool &pool, int *ok) {
+    std::vector<uint8_t> plain(1 << 20), expected(plain.size()), encrypted(plain.size());
+    gost89::AsyncOptions options;
+    gost89::AsyncResult r;
+    gost89_context ref = base, ctx = base;
+
+    fill(plain);
+
+    options.mode = gost89::ASYNC_CFB;
+    options.priority = gost89::ASYNC_BULK;
+    options.chunkSize = 64 * 1024;
+    options.pool = &pool;
+
+    gost89_encrypt_cfb(&ref, plain.data(), expected.data(), plain.size());
+    r = co_await gost89::encrypt_async(&ctx, plain, encrypted, options);
+    *ok &= r.status == gost89::ASYNC_OK && expected == encrypted;
+
+    done(loop);
+}
+
+/* Coroutines are started from the loop, so that they resume on it */
+void test_async() {
+    gost89::EventLoop loop;
+    int ok = 1;
+
+    init_base();
+
+    pending = 2;
+    loop.post([&] {
+        modes(loop, &ok);
+        small(loop, &ok);
+    });
+    loop.run();
+    printf("async modes: %s\n", ok ? "ok" : "FAIL");
+
+    ok = 1;
+    pending = 1;
+    loop.post([&] { cancel(loop, &ok); });
+    loop.run();
+    printf("async cancel: %s\n", ok ? "ok" : "FAIL");
+
+    ok = 1;
+    {
+        gost89::WorkerPool pool(2, 1);
+
+        pending = 4;
+        loop.post([&] {
+            for (int i = 0; i < 4; i++) {
+                bulk(loop, pool, &ok);
+            }
+            ok &= pool.bulkWaiting() == 3;
+        });
+        loop.run();
+    }
+    printf("async bulk: %s\n", ok ? "ok" : "FAIL");
+}
+
+int main(int argc, char **argv) {
+    test_async();
+
+    return 0;
+}
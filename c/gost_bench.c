@@ -0,0 +1,810 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define HAVE_RDTSC 1
+#endif
+
+#ifdef __linux__
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+    #define HAVE_PERF_EVENT 1
+#endif
+
+#include "gost89.h"
+#include "gost89_magma.h"
+#include "gost89_hash.h"
+#include "gost89_fast.h"
+
+#define MAX_THREADS 64
+#define MAX_REPEATS 1000
+
+static uint8_t bench_sbox[8][16] = {
+    {4, 10, 9, 2, 13, 8, 0, 14, 6, 11, 1, 12, 7, 15, 5, 3},
+    {14, 11, 4, 12, 6, 13, 15, 10, 2, 3, 8, 1, 0, 7, 5, 9},
+    {5, 8, 1, 13, 10, 3, 4, 2, 14, 15, 12, 7, 6, 0, 9, 11},
+    {7, 13, 10, 1, 0, 8, 9, 15, 14, 4, 6, 12, 11, 2, 5, 3},
+    {6, 12, 7, 1, 5, 15, 13, 8, 4, 10, 9, 14, 0, 3, 11, 2},
+    {4, 11, 10, 0, 7, 2, 1, 13, 3, 6, 8, 5, 9, 12, 15, 14},
+    {13, 11, 4, 1, 3, 15, 5, 9, 0, 10, 14, 7, 6, 8, 2, 12},
+    {1, 15, 13, 0, 5, 7, 10, 4, 9, 2, 3, 14, 6, 11, 8, 12},
+};
+
+static char *bench_key = "01234567890123456789012345678912";
+static char *bench_iv = "\xFF\x00\x00\x00\x00\x00\x00\x00";
+
+typedef void (*bench_func)(gost89_context *ctx, void *in, void *out, unsigned size);
+
+typedef struct bench_mode {
+    const char *name;
+    bench_func func;
+} bench_mode;
+
+static void bench_ctr(gost89_context *ctx, void *in, void *out, unsigned size) {
+    gost89_encrypt_ctr(ctx, in, out, size);
+}
+
+static void bench_mac(gost89_context *ctx, void *in, void *out, unsigned size) {
+    gost89_mac(ctx, in, size);
+}
+
+static void bench_ctr_mac(gost89_context *ctx, void *in, void *out, unsigned size) {
+    gost89_mac(ctx, in, size);
+    gost89_encrypt_ctr(ctx, in, out, size);
+}
+
+static void bench_magma_omac(gost89_context *ctx, void *in, void *out, unsigned size) {
+    gost89_magma_omac_final(ctx, in, size);
+}
+
+/* The digest runs on the S-box of ctx; it is longer than the smallest messages, so it is not written out */
+static void bench_hash(gost89_context *ctx, void *in, void *out, unsigned size) {
+    gost89_hash_context hash;
+    uint8_t digest[32];
+
+    gost89_hash_init(&hash, ctx);
+    gost89_hash_update(&hash, in, size);
+    gost89_hash_final(&hash, digest);
+}
+
+/* One MGM message per call: nonce setup, encryption and tag */
+static void bench_magma_mgm(gost89_context *ctx, void *in, void *out, unsigned size) {
+    gost89_mgm_context mgm;
+    uint8_t tag[8];
+
+    gost89_mgm_init(&mgm, ctx, ctx->iv);
+    gost89_mgm_encrypt(&mgm, in, out, size);
+    gost89_mgm_final(&mgm, tag);
+}
+
+static bench_mode bench_modes[] = {
+    {"ecb-enc", &gost89_encrypt_ecb},
+    {"ecb-dec", &gost89_decrypt_ecb},
+    {"ctr", &bench_ctr},
+    {"cfb-enc", &gost89_encrypt_cfb},
+    {"cfb-dec", &gost89_decrypt_cfb},
+    {"cbc-enc", &gost89_encrypt_cbc},
+    {"cbc-dec", &gost89_decrypt_cbc},
+    {"mac", &bench_mac},
+    {"ctr+mac", &bench_ctr_mac},
+    {"magma-ctr", &gost89_magma_encrypt_ctr},
+    {"magma-omac", &bench_magma_omac},
+    {"magma-mgm", &bench_magma_mgm},
+    {"hash-94", &bench_hash},
+    {NULL, NULL}
+};
+
+/* Hardware counters recorded with perf_event_open */
+#define PERF_CYCLES         0
+#define PERF_INSTRUCTIONS   1
+#define PERF_L1D_MISSES     2
+#define PERF_BRANCH_MISSES  3
+#define PERF_COUNT          4
+
+typedef struct perf_counters {
+    int fd[PERF_COUNT];
+    uint64_t value[PERF_COUNT];
+} perf_counters;
+
+static const char *perf_names[PERF_COUNT] = {
+    "cycles",
+    "instructions",
+    "l1d_misses",
+    "branch_misses"
+};
+
+typedef struct bench_options {
+    const char *modes;
+    int kernels[GOST89_KERNEL_COUNT];
+    int kernel_count;
+    int threads[MAX_THREADS];
+    int thread_count;
+    uint64_t min_size;
+    uint64_t max_size;
+    uint64_t budget;
+    int warmup;
+    int repeats;
+    int json;
+    int perf;
+    int key_meshing;
+    int counters;
+    int tokens;
+} bench_options;
+
+typedef struct bench_summary {
+    double median;
+    double p10;
+    double p90;
+} bench_summary;
+
+typedef struct bench_worker {
+    pthread_t thread;
+    gost89_context ctx;
+    bench_func func;
+    uint8_t *buffer;
+    uint64_t size;
+    uint64_t iterations;
+} bench_worker;
+
+static bench_options options;
+static int first_result = 1;
+static perf_counters perf;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t now_cycles() {
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+#ifdef HAVE_PERF_EVENT
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static int perf_init() {
+#ifdef HAVE_PERF_EVENT
+    int i;
+
+    perf.fd[PERF_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    perf.fd[PERF_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perf.fd[PERF_L1D_MISSES] = perf_open(PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D |
+        PERF_COUNT_HW_CACHE_OP_READ << 8 |
+        PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    perf.fd[PERF_BRANCH_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+    for (i = 0; i < PERF_COUNT; i++) {
+        if (perf.fd[i] < 0) {
+            fprintf(stderr, "Unable to open %s counter, hardware counters disabled\n", perf_names[i]);
+            while (i--) {
+                close(perf.fd[i]);
+            }
+            return 0;
+        }
+    }
+
+    return 1;
+#else
+    fprintf(stderr, "Hardware counters are not supported on this platform\n");
+    return 0;
+#endif
+}
+
+static void perf_start() {
+#ifdef HAVE_PERF_EVENT
+    int i;
+
+    for (i = 0; i < PERF_COUNT; i++) {
+        ioctl(perf.fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf.fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static void perf_stop() {
+#ifdef HAVE_PERF_EVENT
+    uint64_t data[3];
+    int i;
+
+    for (i = 0; i < PERF_COUNT; i++) {
+        ioctl(perf.fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    for (i = 0; i < PERF_COUNT; i++) {
+        perf.value[i] = 0;
+
+        /* value, time enabled, time running: scale if the counter was multiplexed */
+        if (read(perf.fd[i], data, sizeof(data)) == sizeof(data) && data[2]) {
+            perf.value[i] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+        }
+    }
+#endif
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static bench_summary summarize(double *samples, int n) {
+    bench_summary s;
+
+    qsort(samples, n, sizeof(double), compare_double);
+
+    s.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    s.p10 = samples[(n - 1) / 10];
+    s.p90 = samples[(n - 1) - (n - 1) / 10];
+
+    return s;
+}
+
+static void init_context(gost89_context *ctx, int kernel) {
+    memset(ctx, 0, sizeof(*ctx));
+
+    gost89_set_sbox(ctx, bench_sbox);
+    gost89_set_key(ctx, bench_key);
+    gost89_set_iv(ctx, bench_iv);
+    gost89_set_mac(ctx, NULL);
+    gost89_set_kernel(ctx, kernel);
+    gost89_set_key_meshing(ctx, options.key_meshing);
+    gost89_init_ctr(ctx);
+}
+
+static void *worker_run(void *arg) {
+    bench_worker *w = (bench_worker*)arg;
+    uint64_t i, offset, length;
+
+    for (i = 0; i < w->iterations; i++) {
+        /* Sizes above 4 GB do not fit the unsigned size argument */
+        for (offset = 0; offset < w->size; offset += length) {
+            length = w->size - offset;
+            if (length > 0x40000000) {
+                length = 0x40000000;
+            }
+
+            w->func(&w->ctx, w->buffer + offset, w->buffer + offset, (unsigned)length);
+        }
+    }
+
+    return NULL;
+}
+
+static void print_summary(const char *name, bench_summary s) {
+    printf("\"%s\": {\"median\": %.3f, \"p10\": %.3f, \"p90\": %.3f}", name, s.median, s.p10, s.p90);
+}
+
+static void print_result(const char *kernel, const char *mode, uint64_t size, int threads,
+                         uint64_t iterations, bench_summary mbps, bench_summary cpb) {
+    if (options.json) {
+        printf("%s\n    {\"kernel\": \"%s\", \"mode\": \"%s\", \"size\": %llu, \"threads\": %d, \"iterations\": %llu, ",
+               first_result ? "" : ",", kernel, mode, (unsigned long long)size, threads, (unsigned long long)iterations);
+        print_summary("mbps", mbps);
+        printf(", ");
+        print_summary("cycles_per_byte", cpb);
+    } else {
+        printf("%-7s %-10s %10llu %3d %12.2f %12.2f %12.2f %10.2f",
+               kernel, mode, (unsigned long long)size, threads, mbps.median, mbps.p10, mbps.p90, cpb.median);
+    }
+
+    first_result = 0;
+}
+
+static void print_perf(bench_summary *counters, bench_summary ipc) {
+    int i;
+
+    if (options.json) {
+        printf(", \"per_byte\": {");
+        for (i = 0; i < PERF_COUNT; i++) {
+            printf("%s", i ? ", " : "");
+            print_summary(perf_names[i], counters[i]);
+        }
+        printf("}, ");
+        print_summary("ipc", ipc);
+    } else {
+        printf(" %8.2f %8.2f %6.2f %8.4f %8.4f",
+               counters[PERF_CYCLES].median, counters[PERF_INSTRUCTIONS].median, ipc.median,
+               counters[PERF_L1D_MISSES].median, counters[PERF_BRANCH_MISSES].median);
+    }
+}
+
+static int run_mode(bench_mode *mode, int kernel, uint64_t size, int threads) {
+    bench_worker workers[MAX_THREADS];
+    double mbps[MAX_REPEATS], cpb[MAX_REPEATS];
+    double counters[PERF_COUNT][MAX_REPEATS], ipc[MAX_REPEATS];
+    bench_summary perf_summary[PERF_COUNT];
+    uint64_t iterations, t0, t1, c0, c1, bytes;
+    int i, r;
+
+    iterations = options.budget / size / threads;
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    for (i = 0; i < threads; i++) {
+        workers[i].func = mode->func;
+        workers[i].size = size;
+        workers[i].iterations = iterations;
+        workers[i].buffer = (uint8_t*)malloc(size);
+        if (!workers[i].buffer) {
+            fprintf(stderr, "Unable to allocate %llu bytes\n", (unsigned long long)size);
+            while (i--) {
+                free(workers[i].buffer);
+            }
+            return 0;
+        }
+
+        memset(workers[i].buffer, 0x5A, size);
+        init_context(&workers[i].ctx, kernel);
+    }
+
+    bytes = size * iterations * threads;
+
+    for (r = -options.warmup; r < options.repeats; r++) {
+        if (options.perf) {
+            perf_start();
+        }
+
+        t0 = now_ns();
+        c0 = now_cycles();
+
+        if (threads == 1) {
+            worker_run(&workers[0]);
+        } else {
+            for (i = 0; i < threads; i++) {
+                pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+            }
+            for (i = 0; i < threads; i++) {
+                pthread_join(workers[i].thread, NULL);
+            }
+        }
+
+        c1 = now_cycles();
+        t1 = now_ns();
+
+        if (options.perf) {
+            perf_stop();
+        }
+
+        if (r >= 0) {
+            mbps[r] = (double)bytes / (t1 - t0 ? t1 - t0 : 1) * 1e9 / (1 << 20);
+            cpb[r] = (double)(c1 - c0) / bytes;
+
+            for (i = 0; i < PERF_COUNT; i++) {
+                counters[i][r] = (double)perf.value[i] / bytes;
+            }
+            ipc[r] = perf.value[PERF_CYCLES] ? (double)perf.value[PERF_INSTRUCTIONS] / perf.value[PERF_CYCLES] : 0;
+        }
+    }
+
+    for (i = 0; i < threads; i++) {
+        free(workers[i].buffer);
+    }
+
+    for (i = 0; i < PERF_COUNT; i++) {
+        perf_summary[i] = summarize(counters[i], options.repeats);
+    }
+
+    print_result(gost89_kernel_name(kernel), mode->name, size, threads, iterations,
+                 summarize(mbps, options.repeats), summarize(cpb, options.repeats));
+
+    if (options.perf) {
+        print_perf(perf_summary, summarize(ipc, options.repeats));
+    }
+
+    if (options.json) {
+        printf("}");
+    } else {
+        printf("\n");
+    }
+
+    return 1;
+}
+
+static void run_setup() {
+    gost89_context ctx;
+    double sbox_ns[MAX_REPEATS], key_ns[MAX_REPEATS];
+    uint64_t t0, t1, t2;
+    int i, r;
+    const int n = 100000;
+    bench_summary s, k;
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    for (r = -options.warmup; r < options.repeats; r++) {
+        t0 = now_ns();
+        for (i = 0; i < n; i++) {
+            gost89_set_sbox(&ctx, bench_sbox);
+        }
+        t1 = now_ns();
+        for (i = 0; i < n; i++) {
+            gost89_set_key(&ctx, bench_key);
+        }
+        t2 = now_ns();
+
+        if (r >= 0) {
+            sbox_ns[r] = (double)(t1 - t0) / n;
+            key_ns[r] = (double)(t2 - t1) / n;
+        }
+    }
+
+    s = summarize(sbox_ns, options.repeats);
+    k = summarize(key_ns, options.repeats);
+
+    if (options.json) {
+        printf("  \"setup\": {");
+        print_summary("set_sbox_ns", s);
+        printf(", ");
+        print_summary("set_key_ns", k);
+        printf("},\n");
+    } else {
+        printf("set_sbox: %.1f ns (p10 %.1f, p90 %.1f)\n", s.median, s.p10, s.p90);
+        printf("set_key:  %.1f ns (p10 %.1f, p90 %.1f)\n\n", k.median, k.p10, k.p90);
+    }
+}
+
+/* Latency of one short message: the library calls against gost89_fast_ctr, in ns per message */
+static void run_tokens() {
+    static const unsigned sizes[] = {8, 13, 16, 24, 32, 48, 64};
+    gost89_context ctx;
+    uint8_t iv[8], token[64];
+    double lib_ns[MAX_REPEATS], fast_ns[MAX_REPEATS];
+    bench_summary l, f;
+    uint64_t t0, t1, t2;
+    unsigned s;
+    int i, r;
+    const int n = 1000000;
+
+    init_context(&ctx, GOST89_KERNEL_AUTO);
+    memcpy(iv, bench_iv, sizeof(iv));
+    memset(token, 0x5A, sizeof(token));
+
+    if (options.json) {
+        printf("  \"tokens\": [");
+    } else {
+        printf("%-6s %12s %12s %12s %12s\n", "size", "library ns", "p90", "fast ns", "p90");
+    }
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (r = -options.warmup; r < options.repeats; r++) {
+            /* The IV changes with every message, as it would for real tokens */
+            t0 = now_ns();
+            for (i = 0; i < n; i++) {
+                iv[0] = (uint8_t)i;
+                gost89_set_iv(&ctx, iv);
+                gost89_init_ctr(&ctx);
+                gost89_encrypt_ctr(&ctx, token, token, sizes[s]);
+            }
+            t1 = now_ns();
+            for (i = 0; i < n; i++) {
+                iv[0] = (uint8_t)i;
+                gost89_fast_ctr(&ctx, iv, token, token, sizes[s]);
+            }
+            t2 = now_ns();
+
+            if (r >= 0) {
+                lib_ns[r] = (double)(t1 - t0) / n;
+                fast_ns[r] = (double)(t2 - t1) / n;
+            }
+        }
+
+        l = summarize(lib_ns, options.repeats);
+        f = summarize(fast_ns, options.repeats);
+
+        if (options.json) {
+            printf("%s\n    {\"size\": %u, ", s ? "," : "", sizes[s]);
+            print_summary("library_ns", l);
+            printf(", ");
+            print_summary("fast_ns", f);
+            printf("}");
+        } else {
+            printf("%-6u %12.1f %12.1f %12.1f %12.1f\n", sizes[s], l.median, l.p90, f.median, f.p90);
+        }
+    }
+
+    if (options.json) {
+        printf("\n  ]\n");
+    }
+}
+
+static int mode_selected(const char *name) {
+    const char *p = options.modes;
+    size_t l = strlen(name);
+
+    if (!p) {
+        return 1;
+    }
+
+    while (*p) {
+        if (!strncmp(p, name, l) && (p[l] == ',' || p[l] == '\0')) {
+            return 1;
+        }
+        p = strchr(p, ',');
+        if (!p) {
+            break;
+        }
+        p++;
+    }
+
+    return 0;
+}
+
+static uint64_t parse_size(const char *s) {
+    char *end;
+    uint64_t value = strtoull(s, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K':
+            return value << 10;
+        case 'm': case 'M':
+            return value << 20;
+        case 'g': case 'G':
+            return value << 30;
+        default:
+            return value;
+    }
+}
+
+static int parse_kernels(char *s) {
+    char *name;
+    int kernel;
+
+    options.kernel_count = 0;
+
+    for (name = strtok(s, ","); name; name = strtok(NULL, ",")) {
+        kernel = gost89_kernel_by_name(name);
+        if (kernel <= GOST89_KERNEL_AUTO) {
+            fprintf(stderr, "Unknown kernel: %s\n", name);
+            return 0;
+        }
+        if (options.kernel_count < GOST89_KERNEL_COUNT) {
+            options.kernels[options.kernel_count++] = kernel;
+        }
+    }
+
+    return options.kernel_count > 0;
+}
+
+static int parse_threads(char *s) {
+    char *value;
+    int n;
+
+    options.thread_count = 0;
+
+    for (value = strtok(s, ","); value; value = strtok(NULL, ",")) {
+        n = atoi(value);
+        if (n < 1 || n > MAX_THREADS) {
+            fprintf(stderr, "Invalid thread count: %s\n", value);
+            return 0;
+        }
+        if (options.thread_count < MAX_THREADS) {
+            options.threads[options.thread_count++] = n;
+        }
+    }
+
+    return options.thread_count > 0;
+}
+
+static void print_help(const char *name) {
+    printf(
+        "\n"
+        "Usage: %s [options]\n\n"
+        "Options:\n"
+        "  -m, --modes <list>     Modes: ecb-enc,ecb-dec,ctr,cfb-enc,cfb-dec,cbc-enc,cbc-dec,\n"
+        "                         mac,ctr+mac,magma-ctr,magma-omac,\n"
+        "                         magma-mgm,hash-94 (default: all)\n"
+        "  -K, --kernels <list>   Block kernels: sbox4,sbox8,sbox8x4 (default: all)\n"
+        "  -t, --threads <list>   Thread counts, e.g. 1,2,4 (default: 1)\n"
+        "  -s, --min-size <n>     Smallest message size (default: 8)\n"
+        "  -S, --max-size <n>     Largest message size, up to 1G (default: 16M)\n"
+        "  -b, --budget <n>       Bytes processed per measured run (default: 64M)\n"
+        "  -w, --warmup <n>       Warm-up runs (default: 1)\n"
+        "  -r, --repeats <n>      Measured runs (default: 5)\n"
+        "  -M, --key-meshing      CryptoPro key meshing every 1024 bytes (ctr, cfb)\n"
+        "  -c, --counters         Run with the library counters on (gost89_set_stats), to time their cost\n"
+        "  -T, --tokens           Only time 8..64 byte CTR messages, library and fast path (ns/op)\n"
+        "  -p, --perf             Record hardware counters per byte (Linux perf_event_open)\n"
+        "  -j, --json             Machine-readable output\n",
+        name
+    );
+}
+
+static int parse_args(int argc, char **argv) {
+    int c, i;
+    struct option long_options[] = {
+        {"modes",    required_argument, 0, 'm'},
+        {"kernels",  required_argument, 0, 'K'},
+        {"threads",  required_argument, 0, 't'},
+        {"min-size", required_argument, 0, 's'},
+        {"max-size", required_argument, 0, 'S'},
+        {"budget",   required_argument, 0, 'b'},
+        {"warmup",   required_argument, 0, 'w'},
+        {"repeats",  required_argument, 0, 'r'},
+        {"key-meshing", no_argument,    0, 'M'},
+        {"counters", no_argument,       0, 'c'},
+        {"tokens",   no_argument,       0, 'T'},
+        {"perf",     no_argument,       0, 'p'},
+        {"json",     no_argument,       0, 'j'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    options.modes = NULL;
+    for (i = 1; i < GOST89_KERNEL_COUNT; i++) {
+        options.kernels[i - 1] = i;
+    }
+    options.kernel_count = GOST89_KERNEL_COUNT - 1;
+    options.threads[0] = 1;
+    options.thread_count = 1;
+    options.min_size = 8;
+    options.max_size = 16 << 20;
+    options.budget = 64 << 20;
+    options.warmup = 1;
+    options.repeats = 5;
+    options.json = 0;
+    options.perf = 0;
+    options.key_meshing = 0;
+    options.counters = 0;
+    options.tokens = 0;
+
+    while ((c = getopt_long(argc, argv, "m:K:t:s:S:b:w:r:McTpjh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'm':
+                options.modes = optarg;
+                break;
+            case 'K':
+                if (!parse_kernels(optarg)) {
+                    return 0;
+                }
+                break;
+            case 't':
+                if (!parse_threads(optarg)) {
+                    return 0;
+                }
+                break;
+            case 's':
+                options.min_size = parse_size(optarg);
+                break;
+            case 'S':
+                options.max_size = parse_size(optarg);
+                break;
+            case 'b':
+                options.budget = parse_size(optarg);
+                break;
+            case 'w':
+                options.warmup = atoi(optarg);
+                break;
+            case 'r':
+                options.repeats = atoi(optarg);
+                break;
+            case 'M':
+                options.key_meshing = 1;
+                break;
+            case 'c':
+                options.counters = 1;
+                break;
+            case 'T':
+                options.tokens = 1;
+                break;
+            case 'p':
+                options.perf = 1;
+                break;
+            case 'j':
+                options.json = 1;
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    if (options.min_size < 8 || options.max_size > (1 << 30) || options.min_size > options.max_size) {
+        fprintf(stderr, "Message sizes must be within 8 bytes .. 1G\n");
+        return 0;
+    }
+
+    if (options.repeats < 1 || options.repeats > MAX_REPEATS || options.warmup < 0) {
+        fprintf(stderr, "Invalid number of runs\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    bench_mode *mode;
+    uint64_t size;
+    int k, t;
+
+    if (!parse_args(argc, argv)) {
+        print_help(argv[0]);
+        return 1;
+    }
+
+    if (options.perf && !perf_init()) {
+        options.perf = 0;
+    }
+
+    gost89_set_stats(options.counters);
+
+    if (options.json) {
+        printf("{\n  \"warmup\": %d,\n  \"repeats\": %d,\n  \"counters\": %s,\n  \"timer\": \"%s\",\n",
+               options.warmup, options.repeats, options.counters ? "true" : "false", now_cycles() ? "rdtsc" : "none");
+    }
+
+    run_setup();
+
+    if (options.tokens) {
+        run_tokens();
+        if (options.json) {
+            printf("}\n");
+        }
+        return 0;
+    }
+
+    if (options.json) {
+        printf("  \"results\": [");
+    } else {
+        printf("%-7s %-10s %10s %3s %12s %12s %12s %10s",
+               "kernel", "mode", "size", "thr", "MB/s", "p10", "p90", "cpb");
+        if (options.perf) {
+            printf(" %8s %8s %6s %8s %8s", "cyc/B", "ins/B", "IPC", "L1D/B", "brm/B");
+        }
+        printf("\n");
+    }
+
+    for (k = 0; k < options.kernel_count; k++) {
+        for (mode = bench_modes; mode->name; mode++) {
+            if (!mode_selected(mode->name)) {
+                continue;
+            }
+
+            for (size = options.min_size; size <= options.max_size; size *= 8) {
+                for (t = 0; t < options.thread_count; t++) {
+                    if (!run_mode(mode, options.kernels[k], size, options.threads[t])) {
+                        return 1;
+                    }
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    if (options.json) {
+        printf("\n  ]\n}\n");
+    }
+
+    return 0;
+}
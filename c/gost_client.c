@@ -0,0 +1,510 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "gost_daemon.h"
+
+#define MAX_WINDOW 1024
+
+static struct {
+    const char *socket;
+    int op;
+    int mode;
+    uint32_t iv[2];
+    int fd;
+    int stats;
+    unsigned bench;
+    unsigned size;
+    unsigned window;
+    const char *in_file;
+    const char *out_file;
+} options;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int connect_daemon() {
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, options.socket, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        fprintf(stderr, "Unable to connect to %s: %s\n", options.socket, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t*)data;
+    ssize_t n;
+
+    while (size) {
+        n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+static int read_all(int fd, void *data, size_t size) {
+    uint8_t *p = (uint8_t*)data;
+    ssize_t n;
+
+    while (size) {
+        n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+/* Sends the header with a shared memory descriptor attached */
+static int send_fd(int fd, const gost_daemon_request *request, int memfd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+
+    iov.iov_base = (void*)request;
+    iov.iov_len = sizeof(*request);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(*request);
+}
+
+static void init_request(gost_daemon_request *request, int op, uint32_t size, uint64_t id) {
+    memset(request, 0, sizeof(*request));
+    request->magic = GOST_DAEMON_MAGIC;
+    request->op = (uint16_t)op;
+    request->mode = (uint16_t)options.mode;
+    request->size = size;
+    request->iv[0] = options.iv[0];
+    request->iv[1] = options.iv[1];
+    request->id = id;
+}
+
+static int read_response(int fd, gost_daemon_response *response, void *payload, uint32_t max) {
+    if (!read_all(fd, response, sizeof(*response)) || response->magic != GOST_DAEMON_MAGIC) {
+        fprintf(stderr, "Connection to the daemon lost\n");
+        return 0;
+    }
+
+    if (response->size > max) {
+        fprintf(stderr, "Unexpected response size: %u\n", response->size);
+        return 0;
+    }
+
+    if (response->size && !read_all(fd, payload, response->size)) {
+        fprintf(stderr, "Connection to the daemon lost\n");
+        return 0;
+    }
+
+    if (response->status != GOST_DAEMON_OK) {
+        fprintf(stderr, "Request failed with status %u\n", response->status);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int run_stats(int fd) {
+    gost_daemon_request request;
+    gost_daemon_response response;
+    char text[4096];
+
+    init_request(&request, GOST_DAEMON_STATS, 0, 0);
+    if (!write_all(fd, &request, sizeof(request)) || !read_response(fd, &response, text, sizeof(text) - 1)) {
+        return 0;
+    }
+
+    text[response.size] = 0;
+    fputs(text, stdout);
+
+    return 1;
+}
+
+static uint8_t *load_file(const char *filename, uint32_t *size) {
+    uint8_t *data;
+    FILE *f;
+    long n;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "Unable to open file for reading: %s\n", filename);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (n < 0 || (unsigned long)n > GOST_DAEMON_MAX_FD_SIZE) {
+        fprintf(stderr, "File is too large: %s\n", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    data = (uint8_t*)malloc(n ? n : 1);
+    if (!data || fread(data, 1, n, f) != (size_t)n) {
+        fprintf(stderr, "Unable to read file: %s\n", filename);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+    *size = (uint32_t)n;
+
+    return data;
+}
+
+/* With --fd the file goes through a memfd, otherwise inline */
+static int run_file(int fd) {
+    gost_daemon_request request;
+    gost_daemon_response response;
+    uint8_t *data, *shared = NULL;
+    uint32_t size;
+    int memfd = -1, ok = 0;
+    FILE *f;
+
+    data = load_file(options.in_file, &size);
+    if (!data) {
+        return 0;
+    }
+
+    init_request(&request, options.op, size, 1);
+
+    if (options.fd) {
+        request.flags = GOST_DAEMON_FD;
+        memfd = memfd_create("gost_client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memfd < 0 || ftruncate(memfd, size) || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) ||
+            (size && (shared = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED)) {
+            perror("memfd");
+            goto done;
+        }
+        if (size) {
+            memcpy(shared, data, size);
+        }
+        if (!send_fd(fd, &request, memfd) || !read_response(fd, &response, NULL, 0)) {
+            goto done;
+        }
+        if (size) {
+            memcpy(data, shared, size);
+        }
+    } else {
+        if (size > GOST_DAEMON_MAX_INLINE) {
+            fprintf(stderr, "Files above %u bytes need --fd\n", GOST_DAEMON_MAX_INLINE);
+            goto done;
+        }
+        if (!write_all(fd, &request, sizeof(request)) || !write_all(fd, data, size) ||
+            !read_response(fd, &response, data, size)) {
+            goto done;
+        }
+    }
+
+    if (options.op == GOST_DAEMON_MAC) {
+        printf("MAC:\t%08x\n", response.mac[1]);
+    } else {
+        f = fopen(options.out_file, "wb");
+        if (!f) {
+            fprintf(stderr, "Unable to open file for writing: %s\n", options.out_file);
+            goto done;
+        }
+        fwrite(data, 1, size, f);
+        fclose(f);
+    }
+
+    ok = 1;
+
+done:
+    if (shared && shared != MAP_FAILED) {
+        munmap(shared, size);
+    }
+    if (memfd >= 0) {
+        close(memfd);
+    }
+    free(data);
+
+    return ok;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Keeps window requests in flight and reports throughput and round trip latency */
+static int run_bench(int fd) {
+    gost_daemon_request request;
+    gost_daemon_response response;
+    uint64_t *sent, *latency, start, elapsed;
+    unsigned issued = 0, done = 0;
+    uint8_t *data;
+    int ok = 0;
+
+    data = (uint8_t*)calloc(1, options.size + 1);
+    sent = (uint64_t*)calloc(options.bench, sizeof(uint64_t));
+    latency = (uint64_t*)calloc(options.bench, sizeof(uint64_t));
+    if (!data || !sent || !latency) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto done;
+    }
+
+    start = now_ns();
+
+    while (done < options.bench) {
+        while (issued < options.bench && issued - done < options.window) {
+            init_request(&request, options.op, options.size, issued);
+            sent[issued] = now_ns();
+            if (!write_all(fd, &request, sizeof(request)) ||
+                (options.op != GOST_DAEMON_STATS && !write_all(fd, data, options.size))) {
+                fprintf(stderr, "Connection to the daemon lost\n");
+                goto done;
+            }
+            issued++;
+        }
+
+        if (!read_response(fd, &response, data, options.size) || response.id >= issued) {
+            goto done;
+        }
+        latency[done++] = now_ns() - sent[response.id];
+    }
+
+    elapsed = now_ns() - start;
+    qsort(latency, options.bench, sizeof(uint64_t), compare_u64);
+
+    printf("Requests:\t%u x %u bytes, window %u\n", options.bench, options.size, options.window);
+    printf("Throughput:\t%.0f req/s, %.2f MB/s\n",
+           options.bench / (elapsed / 1e9), (double)options.bench * options.size / (elapsed / 1e3));
+    printf("Latency:\tp50 %.1f us, p99 %.1f us, max %.1f us\n",
+           latency[options.bench / 2] / 1e3, latency[options.bench * 99 / 100] / 1e3,
+           latency[options.bench - 1] / 1e3);
+
+    ok = 1;
+
+done:
+    free(data);
+    free(sent);
+    free(latency);
+
+    return ok;
+}
+
+static int parse_iv(const char *s) {
+    unsigned long long v;
+    char *end;
+
+    v = strtoull(s, &end, 16);
+    if (!*s || *end || strlen(s) > 16) {
+        fprintf(stderr, "IV must be up to 16 hexadecimal digits: %s\n", s);
+        return 0;
+    }
+
+    options.iv[0] = (uint32_t)v;
+    options.iv[1] = (uint32_t)(v >> 32);
+
+    return 1;
+}
+
+static void print_help(const char *name) {
+    printf(
+        "\n"
+        "Usage: %s [options] in_file [out_file]\n"
+        "       %s [options] --bench <count>\n"
+        "       %s --stats\n\n"
+        "Options:\n"
+        "  -S, --socket <path>    Daemon socket (default: /tmp/gost_daemon.sock)\n"
+        "  -e, --encrypt          Encrypt (default)\n"
+        "  -d, --decrypt          Decrypt\n"
+        "  -a, --mac              Compute MAC\n"
+        "  -m, --mode <mode>      ecb | ctr | cfb | cbc (default: ctr)\n"
+        "  -i, --iv <hex>         Initialization vector, as in gost_file (default: 0)\n"
+        "  -f, --fd               Pass the data in shared memory instead of the socket\n"
+        "  -n, --bench <count>    Send count requests and report throughput and latency\n"
+        "  -z, --size <bytes>     Request size for --bench (default: 64)\n"
+        "  -w, --window <n>       Requests in flight for --bench (default: 32)\n"
+        "      --stats            Print the daemon metrics\n",
+        name, name, name
+    );
+}
+
+static int parse_args(int argc, char **argv) {
+    int c;
+    struct option long_options[] = {
+        {"socket",  required_argument, 0, 'S'},
+        {"encrypt", no_argument,       0, 'e'},
+        {"decrypt", no_argument,       0, 'd'},
+        {"mac",     no_argument,       0, 'a'},
+        {"mode",    required_argument, 0, 'm'},
+        {"iv",      required_argument, 0, 'i'},
+        {"fd",      no_argument,       0, 'f'},
+        {"bench",   required_argument, 0, 'n'},
+        {"size",    required_argument, 0, 'z'},
+        {"window",  required_argument, 0, 'w'},
+        {"stats",   no_argument,       0, 1},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    options.socket = "/tmp/gost_daemon.sock";
+    options.op = GOST_DAEMON_ENCRYPT;
+    options.mode = GOST_DAEMON_CTR;
+    options.size = 64;
+    options.window = 32;
+
+    while ((c = getopt_long(argc, argv, "S:edam:i:fn:z:w:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'S':
+                options.socket = optarg;
+                break;
+            case 'e':
+                options.op = GOST_DAEMON_ENCRYPT;
+                break;
+            case 'd':
+                options.op = GOST_DAEMON_DECRYPT;
+                break;
+            case 'a':
+                options.op = GOST_DAEMON_MAC;
+                break;
+            case 'm':
+                if (!strcmp(optarg, "ecb")) {
+                    options.mode = GOST_DAEMON_ECB;
+                } else if (!strcmp(optarg, "ctr")) {
+                    options.mode = GOST_DAEMON_CTR;
+                } else if (!strcmp(optarg, "cfb")) {
+                    options.mode = GOST_DAEMON_CFB;
+                } else if (!strcmp(optarg, "cbc")) {
+                    options.mode = GOST_DAEMON_CBC;
+                } else {
+                    fprintf(stderr, "Unknown mode: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'i':
+                if (!parse_iv(optarg)) {
+                    return 0;
+                }
+                break;
+            case 'f':
+                options.fd = 1;
+                break;
+            case 'n':
+                options.bench = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'z':
+                options.size = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                options.window = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 1:
+                options.stats = 1;
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    if (options.stats || options.bench) {
+        if (options.size > GOST_DAEMON_MAX_INLINE || options.window < 1 || options.window > MAX_WINDOW) {
+            fprintf(stderr, "Size must be up to %u and window within 1 .. %d\n", GOST_DAEMON_MAX_INLINE, MAX_WINDOW);
+            return 0;
+        }
+        return 1;
+    }
+
+    if (optind >= argc) {
+        return 0;
+    }
+
+    options.in_file = argv[optind++];
+    options.out_file = optind < argc ? argv[optind] : NULL;
+
+    if (!options.out_file && options.op != GOST_DAEMON_MAC) {
+        fprintf(stderr, "Output file is required\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int fd, ok;
+
+    if (!parse_args(argc, argv)) {
+        print_help(argv[0]);
+        return 1;
+    }
+
+    fd = connect_daemon();
+    if (fd < 0) {
+        return 1;
+    }
+
+    if (options.stats) {
+        ok = run_stats(fd);
+    } else if (options.bench) {
+        ok = run_bench(fd);
+    } else {
+        ok = run_file(fd);
+    }
+
+    close(fd);
+
+    return ok ? 0 : 1;
+}
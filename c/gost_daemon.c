@@ -0,0 +1,1392 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && !defined(GOST_DAEMON_NO_NUMA)
+    #include <numa.h>
+    #define HAVE_NUMA 1
+#endif
+
+#include "gost89.h"
+#include "gost_daemon.h"
+
+#define MAX_CONNECTIONS 256
+#define MAX_THREADS 64
+#define MAX_QUEUE 4096          /* queued requests above which connections are not read */
+#define MAX_PASSED_FDS 16
+#define BATCH_JOBS 64           /* requests a worker takes from the queue at once */
+#define SMALL_SIZE 4096         /* inline requests up to this size are batched across requests */
+#define READ_SIZE 65536
+#define MAX_OUTPUT (4 << 20)    /* queued response bytes above which a connection is not read */
+#define LATENCY_BUCKETS 32
+#define MAX_NODES 64
+
+/* Response bytes the socket did not take yet; sent by the serving thread as it becomes writable */
+typedef struct output {
+    struct output *next;
+    size_t size;
+    size_t sent;
+    uint8_t data[];
+} output;
+
+typedef struct connection {
+    int fd;
+    int refs;
+    int reading;
+    int broken;
+    pthread_mutex_t write_lock;     /* the output queue and broken */
+    output *out_head;
+    output *out_tail;
+    size_t out_bytes;
+    uint8_t *buffer;
+    unsigned capacity;
+    unsigned start;
+    unsigned length;
+    int passed[MAX_PASSED_FDS];
+    unsigned passed_count;
+    int node;
+    struct connection *next;
+} connection;
+
+typedef struct job {
+    connection *conn;
+    gost_daemon_request request;
+    uint8_t *data;
+    int fd;
+    uint64_t queued;
+    int node;
+    size_t node_size;           /* data allocated on the node, to be freed with node_free */
+    uint32_t status;
+    uint32_t mac[2];
+    char *text;
+    struct job *next;
+} job;
+
+/* Allocated on the worker's node, its copy of the context and key tables included */
+typedef struct worker {
+    pthread_t thread;
+    int node;
+    gost89_context ctx;
+    uint32_t *stage;
+    uint32_t keys[BATCH_JOBS][8];
+} worker;
+
+typedef struct node_stats {
+    unsigned workers;
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t batches;
+    uint64_t stolen;            /* batches taken from another node's queue */
+    uint64_t busy_ns;
+} node_stats;
+
+/* Metrics, updated once per batch */
+typedef struct daemon_stats {
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t batches;
+    uint64_t batched;
+    unsigned queue_max;
+    unsigned connections;
+    uint64_t latency[LATENCY_BUCKETS];
+    uint64_t latency_max;
+    node_stats nodes[MAX_NODES];
+} daemon_stats;
+
+static struct {
+    const char *socket;
+    const char *key_file;
+    const char *sbox_file;
+    int threads;
+    int kernel;
+    int numa;
+} options;
+
+static gost89_context master;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static job *queue_head[MAX_NODES], *queue_tail[MAX_NODES];
+static unsigned queue_depth;
+static int queue_stop;
+
+static pthread_mutex_t ref_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static daemon_stats stats;
+
+static volatile sig_atomic_t stopping;
+
+/* Wakes the serving thread when a worker leaves output queued */
+static int wake_fds[2] = {-1, -1};
+
+/* NUMA nodes with CPUs that workers run on; a single pseudo-node without --numa */
+static int node_ids[MAX_NODES];
+static int node_count = 1;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Number of blocks the library mode functions process for size bytes */
+static unsigned size_blocks(uint32_t size) {
+    return (size / 4 + 1) / 2;
+}
+
+static void on_signal(int sig) {
+    stopping = 1;
+}
+
+static int init_nodes() {
+#ifdef HAVE_NUMA
+    struct bitmask *cpus;
+    int node;
+
+    if (!options.numa) {
+        return 1;
+    }
+
+    if (numa_available() < 0) {
+        fprintf(stderr, "NUMA is not available, running without node placement\n");
+        options.numa = 0;
+        return 1;
+    }
+
+    cpus = numa_allocate_cpumask();
+    if (!cpus) {
+        return 0;
+    }
+
+    node_count = 0;
+    for (node = 0; node <= numa_max_node() && node_count < MAX_NODES; node++) {
+        if (numa_bitmask_isbitset(numa_all_nodes_ptr, node) && !numa_node_to_cpus(node, cpus) &&
+            numa_bitmask_weight(cpus) > 0) {
+            node_ids[node_count++] = node;
+        }
+    }
+
+    numa_free_cpumask(cpus);
+
+    if (!node_count) {
+        node_count = 1;
+        options.numa = 0;
+    }
+#else
+    if (options.numa) {
+        fprintf(stderr, "Built without NUMA support, running without node placement\n");
+        options.numa = 0;
+    }
+#endif
+
+    return 1;
+}
+
+/* Zeroed memory on the given node (an index into node_ids) */
+static void *node_alloc(size_t size, int node) {
+#ifdef HAVE_NUMA
+    if (options.numa) {
+        return numa_alloc_onnode(size, node_ids[node]);
+    }
+#endif
+
+    return calloc(1, size);
+}
+
+static void node_free(void *p, size_t size) {
+#ifdef HAVE_NUMA
+    if (options.numa) {
+        if (p) {
+            numa_free(p, size);
+        }
+        return;
+    }
+#endif
+
+    free(p);
+}
+
+/* Keeps the calling thread on the CPUs of the node, and its allocations local */
+static void node_bind(int node) {
+#ifdef HAVE_NUMA
+    if (options.numa) {
+        numa_run_on_node(node_ids[node]);
+        numa_set_localalloc();
+    }
+#endif
+}
+
+static int read_file(const char *filename, void *data, long size) {
+    FILE *f;
+    int ok;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "Unable to open file: %s\n", filename);
+        return 0;
+    }
+
+    ok = fread(data, 1, size, f) == (size_t)size && fgetc(f) == EOF;
+    fclose(f);
+
+    if (!ok) {
+        fprintf(stderr, "File must be %ld bytes long: %s\n", size, filename);
+    }
+
+    return ok;
+}
+
+/* Same defaults and file formats as gost_file */
+static int init_master() {
+    uint8_t sbox[8][16], buffer[128], key[32];
+    int i;
+
+    memset(&master, 0, sizeof(master));
+
+    if (options.sbox_file) {
+        if (!read_file(options.sbox_file, buffer, sizeof(buffer))) {
+            return 0;
+        }
+        for (i = 0; i < 128; i++) {
+            sbox[i / 16][i % 16] = buffer[i] % 16;
+        }
+    } else {
+        for (i = 0; i < 128; i++) {
+            sbox[i / 16][i % 16] = i % 16;
+        }
+    }
+
+    memset(key, 0, sizeof(key));
+    if (options.key_file && !read_file(options.key_file, key, sizeof(key))) {
+        return 0;
+    }
+
+    gost89_set_sbox(&master, sbox);
+    gost89_set_key(&master, key);
+    gost89_set_kernel(&master, options.kernel);
+
+    memset(key, 0, sizeof(key));
+
+    return 1;
+}
+
+static void out_clear(connection *c) {
+    output *o;
+
+    while ((o = c->out_head) != NULL) {
+        c->out_head = o->next;
+        free(o);
+    }
+
+    c->out_tail = NULL;
+    c->out_bytes = 0;
+}
+
+static void conn_release(connection *c) {
+    unsigned i;
+    int last;
+
+    pthread_mutex_lock(&ref_lock);
+    last = --c->refs == 0;
+    pthread_mutex_unlock(&ref_lock);
+
+    if (!last) {
+        return;
+    }
+
+    for (i = 0; i < c->passed_count; i++) {
+        close(c->passed[i]);
+    }
+
+    out_clear(c);
+    close(c->fd);
+    pthread_mutex_destroy(&c->write_lock);
+    free(c->buffer);
+    free(c);
+}
+
+/* Sends what the socket takes of iov without blocking; any error but a full socket breaks the connection */
+static ssize_t send_some(connection *c, struct iovec *iov, int count) {
+    struct msghdr msg;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    do {
+        n = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno != EAGAIN) {
+        c->broken = 1;
+        out_clear(c);
+    }
+
+    return n < 0 ? 0 : n;
+}
+
+/* Sends queued output until the socket is full; write_lock is held, as for send_some */
+static void out_flush(connection *c) {
+    struct iovec iov;
+    output *o;
+    size_t n;
+
+    while (!c->broken && (o = c->out_head) != NULL) {
+        iov.iov_base = o->data + o->sent;
+        iov.iov_len = o->size - o->sent;
+
+        n = send_some(c, &iov, 1);
+        if (c->broken || !n) {
+            return;
+        }
+
+        o->sent += n;
+        c->out_bytes -= n;
+        if (o->sent == o->size) {
+            c->out_head = o->next;
+            if (!c->out_head) {
+                c->out_tail = NULL;
+            }
+            free(o);
+        }
+    }
+}
+
+/*
+ * Responses never wait for the client: what the socket does not take at
+ * once is queued on the connection and sent by the serving thread, which
+ * stops reading requests from a client while too much of it is queued.
+ */
+static void respond(connection *c, const gost_daemon_request *request, uint32_t status, const uint32_t *mac, const void *payload, uint32_t size) {
+    gost_daemon_response response;
+    struct iovec iov[2];
+    size_t total, sent = 0, skip;
+    output *o;
+    int i;
+
+    memset(&response, 0, sizeof(response));
+    response.magic = GOST_DAEMON_MAGIC;
+    response.status = status;
+    response.size = status == GOST_DAEMON_OK ? size : 0;
+    response.id = request->id;
+    if (mac) {
+        response.mac[0] = mac[0];
+        response.mac[1] = mac[1];
+    }
+
+    iov[0].iov_base = &response;
+    iov[0].iov_len = sizeof(response);
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = response.size;
+    total = sizeof(response) + response.size;
+
+    pthread_mutex_lock(&c->write_lock);
+
+    if (c->broken) {
+        pthread_mutex_unlock(&c->write_lock);
+        return;
+    }
+
+    if (!c->out_head) {
+        sent = send_some(c, iov, response.size ? 2 : 1);
+    }
+
+    if (!c->broken && sent < total) {
+        o = (output*)malloc(sizeof(output) + total - sent);
+        if (!o) {
+            /* The client would lose track of the stream, so it loses the connection */
+            c->broken = 1;
+            out_clear(c);
+            shutdown(c->fd, SHUT_RDWR);
+        } else {
+            o->next = NULL;
+            o->size = total - sent;
+            o->sent = 0;
+            for (i = 0, skip = sent, total = 0; i < 2; i++) {
+                if (skip >= iov[i].iov_len) {
+                    skip -= iov[i].iov_len;
+                    continue;
+                }
+                memcpy(o->data + total, (uint8_t*)iov[i].iov_base + skip, iov[i].iov_len - skip);
+                total += iov[i].iov_len - skip;
+                skip = 0;
+            }
+
+            if (c->out_tail) {
+                c->out_tail->next = o;
+            } else {
+                c->out_head = o;
+                if (write(wake_fds[1], "", 1) < 0) {
+                    /* A wake-up is pending already */
+                }
+            }
+            c->out_tail = o;
+            c->out_bytes += o->size;
+        }
+    }
+
+    pthread_mutex_unlock(&c->write_lock);
+}
+
+static void queue_push(job *j) {
+    pthread_mutex_lock(&queue_lock);
+
+    j->next = NULL;
+    if (queue_tail[j->node]) {
+        queue_tail[j->node]->next = j;
+    } else {
+        queue_head[j->node] = j;
+    }
+    queue_tail[j->node] = j;
+    queue_depth++;
+
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    pthread_mutex_lock(&stats_lock);
+    if (queue_depth > stats.queue_max) {
+        stats.queue_max = queue_depth;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Takes every queued request up to max, so that concurrent requests are processed together.
+ * The requests of the worker's own node come first; when there are none, those of the next
+ * node that has some are taken instead (stolen is set), so that no worker idles.
+ */
+static unsigned queue_pop(int node, job **jobs, unsigned max, int *stolen) {
+    unsigned n = 0;
+    int i, q = node;
+
+    pthread_mutex_lock(&queue_lock);
+
+    while (!queue_depth && !queue_stop) {
+        pthread_cond_wait(&queue_cond, &queue_lock);
+    }
+
+    for (i = 0; i < node_count && !queue_head[q]; i++) {
+        q = (node + i + 1) % node_count;
+    }
+    *stolen = q != node;
+
+    while (queue_head[q] && n < max) {
+        jobs[n++] = queue_head[q];
+        queue_head[q] = queue_head[q]->next;
+        queue_depth--;
+    }
+    if (!queue_head[q]) {
+        queue_tail[q] = NULL;
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+
+    return n;
+}
+
+static int queue_full() {
+    int full;
+
+    pthread_mutex_lock(&queue_lock);
+    full = queue_depth >= MAX_QUEUE;
+    pthread_mutex_unlock(&queue_lock);
+
+    return full;
+}
+
+static char *format_stats() {
+    daemon_stats s;
+    uint64_t total = 0, seen, p[3] = {0, 0, 0};
+    static const double quantiles[3] = {0.5, 0.9, 0.99};
+    unsigned depth;
+    size_t size, length;
+    char *text;
+    int i, q;
+
+    pthread_mutex_lock(&stats_lock);
+    s = stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    pthread_mutex_lock(&queue_lock);
+    depth = queue_depth;
+    pthread_mutex_unlock(&queue_lock);
+
+    /* Latency percentiles are reported as the upper bound of their power-of-two bucket */
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        total += s.latency[i];
+    }
+    for (q = 0; q < 3; q++) {
+        seen = 0;
+        for (i = 0; i < LATENCY_BUCKETS; i++) {
+            seen += s.latency[i];
+            if (total && seen >= quantiles[q] * total) {
+                p[q] = (uint64_t)1 << i;
+                break;
+            }
+        }
+    }
+
+    size = 512 + node_count * 192;
+    text = (char*)malloc(size);
+    if (!text) {
+        return NULL;
+    }
+
+    length = snprintf(text, size,
+             "{\"connections\": %u, \"queue_depth\": %u, \"queue_depth_max\": %u, "
+             "\"requests\": %llu, \"errors\": %llu, \"bytes\": %llu, \"batches\": %llu, \"avg_batch\": %.2f, "
+             "\"latency_us\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %.1f}, \"nodes\": [",
+             s.connections, depth, s.queue_max,
+             (unsigned long long)s.requests, (unsigned long long)s.errors, (unsigned long long)s.bytes,
+             (unsigned long long)s.batches, s.batches ? (double)s.batched / s.batches : 0.0,
+             (unsigned long long)p[0], (unsigned long long)p[1], (unsigned long long)p[2], s.latency_max / 1e3);
+
+    /* Throughput of a node is over the time its workers spent on batches */
+    for (i = 0; i < node_count; i++) {
+        length += snprintf(text + length, size - length,
+             "%s{\"node\": %d, \"workers\": %u, \"requests\": %llu, \"bytes\": %llu, \"batches\": %llu, "
+             "\"stolen\": %llu, \"mb_s\": %.1f}",
+             i ? ", " : "", node_ids[i], s.nodes[i].workers,
+             (unsigned long long)s.nodes[i].requests, (unsigned long long)s.nodes[i].bytes,
+             (unsigned long long)s.nodes[i].batches, (unsigned long long)s.nodes[i].stolen,
+             s.nodes[i].busy_ns ? s.nodes[i].bytes * 1e3 / s.nodes[i].busy_ns : 0.0);
+    }
+
+    snprintf(text + length, size - length, "]}\n");
+
+    return text;
+}
+
+/* Runs one request with the library mode functions, on its own buffer or on the shared memory */
+static void process_direct(worker *w, job *j, uint8_t *data) {
+    gost89_context *ctx = &w->ctx;
+    uint32_t size = j->request.size;
+
+    ctx->iv[0] = j->request.iv[0];
+    ctx->iv[1] = j->request.iv[1];
+    ctx->mac[0] = 0;
+    ctx->mac[1] = 0;
+
+    if (j->request.op == GOST_DAEMON_MAC) {
+        gost89_mac(ctx, data, size);
+        j->mac[0] = ctx->mac[0];
+        j->mac[1] = ctx->mac[1];
+        return;
+    }
+
+    switch (j->request.mode) {
+        case GOST_DAEMON_ECB:
+            if (j->request.op == GOST_DAEMON_ENCRYPT) {
+                gost89_encrypt_ecb(ctx, data, data, size);
+            } else {
+                gost89_decrypt_ecb(ctx, data, data, size);
+            }
+            break;
+
+        case GOST_DAEMON_CTR:
+            gost89_init_ctr(ctx);
+            gost89_encrypt_ctr(ctx, data, data, size);
+            break;
+
+        case GOST_DAEMON_CFB:
+            if (j->request.op == GOST_DAEMON_ENCRYPT) {
+                gost89_encrypt_cfb(ctx, data, data, size);
+            } else {
+                gost89_decrypt_cfb(ctx, data, data, size);
+            }
+            break;
+
+        case GOST_DAEMON_CBC:
+            if (j->request.op == GOST_DAEMON_ENCRYPT) {
+                gost89_encrypt_cbc(ctx, data, data, size);
+            } else {
+                gost89_decrypt_cbc(ctx, data, data, size);
+            }
+            break;
+    }
+}
+
+/*
+ * The client keeps the memory and could shrink it while it is mapped, which
+ * would kill the daemon with SIGBUS; only descriptors sealed against that
+ * are used.
+ */
+static void process_fd(worker *w, job *j) {
+    struct stat st;
+    uint8_t *data;
+    int seals;
+
+    seals = fcntl(j->fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(j->fd, &st) || (uint64_t)st.st_size < j->request.size) {
+        j->status = GOST_DAEMON_EFD;
+        return;
+    }
+
+    if (!j->request.size) {
+        return;
+    }
+
+    data = (uint8_t*)mmap(NULL, j->request.size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+    if (data == MAP_FAILED) {
+        j->status = GOST_DAEMON_EFD;
+        return;
+    }
+
+    process_direct(w, j, data);
+
+    munmap(data, j->request.size);
+}
+
+/* ECB blocks of all small requests in one multi-block call */
+static void process_ecb(worker *w, job **jobs, unsigned n, int encrypt) {
+    unsigned i, blocks = 0, b;
+
+    for (i = 0; i < n; i++) {
+        b = size_blocks(jobs[i]->request.size);
+        memcpy(w->stage + blocks * 2, jobs[i]->data, b * 8);
+        blocks += b;
+    }
+
+    if (encrypt) {
+        gost89_encrypt_blocks(&w->ctx, w->stage, w->stage, blocks);
+    } else {
+        gost89_decrypt_blocks(&w->ctx, w->stage, w->stage, blocks);
+    }
+
+    for (i = 0, blocks = 0; i < n; i++) {
+        b = size_blocks(jobs[i]->request.size);
+        memcpy(jobs[i]->data, w->stage + blocks * 2, b * 8);
+        blocks += b;
+    }
+}
+
+/* The initial counters of all CTR requests, then their keystream, each in one multi-block call */
+static void process_ctr(worker *w, job **jobs, unsigned n) {
+    uint32_t iv[BATCH_JOBS * 2], *data;
+    unsigned i, k, blocks = 0, b;
+
+    for (i = 0; i < n; i++) {
+        iv[i * 2] = jobs[i]->request.iv[0];
+        iv[i * 2 + 1] = jobs[i]->request.iv[1];
+    }
+
+    gost89_encrypt_blocks(&w->ctx, iv, iv, n);
+
+    for (i = 0; i < n; i++) {
+        b = size_blocks(jobs[i]->request.size);
+        w->ctx.iv[0] = iv[i * 2];
+        w->ctx.iv[1] = iv[i * 2 + 1];
+        gost89_ctr_counters(&w->ctx, w->stage + blocks * 2, b);
+        blocks += b;
+    }
+
+    gost89_encrypt_blocks(&w->ctx, w->stage, w->stage, blocks);
+
+    for (i = 0, blocks = 0; i < n; i++) {
+        b = size_blocks(jobs[i]->request.size);
+        data = (uint32_t*)jobs[i]->data;
+        for (k = 0; k < b * 2; k++) {
+            data[k] ^= w->stage[blocks * 2 + k];
+        }
+        blocks += b;
+    }
+}
+
+/* MAC chains of the requests side by side: block k of every request goes through one lane call */
+static void process_mac(worker *w, job **jobs, unsigned n) {
+    uint32_t mac[BATCH_JOBS][2], t[BATCH_JOBS][2], *data;
+    unsigned i, k, lanes, blocks, max = 0;
+
+    for (i = 0; i < n; i++) {
+        mac[i][0] = 0;
+        mac[i][1] = 0;
+        blocks = size_blocks(jobs[i]->request.size);
+        if (blocks > max) {
+            max = blocks;
+        }
+    }
+
+    for (k = 0; k < max; k++) {
+        lanes = 0;
+        for (i = 0; i < n; i++) {
+            if (size_blocks(jobs[i]->request.size) > k) {
+                data = (uint32_t*)jobs[i]->data;
+                t[lanes][0] = mac[i][0] ^ data[k * 2];
+                t[lanes][1] = mac[i][1] ^ data[k * 2 + 1];
+                lanes++;
+            }
+        }
+
+        gost89_encrypt_16_lanes(&w->ctx, w->keys, t, t, lanes);
+
+        lanes = 0;
+        for (i = 0; i < n; i++) {
+            if (size_blocks(jobs[i]->request.size) > k) {
+                mac[i][0] = t[lanes][0];
+                mac[i][1] = t[lanes][1];
+                lanes++;
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        jobs[i]->mac[0] = mac[i][0];
+        jobs[i]->mac[1] = mac[i][1];
+    }
+}
+
+static int valid_request(const gost_daemon_request *r) {
+    if (r->op == GOST_DAEMON_STATS || r->op == GOST_DAEMON_MAC) {
+        return 1;
+    }
+
+    return (r->op == GOST_DAEMON_ENCRYPT || r->op == GOST_DAEMON_DECRYPT) &&
+           r->mode >= GOST_DAEMON_ECB && r->mode <= GOST_DAEMON_CBC;
+}
+
+static void process_batch(worker *w, job **jobs, unsigned n) {
+    job *ecb_enc[BATCH_JOBS], *ecb_dec[BATCH_JOBS], *ctr[BATCH_JOBS], *mac[BATCH_JOBS];
+    unsigned n_ecb_enc = 0, n_ecb_dec = 0, n_ctr = 0, n_mac = 0, i;
+    gost_daemon_request *r;
+    job *j;
+
+    for (i = 0; i < n; i++) {
+        j = jobs[i];
+        r = &j->request;
+
+        if (j->status != GOST_DAEMON_OK) {
+            continue;
+        }
+        if (!valid_request(r)) {
+            j->status = GOST_DAEMON_EINVAL;
+        } else if (r->op == GOST_DAEMON_STATS) {
+            j->text = format_stats();
+            if (!j->text) {
+                j->status = GOST_DAEMON_ENOMEM;
+            }
+        } else if (j->fd >= 0) {
+            process_fd(w, j);
+        } else if (r->size > SMALL_SIZE) {
+            process_direct(w, j, j->data);
+        } else if (r->op == GOST_DAEMON_MAC) {
+            mac[n_mac++] = j;
+        } else if (r->mode == GOST_DAEMON_CTR) {
+            ctr[n_ctr++] = j;
+        } else if (r->mode == GOST_DAEMON_ECB) {
+            if (r->op == GOST_DAEMON_ENCRYPT) {
+                ecb_enc[n_ecb_enc++] = j;
+            } else {
+                ecb_dec[n_ecb_dec++] = j;
+            }
+        } else {
+            process_direct(w, j, j->data);
+        }
+    }
+
+    if (n_ecb_enc) {
+        process_ecb(w, ecb_enc, n_ecb_enc, 1);
+    }
+    if (n_ecb_dec) {
+        process_ecb(w, ecb_dec, n_ecb_dec, 0);
+    }
+    if (n_ctr) {
+        process_ctr(w, ctr, n_ctr);
+    }
+    if (n_mac) {
+        process_mac(w, mac, n_mac);
+    }
+}
+
+static void finish_batch(worker *w, job **jobs, unsigned n, int stolen, uint64_t started) {
+    node_stats *node = &stats.nodes[w->node];
+    uint64_t now, latency, bytes = 0, errors = 0, max = 0, buckets[LATENCY_BUCKETS];
+    unsigned i, b;
+    job *j;
+
+    memset(buckets, 0, sizeof(buckets));
+
+    for (i = 0; i < n; i++) {
+        j = jobs[i];
+
+        if (j->text) {
+            respond(j->conn, &j->request, j->status, NULL, j->text, (uint32_t)strlen(j->text));
+        } else if (j->request.op == GOST_DAEMON_MAC || j->fd >= 0) {
+            respond(j->conn, &j->request, j->status, j->mac, NULL, 0);
+        } else {
+            respond(j->conn, &j->request, j->status, NULL, j->data, j->request.size);
+        }
+
+        now = now_ns();
+        latency = now - j->queued;
+        for (b = 0; b < LATENCY_BUCKETS - 1 && latency >= (uint64_t)1000 << b; b++) {
+        }
+        buckets[b]++;
+        if (latency > max) {
+            max = latency;
+        }
+
+        if (j->status != GOST_DAEMON_OK) {
+            errors++;
+        } else if (j->request.op != GOST_DAEMON_STATS) {
+            bytes += j->request.size;
+        }
+
+        if (j->fd >= 0) {
+            close(j->fd);
+        }
+        conn_release(j->conn);
+        if (j->node_size) {
+            node_free(j->data, j->node_size);
+        } else {
+            free(j->data);
+        }
+        free(j->text);
+        free(j);
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    stats.requests += n;
+    stats.errors += errors;
+    stats.bytes += bytes;
+    stats.batches++;
+    stats.batched += n;
+    for (b = 0; b < LATENCY_BUCKETS; b++) {
+        stats.latency[b] += buckets[b];
+    }
+    if (max > stats.latency_max) {
+        stats.latency_max = max;
+    }
+    node->requests += n;
+    node->bytes += bytes;
+    node->batches++;
+    node->stolen += stolen;
+    node->busy_ns += now_ns() - started;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void *worker_run(void *arg) {
+    worker *w = (worker*)arg;
+    job *jobs[BATCH_JOBS];
+    unsigned n;
+    uint64_t started;
+    int stolen;
+
+    node_bind(w->node);
+
+    while ((n = queue_pop(w->node, jobs, BATCH_JOBS, &stolen)) > 0) {
+        started = now_ns();
+        process_batch(w, jobs, n);
+        finish_batch(w, jobs, n, stolen, started);
+    }
+
+    return NULL;
+}
+
+#define STAGE_SIZE ((size_t)BATCH_JOBS * (SMALL_SIZE + 8))
+
+/* Workers are spread over the nodes in turn, each with its memory on its own node */
+static int start_workers(worker **workers) {
+    int i, k, node;
+
+    for (i = 0; i < options.threads; i++) {
+        node = i % node_count;
+
+        workers[i] = (worker*)node_alloc(sizeof(worker), node);
+        if (!workers[i]) {
+            fprintf(stderr, "Unable to start worker threads\n");
+            return 0;
+        }
+
+        workers[i]->node = node;
+        workers[i]->ctx = master;
+        for (k = 0; k < BATCH_JOBS; k++) {
+            memcpy(workers[i]->keys[k], master.key, sizeof(master.key));
+        }
+        stats.nodes[node].workers++;
+
+        workers[i]->stage = (uint32_t*)node_alloc(STAGE_SIZE, node);
+        if (!workers[i]->stage || pthread_create(&workers[i]->thread, NULL, worker_run, workers[i])) {
+            fprintf(stderr, "Unable to start worker threads\n");
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void stop_workers(worker **workers) {
+    int i;
+
+    pthread_mutex_lock(&queue_lock);
+    queue_stop = 1;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    for (i = 0; i < options.threads; i++) {
+        pthread_join(workers[i]->thread, NULL);
+        node_free(workers[i]->stage, STAGE_SIZE);
+        node_free(workers[i], sizeof(worker));
+    }
+}
+
+/* Builds a job from a complete request; protocol errors are answered here */
+static void enqueue(connection *c, const gost_daemon_request *r, const uint8_t *payload) {
+    size_t size;
+    job *j;
+
+    j = (job*)calloc(1, sizeof(job));
+    if (!j) {
+        respond(c, r, GOST_DAEMON_ENOMEM, NULL, NULL, 0);
+        return;
+    }
+
+    j->request = *r;
+    j->fd = -1;
+    j->queued = now_ns();
+    j->node = c->node;
+
+    if (r->flags & GOST_DAEMON_FD) {
+        if (c->passed_count) {
+            j->fd = c->passed[0];
+            memmove(c->passed, c->passed + 1, --c->passed_count * sizeof(int));
+        } else {
+            j->status = GOST_DAEMON_EFD;
+        }
+    } else if (r->op != GOST_DAEMON_STATS) {
+        /*
+         * Padded to whole blocks, as the mode functions may touch the rest of the last one.
+         * Large requests are processed in place, so their buffer goes on the node that will
+         * process them; small ones are copied into the worker's stage anyway.
+         */
+        size = (r->size + 7) / 8 * 8 + 8;
+        if (options.numa && r->size > SMALL_SIZE) {
+            j->data = (uint8_t*)node_alloc(size, j->node);
+            j->node_size = size;
+        } else {
+            j->data = (uint8_t*)calloc(1, size);
+        }
+        if (!j->data) {
+            free(j);
+            respond(c, r, GOST_DAEMON_ENOMEM, NULL, NULL, 0);
+            return;
+        }
+        memcpy(j->data, payload, r->size);
+    }
+
+    pthread_mutex_lock(&ref_lock);
+    c->refs++;
+    pthread_mutex_unlock(&ref_lock);
+
+    j->conn = c;
+    queue_push(j);
+}
+
+/* Receives what is available, keeping any passed descriptors; returns 0 when the connection is done */
+static int conn_receive(connection *c) {
+    char control[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    unsigned i, count;
+    ssize_t n;
+    int *fds;
+
+    if (c->start) {
+        memmove(c->buffer, c->buffer + c->start, c->length);
+        c->start = 0;
+    }
+
+    iov.iov_base = c->buffer + c->length;
+    iov.iov_len = c->capacity - c->length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do {
+        n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return errno == EAGAIN;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+
+        fds = (int*)CMSG_DATA(cmsg);
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < count; i++) {
+            if (c->passed_count < MAX_PASSED_FDS) {
+                c->passed[c->passed_count++] = fds[i];
+            } else {
+                close(fds[i]);
+            }
+        }
+    }
+
+    c->length += n;
+
+    return n > 0;
+}
+
+/* Parses every complete request in the buffer; returns 0 on a protocol error */
+static int conn_parse(connection *c) {
+    gost_daemon_request r;
+    unsigned need;
+    uint8_t *buffer;
+
+    while (c->length >= sizeof(r)) {
+        memcpy(&r, c->buffer + c->start, sizeof(r));
+
+        if (r.magic != GOST_DAEMON_MAGIC) {
+            return 0;
+        }
+
+        need = sizeof(r);
+        if (!(r.flags & GOST_DAEMON_FD) && r.op != GOST_DAEMON_STATS) {
+            if (r.size > GOST_DAEMON_MAX_INLINE) {
+                respond(c, &r, GOST_DAEMON_ETOOBIG, NULL, NULL, 0);
+                return 0;
+            }
+            need += r.size;
+        }
+
+        if (c->length < need) {
+            if (need > c->capacity) {
+                buffer = (uint8_t*)realloc(c->buffer, need);
+                if (!buffer) {
+                    return 0;
+                }
+                c->buffer = buffer;
+                c->capacity = need;
+            }
+            break;
+        }
+
+        enqueue(c, &r, c->buffer + c->start + sizeof(r));
+
+        c->start += need;
+        c->length -= need;
+    }
+
+    return 1;
+}
+
+static connection *conn_open(int fd) {
+    connection *c;
+
+    c = (connection*)calloc(1, sizeof(connection));
+    if (!c) {
+        close(fd);
+        return NULL;
+    }
+
+    c->buffer = (uint8_t*)malloc(READ_SIZE);
+    if (!c->buffer) {
+        close(fd);
+        free(c);
+        return NULL;
+    }
+
+    c->fd = fd;
+    c->refs = 1;
+    c->reading = 1;
+    c->capacity = READ_SIZE;
+    pthread_mutex_init(&c->write_lock, NULL);
+
+    return c;
+}
+
+static void update_connections(unsigned n) {
+    pthread_mutex_lock(&stats_lock);
+    stats.connections = n;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static int open_socket() {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(options.socket) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long: %s\n", options.socket);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, options.socket);
+    unlink(options.socket);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 128)) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", options.socket, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Whether the serving thread is done with a connection: not read any more and nothing left to send */
+static int conn_done(connection *c) {
+    int done;
+
+    if (c->reading) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ref_lock);
+    done = c->refs == 1;
+    pthread_mutex_unlock(&ref_lock);
+
+    pthread_mutex_lock(&c->write_lock);
+    done = c->broken || (done && !c->out_head);
+    pthread_mutex_unlock(&c->write_lock);
+
+    return done;
+}
+
+/*
+ * One thread accepts connections, reads requests and sends the responses
+ * that workers could not. It stops reading while the queue is full, and
+ * from a client while too much output is queued for it.
+ */
+static void serve(int listen_fd) {
+    struct pollfd pfd[MAX_CONNECTIONS + 2];
+    connection *conns[MAX_CONNECTIONS], *c;
+    unsigned count = 0, accepted = 0, i, n;
+    char drain[64];
+    int fd, full, events;
+
+    while (!stopping) {
+        full = queue_full();
+
+        pfd[0].fd = listen_fd;
+        pfd[0].events = count < MAX_CONNECTIONS ? POLLIN : 0;
+        pfd[1].fd = wake_fds[0];
+        pfd[1].events = POLLIN;
+        for (i = 0; i < count; i++) {
+            c = conns[i];
+
+            pthread_mutex_lock(&c->write_lock);
+            events = c->out_head ? POLLOUT : 0;
+            if (c->reading && !full && c->out_bytes < MAX_OUTPUT) {
+                events |= POLLIN;
+            }
+            pthread_mutex_unlock(&c->write_lock);
+
+            pfd[i + 2].fd = c->fd;
+            pfd[i + 2].events = events;
+            pfd[i + 2].revents = 0;
+        }
+
+        if (poll(pfd, count + 2, 200) <= 0) {
+            continue;
+        }
+
+        if (pfd[1].revents & POLLIN) {
+            while (read(wake_fds[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            c = conns[i];
+
+            if (pfd[i + 2].revents & POLLOUT) {
+                pthread_mutex_lock(&c->write_lock);
+                out_flush(c);
+                pthread_mutex_unlock(&c->write_lock);
+            }
+
+            /* Nothing can be sent any more */
+            if (pfd[i + 2].revents & (POLLHUP | POLLERR) && !(pfd[i + 2].revents & POLLIN)) {
+                pthread_mutex_lock(&c->write_lock);
+                c->broken = 1;
+                out_clear(c);
+                pthread_mutex_unlock(&c->write_lock);
+                c->reading = 0;
+            }
+
+            if (c->reading && pfd[i + 2].revents & (POLLIN | POLLHUP | POLLERR) &&
+                !(conn_receive(c) && conn_parse(c))) {
+                /* The descriptor stays open for the responses still in flight */
+                shutdown(c->fd, SHUT_RD);
+                c->reading = 0;
+            }
+        }
+
+        for (i = 0, n = 0; i < count; i++) {
+            if (conn_done(conns[i])) {
+                conn_release(conns[i]);
+            } else {
+                conns[n++] = conns[i];
+            }
+        }
+        count = n;
+
+        if (pfd[0].revents & POLLIN) {
+            while (count < MAX_CONNECTIONS &&
+                   (fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                if ((c = conn_open(fd)) != NULL) {
+                    /* All requests of a connection stay on one node, connections go to the nodes in turn */
+                    c->node = accepted++ % node_count;
+                    conns[count++] = c;
+                }
+            }
+        }
+
+        update_connections(count);
+    }
+
+    for (i = 0; i < count; i++) {
+        conn_release(conns[i]);
+    }
+}
+
+static void print_help(const char *name) {
+    printf(
+        "\n"
+        "Usage: %s [options]\n\n"
+        "Options:\n"
+        "  -S, --socket <path>    Unix socket to listen on (default: /tmp/gost_daemon.sock)\n"
+        "  -k, --key <file>       Key file, 32 bytes (default: zero key)\n"
+        "  -s, --sbox <file>      S-box file, 128 bytes (default: identity)\n"
+        "  -t, --threads <n>      Worker threads (default: 4)\n"
+        "  -K, --kernel <name>    Block kernel: sbox4 | sbox8 | sbox8x4 (default: auto)\n"
+        "  -N, --numa             Spread workers over the NUMA nodes, pinned, with node-local memory\n",
+        name
+    );
+}
+
+static int parse_args(int argc, char **argv) {
+    int c;
+    struct option long_options[] = {
+        {"socket",  required_argument, 0, 'S'},
+        {"key",     required_argument, 0, 'k'},
+        {"sbox",    required_argument, 0, 's'},
+        {"threads", required_argument, 0, 't'},
+        {"kernel",  required_argument, 0, 'K'},
+        {"numa",    no_argument,       0, 'N'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    options.socket = "/tmp/gost_daemon.sock";
+    options.key_file = NULL;
+    options.sbox_file = NULL;
+    options.threads = 4;
+    options.kernel = GOST89_KERNEL_AUTO;
+    options.numa = 0;
+
+    while ((c = getopt_long(argc, argv, "S:k:s:t:K:Nh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'S':
+                options.socket = optarg;
+                break;
+            case 'k':
+                options.key_file = optarg;
+                break;
+            case 's':
+                options.sbox_file = optarg;
+                break;
+            case 't':
+                options.threads = atoi(optarg);
+                break;
+            case 'K':
+                options.kernel = gost89_kernel_by_name(optarg);
+                if (options.kernel < 0) {
+                    fprintf(stderr, "Unknown kernel: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'N':
+                options.numa = 1;
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    if (options.threads < 1 || options.threads > MAX_THREADS) {
+        fprintf(stderr, "Thread count must be within 1 .. %d\n", MAX_THREADS);
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    worker *workers[MAX_THREADS];
+    struct sigaction sa;
+    int fd;
+
+    if (!parse_args(argc, argv)) {
+        print_help(argv[0]);
+        return 1;
+    }
+
+    if (!init_master() || !init_nodes()) {
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fd = open_socket();
+    if (fd < 0 || pipe2(wake_fds, O_NONBLOCK | O_CLOEXEC)) {
+        return 1;
+    }
+
+    if (!start_workers(workers)) {
+        return 1;
+    }
+
+    printf("Listening on %s with %d threads, kernel %s",
+           options.socket, options.threads, gost89_kernel_name(gost89_get_kernel(&master)));
+    if (options.numa) {
+        printf(", %d NUMA node%s", node_count, node_count == 1 ? "" : "s");
+    }
+    printf("\n");
+    fflush(stdout);
+
+    serve(fd);
+
+    stop_workers(workers);
+    close(fd);
+    unlink(options.socket);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef GOST_DAEMON_H_
+#define GOST_DAEMON_H_
+
+#include <stdint.h>
+
+/*
+ * Wire protocol of gost_daemon.
+ *
+ * A client connects to the daemon's Unix stream socket and sends requests:
+ * a gost_daemon_request header followed by size bytes of payload. Requests
+ * may be pipelined; every one is answered with a gost_daemon_response
+ * carrying the same id, followed by its payload. Responses of pipelined
+ * requests can arrive out of order.
+ *
+ * With GOST_DAEMON_FD the payload is not sent inline: the header carries a
+ * shared memory descriptor (SCM_RIGHTS) holding at least size bytes, and the
+ * data is transformed in place. The response then has no payload. The
+ * descriptor must be sealed against shrinking (memfd_create with
+ * MFD_ALLOW_SEALING, then F_ADD_SEALS with F_SEAL_SHRINK); others are
+ * answered with GOST_DAEMON_EFD.
+ *
+ * Results are the same as those of the library mode functions (and
+ * gost_file) with the daemon's key and S-box and the request's IV. MAC
+ * responses return the MAC in mac; GOST_DAEMON_STATS returns the daemon
+ * metrics as a JSON object.
+ */
+
+#define GOST_DAEMON_MAGIC 0x44383947    /* "G98D" */
+
+#define GOST_DAEMON_ENCRYPT 1
+#define GOST_DAEMON_DECRYPT 2
+#define GOST_DAEMON_MAC     3
+#define GOST_DAEMON_STATS   4
+
+#define GOST_DAEMON_ECB 1
+#define GOST_DAEMON_CTR 2
+#define GOST_DAEMON_CFB 3
+#define GOST_DAEMON_CBC 4
+
+/* Request flags */
+#define GOST_DAEMON_FD 1
+
+/* Response status */
+#define GOST_DAEMON_OK          0
+#define GOST_DAEMON_EINVAL      1   /* malformed request or unknown operation */
+#define GOST_DAEMON_ETOOBIG     2   /* inline payload above GOST_DAEMON_MAX_INLINE */
+#define GOST_DAEMON_EFD         3   /* missing or unusable shared memory descriptor */
+#define GOST_DAEMON_ENOMEM      4
+
+#define GOST_DAEMON_MAX_INLINE (1 << 20)
+#define GOST_DAEMON_MAX_FD_SIZE 0xFFFFFFF8u
+
+typedef struct gost_daemon_request {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t mode;
+    uint32_t flags;
+    uint32_t size;
+    uint32_t iv[2];
+    uint64_t id;
+} gost_daemon_request;
+
+typedef struct gost_daemon_response {
+    uint32_t magic;
+    uint32_t status;
+    uint32_t size;
+    uint32_t mac[2];
+    uint32_t reserved;
+    uint64_t id;
+} gost_daemon_response;
+
+#endif /* GOST_DAEMON_H_ */
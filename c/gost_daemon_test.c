@@ -0,0 +1,477 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "gost89.h"
+#include "gost_daemon.h"
+
+/*
+ * Runs gost_daemon on a private socket and checks its answers against the
+ * library: pipelined small requests, which the daemon batches across
+ * requests, shared memory requests, and a client that does not read.
+ */
+
+#define BATCH_REQUESTS 600
+#define SMALL_SIZE 4096         /* as in gost_daemon.c: inline requests up to this size are batched */
+#define SLOW_REQUESTS 24
+
+static uint8_t test_sbox[8][16] = {
+    {4, 10, 9, 2, 13, 8, 0, 14, 6, 11, 1, 12, 7, 15, 5, 3},
+    {14, 11, 4, 12, 6, 13, 15, 10, 2, 3, 8, 1, 0, 7, 5, 9},
+    {5, 8, 1, 13, 10, 3, 4, 2, 14, 15, 12, 7, 6, 0, 9, 11},
+    {7, 13, 10, 1, 0, 8, 9, 15, 14, 4, 6, 12, 11, 2, 5, 3},
+    {6, 12, 7, 1, 5, 15, 13, 8, 4, 10, 9, 14, 0, 3, 11, 2},
+    {4, 11, 10, 0, 7, 2, 1, 13, 3, 6, 8, 5, 9, 12, 15, 14},
+    {13, 11, 4, 1, 3, 15, 5, 9, 0, 10, 14, 7, 6, 8, 2, 12},
+    {1, 15, 13, 0, 5, 7, 10, 4, 9, 2, 3, 14, 6, 11, 8, 12}
+};
+
+static char *test_key = "01234567890123456789012345678912";
+
+static char socket_path[64], key_path[64], sbox_path[64];
+static gost89_context ctx;
+static uint32_t seed = 12345;
+
+typedef struct expected {
+    uint32_t size;
+    uint32_t mac[2];
+    uint8_t *data;
+} expected;
+
+static uint32_t random32() {
+    seed = seed * 1103515245 + 12345;
+
+    return seed >> 8;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t*)data;
+    ssize_t n;
+
+    while (size) {
+        n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+static int read_all(int fd, void *data, size_t size) {
+    uint8_t *p = (uint8_t*)data;
+    ssize_t n;
+
+    while (size) {
+        n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+static int write_file(const char *filename, const void *data, size_t size) {
+    FILE *f;
+    int ok;
+
+    f = fopen(filename, "wb");
+    if (!f) {
+        return 0;
+    }
+
+    ok = fwrite(data, 1, size, f) == size;
+
+    return !fclose(f) && ok;
+}
+
+static int connect_daemon() {
+    struct sockaddr_un addr;
+    int fd, i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    /* The daemon may still be starting */
+    for (i = 0; i < 100; i++) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (!connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+            return fd;
+        }
+        close(fd);
+        usleep(50000);
+    }
+
+    return -1;
+}
+
+static pid_t start_daemon(const char *program) {
+    pid_t pid;
+    int null;
+
+    pid = fork();
+    if (pid) {
+        return pid;
+    }
+
+    null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+    }
+
+    execl(program, program, "-S", socket_path, "-k", key_path, "-s", sbox_path, "-t", "2", (char*)NULL);
+    fprintf(stderr, "Unable to run %s: %s\n", program, strerror(errno));
+    _exit(127);
+}
+
+static void init_request(gost_daemon_request *r, int op, int mode, uint32_t size, uint64_t id) {
+    memset(r, 0, sizeof(*r));
+    r->magic = GOST_DAEMON_MAGIC;
+    r->op = (uint16_t)op;
+    r->mode = (uint16_t)mode;
+    r->size = size;
+    r->iv[0] = random32();
+    r->iv[1] = random32();
+    r->id = id;
+}
+
+/* What the library gives for the request, on a zero-padded copy as the daemon pads */
+static void reference(const gost_daemon_request *r, const uint8_t *payload, expected *e) {
+    gost89_context ref = ctx;
+
+    e->size = r->size;
+    e->data = (uint8_t*)calloc(1, (r->size + 7) / 8 * 8 + 8);
+    memcpy(e->data, payload, r->size);
+
+    gost89_set_iv(&ref, (void*)r->iv);
+    gost89_set_mac(&ref, NULL);
+
+    if (r->op == GOST_DAEMON_MAC) {
+        gost89_mac(&ref, e->data, r->size);
+        e->mac[0] = ref.mac[0];
+        e->mac[1] = ref.mac[1];
+        e->size = 0;
+        return;
+    }
+
+    switch (r->mode) {
+        case GOST_DAEMON_ECB:
+            if (r->op == GOST_DAEMON_ENCRYPT) {
+                gost89_encrypt_ecb(&ref, e->data, e->data, r->size);
+            } else {
+                gost89_decrypt_ecb(&ref, e->data, e->data, r->size);
+            }
+            break;
+
+        case GOST_DAEMON_CTR:
+            gost89_init_ctr(&ref);
+            gost89_encrypt_ctr(&ref, e->data, e->data, r->size);
+            break;
+
+        case GOST_DAEMON_CFB:
+            gost89_encrypt_cfb(&ref, e->data, e->data, r->size);
+            break;
+
+        case GOST_DAEMON_CBC:
+            gost89_decrypt_cbc(&ref, e->data, e->data, r->size);
+            break;
+    }
+}
+
+static unsigned long long stats_value(const char *text, const char *name) {
+    const char *p = strstr(text, name);
+
+    return p ? strtoull(p + strlen(name), NULL, 10) : 0;
+}
+
+/*
+ * All requests are written before any response is read, so that the
+ * workers find many of them queued and run them together: ECB, CTR and MAC
+ * in their batched paths, the rest and the large ones one by one.
+ */
+static void test_batched(int fd) {
+    static const int ops[][2] = {
+        {GOST_DAEMON_ENCRYPT, GOST_DAEMON_ECB},
+        {GOST_DAEMON_DECRYPT, GOST_DAEMON_ECB},
+        {GOST_DAEMON_ENCRYPT, GOST_DAEMON_CTR},
+        {GOST_DAEMON_MAC, GOST_DAEMON_ECB},
+        {GOST_DAEMON_ENCRYPT, GOST_DAEMON_CFB},
+        {GOST_DAEMON_DECRYPT, GOST_DAEMON_CBC}
+    };
+    static uint8_t payload[SMALL_SIZE * 4];
+    expected *e;
+    gost_daemon_request r;
+    gost_daemon_response response;
+    char text[4096];
+    uint32_t size, i, k;
+    int ok = 1, seen[BATCH_REQUESTS];
+
+    e = (expected*)calloc(BATCH_REQUESTS, sizeof(expected));
+    memset(seen, 0, sizeof(seen));
+
+    for (i = 0; i < BATCH_REQUESTS && ok; i++) {
+        size = i % 50 == 49 ? SMALL_SIZE + 1 + random32() % (SMALL_SIZE * 3) : random32() % (SMALL_SIZE + 1);
+        for (k = 0; k < size; k++) {
+            payload[k] = (uint8_t)random32();
+        }
+
+        k = i % (sizeof(ops) / sizeof(ops[0]));
+        init_request(&r, ops[k][0], ops[k][1], size, i);
+        reference(&r, payload, &e[i]);
+
+        ok &= write_all(fd, &r, sizeof(r)) && write_all(fd, payload, size);
+    }
+
+    for (i = 0; i < BATCH_REQUESTS && ok; i++) {
+        ok &= read_all(fd, &response, sizeof(response)) && response.magic == GOST_DAEMON_MAGIC &&
+              response.status == GOST_DAEMON_OK && response.id < BATCH_REQUESTS && !seen[response.id];
+        if (!ok) {
+            break;
+        }
+
+        seen[response.id] = 1;
+        k = (uint32_t)response.id;
+        ok &= response.size == e[k].size && read_all(fd, payload, response.size) &&
+              !memcmp(payload, e[k].data, response.size);
+        if (!e[k].size) {
+            ok &= response.mac[0] == e[k].mac[0] && response.mac[1] == e[k].mac[1];
+        }
+    }
+
+    /* Fewer batches than requests: the batched paths did run */
+    init_request(&r, GOST_DAEMON_STATS, 0, 0, 0);
+    ok = ok && write_all(fd, &r, sizeof(r)) && read_all(fd, &response, sizeof(response)) &&
+         response.size < sizeof(text) && read_all(fd, text, response.size);
+    if (ok) {
+        text[response.size] = 0;
+        ok &= stats_value(text, "\"batches\": ") < stats_value(text, "\"requests\": ");
+    }
+
+    for (i = 0; i < BATCH_REQUESTS; i++) {
+        free(e[i].data);
+    }
+    free(e);
+
+    printf("daemon batched: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* Sends one request over shared memory, sealed or not; returns the response status or -1 */
+static int fd_request(int fd, uint8_t *data, uint32_t size, int seal, gost_daemon_request *r) {
+    char control[CMSG_SPACE(sizeof(int))];
+    gost_daemon_response response;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    uint8_t *shared;
+    int memfd, status = -1;
+
+    memfd = memfd_create("gost_daemon_test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0 || ftruncate(memfd, size) || (seal && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK))) {
+        return -1;
+    }
+
+    shared = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (shared == MAP_FAILED) {
+        close(memfd);
+        return -1;
+    }
+    memcpy(shared, data, size);
+
+    iov.iov_base = r;
+    iov.iov_len = sizeof(*r);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(*r) &&
+        read_all(fd, &response, sizeof(response)) && response.magic == GOST_DAEMON_MAGIC && !response.size) {
+        status = (int)response.status;
+        memcpy(data, shared, size);
+    }
+
+    munmap(shared, size);
+    close(memfd);
+
+    return status;
+}
+
+/* Sealed memory is transformed in place; memory the client could shrink is refused */
+static void test_fd(int fd) {
+    static uint8_t data[100003];
+    gost_daemon_request r;
+    expected e;
+    uint32_t i;
+    int ok = 1;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7 + 1);
+    }
+
+    init_request(&r, GOST_DAEMON_ENCRYPT, GOST_DAEMON_CTR, sizeof(data), 1);
+    r.flags = GOST_DAEMON_FD;
+    reference(&r, data, &e);
+
+    ok &= fd_request(fd, data, sizeof(data), 1, &r) == GOST_DAEMON_OK && !memcmp(data, e.data, sizeof(data));
+    ok &= fd_request(fd, data, sizeof(data), 0, &r) == GOST_DAEMON_EFD && !memcmp(data, e.data, sizeof(data));
+
+    free(e.data);
+
+    printf("daemon fd: %s\n", ok ? "ok" : "FAIL");
+}
+
+typedef struct slow_writer {
+    int fd;
+    int ok;
+} slow_writer;
+
+/* Large requests from a client that reads none of the answers until later */
+static void *slow_write(void *arg) {
+    slow_writer *s = (slow_writer*)arg;
+    static uint8_t payload[GOST_DAEMON_MAX_INLINE];
+    gost_daemon_request r;
+    unsigned i;
+
+    s->ok = 1;
+    for (i = 0; i < SLOW_REQUESTS && s->ok; i++) {
+        memset(&r, 0, sizeof(r));
+        r.magic = GOST_DAEMON_MAGIC;
+        r.op = GOST_DAEMON_ENCRYPT;
+        r.mode = GOST_DAEMON_CTR;
+        r.size = sizeof(payload);
+        r.id = i;
+        s->ok = write_all(s->fd, &r, sizeof(r)) && write_all(s->fd, payload, sizeof(payload));
+    }
+
+    return NULL;
+}
+
+/* A client that does not read holds neither the workers nor the other clients */
+static void test_slow_reader() {
+    static uint8_t payload[GOST_DAEMON_MAX_INLINE];
+    struct timeval timeout = {2, 0};
+    gost_daemon_request r;
+    gost_daemon_response response;
+    slow_writer slow;
+    pthread_t thread;
+    expected e;
+    uint8_t data[64];
+    unsigned i;
+    int fd, ok = 1;
+
+    slow.fd = connect_daemon();
+    fd = connect_daemon();
+    if (slow.fd < 0 || fd < 0 || pthread_create(&thread, NULL, slow_write, &slow)) {
+        printf("daemon slow reader: FAIL\n");
+        return;
+    }
+
+    /* Let the daemon answer as much as it takes from the slow client */
+    usleep(300000);
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    memset(data, 0x5A, sizeof(data));
+    init_request(&r, GOST_DAEMON_ENCRYPT, GOST_DAEMON_ECB, sizeof(data), 7);
+    reference(&r, data, &e);
+    ok &= write_all(fd, &r, sizeof(r)) && write_all(fd, data, sizeof(data)) &&
+          read_all(fd, &response, sizeof(response)) && response.status == GOST_DAEMON_OK &&
+          response.size == sizeof(data) && read_all(fd, data, sizeof(data)) && !memcmp(data, e.data, sizeof(data));
+    free(e.data);
+    close(fd);
+
+    /* Every queued answer still arrives */
+    for (i = 0; i < SLOW_REQUESTS && ok; i++) {
+        ok &= read_all(slow.fd, &response, sizeof(response)) && response.status == GOST_DAEMON_OK &&
+              response.size == sizeof(payload) && read_all(slow.fd, payload, sizeof(payload));
+    }
+
+    pthread_join(thread, NULL);
+    close(slow.fd);
+
+    printf("daemon slow reader: %s\n", ok && slow.ok ? "ok" : "FAIL");
+}
+
+int main(int argc, char **argv) {
+    uint8_t sbox[128];
+    pid_t daemon;
+    int fd, i, status;
+
+    snprintf(socket_path, sizeof(socket_path), "/tmp/gost_daemon_test.%d.sock", (int)getpid());
+    snprintf(key_path, sizeof(key_path), "/tmp/gost_daemon_test.%d.key", (int)getpid());
+    snprintf(sbox_path, sizeof(sbox_path), "/tmp/gost_daemon_test.%d.sbox", (int)getpid());
+
+    for (i = 0; i < 128; i++) {
+        sbox[i] = test_sbox[i / 16][i % 16];
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    gost89_set_sbox(&ctx, test_sbox);
+    gost89_set_key(&ctx, test_key);
+
+    if (!write_file(key_path, test_key, 32) || !write_file(sbox_path, sbox, sizeof(sbox))) {
+        fprintf(stderr, "Unable to write the key files\n");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    daemon = start_daemon(argc > 1 ? argv[1] : "./gost_daemon");
+    fd = daemon > 0 ? connect_daemon() : -1;
+
+    if (fd < 0) {
+        fprintf(stderr, "Unable to connect to the daemon\n");
+    } else {
+        test_batched(fd);
+        test_fd(fd);
+        close(fd);
+        test_slow_reader();
+    }
+
+    if (daemon > 0) {
+        kill(daemon, SIGTERM);
+        waitpid(daemon, &status, 0);
+    }
+
+    remove(key_path);
+    remove(sbox_path);
+
+    return fd < 0;
+}
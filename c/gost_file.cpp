@@ -1,8 +1,32 @@
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+#ifdef __linux__
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <sys/stat.h>
+    #include <linux/fs.h>
+    #define HAVE_O_DIRECT 1
+#endif
 
 #include "gost89.h"
+#include "gost89.hpp"
+#include "gost89_magma.h"
+#include "gost89_hash.h"
+#include "gost89_tune.h"
+#include "gost89_keystore.h"
+#include "gost89_probes.h"
 
 #if _MSC_VER
     #define strcasecmp strcmpi
@@ -40,11 +64,126 @@ enum Mode {
     MODE_NONE,
     MODE_ECB,
     MODE_CTR,
-    MODE_CFB
+    MODE_CFB,
+    MODE_CBC,
+    MODE_MGM
+};
+
+enum StatsFormat {
+    STATS_NONE,
+    STATS_TEXT,
+    STATS_JSON
+};
+
+enum Stage {
+    STAGE_READ,
+    STAGE_TRANSFORM,
+    STAGE_MAC,
+    STAGE_HASH,
+    STAGE_COMPRESS,
+    STAGE_WRITE,
+    STAGE_COUNT
 };
 
 typedef void (*EncryptFunc)(gost89_context *, void *, void *, unsigned);
 typedef void (*DecryptFunc)(gost89_context *, void *, void *, unsigned);
+typedef void (*InitFunc)(gost89_context *);
+typedef void (*MacFunc)(gost89_context *, void *, unsigned);
+typedef void (*KeyFunc)(gost89_context *, void *);
+
+/* Mode functions: the generic ones from gost89.c, or ones specialised for a built-in S-box */
+struct Engine {
+    const char *params;
+    EncryptFunc encryptEcb;
+    DecryptFunc decryptEcb;
+    InitFunc initCtr;
+    EncryptFunc encryptCtr;
+    EncryptFunc encryptCfb;
+    DecryptFunc decryptCfb;
+    EncryptFunc encryptCbc;
+    DecryptFunc decryptCbc;
+    MacFunc mac;
+    MacFunc macFinal;
+    InitFunc setSbox;
+    KeyFunc setKey;
+};
+
+template <class SboxParams>
+Engine makeEngine() {
+    typedef gost89::Cipher<SboxParams> Cipher;
+
+    Engine engine = {
+        SboxParams::name,
+        &Cipher::encryptEcb,
+        &Cipher::decryptEcb,
+        &Cipher::initCtr,
+        &Cipher::encryptCtr,
+        &Cipher::encryptCfb,
+        &Cipher::decryptCfb,
+        &Cipher::encryptCbc,
+        &Cipher::decryptCbc,
+        &Cipher::mac,
+        &Cipher::mac,
+        &Cipher::setSbox,
+        &gost89_set_key
+    };
+
+    return engine;
+}
+
+static const Engine genericEngine = {
+    NULL,
+    &gost89_encrypt_ecb,
+    &gost89_decrypt_ecb,
+    &gost89_init_ctr,
+    &gost89_encrypt_ctr,
+    &gost89_encrypt_cfb,
+    &gost89_decrypt_cfb,
+    &gost89_encrypt_cbc,
+    &gost89_decrypt_cbc,
+    &gost89_mac,
+    &gost89_mac,
+    NULL,
+    &gost89_set_key
+};
+
+/* GOST R 34.12-2015 Magma: fixed S-box, big-endian blocks, GOST R 34.13-2015 modes and OMAC */
+static const Engine magmaEngine = {
+    NULL,
+    &gost89_magma_encrypt_ecb,
+    &gost89_magma_decrypt_ecb,
+    &gost89_magma_init_ctr,
+    &gost89_magma_encrypt_ctr,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    &gost89_magma_omac,
+    &gost89_magma_omac_final,
+    &gost89_magma_set_sbox,
+    &gost89_magma_set_key
+};
+
+static const Engine builtinEngines[] = {
+    makeEngine<gost89::SboxTest>(),
+    makeEngine<gost89::SboxCryptoProA>(),
+    makeEngine<gost89::SboxCryptoProB>(),
+    makeEngine<gost89::SboxCryptoProC>(),
+    makeEngine<gost89::SboxCryptoProD>(),
+    makeEngine<gost89::SboxTC26Z>()
+};
+
+const Engine *findEngine(const char *params) {
+    unsigned i;
+
+    for (i = 0; i < sizeof(builtinEngines) / sizeof(builtinEngines[0]); i++) {
+        if (!strcasecmp(params, builtinEngines[i].params)) {
+            return &builtinEngines[i];
+        }
+    }
+
+    return NULL;
+}
 
 class IProgress {
 public:
@@ -52,6 +191,148 @@ public:
     virtual void setProgress(long done, long total) = 0;
 };
 
+class Stats {
+public:
+    long long bytes;
+    long long compressedBytes;
+    long long wallTime;
+    long long stageTime[STAGE_COUNT];
+    long peakBuffer;
+    const char *kernel;
+
+protected:
+    long long startTime;
+
+public:
+    Stats() {
+        int i;
+
+        bytes = 0;
+        compressedBytes = 0;
+        wallTime = 0;
+        for (i = 0; i < STAGE_COUNT; i++) {
+            stageTime[i] = 0;
+        }
+        peakBuffer = 0;
+        kernel = NULL;
+        startTime = 0;
+    }
+
+    static long long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+    }
+
+    void start() {
+        startTime = now();
+    }
+
+    void stop() {
+        wallTime = now() - startTime;
+    }
+
+    void useBuffer(long size) {
+        if (size > peakBuffer) {
+            peakBuffer = size;
+        }
+    }
+
+    double throughput() {
+        return wallTime ? (double)bytes / (1 << 20) / ((double)wallTime / 1e9) : 0;
+    }
+};
+
+/*
+ * Chrome trace-event recorder (chrome://tracing, ui.perfetto.dev). Every
+ * thread appends spans to a buffer of its own, without locking; the lock
+ * is only taken the first time a thread records. write() is called once
+ * the other threads are done.
+ */
+class Tracer {
+protected:
+    struct Event {
+        const char *name;
+        long long start;
+        long long end;
+    };
+
+    struct Buffer {
+        int tid;
+        const char *threadName;
+        std::vector<Event> events;
+    };
+
+    std::mutex mutex;
+    std::vector<Buffer*> buffers;
+    long long origin;
+
+public:
+    Tracer() {
+        origin = Stats::now();
+    }
+
+    ~Tracer() {
+        for (Buffer *buffer : buffers) {
+            delete buffer;
+        }
+    }
+
+    void nameThread(const char *name) {
+        getBuffer()->threadName = name;
+    }
+
+    void span(const char *name, long long start, long long end) {
+        Event event = {name, start, end};
+        getBuffer()->events.push_back(event);
+    }
+
+    bool write(const char *filename) {
+        FILE *f = fopen(filename, "w");
+
+        if (!f) {
+            fprintf(stderr, "Unable to open trace file for writing: %s\n", filename);
+            return false;
+        }
+
+        fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"gost_file\"}}");
+
+        for (Buffer *buffer : buffers) {
+            fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    buffer->tid, buffer->threadName);
+
+            for (const Event &event : buffer->events) {
+                fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        event.name, buffer->tid, (event.start - origin) / 1e3, (event.end - event.start) / 1e3);
+            }
+        }
+
+        fprintf(f, "\n]}\n");
+
+        return !fclose(f);
+    }
+
+protected:
+    Buffer *getBuffer() {
+        thread_local Tracer *owner = NULL;
+        thread_local Buffer *buffer = NULL;
+
+        if (owner != this) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            buffer = new Buffer();
+            buffer->tid = (int)buffers.size() + 1;
+            buffer->threadName = "thread";
+            buffer->events.reserve(4096);
+            buffers.push_back(buffer);
+            owner = this;
+        }
+
+        return buffer;
+    }
+};
+
 class View : public IProgress {
 protected:
     int progress;
@@ -69,10 +350,36 @@ public:
             "  -e, --encrypt      Encrypt\n"
             "  -d, --decrypt      Decrypt\n"
             "  -a, --mac          Compute a message authentication code\n"
-            "  -m, --mode <mode>  Encryption mode: ecb | ctr | cfb\n"
+            "  -m, --mode <mode>  Encryption mode: ecb | ctr | cfb | cbc | mgm\n"
+            "                     cbc takes whole 8-byte blocks, or any size with -z\n"
+            "                     mgm decryption writes the plain text before the tag\n"
+            "                     is checked, and removes the output if it fails\n"
             "  -s, --sbox <file>  S-box file\n"
+            "  -p, --params <id>  Built-in S-box: test | cryptopro-a | cryptopro-b |\n"
+            "                     cryptopro-c | cryptopro-d | tc26-z\n"
             "  -k, --key <file>   Key file\n"
+            "      --keystore <file>\n"
+            "                     Binary keystore to take the key and S-box from;\n"
+            "                     --params and --magma keep their own S-box\n"
+            "      --key-id <id>  Key id in the keystore, up to 32 bytes\n"
+            "      --keystore-add Add the --key with the --sbox or --params S-box to the\n"
+            "                     keystore as --key-id, replacing a key of that id\n"
             "  -i, --iv <value>   Initial vector, up to 16 hexadecimal digits\n"
+            "      --key-meshing  CryptoPro key meshing every 1024 bytes (ctr, cfb)\n"
+            "      --magma        GOST R 34.12-2015 Magma (ecb, ctr, mgm; --mac computes OMAC)\n"
+            "      --acpkm <n>    Magma CTR-ACPKM with n-byte sections\n"
+            "      --aad <file>   Associated data authenticated in mgm mode\n"
+            "      --hash <id>    GOST R 34.11-94 digest of the plain text in the same pass:\n"
+            "                     test | cryptopro\n"
+            "  -z, --compress     Deflate (zlib) the plain text before encryption and\n"
+            "                     inflate it after decryption (ecb, ctr, cfb, cbc)\n"
+            "      --level <n>    Compression level, 1 (fastest) .. 9 (smallest), default 6\n"
+            "      --direct       Read and write with O_DIRECT, bypassing the page cache\n"
+            "      --stats <fmt>  Show throughput and stage timings: text | json\n"
+            "      --trace <file> Write a timeline of every chunk's read, cipher, MAC and\n"
+            "                     write, per thread, as Chrome trace-event JSON\n"
+            "      --tune         Benchmark the kernels again and update the tuning cache;\n"
+            "                     the input file may then be omitted\n"
             "      --debug        Show debug info\n",
             name
         );
@@ -107,6 +414,14 @@ public:
             case MODE_CFB:
                 modeStr = "CFB";
                 break;
+
+            case MODE_CBC:
+                modeStr = "CBC";
+                break;
+
+            case MODE_MGM:
+                modeStr = "MGM";
+                break;
         }
 
         printf("%s", operationStr);
@@ -172,12 +487,70 @@ public:
     }
 
     void printIv(gost89_context *ctx) {
-        printf("IV:\t%016llx\n", *((uint64_t*)ctx->iv));
+        printf("IV:\t%016" PRIx64 "\n", (uint64_t)ctx->iv[1] << 32 | ctx->iv[0]);
     }
 
     void printMac(gost89_context *ctx) {
         printf("MAC:\t%08x\n", ctx->mac[1]);
     }
+
+    void printHash(const uint8_t *digest) {
+        int i;
+
+        printf("Hash:\t");
+        for (i = 0; i < 32; i++) {
+            printf("%02x", digest[i]);
+        }
+        puts("");
+    }
+
+    void printTuning(const gost89_tune_result *result) {
+        char batch[16];
+        int i;
+
+        printf("Tuned for %s:\n", result->model);
+        for (i = 0; i < GOST89_MODE_COUNT; i++) {
+            if (result->batch[i]) {
+                snprintf(batch, sizeof(batch), "%u", result->batch[i]);
+            } else {
+                strcpy(batch, "default");
+            }
+            printf("  %-8s %-8s batch %-8s %.1f MB/s\n", gost89_tune_mode_name(i),
+                   gost89_kernel_name(result->kernel[i]), batch, result->speed[i]);
+        }
+        puts("");
+    }
+
+    void printStats(Stats *stats, StatsFormat format) {
+        const char *names[STAGE_COUNT] = {"read", "transform", "mac", "hash", "compress", "write"};
+        int i;
+
+        if (format == STATS_JSON) {
+            printf("{\"bytes\": %lld, \"wall_ms\": %.3f, \"mbps\": %.2f, \"stages_ms\": {",
+                   stats->bytes, stats->wallTime / 1e6, stats->throughput());
+            for (i = 0; i < STAGE_COUNT; i++) {
+                printf("%s\"%s\": %.3f", i ? ", " : "", names[i], stats->stageTime[i] / 1e6);
+            }
+            printf("}, \"peak_buffer\": %ld, \"kernel\": \"%s\"", stats->peakBuffer, stats->kernel);
+            if (stats->compressedBytes) {
+                printf(", \"compressed_bytes\": %lld", stats->compressedBytes);
+            }
+            printf("}\n");
+            return;
+        }
+
+        printf("Bytes:\t%lld\n", stats->bytes);
+        printf("Time:\t%.3f ms (%.2f MB/s)\n", stats->wallTime / 1e6, stats->throughput());
+        for (i = 0; i < STAGE_COUNT; i++) {
+            printf("  %-10s %10.3f ms %5.1f%%\n", names[i], stats->stageTime[i] / 1e6,
+                   stats->wallTime ? stats->stageTime[i] * 100.0 / stats->wallTime : 0.0);
+        }
+        if (stats->compressedBytes) {
+            printf("Zlib:\t%lld bytes (%.2fx)\n", stats->compressedBytes, (double)stats->bytes / stats->compressedBytes);
+        }
+        printf("Buffer:\t%ld bytes\n", stats->peakBuffer);
+        printf("Kernel:\t%s\n", stats->kernel);
+    }
 };
 
 class Options {
@@ -186,10 +559,25 @@ public:
     Mode mode;
     bool enableMac;
     char *sboxFile;
+    const Engine *engine;
     char *keyFile;
+    char *keystoreFile;
+    char *keyId;
+    bool keystoreAdd;
     char *ivStr;
     char *inFile;
     char *outFile;
+    StatsFormat stats;
+    char *traceFile;
+    bool keyMeshing;
+    bool magma;
+    unsigned acpkm;
+    char *aadFile;
+    uint8_t (*hashSbox)[16];
+    bool compress;
+    int compressLevel;
+    bool direct;
+    bool tune;
     bool debug;
     bool error;
 
@@ -198,17 +586,31 @@ public:
         mode = MODE_NONE;
         enableMac = false;
         sboxFile = NULL;
+        engine = &genericEngine;
         keyFile = NULL;
+        keystoreFile = NULL;
+        keyId = NULL;
+        keystoreAdd = false;
         ivStr = NULL;
         inFile = NULL;
         outFile = NULL;
+        stats = STATS_NONE;
+        traceFile = NULL;
+        keyMeshing = false;
+        magma = false;
+        acpkm = 0;
+        aadFile = NULL;
+        hashSbox = NULL;
+        compress = false;
+        compressLevel = 6;
+        direct = false;
+        tune = false;
         debug = false;
         error = false;
     }
 
     bool parseArgs(int argc, char **argv) {
         int i;
-        char *arg;
         const char *msgUnknownOption = "Unknown option: %s\n";
         const char *fileExtEncrypted = ".gost", *fileExtPlain = ".plain";
 
@@ -234,6 +636,10 @@ public:
                     mode = MODE_CTR;
                 } else if (!strcasecmp(argv[i], "cfb")) {
                     mode = MODE_CFB;
+                } else if (!strcasecmp(argv[i], "cbc")) {
+                    mode = MODE_CBC;
+                } else if (!strcasecmp(argv[i], "mgm")) {
+                    mode = MODE_MGM;
                 } else {
                     fprintf(stderr, "Unknown mode: %s\n", argv[i]);
                     error = true;
@@ -241,12 +647,82 @@ public:
             } else if (match(argv[i], "s", "sbox")) {
                 i++;
                 sboxFile = argv[i];
+            } else if (match(argv[i], "p", "params")) {
+                i++;
+                engine = findEngine(argv[i]);
+                if (!engine) {
+                    fprintf(stderr, "Unknown parameter set: %s\n", argv[i]);
+                    engine = &genericEngine;
+                    error = true;
+                }
             } else if (match(argv[i], "k", "key")) {
                 i++;
                 keyFile = argv[i];
+            } else if (match(argv[i], NULL, "keystore")) {
+                i++;
+                keystoreFile = argv[i];
+            } else if (match(argv[i], NULL, "key-id")) {
+                i++;
+                keyId = argv[i];
+                if (!*keyId || strlen(keyId) > GOST89_KEYSTORE_ID_SIZE) {
+                    fprintf(stderr, "Key id must be 1 to %d bytes: %s\n", GOST89_KEYSTORE_ID_SIZE, keyId);
+                    error = true;
+                }
+            } else if (match(argv[i], NULL, "keystore-add")) {
+                keystoreAdd = true;
             } else if (match(argv[i], "i", "iv")) {
                 i++;
                 ivStr = argv[i];
+            } else if (match(argv[i], NULL, "stats")) {
+                i++;
+                if (!strcasecmp(argv[i], "text")) {
+                    stats = STATS_TEXT;
+                } else if (!strcasecmp(argv[i], "json")) {
+                    stats = STATS_JSON;
+                } else {
+                    fprintf(stderr, "Unknown stats format: %s\n", argv[i]);
+                    error = true;
+                }
+            } else if (match(argv[i], NULL, "trace")) {
+                i++;
+                traceFile = argv[i];
+            } else if (match(argv[i], NULL, "key-meshing")) {
+                keyMeshing = true;
+            } else if (match(argv[i], NULL, "magma")) {
+                magma = true;
+            } else if (match(argv[i], NULL, "acpkm")) {
+                i++;
+                acpkm = strtoul(argv[i], NULL, 10);
+                if (!acpkm || acpkm % 8) {
+                    fprintf(stderr, "ACPKM section must be a positive multiple of 8 bytes: %s\n", argv[i]);
+                    error = true;
+                }
+            } else if (match(argv[i], NULL, "aad")) {
+                i++;
+                aadFile = argv[i];
+            } else if (match(argv[i], NULL, "hash")) {
+                i++;
+                if (!strcasecmp(argv[i], "test")) {
+                    hashSbox = gost89_hash_sbox_test;
+                } else if (!strcasecmp(argv[i], "cryptopro")) {
+                    hashSbox = gost89_hash_sbox_cryptopro;
+                } else {
+                    fprintf(stderr, "Unknown hash parameter set: %s\n", argv[i]);
+                    error = true;
+                }
+            } else if (match(argv[i], "z", "compress")) {
+                compress = true;
+            } else if (match(argv[i], NULL, "level")) {
+                i++;
+                compressLevel = atoi(argv[i]);
+                if (compressLevel < 1 || compressLevel > 9) {
+                    fprintf(stderr, "Compression level must be 1 to 9: %s\n", argv[i]);
+                    error = true;
+                }
+            } else if (match(argv[i], NULL, "direct")) {
+                direct = true;
+            } else if (match(argv[i], NULL, "tune")) {
+                tune = true;
             } else if (match(argv[i], NULL, "debug")) {
                 debug = true;
             } else {
@@ -259,10 +735,70 @@ public:
             operation = OPERATION_ENCRYPT;
         }
 
+        if (sboxFile && engine->setSbox) {
+            fprintf(stderr, "Options --sbox and --params are mutually exclusive\n");
+            error = true;
+        }
+
         if (mode == MODE_NONE) {
             mode = MODE_CTR;
         }
 
+        if (keystoreFile || keyId || keystoreAdd) {
+            if (!keystoreFile || !keyId) {
+                fprintf(stderr, "Options --keystore and --key-id go together\n");
+                error = true;
+            } else if (keystoreAdd) {
+                if (!keyFile || magma) {
+                    fprintf(stderr, "Option --keystore-add needs --key and does not apply to --magma\n");
+                    error = true;
+                }
+            } else if (keyFile || sboxFile) {
+                fprintf(stderr, "Option --keystore replaces --key and --sbox\n");
+                error = true;
+            }
+        }
+
+        if (magma) {
+            if (sboxFile || engine != &genericEngine) {
+                fprintf(stderr, "Magma has a fixed S-box, --sbox and --params do not apply\n");
+                error = true;
+            }
+            if (mode != MODE_ECB && mode != MODE_CTR && mode != MODE_MGM) {
+                fprintf(stderr, "Magma supports ecb, ctr and mgm modes only\n");
+                error = true;
+            }
+            if (keyMeshing) {
+                fprintf(stderr, "Magma uses --acpkm instead of --key-meshing\n");
+                error = true;
+            }
+            engine = &magmaEngine;
+        }
+
+        if (mode == MODE_MGM) {
+            if (!magma) {
+                fprintf(stderr, "Mode mgm requires --magma\n");
+                error = true;
+            }
+            if (operation == OPERATION_MAC) {
+                fprintf(stderr, "Mode mgm authenticates while encrypting, use --encrypt or --decrypt\n");
+                error = true;
+            }
+        } else if (aadFile) {
+            fprintf(stderr, "Option --aad requires mgm mode\n");
+            error = true;
+        }
+
+        if (compress && (operation == OPERATION_MAC || mode == MODE_MGM)) {
+            fprintf(stderr, "Option --compress applies to encryption and decryption in ecb, ctr, cfb and cbc modes\n");
+            error = true;
+        }
+
+        if (acpkm && (!magma || mode != MODE_CTR)) {
+            fprintf(stderr, "Option --acpkm requires --magma and ctr mode\n");
+            error = true;
+        }
+
         if (argc > i) {
             inFile = argv[i];
 
@@ -283,11 +819,16 @@ public:
                     strcat(outFile, fileExtPlain);
                 }
             }
-        } else {
+        } else if (!tune && !keystoreAdd) {
             fprintf(stderr, "No input file specified\n");
             error = true;
         }
 
+        if (keystoreAdd && inFile) {
+            fprintf(stderr, "Option --keystore-add takes no input file\n");
+            error = true;
+        }
+
         return !error;
     }
 
@@ -343,7 +884,19 @@ public:
         return true;
     }
 
-    bool loadKey(char *filename) {
+    bool loadKey(char *filename, KeyFunc setKey) {
+        uint8_t key[32];
+
+        if (!readKey(filename, key)) {
+            return false;
+        }
+
+        setKey(&ctx, key);
+
+        return true;
+    }
+
+    bool readKey(char *filename, uint8_t *key) {
         FILE *f;
         long size;
         size_t read;
@@ -360,8 +913,8 @@ public:
             return false;
         }
 
-        read = fread(ctx.key, 1, sizeof(ctx.key), f);
-        if (read != sizeof(ctx.key)) {
+        read = fread(key, 1, 32, f);
+        if (read != 32) {
             fprintf(stderr, "Unable to read key file: %s\n", filename);
             return false;
         }
@@ -369,8 +922,60 @@ public:
         return true;
     }
 
+    /* The key of id, and its S-box unless the engine has its own */
+    bool loadKeystore(char *filename, char *id, KeyFunc setKey, bool setSbox) {
+        gost89_keystore ks;
+        const gost89_keystore_record *record;
+        uint8_t (*sbox)[16];
+
+        if (!gost89_keystore_open(&ks, filename)) {
+            fprintf(stderr, "Unable to open keystore: %s\n", filename);
+            return false;
+        }
+
+        record = gost89_keystore_find(&ks, id, &sbox);
+        if (!record) {
+            fprintf(stderr, "Key not found in keystore: %s\n", id);
+            gost89_keystore_close(&ks);
+            return false;
+        }
+
+        if (setSbox) {
+            gost89_set_sbox(&ctx, sbox);
+        }
+        setKey(&ctx, (void*)record->key);
+
+        gost89_keystore_close(&ks);
+
+        return true;
+    }
+
+    /* The key file goes in with the S-box already set */
+    bool addToKeystore(char *filename, char *id, char *keyFile) {
+        uint8_t key[32];
+
+        if (!readKey(keyFile, key)) {
+            return false;
+        }
+
+        if (!gost89_keystore_put(filename, id, key, ctx.sbox)) {
+            fprintf(stderr, "Unable to update keystore: %s\n", filename);
+            return false;
+        }
+
+        return true;
+    }
+
     bool parseIv(char *iv) {
-        return sscanf(iv, "%16llx", (uint64_t*)ctx.iv) != EOF;
+        uint64_t value;
+        int n = sscanf(iv, "%16" SCNx64, &value);
+
+        if (n == 1) {
+            ctx.iv[0] = (uint32_t)value;
+            ctx.iv[1] = (uint32_t)(value >> 32);
+        }
+
+        return n != EOF;
     }
 
     void setDefaultSbox() {
@@ -400,194 +1005,1235 @@ public:
     }
 };
 
-class File {
-public:
-    IProgress *progressObj;
+/* Reusable I/O buffers of one size, aligned for O_DIRECT; all of them are freed with the pool */
+class BufferPool {
 protected:
-    static const int IO_BUFSIZE = 65536;
-    FILE *in, *out;
+    std::mutex mutex;
+    std::vector<char*> all;
+    std::vector<char*> free;
     long size;
+    long alignment;
 
 public:
-    File() {
-        in = NULL;
-        out = NULL;
-        size = 0;
-        progressObj = NULL;
+    BufferPool(long size, long alignment) {
+        this->size = size;
+        this->alignment = alignment;
     }
 
-    bool open(char *inFilename, char *outFilename) {
-        in = fopen(inFilename, "rb");
-        if (!in) {
-            fprintf(stderr, "Unable to open file for reading: %s\n", inFilename);
-            return false;
-        }
-
-        size = filesize(in);
-        if (!size) {
-            fprintf(stderr, "Empty file: %s", inFilename);
-            return false;
-        }
-
-        if (outFilename) {
-            out = fopen(outFilename, "wb");
-            if (!out) {
-                fprintf(stderr, "Unable to open file for writing: %s\n", outFilename);
-                return false;
-            }
+    ~BufferPool() {
+        for (char *buffer : all) {
+#if _MSC_VER
+            _aligned_free(buffer);
+#else
+            ::free(buffer);
+#endif
         }
+    }
 
-        return true;
+    long getSize() {
+        return size;
     }
 
-    bool process(Operation operation, Mode mode, bool enableMac, gost89_context *ctx) {
-        switch (operation) {
-            case OPERATION_ENCRYPT:
-                return encrypt(mode, enableMac, ctx);
-            case OPERATION_DECRYPT:
-                return decrypt(mode, enableMac, ctx);
-            case OPERATION_MAC:
-                return computeMac(ctx);
-            default:
-                return false;
-        }
+    long getAllocated() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (long)all.size() * size;
     }
 
-    bool encrypt(Mode mode, bool enableMac, gost89_context *ctx) {
-        EncryptFunc encryptFunc = getEncryptFunc(mode);
-        long offset, length;
-        char buffer[IO_BUFSIZE];
+    char *get() {
+        std::lock_guard<std::mutex> lock(mutex);
+        void *buffer;
 
-        if (!encryptFunc) {
-            return false;
+        if (!free.empty()) {
+            buffer = free.back();
+            free.pop_back();
+            return (char*)buffer;
         }
 
-        if (mode == MODE_CTR) {
-            gost89_init_ctr(ctx);
+#if _MSC_VER
+        buffer = _aligned_malloc(size, alignment);
+#else
+        if (posix_memalign(&buffer, alignment, size)) {
+            buffer = NULL;
+        }
+#endif
+        if (!buffer) {
+            fprintf(stderr, "Unable to allocate %ld bytes\n", size);
+            exit(1);
         }
 
-        for (offset = 0; offset < size; offset += IO_BUFSIZE) {
-            length = size - offset;
-            if (length > IO_BUFSIZE) {
-                length = IO_BUFSIZE;
-            } else {
-                unsigned i;
-                for (i = length; i < IO_BUFSIZE; i++) {
-                    buffer[i] = '\0';
-                }
-            }
-
-            if (progressObj) {
-                progressObj->setProgress(offset, size);
-            }
+        all.push_back((char*)buffer);
 
-            if (fread(buffer, 1, length, in) != length) {
-                fprintf(stderr, "Error reading from file\n");
-                return false;
-            }
+        return (char*)buffer;
+    }
+
+    void put(char *buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        free.push_back(buffer);
+    }
+};
+
+/* A pool buffer held for the lifetime of this object */
+class PooledBuffer {
+protected:
+    BufferPool *pool;
+    char *data;
+
+public:
+    PooledBuffer(BufferPool *pool) {
+        this->pool = pool;
+        data = pool->get();
+    }
+
+    ~PooledBuffer() {
+        pool->put(data);
+    }
+
+    operator char *() {
+        return data;
+    }
+};
+
+/* A buffer of the compressed stream, passed between the compression and cipher threads */
+struct Chunk {
+    char *data;
+    long length;
+};
+
+/* Bounded FIFO of chunks; either side may abort, which wakes up and fails the other */
+class ChunkQueue {
+protected:
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Chunk> chunks;
+    size_t depth;
+    bool closed;
+    bool aborted;
+    Tracer *tracer;
+
+public:
+    ChunkQueue(size_t depth, Tracer *tracer) {
+        this->depth = depth;
+        this->tracer = tracer;
+        closed = false;
+        aborted = false;
+    }
+
+    bool push(Chunk &chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        wait(lock, "queue full", [this] { return aborted || chunks.size() < depth; });
+        if (aborted) {
+            return false;
+        }
+
+        chunks.push_back(std::move(chunk));
+        cond.notify_all();
+
+        return true;
+    }
+
+    /* False once the queue is closed and empty, or aborted */
+    bool pop(Chunk &chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        wait(lock, "queue empty", [this] { return aborted || closed || !chunks.empty(); });
+        if (aborted || chunks.empty()) {
+            return false;
+        }
+
+        chunk = std::move(chunks.front());
+        chunks.pop_front();
+        cond.notify_all();
+
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        cond.notify_all();
+    }
+
+    void abort() {
+        std::lock_guard<std::mutex> lock(mutex);
+        aborted = true;
+        cond.notify_all();
+    }
+
+    bool isAborted() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return aborted;
+    }
+
+protected:
+    /* Waits that actually block show up in the trace */
+    template <class Predicate>
+    void wait(std::unique_lock<std::mutex> &lock, const char *name, Predicate ready) {
+        long long start;
+
+        if (ready()) {
+            return;
+        }
+
+        start = tracer ? Stats::now() : 0;
+        cond.wait(lock, ready);
+        if (tracer) {
+            tracer->span(name, start, Stats::now());
+        }
+    }
+};
+
+class File {
+public:
+    IProgress *progressObj;
+    Stats *statsObj;
+    Tracer *traceObj;
+    const Engine *engine;
+    gost89_hash_context *hashObj;
+    int compressLevel;  /* zlib level, 0 for no compression stage */
+    bool direct;        /* O_DIRECT input and output, bypassing the page cache */
+protected:
+    static const int IO_BUFSIZE = 65536;
+    static const int DIRECT_BUFSIZE = 1 << 20;
+    static const int QUEUE_DEPTH = 4;
+    static const int MGM_TAGSIZE = 8;
+    FILE *in, *out, *aad;
+    long size, aadSize;
+    BufferPool *pool;
+    long bufferSize;
+    /* O_DIRECT descriptors used instead of in and out, and whether the flag is currently set on them */
+    int inFd, outFd;
+    bool inDirect, outDirect;
+    long alignment;
+
+public:
+    File() {
+        in = NULL;
+        out = NULL;
+        aad = NULL;
+        size = 0;
+        aadSize = 0;
+        progressObj = NULL;
+        statsObj = NULL;
+        traceObj = NULL;
+        engine = &genericEngine;
+        hashObj = NULL;
+        compressLevel = 0;
+        direct = false;
+        pool = NULL;
+        bufferSize = IO_BUFSIZE;
+        inFd = -1;
+        outFd = -1;
+        inDirect = false;
+        outDirect = false;
+        alignment = 1;
+    }
+
+    long getSize() {
+        return size;
+    }
+
+    long getAadSize() {
+        return aadSize;
+    }
+
+    bool open(char *inFilename, char *outFilename) {
+        if (direct) {
+            return openDirect(inFilename, outFilename);
+        }
+
+        pool = new BufferPool(bufferSize, 64);
+
+        in = fopen(inFilename, "rb");
+        if (!in) {
+            fprintf(stderr, "Unable to open file for reading: %s\n", inFilename);
+            return false;
+        }
+
+        size = filesize(in);
+        if (!size) {
+            fprintf(stderr, "Empty file: %s", inFilename);
+            return false;
+        }
+
+        if (outFilename) {
+            out = fopen(outFilename, "wb");
+            if (!out) {
+                fprintf(stderr, "Unable to open file for writing: %s\n", outFilename);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void close() {
+        if (out) {
+            fclose(out);
+            out = NULL;
+        }
+#ifdef HAVE_O_DIRECT
+        if (outFd >= 0) {
+            /* The unaligned tail went through the page cache; it is not kept there */
+            fdatasync(outFd);
+            posix_fadvise(outFd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(outFd);
+            outFd = -1;
+        }
+        if (inFd >= 0) {
+            posix_fadvise(inFd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(inFd);
+            inFd = -1;
+        }
+#endif
+    }
+
+    bool openAad(char *filename) {
+        aad = fopen(filename, "rb");
+        if (!aad) {
+            fprintf(stderr, "Unable to open associated data file: %s\n", filename);
+            return false;
+        }
+
+        aadSize = filesize(aad);
+
+        return true;
+    }
+
+    /* The library mode function doing the bulk of the work, for the tuned kernel */
+    static int tuneMode(Operation operation, Mode mode) {
+        bool decrypt = operation == OPERATION_DECRYPT;
+
+        switch (operation == OPERATION_MAC ? MODE_NONE : mode) {
+            case MODE_ECB:
+                return decrypt ? GOST89_MODE_ECB_DECRYPT : GOST89_MODE_ECB_ENCRYPT;
+            case MODE_CFB:
+                return decrypt ? GOST89_MODE_CFB_DECRYPT : GOST89_MODE_CFB_ENCRYPT;
+            case MODE_CBC:
+                return decrypt ? GOST89_MODE_CBC_DECRYPT : GOST89_MODE_CBC_ENCRYPT;
+            case MODE_NONE:
+                return GOST89_MODE_MAC;
+            default:
+                return GOST89_MODE_CTR;
+        }
+    }
+
+    bool process(Operation operation, Mode mode, bool enableMac, gost89_context *ctx) {
+        long long start = Stats::now();
+        bool result;
+
+        if (traceObj) {
+            traceObj->nameThread("main");
+        }
+
+        if (statsObj) {
+            statsObj->kernel = engine->params ? "unrolled" : gost89_kernel_name(gost89_get_mode_kernel(ctx, tuneMode(operation, mode)));
+            statsObj->start();
+        }
+
+        switch (operation) {
+            case OPERATION_ENCRYPT:
+                if (mode == MODE_MGM) {
+                    result = encryptMgm(ctx);
+                } else if (compressLevel) {
+                    result = encryptCompressed(mode, enableMac, ctx);
+                } else {
+                    result = encrypt(mode, enableMac, ctx);
+                }
+                break;
+            case OPERATION_DECRYPT:
+                if (mode == MODE_MGM) {
+                    result = decryptMgm(ctx);
+                } else if (compressLevel) {
+                    result = decryptCompressed(mode, enableMac, ctx);
+                } else {
+                    result = decrypt(mode, enableMac, ctx);
+                }
+                break;
+            case OPERATION_MAC:
+                result = computeMac(ctx);
+                break;
+            default:
+                result = false;
+        }
+
+        if (statsObj) {
+            statsObj->stop();
+            statsObj->bytes = size;
+            statsObj->useBuffer(pool->getAllocated());
+        }
+
+        if (traceObj) {
+            traceObj->span(operation == OPERATION_DECRYPT ? "decrypt" : operation == OPERATION_MAC ? "mac" : "encrypt", start, Stats::now());
+        }
+
+        return result;
+    }
+
+    bool encrypt(Mode mode, bool enableMac, gost89_context *ctx) {
+        EncryptFunc encryptFunc = getEncryptFunc(mode);
+        long offset, length;
+        PooledBuffer buffer(pool);
+        long long t = 0;
+
+        if (!encryptFunc) {
+            return false;
+        }
+
+        /* Key meshing replaces the key in ctx, the MAC is computed with the original one */
+        gost89_context macCtx = *ctx;
+
+        if (mode == MODE_CTR) {
+            engine->initCtr(ctx);
+        }
+
+        for (offset = 0; offset < size; offset += bufferSize) {
+            length = size - offset;
+            if (length > bufferSize) {
+                length = bufferSize;
+            } else {
+                memset(buffer + length, 0, bufferSize - length);
+            }
+
+            if (progressObj) {
+                progressObj->setProgress(offset, size);
+            }
+
+            lap(-1, &t);
+
+            GOST89_PROBE2(read_start, offset, length);
+
+            if (!readInput(buffer, length)) {
+                fprintf(stderr, "Error reading from file\n");
+                return false;
+            }
+
+            GOST89_PROBE2(read_done, offset, length);
+
+            lap(STAGE_READ, &t);
+
+            if (enableMac) {
+                getMacFunc(offset, length)(&macCtx, buffer, length);
+                lap(STAGE_MAC, &t);
+            }
+
+            hash(buffer, length, &t);
+
+            GOST89_PROBE2(transform_start, offset, length);
+            encryptFunc(ctx, buffer, buffer, length);
+            GOST89_PROBE2(transform_done, offset, length);
+
+            lap(STAGE_TRANSFORM, &t);
+
+            GOST89_PROBE2(write_start, offset, length);
+
+            if (!writeOutput(buffer, length)) {
+                fprintf(stderr, "Error writing to file\n");
+                return false;
+            }
+
+            GOST89_PROBE2(write_done, offset, length);
+
+            lap(STAGE_WRITE, &t);
+        }
+
+        ctx->mac[0] = macCtx.mac[0];
+        ctx->mac[1] = macCtx.mac[1];
+
+        return true;
+    }
+
+    bool decrypt(Mode mode, bool enableMac, gost89_context *ctx) {
+        DecryptFunc decryptFunc = getDecryptFunc(mode);
+        long offset, length;
+        PooledBuffer buffer(pool);
+        long long t = 0;
+
+        if (!decryptFunc) {
+            return false;
+        }
+
+        /* Key meshing replaces the key in ctx, the MAC is computed with the original one */
+        gost89_context macCtx = *ctx;
+
+        if (mode == MODE_CTR) {
+            engine->initCtr(ctx);
+        }
+
+        for (offset = 0; offset < size; offset += bufferSize) {
+            length = size - offset;
+            if (length > bufferSize) {
+                length = bufferSize;
+            } else {
+                memset(buffer + length, 0, bufferSize - length);
+            }
+
+            if (progressObj) {
+                progressObj->setProgress(offset, size);
+            }
+
+            lap(-1, &t);
+
+            GOST89_PROBE2(read_start, offset, length);
+
+            if (!readInput(buffer, length)) {
+                fprintf(stderr, "Error reading from file\n");
+                return false;
+            }
+
+            GOST89_PROBE2(read_done, offset, length);
+
+            lap(STAGE_READ, &t);
+
+            GOST89_PROBE2(transform_start, offset, length);
+            decryptFunc(ctx, buffer, buffer, length);
+            GOST89_PROBE2(transform_done, offset, length);
+
+            /* Decrypting the zero padding leaves key stream in it, which the MAC of the last block would read */
+            if (length < bufferSize) {
+                memset(buffer + length, 0, bufferSize - length);
+            }
+
+            lap(STAGE_TRANSFORM, &t);
 
             if (enableMac) {
-                gost89_mac(ctx, buffer, length);
+                getMacFunc(offset, length)(&macCtx, buffer, length);
+                lap(STAGE_MAC, &t);
+            }
+
+            hash(buffer, length, &t);
+
+            GOST89_PROBE2(write_start, offset, length);
+
+            if (!writeOutput(buffer, length)) {
+                fprintf(stderr, "Error writing to file\n");
+                return false;
+            }
+
+            GOST89_PROBE2(write_done, offset, length);
+
+            lap(STAGE_WRITE, &t);
+        }
+
+        ctx->mac[0] = macCtx.mac[0];
+        ctx->mac[1] = macCtx.mac[1];
+
+        return true;
+    }
+
+    /*
+     * Compression runs on a second thread: it reads, authenticates and
+     * deflates the plain text while this thread encrypts and writes the
+     * previous chunks. Chunks fill a pool buffer except the last, so the
+     * chained modes see whole blocks until the end, as with encrypt().
+     */
+    bool encryptCompressed(Mode mode, bool enableMac, gost89_context *ctx) {
+        EncryptFunc encryptFunc = getEncryptFunc(mode);
+        ChunkQueue queue(QUEUE_DEPTH, traceObj);
+        Chunk chunk;
+        long long t = 0, written = 0;
+        bool deflated = false, result = true;
+
+        if (!encryptFunc) {
+            return false;
+        }
+
+        gost89_context macCtx = *ctx;
+
+        if (mode == MODE_CTR) {
+            engine->initCtr(ctx);
+        }
+
+        std::thread compressor([&] {
+            if (traceObj) {
+                traceObj->nameThread("deflate");
+            }
+            deflated = deflateInput(&queue, enableMac ? &macCtx : NULL);
+        });
+
+        while (queue.pop(chunk)) {
+            lap(-1, &t);
+
+            memset(chunk.data + chunk.length, 0, bufferSize - chunk.length);
+
+            /* The block modes write the zero-padded last block whole; inflate ignores what follows the stream */
+            if (mode == MODE_ECB || mode == MODE_CBC) {
+                chunk.length = (chunk.length + 7) / 8 * 8;
+            }
+
+            encryptFunc(ctx, chunk.data, chunk.data, chunk.length);
+
+            lap(STAGE_TRANSFORM, &t);
+
+            if (!writeOutput(chunk.data, chunk.length)) {
+                fprintf(stderr, "Error writing to file\n");
+                pool->put(chunk.data);
+                queue.abort();
+                result = false;
+                break;
+            }
+
+            lap(STAGE_WRITE, &t);
+
+            written += chunk.length;
+            pool->put(chunk.data);
+        }
+
+        compressor.join();
+
+        if (statsObj) {
+            statsObj->compressedBytes = written;
+        }
+
+        ctx->mac[0] = macCtx.mac[0];
+        ctx->mac[1] = macCtx.mac[1];
+
+        return result && deflated;
+    }
+
+    /* The mirror of encryptCompressed: this thread reads and decrypts, the second one inflates and writes */
+    bool decryptCompressed(Mode mode, bool enableMac, gost89_context *ctx) {
+        DecryptFunc decryptFunc = getDecryptFunc(mode);
+        ChunkQueue queue(QUEUE_DEPTH, traceObj);
+        Chunk chunk;
+        long offset;
+        long long t = 0;
+        bool inflated = false, result = true;
+
+        if (!decryptFunc) {
+            return false;
+        }
+
+        gost89_context macCtx = *ctx;
+
+        if (mode == MODE_CTR) {
+            engine->initCtr(ctx);
+        }
+
+        if (statsObj) {
+            statsObj->compressedBytes = size;
+        }
+
+        std::thread decompressor([&] {
+            if (traceObj) {
+                traceObj->nameThread("inflate");
+            }
+            inflated = inflateOutput(&queue, enableMac ? &macCtx : NULL);
+        });
+
+        for (offset = 0; offset < size; offset += chunk.length) {
+            chunk.data = pool->get();
+            chunk.length = size - offset;
+            if (chunk.length > bufferSize) {
+                chunk.length = bufferSize;
+            } else {
+                memset(chunk.data + chunk.length, 0, bufferSize - chunk.length);
+            }
+
+            if (progressObj) {
+                progressObj->setProgress(offset, size);
+            }
+
+            lap(-1, &t);
+
+            if (!readInput(chunk.data, chunk.length)) {
+                fprintf(stderr, "Error reading from file\n");
+                queue.abort();
+                result = false;
+                break;
+            }
+
+            lap(STAGE_READ, &t);
+
+            decryptFunc(ctx, chunk.data, chunk.data, chunk.length);
+
+            lap(STAGE_TRANSFORM, &t);
+
+            if (!queue.push(chunk)) {
+                break;
+            }
+        }
+
+        queue.close();
+        decompressor.join();
+
+        ctx->mac[0] = macCtx.mac[0];
+        ctx->mac[1] = macCtx.mac[1];
+
+        return result && inflated;
+    }
+
+    /* Appends the 8-byte tag to the ciphertext */
+    bool encryptMgm(gost89_context *ctx) {
+        gost89_mgm_context mgm;
+        uint8_t tag[MGM_TAGSIZE];
+
+        if (!initMgm(&mgm, ctx)) {
+            return false;
+        }
+
+        if (!transformMgm(&mgm, size, &gost89_mgm_encrypt)) {
+            return false;
+        }
+
+        gost89_mgm_final(&mgm, tag);
+        setTag(ctx, tag);
+
+        if (!writeOutput((char*)tag, sizeof(tag))) {
+            fprintf(stderr, "Error writing to file\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    /* Expects the tag at the end of the input; the plaintext is written before the tag is checked */
+    bool decryptMgm(gost89_context *ctx) {
+        gost89_mgm_context mgm;
+        uint8_t tag[MGM_TAGSIZE], expected[MGM_TAGSIZE], diff;
+        unsigned i;
+
+        if (size < MGM_TAGSIZE) {
+            fprintf(stderr, "Input is shorter than the authentication tag\n");
+            return false;
+        }
+
+        if (!seekInput(size - MGM_TAGSIZE) || !readInput((char*)expected, sizeof(expected)) || !seekInput(0)) {
+            fprintf(stderr, "Error reading from file\n");
+            return false;
+        }
+
+        if (!initMgm(&mgm, ctx)) {
+            return false;
+        }
+
+        if (!transformMgm(&mgm, size - MGM_TAGSIZE, &gost89_mgm_decrypt)) {
+            return false;
+        }
+
+        gost89_mgm_final(&mgm, tag);
+        setTag(ctx, tag);
+
+        /* Every byte is compared, so the time taken does not tell how much of the tag matched */
+        diff = 0;
+        for (i = 0; i < sizeof(tag); i++) {
+            diff |= tag[i] ^ expected[i];
+        }
+
+        if (diff) {
+            fprintf(stderr, "Authentication failed\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool computeMac(gost89_context *ctx) {
+        long offset, length;
+        PooledBuffer buffer(pool);
+        long long t = 0;
+
+        for (offset = 0; offset < size; offset += bufferSize) {
+            length = size - offset;
+            if (length > bufferSize) {
+                length = bufferSize;
+            } else {
+                memset(buffer + length, 0, bufferSize - length);
             }
 
-            encryptFunc(ctx, buffer, buffer, length);
+            if (progressObj) {
+                progressObj->setProgress(offset, size);
+            }
 
-            if (fwrite(buffer, 1, length, out) != length) {
-                fprintf(stderr, "Error writing to file\n");
+            lap(-1, &t);
+
+            if (!readInput(buffer, length)) {
+                fprintf(stderr, "Error reading from file\n");
                 return false;
             }
+
+            lap(STAGE_READ, &t);
+
+            getMacFunc(offset, length)(ctx, buffer, length);
+
+            lap(STAGE_MAC, &t);
+
+            hash(buffer, length, &t);
         }
 
         return true;
     }
 
-    bool decrypt(Mode mode, bool enableMac, gost89_context *ctx) {
-        DecryptFunc decryptFunc = getDecryptFunc(mode);
-        long offset, length;
-        char buffer[IO_BUFSIZE];
+protected:
+    /* Feeds the plain text to the digest, if one is requested */
+    void hash(char *buffer, long length, long long *t) {
+        if (!hashObj) {
+            return;
+        }
 
-        if (!decryptFunc) {
+        gost89_hash_update(hashObj, buffer, length);
+        lap(STAGE_HASH, t);
+    }
+
+    /* Compression thread of encryptCompressed; the plain text size is known, so OMAC sees its last block */
+    bool deflateInput(ChunkQueue *queue, gost89_context *macCtx) {
+        z_stream zs;
+        Chunk chunk;
+        long offset, length;
+        PooledBuffer buffer(pool);
+        long long t = 0;
+        int flush, status;
+
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit(&zs, compressLevel) != Z_OK) {
+            fprintf(stderr, "Unable to initialise zlib\n");
+            queue->abort();
             return false;
         }
 
-        if (mode == MODE_CTR) {
-            gost89_init_ctr(ctx);
-        }
+        chunk.data = pool->get();
+        zs.next_out = (Bytef*)chunk.data;
+        zs.avail_out = bufferSize;
 
-        for (offset = 0; offset < size; offset += IO_BUFSIZE) {
+        for (offset = 0; ; offset += length) {
             length = size - offset;
-            if (length > IO_BUFSIZE) {
-                length = IO_BUFSIZE;
+            if (length > bufferSize) {
+                length = bufferSize;
             } else {
-                unsigned i;
-                for (i = length; i < IO_BUFSIZE; i++) {
-                    buffer[i] = '\0';
-                }
+                /* The MAC reads the whole last block, which must not carry the previous chunk */
+                memset(buffer + length, 0, bufferSize - length);
             }
+            flush = offset + length < size ? Z_NO_FLUSH : Z_FINISH;
 
             if (progressObj) {
                 progressObj->setProgress(offset, size);
             }
 
-            if (fread(buffer, 1, length, in) != length) {
+            lap(-1, &t);
+
+            if (!readInput(buffer, length)) {
                 fprintf(stderr, "Error reading from file\n");
+                break;
+            }
+
+            lap(STAGE_READ, &t);
+
+            if (macCtx) {
+                getMacFunc(offset, length)(macCtx, buffer, length);
+                lap(STAGE_MAC, &t);
+            }
+
+            hash(buffer, length, &t);
+
+            zs.next_in = (Bytef*)(char*)buffer;
+            zs.avail_in = length;
+
+            do {
+                status = deflate(&zs, flush);
+                lap(STAGE_COMPRESS, &t);
+
+                /* Full chunks go out as they fill up, the last one when the stream ends */
+                if (!zs.avail_out || status == Z_STREAM_END) {
+                    chunk.length = bufferSize - zs.avail_out;
+                    if (!queue->push(chunk)) {
+                        deflateEnd(&zs);
+                        return false;
+                    }
+
+                    chunk.data = pool->get();
+                    zs.next_out = (Bytef*)chunk.data;
+                    zs.avail_out = bufferSize;
+
+                    /* Time blocked on a full queue is not compression */
+                    lap(-1, &t);
+                }
+            } while (zs.avail_in || (flush == Z_FINISH && status != Z_STREAM_END));
+
+            if (flush == Z_FINISH) {
+                deflateEnd(&zs);
+                queue->close();
+                return true;
+            }
+        }
+
+        deflateEnd(&zs);
+        queue->abort();
+
+        return false;
+    }
+
+    /*
+     * Decompression thread of decryptCompressed. The plain text size is only
+     * known at the end of the stream, so one inflated buffer is held back
+     * until the next one exists, for OMAC to tell its last block.
+     */
+    bool inflateOutput(ChunkQueue *queue, gost89_context *macCtx) {
+        z_stream zs;
+        Chunk chunk;
+        PooledBuffer first(pool), second(pool);
+        char *buffers[2] = {first, second};
+        long length;
+        long long t = 0;
+        int status = Z_OK, current = 0;
+        bool held = false;
+
+        memset(&zs, 0, sizeof(zs));
+        if (inflateInit(&zs) != Z_OK) {
+            fprintf(stderr, "Unable to initialise zlib\n");
+            queue->abort();
+            return false;
+        }
+
+        zs.next_out = (Bytef*)buffers[current];
+        zs.avail_out = bufferSize;
+
+        while (status != Z_STREAM_END && queue->pop(chunk)) {
+            zs.next_in = (Bytef*)chunk.data;
+            zs.avail_in = chunk.length;
+
+            while (zs.avail_in && status != Z_STREAM_END) {
+                lap(-1, &t);
+                status = inflate(&zs, Z_NO_FLUSH);
+                lap(STAGE_COMPRESS, &t);
+
+                if (status != Z_OK && status != Z_STREAM_END) {
+                    fprintf(stderr, "Corrupt compressed data\n");
+                    break;
+                }
+
+                if (!zs.avail_out) {
+                    if (held && !writePlain(buffers[1 - current], bufferSize, false, macCtx, &t)) {
+                        status = Z_ERRNO;
+                        break;
+                    }
+
+                    held = true;
+                    current = 1 - current;
+                    zs.next_out = (Bytef*)buffers[current];
+                    zs.avail_out = bufferSize;
+                }
+            }
+
+            pool->put(chunk.data);
+
+            if (status != Z_OK && status != Z_STREAM_END) {
+                break;
+            }
+        }
+
+        inflateEnd(&zs);
+
+        if (status != Z_STREAM_END) {
+            if (status == Z_OK && !queue->isAborted()) {
+                fprintf(stderr, "Truncated compressed data\n");
+            }
+            queue->abort();
+            return false;
+        }
+
+        /* Anything after the end of the stream is ignored */
+        while (queue->pop(chunk)) {
+            pool->put(chunk.data);
+        }
+
+        length = bufferSize - zs.avail_out;
+        if (held && !writePlain(buffers[1 - current], bufferSize, !length, macCtx, &t)) {
+            return false;
+        }
+
+        return !length || writePlain(buffers[current], length, true, macCtx, &t);
+    }
+
+    /*
+     * O_DIRECT needs the buffer, the file offset and the length aligned to
+     * the logical block size of the device. Buffers come from the pool and
+     * are sized to a multiple of it, so this holds for every transfer but
+     * the last partial one (and the MGM tag), for which readInput and
+     * writeOutput drop the flag and go through the page cache.
+     */
+    bool openDirect(char *inFilename, char *outFilename) {
+#ifdef HAVE_O_DIRECT
+        struct stat st;
+
+        inFd = ::open(inFilename, O_RDONLY | O_DIRECT);
+        if (inFd < 0) {
+            fprintf(stderr, "Unable to open file for direct reading: %s: %s\n", inFilename, strerror(errno));
+            return false;
+        }
+
+        if (fstat(inFd, &st)) {
+            fprintf(stderr, "Unable to open file for direct reading: %s: %s\n", inFilename, strerror(errno));
+            return false;
+        }
+        size = (long)st.st_size;
+        if (!size) {
+            fprintf(stderr, "Empty file: %s", inFilename);
+            return false;
+        }
+        alignment = blockSize(inFd, &st);
+        inDirect = true;
+
+        if (outFilename) {
+            outFd = ::open(outFilename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+            if (outFd < 0) {
+                fprintf(stderr, "Unable to open file for direct writing: %s: %s\n", outFilename, strerror(errno));
                 return false;
             }
+            if (!fstat(outFd, &st) && blockSize(outFd, &st) > alignment) {
+                alignment = blockSize(outFd, &st);
+            }
+            outDirect = true;
+        }
 
-            decryptFunc(ctx, buffer, buffer, length);
+        bufferSize = (DIRECT_BUFSIZE + alignment - 1) / alignment * alignment;
+        pool = new BufferPool(bufferSize, alignment);
 
-            if (enableMac) {
-                gost89_mac(ctx, buffer, length);
+        return true;
+#else
+        fprintf(stderr, "Direct I/O is not supported on this platform\n");
+        return false;
+#endif
+    }
+
+#ifdef HAVE_O_DIRECT
+    /* Logical block size of the device, at least a page for the buffers */
+    static long blockSize(int fd, struct stat *st) {
+        long page = sysconf(_SC_PAGESIZE), block = st->st_blksize;
+        int sectorSize;
+
+        if (S_ISBLK(st->st_mode) && !ioctl(fd, BLKSSZGET, &sectorSize)) {
+            block = sectorSize;
+        }
+
+        return block > page ? block : page;
+    }
+
+    static bool setDirect(int fd, bool enable, bool *state) {
+        int flags;
+
+        if (*state == enable) {
+            return true;
+        }
+
+        flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, enable ? flags | O_DIRECT : flags & ~O_DIRECT)) {
+            return false;
+        }
+        *state = enable;
+
+        return true;
+    }
+
+    bool isAligned(const char *buffer, long long offset, long length) {
+        return !((uintptr_t)buffer % alignment) && !(offset % alignment) && !(length % alignment);
+    }
+#endif
+
+    bool readInput(char *buffer, long length) {
+#ifdef HAVE_O_DIRECT
+        if (inFd >= 0) {
+            long done = 0;
+            ssize_t n;
+
+            if (!setDirect(inFd, isAligned(buffer, lseek(inFd, 0, SEEK_CUR), length), &inDirect)) {
+                return false;
             }
 
-            if (fwrite(buffer, 1, length, out) != length) {
-                fprintf(stderr, "Error writing to file\n");
+            while (done < length) {
+                n = read(inFd, buffer + done, length - done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                done += n;
+            }
+
+            return true;
+        }
+#endif
+        return fread(buffer, 1, length, in) == (size_t)length;
+    }
+
+    bool writeOutput(const char *buffer, long length) {
+#ifdef HAVE_O_DIRECT
+        if (outFd >= 0) {
+            long done = 0;
+            ssize_t n;
+
+            if (!setDirect(outFd, isAligned(buffer, lseek(outFd, 0, SEEK_CUR), length), &outDirect)) {
                 return false;
             }
+
+            while (done < length) {
+                n = write(outFd, buffer + done, length - done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                done += n;
+            }
+
+            return true;
+        }
+#endif
+        return fwrite(buffer, 1, length, out) == (size_t)length;
+    }
+
+    bool seekInput(long offset) {
+#ifdef HAVE_O_DIRECT
+        if (inFd >= 0) {
+            return lseek(inFd, offset, SEEK_SET) == offset;
+        }
+#endif
+        return !fseek(in, offset, SEEK_SET);
+    }
+
+    /* Authenticates, hashes and writes inflated plain text */
+    bool writePlain(char *buffer, long length, bool last, gost89_context *macCtx, long long *t) {
+        if (length < bufferSize) {
+            memset(buffer + length, 0, bufferSize - length);
+        }
+
+        if (macCtx) {
+            (last ? engine->macFinal : engine->mac)(macCtx, buffer, length);
+            lap(STAGE_MAC, t);
         }
 
+        hash(buffer, length, t);
+
+        if (!writeOutput(buffer, length)) {
+            fprintf(stderr, "Error writing to file\n");
+            return false;
+        }
+
+        lap(STAGE_WRITE, t);
+
         return true;
     }
 
-    bool computeMac(gost89_context *ctx) {
+    /* The 64-bit nonce is taken from the initial vector, most significant byte first */
+    bool initMgm(gost89_mgm_context *mgm, gost89_context *ctx) {
+        uint64_t iv = (uint64_t)ctx->iv[1] << 32 | ctx->iv[0];
+        uint8_t nonce[8], buffer[IO_BUFSIZE];
         long offset, length;
-        char buffer[IO_BUFSIZE];
+        int i;
 
-        for (offset = 0; offset < size; offset += IO_BUFSIZE) {
-            length = size - offset;
+        for (i = 0; i < 8; i++) {
+            nonce[i] = (uint8_t)(iv >> (56 - i * 8));
+        }
+
+        gost89_mgm_init(mgm, ctx, nonce);
+
+        for (offset = 0; offset < aadSize; offset += IO_BUFSIZE) {
+            length = aadSize - offset;
             if (length > IO_BUFSIZE) {
                 length = IO_BUFSIZE;
-            } else {
-                unsigned i;
-                for (i = length; i < IO_BUFSIZE; i++) {
-                    buffer[i] = '\0';
-                }
+            }
+
+            if (fread(buffer, 1, length, aad) != (size_t)length) {
+                fprintf(stderr, "Error reading associated data\n");
+                return false;
+            }
+
+            gost89_mgm_aad(mgm, buffer, length);
+        }
+
+        return true;
+    }
+
+    bool transformMgm(gost89_mgm_context *mgm, long length, void (*transform)(gost89_mgm_context *, void *, void *, unsigned)) {
+        long offset, n;
+        PooledBuffer buffer(pool);
+        long long t = 0;
+
+        for (offset = 0; offset < length; offset += bufferSize) {
+            n = length - offset;
+            if (n > bufferSize) {
+                n = bufferSize;
             }
 
             if (progressObj) {
-                progressObj->setProgress(offset, size);
+                progressObj->setProgress(offset, length);
             }
 
-            if (fread(buffer, 1, length, in) != length) {
+            lap(-1, &t);
+
+            if (!readInput(buffer, n)) {
                 fprintf(stderr, "Error reading from file\n");
                 return false;
             }
 
-            gost89_mac(ctx, buffer, length);
+            lap(STAGE_READ, &t);
+
+            if (transform == &gost89_mgm_encrypt) {
+                hash(buffer, n, &t);
+            }
+
+            transform(mgm, buffer, buffer, n);
+
+            lap(STAGE_TRANSFORM, &t);
+
+            if (transform == &gost89_mgm_decrypt) {
+                hash(buffer, n, &t);
+            }
+
+            if (!writeOutput(buffer, n)) {
+                fprintf(stderr, "Error writing to file\n");
+                return false;
+            }
+
+            lap(STAGE_WRITE, &t);
         }
 
         return true;
     }
 
-protected:
+    /* Like OMAC, ctx->mac[1] holds the first four bytes of the tag */
+    void setTag(gost89_context *ctx, const uint8_t *tag) {
+        ctx->mac[1] = (uint32_t)tag[0] << 24 | (uint32_t)tag[1] << 16 | (uint32_t)tag[2] << 8 | tag[3];
+        ctx->mac[0] = (uint32_t)tag[4] << 24 | (uint32_t)tag[5] << 16 | (uint32_t)tag[6] << 8 | tag[7];
+    }
+
+    /* Charges the time since the previous lap to a stage; stage -1 only restarts the clock */
+    void lap(int stage, long long *t) {
+        static const char *names[STAGE_COUNT] = {"read", "cipher", "mac", "hash", "compress", "write"};
+        long long n;
+
+        if (!statsObj && !traceObj) {
+            return;
+        }
+
+        n = Stats::now();
+        if (stage >= 0) {
+            if (statsObj) {
+                statsObj->stageTime[stage] += n - *t;
+            }
+            if (traceObj) {
+                traceObj->span(names[stage], *t, n);
+            }
+        }
+        *t = n;
+    }
+
+    /* OMAC processes the last block of the message differently */
+    MacFunc getMacFunc(long offset, long length) {
+        return offset + length < size ? engine->mac : engine->macFinal;
+    }
+
     EncryptFunc getEncryptFunc(Mode mode) {
         switch (mode) {
             case MODE_ECB:
-                return &gost89_encrypt_ecb;
+                return engine->encryptEcb;
             case MODE_CTR:
-                return &gost89_encrypt_ctr;
+                return engine->encryptCtr;
             case MODE_CFB:
-                return &gost89_encrypt_cfb;
+                return engine->encryptCfb;
+            case MODE_CBC:
+                return engine->encryptCbc;
             default:
                 return NULL;
         }
@@ -596,11 +2242,13 @@ protected:
     DecryptFunc getDecryptFunc(Mode mode) {
         switch (mode) {
             case MODE_ECB:
-                return &gost89_decrypt_ecb;
+                return engine->decryptEcb;
             case MODE_CTR:
-                return &gost89_encrypt_ctr;
+                return engine->encryptCtr;
             case MODE_CFB:
-                return &gost89_decrypt_cfb;
+                return engine->decryptCfb;
+            case MODE_CBC:
+                return engine->decryptCbc;
             default:
                 return NULL;
         }
@@ -615,6 +2263,20 @@ protected:
     Options *options;
     Context *context;
     File *file;
+    Stats *stats;
+    Tracer *tracer;
+    gost89_context hashCtx;
+    gost89_hash_context hash;
+
+    /* Drops the output of a run refused after the files were opened */
+    bool abandon() {
+        file->close();
+        if (options->outFile) {
+            remove(options->outFile);
+        }
+
+        return false;
+    }
 
 public:
     App(int argc, char **argv) {
@@ -623,14 +2285,44 @@ public:
     }
 
     bool run() {
+        bool processed;
+
         if (!init()) {
             return false;
         }
 
+        if (!options->inFile) {
+            return true;
+        }
+
         if (!file->open(options->inFile, options->outFile)) {
             return false;
         }
 
+        if (options->magma && options->mode == MODE_ECB && options->operation != OPERATION_MAC && file->getSize() % 8) {
+            fprintf(stderr, "Magma ECB needs a multiple of 8 bytes: %s\n", options->inFile);
+            return abandon();
+        }
+
+        /* A cut last CBC block cannot be decrypted; compressed plain text is padded to whole blocks instead */
+        if (options->mode == MODE_CBC && options->operation != OPERATION_MAC &&
+            !(options->compress && options->operation == OPERATION_ENCRYPT) && file->getSize() % 8) {
+            fprintf(stderr, "CBC needs a multiple of 8 bytes: %s\n", options->inFile);
+            return abandon();
+        }
+
+        if (options->aadFile && !file->openAad(options->aadFile)) {
+            return false;
+        }
+
+        /* MGM lengths are counted in 32-bit bit counts */
+        if (options->mode == MODE_MGM &&
+            (file->getSize() - (options->operation == OPERATION_DECRYPT ? 8 : 0) > GOST89_MGM_MAX_SIZE ||
+             file->getAadSize() > GOST89_MGM_MAX_SIZE)) {
+            fprintf(stderr, "MGM is limited to %u bytes of data and associated data\n", GOST89_MGM_MAX_SIZE);
+            return false;
+        }
+
         if (options->debug) {
             view->printSbox(&context->ctx);
             view->printKey(&context->ctx);
@@ -644,11 +2336,26 @@ public:
 
         view->printStatus(options->operation, options->mode, options->inFile, options->outFile);
 
-        if (!file->process(options->operation, options->mode, options->enableMac, &context->ctx)) {
+        processed = file->process(options->operation, options->mode, options->enableMac, &context->ctx);
+
+        /* Failed runs are traced too, that is when a timeline helps most */
+        if (tracer) {
+            tracer->write(options->traceFile);
+        }
+
+        if (!processed) {
             view->printAbort();
+
+            /* Unauthenticated MGM plaintext is not left behind */
+            if (options->mode == MODE_MGM && options->operation == OPERATION_DECRYPT) {
+                file->close();
+                remove(options->outFile);
+            }
+
             return false;
         }
 
+        file->close();
         view->printDone();
 
         if (options->enableMac) {
@@ -656,6 +2363,21 @@ public:
             view->printMac(&context->ctx);
         }
 
+        if (options->hashSbox) {
+            uint8_t digest[32];
+
+            gost89_hash_final(&hash, digest);
+            if (!options->enableMac) {
+                puts("");
+            }
+            view->printHash(digest);
+        }
+
+        if (stats) {
+            puts("");
+            view->printStats(stats, options->stats);
+        }
+
         return true;
     }
 
@@ -664,10 +2386,22 @@ protected:
         return
             initOptions() &&
             initView() &&
+            initTuning() &&
             initContext() &&
             initFile();
     }
 
+    /* Kernels are benchmarked on the first run on a host and with --tune, otherwise taken from the cache */
+    bool initTuning() {
+        gost89_tune_result result;
+
+        if (gost89_tune_init(options->tune, &result) && (options->tune || options->debug)) {
+            view->printTuning(&result);
+        }
+
+        return true;
+    }
+
     bool initView() {
         view = new View();
 
@@ -692,12 +2426,23 @@ protected:
             if (!context->loadSbox(options->sboxFile)) {
                 return false;
             }
+        } else if (options->engine->setSbox) {
+            options->engine->setSbox(&context->ctx);
         } else {
             context->setDefaultSbox();
         }
 
-        if (options->keyFile) {
-            if (!context->loadKey(options->keyFile)) {
+        if (options->keystoreAdd) {
+            return context->addToKeystore(options->keystoreFile, options->keyId, options->keyFile);
+        }
+
+        if (options->keystoreFile) {
+            if (!context->loadKeystore(options->keystoreFile, options->keyId, options->engine->setKey,
+                                       !options->engine->setSbox && !options->magma)) {
+                return false;
+            }
+        } else if (options->keyFile) {
+            if (!context->loadKey(options->keyFile, options->engine->setKey)) {
                 return false;
             }
         } else {
@@ -714,12 +2459,50 @@ protected:
 
         context->setDefaultMac();
 
+        gost89_set_key_meshing(&context->ctx, options->keyMeshing);
+
+        if (options->magma) {
+            if (options->mode == MODE_MGM) {
+                if (context->ctx.iv[1] >> 31) {
+                    fprintf(stderr, "MGM nonce must be below 8000000000000000: %s\n", options->ivStr);
+                    return false;
+                }
+            } else if (context->ctx.iv[1]) {
+                fprintf(stderr, "Magma CTR takes a 32-bit initial vector: %s\n", options->ivStr);
+                return false;
+            }
+
+            gost89_magma_set_acpkm(&context->ctx, options->acpkm);
+        }
+
         return true;
     }
 
     bool initFile() {
         file = new File();
         file->progressObj = view;
+        file->engine = options->engine;
+        file->compressLevel = options->compress ? options->compressLevel : 0;
+        file->direct = options->direct;
+
+        if (options->hashSbox) {
+            memset(&hashCtx, 0, sizeof(hashCtx));
+            gost89_set_sbox(&hashCtx, options->hashSbox);
+            gost89_hash_init(&hash, &hashCtx);
+            file->hashObj = &hash;
+        }
+
+        stats = NULL;
+        if (options->stats != STATS_NONE) {
+            stats = new Stats();
+            file->statsObj = stats;
+        }
+
+        tracer = NULL;
+        if (options->traceFile) {
+            tracer = new Tracer();
+            file->traceObj = tracer;
+        }
 
         return true;
     }
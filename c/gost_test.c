@@ -1,9 +1,17 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
-#include <time.h>
+#include <pthread.h>
 
 #include "gost89.h"
+#include "gost89_ring.h"
+#include "gost89_magma.h"
+#include "gost89_hash.h"
+#include "gost89_keywrap.h"
+#include "gost89_tune.h"
+#include "gost89_fast.h"
+#include "gost89_keystore.h"
+#include "gost_test_hpp.h"
 
 /*
 static uint8_t test_sbox[8][16] = {
@@ -71,33 +79,6 @@ void test() {
     puts("");
 }
 
-void benchmark() {
-    int i;
-    clock_t t0, t1;
-    char a[8], b[8];
-
-    gost89_set_key(&ctx, test_key);
-    memcpy(a, "ABCDEFGH", 8);
-
-    t0 = clock();
-    for (i = 0; i < 5000000; i++) {
-        gost89_encrypt(&ctx, a, b);
-        gost89_encrypt(&ctx, b, a);
-    }
-    for (i = 0; i < 5000000; i++) {
-        gost89_decrypt(&ctx, a, b);
-        gost89_decrypt(&ctx, b, a);
-    }
-    t1 = clock();
-
-    for (i = 0; i < 8; i++) {
-        printf("%02x ", a[i]);
-    }
-    puts("");
-
-    printf("%f\n", (float)(t1 - t0) / CLOCKS_PER_SEC);
-}
-
 void error_open_read(const char *filename) {
     fprintf(stderr, "Unable to open file for reading: %s\n", filename);
 }
@@ -329,6 +310,963 @@ void test_mac() {
     printf("%08x %08x\n", ctx.mac[0], ctx.mac[1]);
 }
 
+void test_ctr_ring() {
+    static char plain[65536], expected[65536], encrypted[65536];
+    gost89_context ref, ring_ctx;
+    gost89_ctr_ring ring;
+    unsigned i, offset, size;
+    int ok = 1;
+
+    for (i = 0; i < sizeof(plain); i++) {
+        plain[i] = (char)(i * 31 + 7);
+    }
+
+    gost89_set_key(&ctx, test_key);
+    gost89_set_iv(&ctx, test_iv);
+    gost89_init_ctr(&ctx);
+    ref = ctx;
+    ring_ctx = ctx;
+
+    gost89_ctr_ring_init(&ring, &ring_ctx, 256);
+    gost89_ctr_ring_fill(&ring, 100);
+    gost89_ctr_ring_start(&ring);
+
+    /* Message sizes from one block to several ring lengths */
+    for (offset = 0, size = 8; offset + size <= sizeof(plain); offset += size, size = size * 3 % 4096 + 8) {
+        size &= ~7u;
+        gost89_encrypt_ctr(&ref, plain + offset, expected + offset, size);
+        gost89_ctr_ring_encrypt(&ring, plain + offset, encrypted + offset, size);
+
+        if (memcmp(expected + offset, encrypted + offset, size)) {
+            ok = 0;
+        }
+    }
+
+    gost89_ctr_ring_free(&ring);
+
+    /* Partial blocks take a whole keystream block, as the library does on a zero-padded copy */
+    ref = ctx;
+    ring_ctx = ctx;
+    gost89_ctr_ring_init(&ring, &ring_ctx, 32);
+    gost89_ctr_ring_start(&ring);
+
+    for (offset = 0, size = 1; offset + size <= sizeof(plain); offset += size, size = size * 5 % 3001 + 1) {
+        memset(expected, 0, (size + 7) & ~7u);
+        memcpy(expected, plain + offset, size);
+        gost89_encrypt_ctr(&ref, expected, expected, (size + 7) & ~7u);
+
+        /* Every other message in place, filling the ring from this thread as well */
+        if (offset & 1) {
+            memcpy(encrypted, plain + offset, size);
+            gost89_ctr_ring_fill(&ring, 16);
+            gost89_ctr_ring_encrypt(&ring, encrypted, encrypted, size);
+        } else {
+            gost89_ctr_ring_encrypt(&ring, plain + offset, encrypted, size);
+        }
+
+        if (memcmp(expected, encrypted, size)) {
+            ok = 0;
+        }
+    }
+
+    gost89_ctr_ring_free(&ring);
+
+    printf("ctr ring: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* Every kernel must match the nibble-table one, and CBC must decrypt in place */
+void test_kernels() {
+    static const int junk[] = {-7, GOST89_KERNEL_COUNT, 0x5A5A5A5A};
+    static char plain[4104], expected[4104], encrypted[4104];
+    gost89_context ref, k_ctx;
+    unsigned i, size;
+    int kernel, ok = 1;
+
+    for (i = 0; i < sizeof(plain); i++) {
+        plain[i] = (char)(i * 17 + 3);
+    }
+
+    gost89_set_key(&ctx, test_key);
+    gost89_set_iv(&ctx, test_iv);
+
+    for (kernel = GOST89_KERNEL_AUTO; kernel < GOST89_KERNEL_COUNT; kernel++) {
+        for (size = 8; size <= sizeof(plain); size += 296) {
+            ref = ctx;
+            k_ctx = ctx;
+            gost89_set_kernel(&ref, GOST89_KERNEL_SBOX4);
+            gost89_set_kernel(&k_ctx, kernel);
+
+            gost89_encrypt_ecb(&ref, plain, expected, size);
+            gost89_encrypt_ecb(&k_ctx, plain, encrypted, size);
+            ok &= !memcmp(expected, encrypted, size);
+
+            gost89_encrypt_ctr(&ref, plain, expected, size);
+            gost89_encrypt_ctr(&k_ctx, plain, encrypted, size);
+            ok &= !memcmp(expected, encrypted, size);
+
+            gost89_decrypt_cfb(&ref, plain, expected, size);
+            gost89_decrypt_cfb(&k_ctx, plain, encrypted, size);
+            ok &= !memcmp(expected, encrypted, size);
+
+            ref.iv[0] = k_ctx.iv[0] = ctx.iv[0];
+            ref.iv[1] = k_ctx.iv[1] = ctx.iv[1];
+            gost89_encrypt_cbc(&ref, plain, expected, size);
+            gost89_encrypt_cbc(&k_ctx, plain, encrypted, size);
+            ok &= !memcmp(expected, encrypted, size);
+
+            k_ctx.iv[0] = ctx.iv[0];
+            k_ctx.iv[1] = ctx.iv[1];
+            gost89_decrypt_cbc(&k_ctx, encrypted, encrypted, size);
+            ok &= !memcmp(plain, encrypted, size);
+        }
+    }
+
+    /* An unset kernel runs as auto, counted in range, and gost89_set_key resets it */
+    gost89_set_stats(1);
+    for (i = 0; i < sizeof(junk) / sizeof(junk[0]); i++) {
+        k_ctx = ctx;
+        k_ctx.kernel = junk[i];
+        ok &= gost89_get_kernel(&k_ctx) == GOST89_KERNEL_SBOX8_X4;
+        gost89_encrypt_ecb(&k_ctx, plain, encrypted, 64);
+        gost89_set_key(&k_ctx, test_key);
+        ok &= k_ctx.kernel == GOST89_KERNEL_AUTO;
+    }
+    gost89_set_stats(0);
+    gost89_encrypt_ecb(&ctx, plain, expected, 64);
+    ok &= !memcmp(expected, encrypted, 64);
+
+    printf("kernels: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* Key meshing against a block-at-a-time reference that rebuilds the key with gost89_set_key */
+void test_key_meshing() {
+    static const uint8_t constant[32] = {
+        0x69, 0x00, 0x72, 0x22, 0x64, 0xC9, 0x04, 0x23, 0x8D, 0x3A, 0xDB, 0x96, 0x46, 0xE9, 0x2A, 0xC4,
+        0x18, 0xFE, 0xAC, 0x94, 0x00, 0xED, 0x07, 0x12, 0xC0, 0x86, 0xDC, 0xC2, 0xEF, 0x4C, 0xA9, 0x2B
+    };
+    static char plain[5000], expected[5000], encrypted[5000];
+    gost89_context ref, m_ctx;
+    uint32_t key[8];
+    unsigned i, offset, size;
+    int ok = 1;
+
+    for (i = 0; i < sizeof(plain); i++) {
+        plain[i] = (char)(i * 11 + 5);
+    }
+
+    gost89_set_key(&ctx, test_key);
+    gost89_set_iv(&ctx, test_iv);
+
+    /* CFB */
+    ref = ctx;
+    for (i = 0; i < sizeof(plain); i += 8) {
+        if (i && i % 1024 == 0) {
+            memcpy(key, constant, sizeof(key));
+            gost89_decrypt_ecb(&ref, key, key, sizeof(key));
+            gost89_set_key(&ref, key);
+            gost89_encrypt(&ref, ref.iv, ref.iv);
+        }
+        gost89_encrypt_cfb(&ref, plain + i, expected + i, 8);
+    }
+
+    m_ctx = ctx;
+    gost89_set_key_meshing(&m_ctx, 1);
+    for (offset = 0, size = 8; offset < sizeof(plain); offset += size, size = (size * 5 + 8) % 1500 & ~7u) {
+        if (size > sizeof(plain) - offset) {
+            size = sizeof(plain) - offset;
+        }
+        gost89_encrypt_cfb(&m_ctx, plain + offset, encrypted + offset, size);
+    }
+    ok &= !memcmp(expected, encrypted, sizeof(plain));
+
+    m_ctx = ctx;
+    gost89_set_key_meshing(&m_ctx, 1);
+    gost89_decrypt_cfb(&m_ctx, expected, encrypted, sizeof(plain));
+    ok &= !memcmp(plain, encrypted, sizeof(plain));
+
+    /* CTR */
+    ref = ctx;
+    gost89_init_ctr(&ref);
+    for (i = 0; i < sizeof(plain); i += 8) {
+        if (i && i % 1024 == 0) {
+            memcpy(key, constant, sizeof(key));
+            gost89_decrypt_ecb(&ref, key, key, sizeof(key));
+            gost89_set_key(&ref, key);
+            gost89_encrypt(&ref, ref.iv, ref.iv);
+        }
+        gost89_encrypt_ctr(&ref, plain + i, expected + i, 8);
+    }
+
+    m_ctx = ctx;
+    gost89_set_key_meshing(&m_ctx, 1);
+    gost89_init_ctr(&m_ctx);
+    for (offset = 0, size = 8; offset < sizeof(plain); offset += size, size = (size * 3 + 16) % 2100 & ~7u) {
+        if (size > sizeof(plain) - offset) {
+            size = sizeof(plain) - offset;
+        }
+        gost89_encrypt_ctr(&m_ctx, plain + offset, encrypted + offset, size);
+    }
+    ok &= !memcmp(expected, encrypted, sizeof(plain));
+
+    /* A context from dirty memory is unmeshed once its key is set, here with mesh_size 0 */
+    ref = ctx;
+    gost89_set_key_meshing(&ref, 0);
+    gost89_init_ctr(&ref);
+    gost89_encrypt_ctr(&ref, plain, expected, sizeof(plain));
+
+    memset(&m_ctx, 0, sizeof(m_ctx));
+    m_ctx.key_meshing = 1;
+    gost89_set_sbox(&m_ctx, test_sbox);
+    gost89_set_key(&m_ctx, test_key);
+    gost89_set_iv(&m_ctx, test_iv);
+    gost89_init_ctr(&m_ctx);
+    gost89_encrypt_ctr(&m_ctx, plain, encrypted, sizeof(plain));
+    ok &= !memcmp(expected, encrypted, sizeof(plain));
+
+    printf("key meshing: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* GOST R 34.12-2015 / 34.13-2015 examples and the Magma CTR-ACPKM example from RFC 8645 */
+void test_magma() {
+    static uint8_t key[32] = {
+        0xFF, 0xEE, 0xDD, 0xCC, 0xBB, 0xAA, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00,
+        0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+    };
+    static uint8_t plain[32] = {
+        0x92, 0xDE, 0xF0, 0x6B, 0x3C, 0x13, 0x0A, 0x59, 0xDB, 0x54, 0xC7, 0x04, 0xF8, 0x18, 0x9D, 0x20,
+        0x4A, 0x98, 0xFB, 0x2E, 0x67, 0xA8, 0x02, 0x4C, 0x89, 0x12, 0x40, 0x9B, 0x17, 0xB5, 0x7E, 0x41
+    };
+    static uint8_t ecb[32] = {
+        0x2B, 0x07, 0x3F, 0x04, 0x94, 0xF3, 0x72, 0xA0, 0xDE, 0x70, 0xE7, 0x15, 0xD3, 0x55, 0x6E, 0x48,
+        0x11, 0xD8, 0xD9, 0xE9, 0xEA, 0xCF, 0xBC, 0x1E, 0x7C, 0x68, 0x26, 0x09, 0x96, 0xC6, 0x7E, 0xFB
+    };
+    static uint8_t ctr[32] = {
+        0x4E, 0x98, 0x11, 0x0C, 0x97, 0xB7, 0xB9, 0x3C, 0x3E, 0x25, 0x0D, 0x93, 0xD6, 0xE8, 0x5D, 0x69,
+        0x13, 0x6D, 0x86, 0x88, 0x07, 0xB2, 0xDB, 0xEF, 0x56, 0x8E, 0xB6, 0x80, 0xAB, 0x52, 0xA1, 0x2D
+    };
+    static uint8_t omac[8] = {0x15, 0x4E, 0x72, 0x10, 0x20, 0x30, 0xC5, 0xBB};
+    static uint8_t acpkm_key[32] = {
+        0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10, 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF
+    };
+    static uint8_t acpkm_plain[56] = {
+        0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x00, 0xFF, 0xEE, 0xDD, 0xCC, 0xBB, 0xAA, 0x99, 0x88,
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xEE, 0xFF, 0x0A,
+        0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xEE, 0xFF, 0x0A, 0x00,
+        0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99
+    };
+    static uint8_t acpkm[56] = {
+        0x2A, 0xB8, 0x1D, 0xEE, 0xEB, 0x1E, 0x4C, 0xAB, 0x68, 0xE1, 0x04, 0xC4, 0xBD, 0x6B, 0x94, 0xEA,
+        0xC7, 0x2C, 0x67, 0xAF, 0x6C, 0x2E, 0x5B, 0x6B, 0x0E, 0xAF, 0xB6, 0x17, 0x70, 0xF1, 0xB3, 0x2E,
+        0xA1, 0xAE, 0x71, 0x14, 0x9E, 0xED, 0x13, 0x82, 0xAB, 0xD4, 0x67, 0x18, 0x06, 0x72, 0xEC, 0x6F,
+        0x84, 0xA2, 0xF1, 0x5B, 0x3F, 0xCA, 0x72, 0xC1
+    };
+    gost89_context m_ctx;
+    uint8_t out[56];
+    int ok = 1;
+
+    memset(&m_ctx, 0, sizeof(m_ctx));
+    gost89_magma_set_sbox(&m_ctx);
+    gost89_magma_set_key(&m_ctx, key);
+
+    gost89_magma_encrypt_ecb(&m_ctx, plain, out, sizeof(plain));
+    ok &= !memcmp(out, ecb, sizeof(ecb));
+
+    gost89_magma_decrypt_ecb(&m_ctx, out, out, sizeof(ecb));
+    ok &= !memcmp(out, plain, sizeof(plain));
+
+    m_ctx.iv[0] = 0x12345678;
+    gost89_magma_init_ctr(&m_ctx);
+    gost89_magma_encrypt_ctr(&m_ctx, plain, out, sizeof(plain));
+    ok &= !memcmp(out, ctr, sizeof(ctr));
+
+    gost89_set_mac(&m_ctx, NULL);
+    gost89_magma_omac(&m_ctx, plain, 16);
+    gost89_magma_omac_final(&m_ctx, plain + 16, 16);
+    gost89_magma_get_mac(&m_ctx, out);
+    ok &= !memcmp(out, omac, sizeof(omac));
+
+    gost89_magma_set_key(&m_ctx, acpkm_key);
+    gost89_magma_set_acpkm(&m_ctx, 16);
+    m_ctx.iv[0] = 0x12345678;
+    gost89_magma_init_ctr(&m_ctx);
+    gost89_magma_encrypt_ctr(&m_ctx, acpkm_plain, out, 24);
+    gost89_magma_encrypt_ctr(&m_ctx, acpkm_plain + 24, out + 24, sizeof(acpkm_plain) - 24);
+    ok &= !memcmp(out, acpkm, sizeof(acpkm));
+
+    printf("magma: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* RFC 9058 example for Magma, followed by chunked, in-place and tampered variants */
+void test_mgm() {
+    static uint8_t key[32] = {
+        0xFF, 0xEE, 0xDD, 0xCC, 0xBB, 0xAA, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00,
+        0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+    };
+    static uint8_t nonce[8] = {0x12, 0xDE, 0xF0, 0x6B, 0x3C, 0x13, 0x0A, 0x59};
+    static uint8_t aad[41] = {
+        0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+        0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,
+        0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0xEA
+    };
+    static uint8_t plain[67] = {
+        0xFF, 0xEE, 0xDD, 0xCC, 0xBB, 0xAA, 0x99, 0x88, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x00,
+        0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xEE, 0xFF, 0x0A, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+        0x99, 0xAA, 0xBB, 0xCC, 0xEE, 0xFF, 0x0A, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+        0xAA, 0xBB, 0xCC, 0xEE, 0xFF, 0x0A, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+        0xAA, 0xBB, 0xCC
+    };
+    static uint8_t encrypted[67] = {
+        0xC7, 0x95, 0x06, 0x6C, 0x5F, 0x9E, 0xA0, 0x3B, 0x85, 0x11, 0x33, 0x42, 0x45, 0x91, 0x85, 0xAE,
+        0x1F, 0x2E, 0x00, 0xD6, 0xBF, 0x2B, 0x78, 0x5D, 0x94, 0x04, 0x70, 0xB8, 0xBB, 0x9C, 0x8E, 0x7D,
+        0x9A, 0x5D, 0xD3, 0x73, 0x1F, 0x7D, 0xDC, 0x70, 0xEC, 0x27, 0xCB, 0x0A, 0xCE, 0x6F, 0xA5, 0x76,
+        0x70, 0xF6, 0x5C, 0x64, 0x6A, 0xBB, 0x75, 0xD5, 0x47, 0xAA, 0x37, 0xC3, 0xBC, 0xB5, 0xC3, 0x4E,
+        0x03, 0xBB, 0x9C
+    };
+    static uint8_t tag[8] = {0xA7, 0x92, 0x80, 0x69, 0xAA, 0x10, 0xFD, 0x10};
+    gost89_context m_ctx;
+    gost89_mgm_context mgm;
+    uint8_t out[67], t[8];
+    int ok = 1, clmul;
+
+    memset(&m_ctx, 0, sizeof(m_ctx));
+    gost89_magma_set_sbox(&m_ctx);
+    gost89_magma_set_key(&m_ctx, key);
+
+    for (clmul = 0; clmul < 2; clmul++) {
+        gost89_mgm_init(&mgm, &m_ctx, nonce);
+        mgm.clmul &= clmul;
+        gost89_mgm_aad(&mgm, aad, sizeof(aad));
+        gost89_mgm_encrypt(&mgm, plain, out, sizeof(plain));
+        gost89_mgm_final(&mgm, t);
+        ok &= !memcmp(out, encrypted, sizeof(encrypted));
+        ok &= !memcmp(t, tag, sizeof(tag));
+    }
+
+    memcpy(out, encrypted, sizeof(encrypted));
+    gost89_mgm_init(&mgm, &m_ctx, nonce);
+    gost89_mgm_aad(&mgm, aad, 16);
+    gost89_mgm_aad(&mgm, aad + 16, sizeof(aad) - 16);
+    gost89_mgm_decrypt(&mgm, out, out, 24);
+    gost89_mgm_decrypt(&mgm, out + 24, out + 24, sizeof(out) - 24);
+    gost89_mgm_final(&mgm, t);
+    ok &= !memcmp(out, plain, sizeof(plain));
+    ok &= !memcmp(t, tag, sizeof(tag));
+
+    out[0] ^= 1;
+    gost89_mgm_init(&mgm, &m_ctx, nonce);
+    gost89_mgm_aad(&mgm, aad, sizeof(aad));
+    gost89_mgm_encrypt(&mgm, out, out, sizeof(out));
+    gost89_mgm_final(&mgm, t);
+    ok &= memcmp(t, tag, sizeof(tag)) != 0;
+
+    printf("mgm: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* GOST R 34.11-94 examples for both parameter sets, hashed in one piece and in uneven pieces */
+void test_hash() {
+    static const char *messages[3] = {"", "abc", "Suppose the original message has length = 50 bytes"};
+    static uint8_t test[3][32] = {
+        {
+            0xCE, 0x85, 0xB9, 0x9C, 0xC4, 0x67, 0x52, 0xFF, 0xFE, 0xE3, 0x5C, 0xAB, 0x9A, 0x7B, 0x02, 0x78,
+            0xAB, 0xB4, 0xC2, 0xD2, 0x05, 0x5C, 0xFF, 0x68, 0x5A, 0xF4, 0x91, 0x2C, 0x49, 0x49, 0x0F, 0x8D
+        },
+        {
+            0xF3, 0x13, 0x43, 0x48, 0xC4, 0x4F, 0xB1, 0xB2, 0xA2, 0x77, 0x72, 0x9E, 0x22, 0x85, 0xEB, 0xB5,
+            0xCB, 0x5E, 0x0F, 0x29, 0xC9, 0x75, 0xBC, 0x75, 0x3B, 0x70, 0x49, 0x7C, 0x06, 0xA4, 0xD5, 0x1D
+        },
+        {
+            0x47, 0x1A, 0xBA, 0x57, 0xA6, 0x0A, 0x77, 0x0D, 0x3A, 0x76, 0x13, 0x06, 0x35, 0xC1, 0xFB, 0xEA,
+            0x4E, 0xF1, 0x4D, 0xE5, 0x1F, 0x78, 0xB4, 0xAE, 0x57, 0xDD, 0x89, 0x3B, 0x62, 0xF5, 0x52, 0x08
+        }
+    };
+    static uint8_t cryptopro[2][32] = {
+        {
+            0x98, 0x1E, 0x5F, 0x3C, 0xA3, 0x0C, 0x84, 0x14, 0x87, 0x83, 0x0F, 0x84, 0xFB, 0x43, 0x3E, 0x13,
+            0xAC, 0x11, 0x01, 0x56, 0x9B, 0x9C, 0x13, 0x58, 0x4A, 0xC4, 0x83, 0x23, 0x4C, 0xD6, 0x56, 0xC0
+        },
+        {
+            0xB2, 0x85, 0x05, 0x6D, 0xBF, 0x18, 0xD7, 0x39, 0x2D, 0x76, 0x77, 0x36, 0x95, 0x24, 0xDD, 0x14,
+            0x74, 0x74, 0x59, 0xED, 0x81, 0x43, 0x99, 0x7E, 0x16, 0x3B, 0x29, 0x86, 0xF9, 0x2F, 0xD4, 0x2C
+        }
+    };
+    gost89_context h_ctx;
+    gost89_hash_context hash;
+    uint8_t digest[32];
+    unsigned i, size;
+    int kernel, ok = 1;
+
+    memset(&h_ctx, 0, sizeof(h_ctx));
+
+    for (kernel = GOST89_KERNEL_SBOX4; kernel < GOST89_KERNEL_COUNT; kernel++) {
+        gost89_set_kernel(&h_ctx, kernel);
+
+        gost89_set_sbox(&h_ctx, gost89_hash_sbox_test);
+        for (i = 0; i < 3; i++) {
+            size = strlen(messages[i]);
+            gost89_hash_init(&hash, &h_ctx);
+            gost89_hash_update(&hash, (void*)messages[i], size / 3);
+            gost89_hash_update(&hash, (void*)(messages[i] + size / 3), size - size / 3);
+            gost89_hash_final(&hash, digest);
+            ok &= !memcmp(digest, test[i], sizeof(digest));
+        }
+
+        gost89_set_sbox(&h_ctx, gost89_hash_sbox_cryptopro);
+        for (i = 0; i < 2; i++) {
+            gost89_hash_init(&hash, &h_ctx);
+            gost89_hash_update(&hash, (void*)messages[i], strlen(messages[i]));
+            gost89_hash_final(&hash, digest);
+            ok &= !memcmp(digest, cryptopro[i], sizeof(digest));
+        }
+    }
+
+    printf("hash: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* Reference key wrap with the plain context API, one key at a time */
+static void key_wrap_reference(gost89_context *kek, int algorithm, uint8_t *ukm, uint8_t *cek, uint8_t *wrapped) {
+    gost89_context w_ctx = *kek;
+    uint32_t key[8], iv[2];
+    int i, j;
+
+    if (algorithm == GOST89_KEY_WRAP_CRYPTOPRO) {
+        for (i = 0; i < 8; i++) {
+            memcpy(key, w_ctx.key, sizeof(key));
+            iv[0] = 0;
+            iv[1] = 0;
+            for (j = 0; j < 8; j++) {
+                iv[ukm[i] >> j & 1 ? 0 : 1] += key[j];
+            }
+            gost89_set_iv(&w_ctx, iv);
+            gost89_encrypt_cfb(&w_ctx, key, key, sizeof(key));
+            gost89_set_key(&w_ctx, key);
+        }
+    }
+
+    gost89_set_mac(&w_ctx, ukm);
+    gost89_mac(&w_ctx, cek, 32);
+
+    memcpy(wrapped, ukm, 8);
+    gost89_encrypt_ecb(&w_ctx, cek, wrapped + 8, 32);
+    memcpy(wrapped + 40, w_ctx.mac, 4);
+}
+
+/* Known answers from keyWrapCryptoPro and the RFC 4357 6.1 steps of the OpenSSL 1.0 ccgost engine */
+static int test_key_wrap_known() {
+    static uint8_t sbox_cryptopro_a[8][16] = {
+        {9, 6, 3, 2, 8, 11, 1, 7, 10, 4, 14, 15, 12, 0, 13, 5},
+        {3, 7, 14, 9, 8, 10, 15, 0, 5, 2, 6, 12, 11, 4, 13, 1},
+        {14, 4, 6, 2, 11, 3, 13, 8, 12, 15, 5, 10, 0, 7, 1, 9},
+        {14, 7, 10, 12, 13, 1, 3, 9, 0, 2, 11, 4, 15, 8, 5, 6},
+        {11, 5, 1, 9, 8, 13, 15, 0, 14, 4, 2, 3, 12, 7, 10, 6},
+        {3, 10, 13, 12, 1, 2, 0, 11, 7, 5, 9, 4, 8, 15, 14, 6},
+        {1, 13, 2, 9, 7, 10, 6, 0, 8, 12, 4, 5, 15, 3, 11, 14},
+        {11, 10, 15, 5, 0, 12, 14, 8, 6, 2, 3, 9, 1, 7, 13, 4}
+    };
+    static uint8_t key[32] = {
+        0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F,
+        0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F
+    };
+    static uint8_t ukm[8] = {0xA5, 0xB8, 0x9F, 0xF2, 0xD1, 0x34, 0x0B, 0x6E};
+    static uint8_t cek[32] = {
+        0x03, 0x14, 0x25, 0x36, 0x47, 0x58, 0x69, 0x7A, 0x8B, 0x9C, 0xAD, 0xBE, 0xCF, 0xE0, 0xF1, 0x02,
+        0x13, 0x24, 0x35, 0x46, 0x57, 0x68, 0x79, 0x8A, 0x9B, 0xAC, 0xBD, 0xCE, 0xDF, 0xF0, 0x01, 0x12
+    };
+    static uint8_t expected[2][GOST89_KEY_WRAP_SIZE] = {
+        {
+            0xA5, 0xB8, 0x9F, 0xF2, 0xD1, 0x34, 0x0B, 0x6E, 0x0F, 0xB9, 0x72, 0xBC, 0xCC, 0x98, 0x94, 0x34,
+            0x02, 0xCA, 0x6C, 0x2E, 0x28, 0xA7, 0xF3, 0xC4, 0x5B, 0x54, 0x87, 0x0A, 0x72, 0x92, 0x90, 0xF6,
+            0xEE, 0x61, 0x69, 0x46, 0xDE, 0xE3, 0x82, 0xB4, 0x1C, 0x7F, 0xEC, 0x46
+        },
+        {
+            0xA5, 0xB8, 0x9F, 0xF2, 0xD1, 0x34, 0x0B, 0x6E, 0x3B, 0x4A, 0x61, 0xAF, 0x19, 0x61, 0x2F, 0xC8,
+            0xC8, 0xE8, 0x32, 0x46, 0x7F, 0x59, 0xF6, 0x30, 0x3E, 0x15, 0xD1, 0xE9, 0xDD, 0xFF, 0x5E, 0x78,
+            0x3A, 0x78, 0xA5, 0x05, 0x28, 0x57, 0x5F, 0x3C, 0xF4, 0xFC, 0xD2, 0x85
+        }
+    };
+    gost89_context kek;
+    uint8_t wrapped[GOST89_KEY_WRAP_SIZE], unwrapped[32];
+    int algorithm, ok = 1;
+
+    memset(&kek, 0, sizeof(kek));
+    gost89_set_sbox(&kek, sbox_cryptopro_a);
+    gost89_set_key(&kek, key);
+
+    for (algorithm = GOST89_KEY_WRAP_GOST; algorithm <= GOST89_KEY_WRAP_CRYPTOPRO; algorithm++) {
+        gost89_key_wrap(&kek, algorithm, ukm, cek, wrapped);
+        ok &= !memcmp(wrapped, expected[algorithm], sizeof(wrapped));
+
+        ok &= gost89_key_unwrap(&kek, algorithm, expected[algorithm], unwrapped);
+        ok &= !memcmp(unwrapped, cek, sizeof(unwrapped));
+    }
+
+    return ok;
+}
+
+/* Batches of every size up to a few lane groups, with one and several threads, against the reference */
+void test_key_wrap() {
+    static uint8_t ukm[37 * 8], cek[37 * 32], wrapped[37 * GOST89_KEY_WRAP_SIZE];
+    static uint8_t expected[37 * GOST89_KEY_WRAP_SIZE], unwrapped[37 * 32], valid[37];
+    gost89_context kek;
+    unsigned i, n;
+    int algorithm, threads, ok = test_key_wrap_known();
+
+    memset(&kek, 0, sizeof(kek));
+    gost89_set_sbox(&kek, test_sbox);
+    gost89_set_key(&kek, test_key);
+
+    for (i = 0; i < sizeof(ukm); i++) {
+        ukm[i] = (uint8_t)(i * 29 + 7);
+    }
+    for (i = 0; i < sizeof(cek); i++) {
+        cek[i] = (uint8_t)(i * 13 + 1);
+    }
+
+    for (algorithm = GOST89_KEY_WRAP_GOST; algorithm <= GOST89_KEY_WRAP_CRYPTOPRO; algorithm++) {
+        for (i = 0; i < 37; i++) {
+            key_wrap_reference(&kek, algorithm, ukm + i * 8, cek + i * 32, expected + i * GOST89_KEY_WRAP_SIZE);
+        }
+
+        for (n = 1; n <= 37; n += 4) {
+            for (threads = 1; threads <= 3; threads += 2) {
+                memset(wrapped, 0, sizeof(wrapped));
+                gost89_key_wrap_batch(&kek, algorithm, ukm, cek, wrapped, n, threads);
+                ok &= !memcmp(wrapped, expected, n * GOST89_KEY_WRAP_SIZE);
+
+                ok &= gost89_key_unwrap_batch(&kek, algorithm, wrapped, unwrapped, valid, n, threads) == 0;
+                ok &= !memcmp(unwrapped, cek, n * 32);
+            }
+        }
+
+        wrapped[5 * GOST89_KEY_WRAP_SIZE + 20] ^= 1;
+        ok &= gost89_key_unwrap_batch(&kek, algorithm, wrapped, unwrapped, valid, 37, 3) == 1;
+        ok &= !valid[5] && valid[4] && valid[6];
+
+        ok &= gost89_key_unwrap(&kek, algorithm, wrapped + 6 * GOST89_KEY_WRAP_SIZE, unwrapped);
+        ok &= !memcmp(unwrapped, cek + 6 * 32, 32);
+    }
+
+    printf("key wrap: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* Any tuning gives the same results, and the cache keeps other CPUs' entries across a save */
+void test_tune() {
+    static char plain[4100], expected[8][4100], out[4100];
+    static const unsigned batches[] = {0, 1, 8, 96, 256, 1000};
+    gost89_tune_result result, loaded;
+    gost89_context ref, t_ctx;
+    char line[256];
+    unsigned b;
+    int mode, kernel, lines = 0, other = 0, ok = 1;
+    FILE *f;
+
+    for (b = 0; b < sizeof(plain); b++) {
+        plain[b] = (char)(b * 7 + 1);
+    }
+
+    gost89_set_key(&ctx, test_key);
+    gost89_set_iv(&ctx, test_iv);
+    gost89_set_kernel(&ctx, GOST89_KERNEL_AUTO);
+
+    for (mode = 0; mode < GOST89_MODE_COUNT; mode++) {
+        gost89_set_mode_tuning(mode, GOST89_KERNEL_AUTO, 0);
+    }
+
+    ref = ctx;
+    gost89_set_kernel(&ref, GOST89_KERNEL_SBOX4);
+    gost89_encrypt_ecb(&ref, plain, expected[0], sizeof(plain));
+    gost89_decrypt_ecb(&ref, plain, expected[1], sizeof(plain));
+    gost89_init_ctr(&ref);
+    gost89_encrypt_ctr(&ref, plain, expected[2], sizeof(plain));
+    ref.iv[0] = ctx.iv[0];
+    ref.iv[1] = ctx.iv[1];
+    gost89_encrypt_cfb(&ref, plain, expected[3], sizeof(plain));
+    ref.iv[0] = ctx.iv[0];
+    ref.iv[1] = ctx.iv[1];
+    gost89_decrypt_cfb(&ref, plain, expected[4], sizeof(plain));
+    ref.iv[0] = ctx.iv[0];
+    ref.iv[1] = ctx.iv[1];
+    gost89_encrypt_cbc(&ref, plain, expected[5], sizeof(plain));
+    ref.iv[0] = ctx.iv[0];
+    ref.iv[1] = ctx.iv[1];
+    gost89_decrypt_cbc(&ref, plain, expected[6], sizeof(plain));
+    gost89_mac(&ref, plain, sizeof(plain));
+
+    for (kernel = GOST89_KERNEL_AUTO; kernel < GOST89_KERNEL_COUNT; kernel++) {
+        for (b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+            for (mode = 0; mode < GOST89_MODE_COUNT; mode++) {
+                gost89_set_mode_tuning(mode, kernel, batches[b]);
+            }
+
+            t_ctx = ctx;
+            gost89_encrypt_ecb(&t_ctx, plain, out, sizeof(plain));
+            ok &= !memcmp(out, expected[0], sizeof(plain));
+            gost89_decrypt_ecb(&t_ctx, plain, out, sizeof(plain));
+            ok &= !memcmp(out, expected[1], sizeof(plain));
+            gost89_init_ctr(&t_ctx);
+            gost89_encrypt_ctr(&t_ctx, plain, out, sizeof(plain));
+            ok &= !memcmp(out, expected[2], sizeof(plain));
+
+            t_ctx = ctx;
+            gost89_encrypt_cfb(&t_ctx, plain, out, sizeof(plain));
+            ok &= !memcmp(out, expected[3], sizeof(plain));
+            t_ctx = ctx;
+            gost89_decrypt_cfb(&t_ctx, plain, out, sizeof(plain));
+            ok &= !memcmp(out, expected[4], sizeof(plain));
+            t_ctx = ctx;
+            gost89_encrypt_cbc(&t_ctx, plain, out, sizeof(plain));
+            ok &= !memcmp(out, expected[5], sizeof(plain));
+            t_ctx = ctx;
+            gost89_decrypt_cbc(&t_ctx, plain, out, sizeof(plain));
+            ok &= !memcmp(out, expected[6], sizeof(plain));
+            gost89_mac(&t_ctx, plain, sizeof(plain));
+            ok &= !memcmp(t_ctx.mac, ref.mac, sizeof(ref.mac));
+
+            ok &= gost89_get_mode_kernel(&ctx, GOST89_MODE_CTR) == (kernel ? kernel : GOST89_KERNEL_SBOX8_X4);
+        }
+    }
+
+    for (mode = 0; mode < GOST89_MODE_COUNT; mode++) {
+        gost89_set_mode_tuning(mode, GOST89_KERNEL_AUTO, 0);
+    }
+
+    f = fopen("test.tune", "w");
+    if (f) {
+        fputs("other cpu\tctr\tsbox4\t8\nbroken line\n", f);
+        fclose(f);
+    }
+
+    memset(&result, 0, sizeof(result));
+    gost89_tune_cpu_model(result.model, sizeof(result.model));
+    for (mode = 0; mode < GOST89_MODE_COUNT; mode++) {
+        result.kernel[mode] = GOST89_KERNEL_SBOX4 + mode % 3;
+        result.batch[mode] = mode * 8;
+    }
+
+    ok &= gost89_tune_save("test.tune", &result);
+    ok &= gost89_tune_load("test.tune", &loaded);
+    ok &= !memcmp(result.kernel, loaded.kernel, sizeof(result.kernel)) && !memcmp(result.batch, loaded.batch, sizeof(result.batch));
+
+    /* Saved again, this CPU's lines are replaced rather than added */
+    result.kernel[GOST89_MODE_MAC] = GOST89_KERNEL_SBOX8;
+    ok &= gost89_tune_save("test.tune", &result);
+    ok &= gost89_tune_load("test.tune", &loaded) && loaded.kernel[GOST89_MODE_MAC] == GOST89_KERNEL_SBOX8;
+
+    f = fopen("test.tune", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            lines++;
+            other += !strncmp(line, "other cpu\t", 10);
+        }
+        fclose(f);
+        ok &= lines == 1 + 1 + GOST89_MODE_COUNT && other == 1;
+    } else {
+        ok = 0;
+    }
+
+    remove("test.tune");
+
+    printf("tune: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* Every size up to a few blocks, at odd offsets, against the library on a padded copy */
+void test_fast() {
+    static const char *ivs[] = {"\xFF\x00\x00\x00\x00\x00\x00\x00", "\x01\x02\x03\x04\xFE\xFF\xFF\xFF"};
+    char plain[136], expected[136], out[136];
+    static char meshed[4100], meshed_expected[4104], meshed_out[4102];
+    gost89_context ref;
+    unsigned size, offset, i, j;
+    int ok = 1;
+
+    gost89_set_key(&ctx, test_key);
+    gost89_set_kernel(&ctx, GOST89_KERNEL_AUTO);
+    gost89_set_key_meshing(&ctx, 0);
+
+    for (i = 0; i < sizeof(ivs) / sizeof(ivs[0]); i++) {
+        for (size = 0; size <= 128; size++) {
+            for (offset = 0; offset < 8; offset += 3) {
+                for (j = 0; j < sizeof(plain); j++) {
+                    plain[j] = (char)(j * 11 + size);
+                }
+                memset(out, 0x55, sizeof(out));
+
+                ref = ctx;
+                gost89_set_iv(&ref, (void*)ivs[i]);
+                gost89_init_ctr(&ref);
+                gost89_encrypt_ctr(&ref, plain, expected, (size + 7) / 8 * 8);
+
+                gost89_fast_ctr(&ctx, ivs[i], plain, out + offset, size);
+                ok &= !memcmp(out + offset, expected, size);
+                ok &= out[offset + size] == 0x55 && (!offset || out[offset - 1] == 0x55);
+
+                memmove(out, out + offset, size);
+                gost89_fast_ctr(&ctx, ivs[i], out, out, size);
+                ok &= !memcmp(out, plain, size);
+            }
+        }
+    }
+
+    /* With key meshing the key changes every GOST89_MESH_SIZE bytes, across several mesh points here */
+    gost89_set_key_meshing(&ctx, 1);
+
+    for (size = 0; size <= sizeof(meshed); size += size < 24 ? 1 : 509) {
+        for (j = 0; j < size; j++) {
+            meshed[j] = (char)(j * 7 + size);
+        }
+
+        ref = ctx;
+        gost89_set_iv(&ref, (void*)ivs[0]);
+        gost89_init_ctr(&ref);
+        memcpy(meshed_expected, meshed, size);
+        gost89_encrypt_ctr(&ref, meshed_expected, meshed_expected, (size + 7) / 8 * 8);
+
+        memset(meshed_out, 0x55, sizeof(meshed_out));
+        gost89_fast_ctr(&ctx, ivs[0], meshed, meshed_out + 1, size);
+        ok &= !memcmp(meshed_out + 1, meshed_expected, size);
+        ok &= meshed_out[0] == 0x55 && meshed_out[size + 1] == 0x55;
+    }
+
+    gost89_set_key_meshing(&ctx, 0);
+
+    printf("fast ctr: %s\n", ok ? "ok" : "FAIL");
+}
+
+enum {HPP_ECB_ENCRYPT, HPP_ECB_DECRYPT, HPP_CTR, HPP_CFB_ENCRYPT, HPP_CFB_DECRYPT, HPP_CBC_ENCRYPT, HPP_CBC_DECRYPT, HPP_MAC, HPP_MODES};
+
+/* Runs a mode on the gost89.hpp drivers of e, or on the library if lib is set, after the same setup */
+static void hpp_run(const gost_test_engine *e, int lib, int mode, int meshing, gost89_context *c, void *in, void *out, unsigned size) {
+    static const gost_test_crypt_func library[] = {
+        gost89_encrypt_ecb, gost89_decrypt_ecb, gost89_encrypt_ctr, gost89_encrypt_cfb,
+        gost89_decrypt_cfb, gost89_encrypt_cbc, gost89_decrypt_cbc
+    };
+    gost_test_crypt_func drivers[] = {
+        e->encrypt_ecb, e->decrypt_ecb, e->encrypt_ctr, e->encrypt_cfb,
+        e->decrypt_cfb, e->encrypt_cbc, e->decrypt_cbc
+    };
+    /* Two calls split at a block boundary, so the chaining state has to carry over */
+    unsigned half = size / 2 / 8 * 8;
+
+    memset(c, 0, sizeof(*c));
+    e->set_sbox(c);
+    gost89_set_key(c, test_key);
+    gost89_set_key_meshing(c, meshing);
+    gost89_set_iv(c, test_iv);
+    gost89_set_mac(c, NULL);
+
+    if (mode == HPP_CTR) {
+        if (lib) {
+            gost89_init_ctr(c);
+        } else {
+            e->init_ctr(c);
+        }
+    }
+
+    if (mode == HPP_MAC) {
+        (lib ? gost89_mac : e->mac)(c, in, half);
+        (lib ? gost89_mac : e->mac)(c, (char*)in + half, size - half);
+        return;
+    }
+
+    (lib ? library : drivers)[mode](c, in, out, half);
+    (lib ? library : drivers)[mode](c, (char*)in + half, (char*)out + half, size - half);
+}
+
+/* The constexpr Cipher<> drivers of gost89.hpp against the library, for each built-in S-box and mode */
+void test_hpp() {
+    /* Sizes of 4..7 past a block boundary go through the whole zero-padded block, as in gost89.c */
+    static const unsigned sizes[] = {0, 8, 12, 16, 64, 1000, 2052, 4104};
+    static uint32_t plain[1028], expected[1028], out[1028];
+    gost89_context ref, hpp;
+    unsigned i, j, k, size;
+    int mode, meshing, ok = 1;
+
+    for (i = 0; i < gost_test_engine_count; i++) {
+        const gost_test_engine *e = &gost_test_engines[i];
+        int engine_ok = 1;
+
+        for (meshing = 0; meshing < 2; meshing++) {
+            for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+                size = sizes[j];
+
+                for (mode = 0; mode < HPP_MODES; mode++) {
+                    for (k = 0; k < sizeof(plain) / sizeof(plain[0]); k++) {
+                        plain[k] = k < (size + 7) / 8 * 2 ? k * 0x9E3779B9u + size : 0;
+                    }
+                    memset(expected, 0, sizeof(expected));
+                    memset(out, 0, sizeof(out));
+
+                    hpp_run(e, 1, mode, meshing, &ref, plain, expected, size);
+                    hpp_run(e, 0, mode, meshing, &hpp, plain, out, size);
+
+                    engine_ok &= !memcmp(expected, out, sizeof(out));
+                    engine_ok &= !memcmp(ref.key, hpp.key, sizeof(ref.key));
+                    engine_ok &= !memcmp(ref.iv, hpp.iv, sizeof(ref.iv));
+                    engine_ok &= !memcmp(ref.mac, hpp.mac, sizeof(ref.mac));
+                }
+            }
+        }
+
+        if (!engine_ok) {
+            printf("hpp: %s differs\n", e->params);
+        }
+        ok &= engine_ok;
+    }
+
+    printf("hpp: %s\n", ok ? "ok" : "FAIL");
+}
+
+static void *stats_thread(void *arg) {
+    gost89_context thread_ctx = ctx;
+    char buffer[24] = {0};
+    int i;
+
+    for (i = 0; i < *(int*)arg; i++) {
+        gost89_encrypt_ecb(&thread_ctx, buffer, buffer, sizeof(buffer));
+    }
+
+    return NULL;
+}
+
+/* Deltas of a few calls on this thread and on two short-lived ones, the second reusing a slot */
+void test_stats() {
+    gost89_stats before, after;
+    char buffer[24] = {0};
+    uint64_t blocks = 0, kernel_blocks = 0;
+    pthread_t thread;
+    int ok = 1, calls, i;
+
+    gost89_set_stats(1);
+    gost89_stats_snapshot(&before);
+
+    gost89_set_key(&ctx, test_key);
+    gost89_set_key_meshing(&ctx, 0);
+    gost89_set_iv(&ctx, test_iv);
+    gost89_init_ctr(&ctx);
+    gost89_encrypt_ctr(&ctx, buffer, buffer, 13);
+    gost89_mac(&ctx, buffer, 20);
+
+    calls = 2;
+    ok &= !pthread_create(&thread, NULL, stats_thread, &calls) && !pthread_join(thread, NULL);
+    calls = 1;
+    ok &= !pthread_create(&thread, NULL, stats_thread, &calls) && !pthread_join(thread, NULL);
+
+    gost89_stats_snapshot(&after);
+    gost89_set_stats(0);
+
+    ok &= after.key_setups - before.key_setups == 1;
+    ok &= after.calls[GOST89_MODE_CTR] - before.calls[GOST89_MODE_CTR] == 1;
+    ok &= after.blocks[GOST89_MODE_CTR] - before.blocks[GOST89_MODE_CTR] == 2;
+    ok &= after.bytes[GOST89_MODE_CTR] - before.bytes[GOST89_MODE_CTR] == 13;
+    ok &= after.blocks[GOST89_MODE_MAC] - before.blocks[GOST89_MODE_MAC] == 3;
+    ok &= after.calls[GOST89_MODE_ECB_ENCRYPT] - before.calls[GOST89_MODE_ECB_ENCRYPT] == 3;
+    ok &= after.bytes[GOST89_MODE_ECB_ENCRYPT] - before.bytes[GOST89_MODE_ECB_ENCRYPT] == 72;
+    ok &= after.tails - before.tails == 2;
+    ok &= after.padded_tails - before.padded_tails == 2;
+
+    for (i = 0; i < GOST89_MODE_COUNT; i++) {
+        blocks += after.blocks[i] - before.blocks[i];
+    }
+    for (i = 0; i < GOST89_KERNEL_COUNT; i++) {
+        kernel_blocks += after.kernel_blocks[i] - before.kernel_blocks[i];
+    }
+    ok &= blocks == 14 && kernel_blocks == blocks;
+
+    /* The chained modes run one block at a time, so the interleaved kernel is credited to sbox8 */
+    gost89_set_stats(1);
+    gost89_set_kernel(&ctx, GOST89_KERNEL_SBOX8_X4);
+    gost89_encrypt_cfb(&ctx, buffer, buffer, 8);
+    gost89_encrypt_cbc(&ctx, buffer, buffer, 16);
+    gost89_mac(&ctx, buffer, 8);
+    gost89_set_kernel(&ctx, GOST89_KERNEL_AUTO);
+    gost89_stats_snapshot(&before);
+    gost89_set_stats(0);
+
+    ok &= before.kernel_blocks[GOST89_KERNEL_SBOX8] - after.kernel_blocks[GOST89_KERNEL_SBOX8] == 4;
+    ok &= before.kernel_blocks[GOST89_KERNEL_SBOX8_X4] == after.kernel_blocks[GOST89_KERNEL_SBOX8_X4];
+
+    /* Off again: nothing more is counted */
+    after = before;
+    gost89_encrypt_ctr(&ctx, buffer, buffer, 8);
+    gost89_stats_snapshot(&before);
+    ok &= before.calls[GOST89_MODE_CTR] == after.calls[GOST89_MODE_CTR];
+
+    printf("stats: %s\n", ok ? "ok" : "FAIL");
+}
+
+/* Keys added out of order, one replaced, all found again through the mapping */
+void test_keystore() {
+    static const char *ids[] = {"m", "alpha", "zeta", "beta", "0123456789abcdef0123456789abcdef"};
+    uint8_t keys[5][32], other_sbox[8][16], (*sbox)[16];
+    gost89_keystore ks;
+    const gost89_keystore_record *record;
+    gost89_context loaded, expected;
+    char block[8] = "keystore", out[8], ref[8];
+    unsigned i, j;
+    int ok = 1;
+    FILE *f;
+
+    remove("test.keystore");
+
+    for (i = 0; i < 5; i++) {
+        for (j = 0; j < 32; j++) {
+            keys[i][j] = (uint8_t)(i * 32 + j);
+        }
+    }
+    for (i = 0; i < 128; i++) {
+        other_sbox[i / 16][i % 16] = (uint8_t)((i * 7 + 3) % 16);
+    }
+
+    for (i = 0; i < 5; i++) {
+        ok &= gost89_keystore_put("test.keystore", ids[i], keys[i], i % 2 ? other_sbox : test_sbox);
+    }
+    keys[2][0] ^= 0xFF;
+    ok &= gost89_keystore_put("test.keystore", ids[2], keys[2], test_sbox);
+    ok &= !gost89_keystore_put("test.keystore", "0123456789abcdef0123456789abcdef0", keys[0], test_sbox);
+
+    ok &= gost89_keystore_open(&ks, "test.keystore");
+    if (ok) {
+        ok &= ks.header->key_count == 5 && ks.header->sbox_count == 2;
+
+        for (i = 1; i < ks.header->key_count; i++) {
+            ok &= memcmp(ks.index[i - 1].id, ks.index[i].id, GOST89_KEYSTORE_ID_SIZE) < 0;
+        }
+
+        for (i = 0; i < 5; i++) {
+            record = gost89_keystore_find(&ks, ids[i], &sbox);
+            ok &= record && !memcmp(record->key, keys[i], 32);
+            ok &= record && !memcmp(sbox, i % 2 ? other_sbox : test_sbox, 128);
+        }
+
+        ok &= !gost89_keystore_find(&ks, "alph", NULL) && !gost89_keystore_find(&ks, "", NULL);
+
+        memset(&loaded, 0, sizeof(loaded));
+        memset(&expected, 0, sizeof(expected));
+        ok &= gost89_keystore_load(&ks, ids[3], &loaded);
+        gost89_set_sbox(&expected, other_sbox);
+        gost89_set_key(&expected, keys[3]);
+        gost89_encrypt(&loaded, block, out);
+        gost89_encrypt(&expected, block, ref);
+        ok &= !memcmp(out, ref, sizeof(out));
+
+        gost89_keystore_close(&ks);
+    }
+
+    /* Anything else under the name is not replaced */
+    f = fopen("test.keystore", "wb");
+    if (f) {
+        fputs("not a keystore", f);
+        fclose(f);
+        ok &= !gost89_keystore_open(&ks, "test.keystore");
+        ok &= !gost89_keystore_put("test.keystore", ids[0], keys[0], test_sbox);
+    } else {
+        ok = 0;
+    }
+
+    remove("test.keystore");
+
+    printf("keystore: %s\n", ok ? "ok" : "FAIL");
+}
+
 int main(int argc, char **argv) {
     gost89_set_sbox(&ctx, test_sbox);
 
@@ -340,7 +1278,18 @@ int main(int argc, char **argv) {
     test_decrypt_ctr();
     test_encrypt_cfb();
     test_decrypt_cfb();
-    benchmark();
+    test_ctr_ring();
+    test_kernels();
+    test_key_meshing();
+    test_magma();
+    test_mgm();
+    test_hash();
+    test_key_wrap();
+    test_tune();
+    test_fast();
+    test_hpp();
+    test_stats();
+    test_keystore();
 
     return 0;
 }
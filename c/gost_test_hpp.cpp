@@ -0,0 +1,32 @@
+#include "gost89.hpp"
+#include "gost_test_hpp.h"
+
+template <class SboxParams>
+static constexpr gost_test_engine makeEngine() {
+    typedef gost89::Cipher<SboxParams> Cipher;
+
+    return {
+        SboxParams::name,
+        &Cipher::setSbox,
+        &Cipher::encryptEcb,
+        &Cipher::decryptEcb,
+        &Cipher::initCtr,
+        &Cipher::encryptCtr,
+        &Cipher::encryptCfb,
+        &Cipher::decryptCfb,
+        &Cipher::encryptCbc,
+        &Cipher::decryptCbc,
+        &Cipher::mac
+    };
+}
+
+const gost_test_engine gost_test_engines[] = {
+    makeEngine<gost89::SboxTest>(),
+    makeEngine<gost89::SboxCryptoProA>(),
+    makeEngine<gost89::SboxCryptoProB>(),
+    makeEngine<gost89::SboxCryptoProC>(),
+    makeEngine<gost89::SboxCryptoProD>(),
+    makeEngine<gost89::SboxTC26Z>()
+};
+
+const unsigned gost_test_engine_count = sizeof(gost_test_engines) / sizeof(gost_test_engines[0]);
@@ -0,0 +1,38 @@
+#ifndef GOST_TEST_HPP_H_
+#define GOST_TEST_HPP_H_
+
+#include "gost89.h"
+
+/*
+ * The gost89.hpp Cipher<> drivers of each built-in parameter set, compiled
+ * in gost_test_hpp.cpp so that gost_test.c can compare them with gost89.c.
+ */
+
+typedef void (*gost_test_crypt_func)(gost89_context *ctx, void *in, void *out, unsigned size);
+
+typedef struct gost_test_engine {
+    const char *params;
+    void (*set_sbox)(gost89_context *ctx);
+    gost_test_crypt_func encrypt_ecb;
+    gost_test_crypt_func decrypt_ecb;
+    void (*init_ctr)(gost89_context *ctx);
+    gost_test_crypt_func encrypt_ctr;
+    gost_test_crypt_func encrypt_cfb;
+    gost_test_crypt_func decrypt_cfb;
+    gost_test_crypt_func encrypt_cbc;
+    gost_test_crypt_func decrypt_cbc;
+    void (*mac)(gost89_context *ctx, void *plain, unsigned size);
+} gost_test_engine;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const gost_test_engine gost_test_engines[];
+extern const unsigned gost_test_engine_count;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOST_TEST_HPP_H_ */
@@ -3,37 +3,61 @@ package gost89
 import (
 	"crypto/cipher"
 	"errors"
+	"strconv"
 )
 
 type gost89Cipher struct {
-	gost89 Gost89
+	gost89 *Gost89
 }
 
 func NewCipher(key []byte) (cipher.Block, error) {
 	l := len(key)
 	if l != 32 {
-		return nil, errors.New("Invalid key size: " + string(l))
+		return nil, errors.New("Invalid key size: " + strconv.Itoa(l))
 	}
 
 	c := new(gost89Cipher)
+	c.gost89 = new(Gost89)
 	c.gost89.SetSbox(SboxTest)
 	c.gost89.SetKeyBytes(key)
 
 	return c, nil
 }
 
+// Cipher returns a cipher.Block over this S-box and key, for the stream and block mode constructors.
+// The block only reads from this, so it must not be changed while the block is in use.
+func (this *Gost89) Cipher() cipher.Block {
+	return &gost89Cipher{this}
+}
+
 func (this *gost89Cipher) BlockSize() int {
 	return 8
 }
 
 func (this *gost89Cipher) Encrypt(dst, src []byte) {
-	t := BytesToBlock64(src)
-	t = this.gost89.Encrypt(t)
-	dst = Block64ToBytes(t)
+	PutBlock64(dst, this.gost89.Encrypt(BytesToBlock64(src)))
 }
 
 func (this *gost89Cipher) Decrypt(dst, src []byte) {
-	t := BytesToBlock64(src)
-	t = this.gost89.Decrypt(t)
-	dst = Block64ToBytes(t)
+	PutBlock64(dst, this.gost89.Decrypt(BytesToBlock64(src)))
+}
+
+func blockGost89(block cipher.Block) *Gost89 {
+	c, ok := block.(*gost89Cipher)
+	if !ok {
+		panic("gost89: block is not from NewCipher or Gost89.Cipher")
+	}
+	return c.gost89
+}
+
+func checkIv(iv []byte) {
+	if len(iv) != 8 {
+		panic("gost89: IV length must equal block size")
+	}
+}
+
+func checkBuffers(dst, src []byte) {
+	if len(dst) < len(src) {
+		panic("gost89: output smaller than input")
+	}
 }
@@ -212,6 +212,12 @@ func BytesToBlock64(b []byte) Block64 {
 	}
 }
 
+// PutBlock64 stores a block in the first 8 bytes of b, without allocating
+func PutBlock64(b []byte, i Block64) {
+	binary.LittleEndian.PutUint32(b[4:8], i[1])
+	binary.LittleEndian.PutUint32(b[0:4], i[0])
+}
+
 func Block64ToBytes(i Block64) []byte {
 	return []byte{
 		byte(i[0]),
@@ -0,0 +1,89 @@
+package gost89
+
+import (
+	"crypto/cipher"
+	"strconv"
+	"testing"
+)
+
+// go test -bench . -benchmem reports MB/s and allocs/op for each mode and size
+
+var benchKey = []byte("01234567890123456789012345678912")
+var benchIv = []byte("\xFF\x00\x00\x00\x00\x00\x00\x00")
+
+func benchSizes(b *testing.B, sizes []int, run func(b *testing.B, in, out []byte)) {
+	for _, size := range sizes {
+		b.Run(strconv.Itoa(size), func(b *testing.B) {
+			in := make([]byte, size)
+			out := make([]byte, size)
+
+			b.SetBytes(int64(size))
+			b.ReportAllocs()
+			b.ResetTimer()
+
+			run(b, in, out)
+		})
+	}
+}
+
+func benchBlock(b *testing.B) cipher.Block {
+	block, err := NewCipher(benchKey)
+	if err != nil {
+		b.Fatal(err)
+	}
+	return block
+}
+
+func BenchmarkEncryptBytesCTR(b *testing.B) {
+	g := new(Gost89)
+	g.SetSbox(SboxTest)
+	g.SetKeyBytes(benchKey)
+	g.SetIvBytes(benchIv)
+	g.InitCTR()
+
+	benchSizes(b, []int{64, 4096}, func(b *testing.B, in, out []byte) {
+		for i := 0; i < b.N; i++ {
+			g.EncryptBytesCTR(in)
+		}
+	})
+}
+
+func BenchmarkCTR(b *testing.B) {
+	s := NewCTR(benchBlock(b), benchIv)
+
+	benchSizes(b, []int{13, 64, 4096, 1 << 20}, func(b *testing.B, in, out []byte) {
+		for i := 0; i < b.N; i++ {
+			s.XORKeyStream(out, in)
+		}
+	})
+}
+
+func BenchmarkParallelCTR(b *testing.B) {
+	s := NewParallelCTR(benchBlock(b), benchIv, 0)
+
+	benchSizes(b, []int{4096, 1 << 20, 16 << 20}, func(b *testing.B, in, out []byte) {
+		for i := 0; i < b.N; i++ {
+			s.XORKeyStream(out, in)
+		}
+	})
+}
+
+func BenchmarkCFBEncrypter(b *testing.B) {
+	s := NewCFBEncrypter(benchBlock(b), benchIv)
+
+	benchSizes(b, []int{13, 64, 4096}, func(b *testing.B, in, out []byte) {
+		for i := 0; i < b.N; i++ {
+			s.XORKeyStream(out, in)
+		}
+	})
+}
+
+func BenchmarkECBEncrypter(b *testing.B) {
+	m := NewECBEncrypter(benchBlock(b))
+
+	benchSizes(b, []int{64, 4096}, func(b *testing.B, in, out []byte) {
+		for i := 0; i < b.N; i++ {
+			m.CryptBlocks(out, in)
+		}
+	})
+}
@@ -1,35 +1,107 @@
 package gost89
 
-func (this *Gost89) EncryptBytesCFB(plain []byte) []byte {
-	length := len(plain)
-	var encrypted []byte
+import (
+	"crypto/cipher"
+	"encoding/binary"
+)
 
-	for i := 0; i < length; i += 8 {
-		t := this.Encrypt(this.iv)
-		block := BytesToBlock64(plain[i : i+8])
-		block[0] ^= t[0]
-		block[1] ^= t[1]
-		this.iv = block
+func (this *Gost89) EncryptBytesCFB(plain []byte) []byte {
+	encrypted := make([]byte, len(plain))
 
-		encrypted = append(encrypted, Block64ToBytes(block)...)
-	}
+	s := cfbStream{gost89: this, used: 8}
+	PutBlock64(s.next[:], this.iv)
+	s.XORKeyStream(encrypted, plain)
+	this.iv = BytesToBlock64(s.next[:])
 
-	return encrypted[:length]
+	return encrypted
 }
 
 func (this *Gost89) DecryptBytesCFB(encrypted []byte) []byte {
-	length := len(encrypted)
-	var plain []byte
+	plain := make([]byte, len(encrypted))
+
+	s := cfbStream{gost89: this, used: 8, decrypt: true}
+	PutBlock64(s.next[:], this.iv)
+	s.XORKeyStream(plain, encrypted)
+	this.iv = BytesToBlock64(s.next[:])
+
+	return plain
+}
+
+type cfbStream struct {
+	gost89  *Gost89
+	next    [8]byte // the ciphertext block being fed back, complete when used is 8
+	gamma   [8]byte
+	used    int
+	decrypt bool
+}
+
+// NewCFBEncrypter returns a stream that encrypts in CFB mode, as SetIvBytes
+// and EncryptBytesCFB do, with no allocations per call. Calls may be of any
+// length and continue each other.
+func NewCFBEncrypter(block cipher.Block, iv []byte) cipher.Stream {
+	return newCFB(block, iv, false)
+}
+
+func NewCFBDecrypter(block cipher.Block, iv []byte) cipher.Stream {
+	return newCFB(block, iv, true)
+}
+
+func newCFB(block cipher.Block, iv []byte, decrypt bool) *cfbStream {
+	checkIv(iv)
+
+	s := &cfbStream{gost89: blockGost89(block), used: 8, decrypt: decrypt}
+	copy(s.next[:], iv)
+	return s
+}
+
+func (this *cfbStream) XORKeyStream(dst, src []byte) {
+	checkBuffers(dst, src)
+
+	for len(src) > 0 {
+		if this.used == 8 && len(src) >= 8 {
+			n := len(src) &^ 7
+			this.xorBlocks(dst[:n], src[:n])
+			dst = dst[n:]
+			src = src[n:]
+			continue
+		}
+
+		if this.used == 8 {
+			PutBlock64(this.gamma[:], this.gost89.Encrypt(BytesToBlock64(this.next[:])))
+			this.used = 0
+		}
+
+		c := src[0]
+		dst[0] = c ^ this.gamma[this.used]
+		if !this.decrypt {
+			c = dst[0]
+		}
+		this.next[this.used] = c
+		this.used++
+
+		dst = dst[1:]
+		src = src[1:]
+	}
+}
+
+// xorBlocks transforms whole blocks, starting with the complete feedback block in next
+func (this *cfbStream) xorBlocks(dst, src []byte) {
+	iv := BytesToBlock64(this.next[:])
+
+	for i := 0; i+8 <= len(src); i += 8 {
+		t := this.gost89.Encrypt(iv)
 
-	for i := 0; i < length; i += 8 {
-		t := this.Encrypt(this.iv)
-		block := BytesToBlock64(encrypted[i : i+8])
-		this.iv = block
-		block[0] ^= t[0]
-		block[1] ^= t[1]
+		a := binary.LittleEndian.Uint32(src[i : i+4])
+		b := binary.LittleEndian.Uint32(src[i+4 : i+8])
+		binary.LittleEndian.PutUint32(dst[i+4:i+8], b^t[1])
+		binary.LittleEndian.PutUint32(dst[i:i+4], a^t[0])
 
-		plain = append(plain, Block64ToBytes(block)...)
+		if this.decrypt {
+			iv = Block64{a, b}
+		} else {
+			iv = Block64{a ^ t[0], b ^ t[1]}
+		}
 	}
 
-	return plain[:length]
+	PutBlock64(this.next[:], iv)
 }
@@ -1,28 +1,161 @@
 package gost89
 
+import (
+	"crypto/cipher"
+	"encoding/binary"
+	"runtime"
+	"sync"
+)
+
+// Slices of at least parallelMinSize bytes are split between goroutines, each taking at least parallelChunk
+const (
+	parallelMinSize = 64 * 1024
+	parallelChunk   = 16 * 1024
+)
+
 func (this *Gost89) InitCTR() {
 	this.iv = this.Encrypt(this.iv)
 }
 
 func (this *Gost89) EncryptBytesCTR(plain []byte) []byte {
-	length := len(plain)
-	var encrypted []byte
-
-	for i := 0; i < length; i += 8 {
-		this.iv[0] += 0x1010101
-		if this.iv[1] > 0xFFFFFFFF-0x1010104 {
-			this.iv[1] += 0x1010104 + 1
-		} else {
-			this.iv[1] += 0x1010104
+	encrypted := make([]byte, len(plain))
+
+	s := ctrStream{gost89: this, counter: this.iv, used: 8}
+	s.XORKeyStream(encrypted, plain)
+	this.iv = s.counter
+
+	return encrypted
+}
+
+type ctrStream struct {
+	gost89  *Gost89
+	counter Block64
+	gamma   [8]byte
+	used    int
+	workers int
+}
+
+// NewCTR returns a stream that encrypts and decrypts in CTR mode, the same as
+// SetIvBytes, InitCTR and EncryptBytesCTR, with no allocations per call. Calls
+// may be of any length and continue each other.
+func NewCTR(block cipher.Block, iv []byte) cipher.Stream {
+	checkIv(iv)
+
+	g := blockGost89(block)
+	return &ctrStream{gost89: g, counter: g.Encrypt(BytesToBlock64(iv)), used: 8}
+}
+
+// NewParallelCTR is NewCTR that splits slices of 64 KB and more between up to
+// workers goroutines (GOMAXPROCS if workers <= 0). Such calls allocate for the
+// goroutines; shorter ones run as in NewCTR.
+func NewParallelCTR(block cipher.Block, iv []byte, workers int) cipher.Stream {
+	if workers <= 0 {
+		workers = runtime.GOMAXPROCS(0)
+	}
+
+	s := NewCTR(block, iv).(*ctrStream)
+	s.workers = workers
+	return s
+}
+
+func (this *ctrStream) XORKeyStream(dst, src []byte) {
+	checkBuffers(dst, src)
+
+	for len(src) > 0 && this.used < 8 {
+		dst[0] = src[0] ^ this.gamma[this.used]
+		this.used++
+		dst = dst[1:]
+		src = src[1:]
+	}
+
+	n := len(src) &^ 7
+	if this.workers > 1 && n >= parallelMinSize {
+		this.xorParallel(dst[:n], src[:n])
+	} else {
+		xorCTR(this.gost89, &this.counter, dst[:n], src[:n])
+	}
+
+	if n < len(src) {
+		ctrNext(&this.counter)
+		PutBlock64(this.gamma[:], this.gost89.Encrypt(this.counter))
+		this.used = 0
+
+		for i := n; i < len(src); i++ {
+			dst[i] = src[i] ^ this.gamma[this.used]
+			this.used++
 		}
+	}
+}
+
+func (this *ctrStream) xorParallel(dst, src []byte) {
+	var wg sync.WaitGroup
+
+	g, counter := this.gost89, this.counter
+	blocks := len(src) / 8
+	per := (blocks + this.workers - 1) / this.workers
+	if per < parallelChunk/8 {
+		per = parallelChunk / 8
+	}
+
+	for start := 0; start < blocks; start += per {
+		end := start + per
+		if end > blocks {
+			end = blocks
+		}
+
+		wg.Add(1)
+		go func(start, end int) {
+			defer wg.Done()
+
+			c := ctrSeek(counter, uint64(start))
+			xorCTR(g, &c, dst[start*8:end*8], src[start*8:end*8])
+		}(start, end)
+	}
+
+	wg.Wait()
+	this.counter = ctrSeek(counter, uint64(blocks))
+}
+
+// xorCTR transforms whole blocks, advancing the counter by one per block
+func xorCTR(g *Gost89, counter *Block64, dst, src []byte) {
+	c := *counter
+
+	for i := 0; i+8 <= len(src); i += 8 {
+		ctrNext(&c)
+		t := g.Encrypt(c)
+
+		binary.LittleEndian.PutUint32(dst[i+4:i+8], binary.LittleEndian.Uint32(src[i+4:i+8])^t[1])
+		binary.LittleEndian.PutUint32(dst[i:i+4], binary.LittleEndian.Uint32(src[i:i+4])^t[0])
+	}
+
+	*counter = c
+}
+
+func ctrNext(c *Block64) {
+	c[0] += 0x1010101
+	if c[1] > 0xFFFFFFFF-0x1010104 {
+		c[1] += 0x1010104 + 1
+	} else {
+		c[1] += 0x1010104
+	}
+}
+
+// ctrSeek returns the counter blocks steps of ctrNext later. The high word is
+// added modulo 2^32 - 1, and once stepped it is never 0 (0xFFFFFFFF stands for it).
+func ctrSeek(c Block64, blocks uint64) Block64 {
+	const m = 0xFFFFFFFF
+
+	if blocks == 0 {
+		return c
+	}
 
-		t := this.Encrypt(this.iv)
-		block := BytesToBlock64(plain[i : i+8])
-		block[0] ^= t[0]
-		block[1] ^= t[1]
+	c[0] += uint32(blocks * 0x1010101)
 
-		encrypted = append(encrypted, Block64ToBytes(block)...)
+	r := (uint64(c[1]) + blocks%m*0x1010104) % m
+	if r == 0 {
+		r = m
 	}
+	c[1] = uint32(r)
 
-	return encrypted[:length]
+	return c
 }
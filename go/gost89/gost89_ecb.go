@@ -1,14 +1,15 @@
 package gost89
 
+import (
+	"crypto/cipher"
+)
+
 func (this *Gost89) EncryptBytesECB(plain []byte) []byte {
 	length := len(plain)
-	var encrypted []byte
+	encrypted := make([]byte, (length+7)&^7)
 
 	for i := 0; i < length; i += 8 {
-		block := plain[i : i+8]
-		block = this.EncryptBytes(block)
-
-		encrypted = append(encrypted, block...)
+		PutBlock64(encrypted[i:], this.Encrypt(BytesToBlock64(plain[i:i+8])))
 	}
 
 	return encrypted[:length]
@@ -16,14 +17,44 @@ func (this *Gost89) EncryptBytesECB(plain []byte) []byte {
 
 func (this *Gost89) DecryptBytesECB(encrypted []byte) []byte {
 	length := len(encrypted)
-	var plain []byte
+	plain := make([]byte, (length+7)&^7)
 
 	for i := 0; i < length; i += 8 {
-		block := encrypted[i : i+8]
-		block = this.DecryptBytes(block)
-
-		plain = append(plain, block...)
+		PutBlock64(plain[i:], this.Decrypt(BytesToBlock64(encrypted[i:i+8])))
 	}
 
 	return plain[:length]
 }
+
+type ecbMode struct {
+	gost89  *Gost89
+	decrypt bool
+}
+
+// NewECBEncrypter returns a cipher.BlockMode that encrypts whole blocks in ECB mode, with no allocations
+func NewECBEncrypter(block cipher.Block) cipher.BlockMode {
+	return &ecbMode{gost89: blockGost89(block)}
+}
+
+func NewECBDecrypter(block cipher.Block) cipher.BlockMode {
+	return &ecbMode{gost89: blockGost89(block), decrypt: true}
+}
+
+func (this *ecbMode) BlockSize() int {
+	return 8
+}
+
+func (this *ecbMode) CryptBlocks(dst, src []byte) {
+	if len(src)%8 != 0 {
+		panic("gost89: input not full blocks")
+	}
+	checkBuffers(dst, src)
+
+	for i := 0; i < len(src); i += 8 {
+		if this.decrypt {
+			PutBlock64(dst[i:], this.gost89.Decrypt(BytesToBlock64(src[i:i+8])))
+		} else {
+			PutBlock64(dst[i:], this.gost89.Encrypt(BytesToBlock64(src[i:i+8])))
+		}
+	}
+}
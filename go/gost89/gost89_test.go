@@ -0,0 +1,295 @@
+package gost89
+
+import (
+	"bytes"
+	"crypto/cipher"
+	"math/rand"
+	"testing"
+)
+
+// GO111MODULE=off go test checks the streams and block modes against the
+// EncryptBytes functions and a block-by-block reference built on Encrypt
+
+var testSizes = []int{0, 1, 7, 8, 9, 15, 16, 63, 64, 65, 1000, 1029}
+
+// Lengths of consecutive calls; the last one starts a parallel run mid-block
+var testSplits = []int{1, 3, 8, 13, 64, 5, 7, parallelMinSize + 9}
+
+func testGost89() *Gost89 {
+	g := new(Gost89)
+	g.SetSbox(SboxTest)
+	g.SetKeyBytes(benchKey)
+	return g
+}
+
+func testData(size int) []byte {
+	data := make([]byte, size)
+	rand.New(rand.NewSource(int64(size))).Read(data)
+	return data
+}
+
+// xorSplit runs the stream over src in calls of the testSplits lengths, in turn
+func xorSplit(s cipher.Stream, dst, src []byte) {
+	for i := 0; len(src) > 0; i++ {
+		n := testSplits[i%len(testSplits)]
+		if n > len(src) {
+			n = len(src)
+		}
+
+		s.XORKeyStream(dst[:n], src[:n])
+		dst = dst[n:]
+		src = src[n:]
+	}
+}
+
+// refCTR encrypts block by block from the counter, the last block cut short
+func refCTR(g *Gost89, counter Block64, src []byte) []byte {
+	out := make([]byte, len(src))
+
+	for i := 0; i < len(src); i += 8 {
+		ctrNext(&counter)
+		gamma := Block64ToBytes(g.Encrypt(counter))
+
+		for j := i; j < i+8 && j < len(src); j++ {
+			out[j] = src[j] ^ gamma[j-i]
+		}
+	}
+
+	return out
+}
+
+// refCFB works on a zero-padded copy, so a short last block is fed back padded
+func refCFB(g *Gost89, iv Block64, src []byte, decrypt bool) []byte {
+	in := make([]byte, (len(src)+7)&^7)
+	out := make([]byte, len(in))
+	copy(in, src)
+
+	for i := 0; i < len(in); i += 8 {
+		gamma := Block64ToBytes(g.Encrypt(iv))
+
+		for j := 0; j < 8; j++ {
+			out[i+j] = in[i+j] ^ gamma[j]
+		}
+
+		if decrypt {
+			iv = BytesToBlock64(in[i:])
+		} else {
+			iv = BytesToBlock64(out[i:])
+		}
+	}
+
+	return out[:len(src)]
+}
+
+func TestCipherBlock(t *testing.T) {
+	g := testGost89()
+	block := g.Cipher()
+	src := testData(64)
+
+	for i := 0; i < len(src); i += 8 {
+		dst := make([]byte, 10)
+
+		block.Encrypt(dst, src[i:i+8])
+		if !bytes.Equal(dst[:8], g.EncryptBytes(src[i:i+8])) || dst[8] != 0 || dst[9] != 0 {
+			t.Fatalf("Encrypt at %d: % x", i, dst)
+		}
+
+		block.Decrypt(dst, dst)
+		if !bytes.Equal(dst[:8], src[i:i+8]) {
+			t.Fatalf("Decrypt in place at %d: % x", i, dst)
+		}
+	}
+
+	c, err := NewCipher(benchKey)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	dst := make([]byte, 8)
+	c.Encrypt(dst, src)
+	if !bytes.Equal(dst, g.EncryptBytes(src)) {
+		t.Fatalf("NewCipher Encrypt: % x", dst)
+	}
+
+	if _, err := NewCipher(benchKey[:31]); err == nil || err.Error() != "Invalid key size: 31" {
+		t.Fatalf("NewCipher with 31 bytes: %v", err)
+	}
+}
+
+func TestECB(t *testing.T) {
+	g := testGost89()
+	enc := NewECBEncrypter(g.Cipher())
+	dec := NewECBDecrypter(g.Cipher())
+
+	for _, size := range testSizes {
+		size &^= 7
+		src := testData(size)
+		want := g.EncryptBytesECB(src)
+
+		for i := 0; i < size; i += 8 {
+			if !bytes.Equal(want[i:i+8], g.EncryptBytes(src[i:i+8])) {
+				t.Fatalf("EncryptBytesECB, %d bytes: block %d", size, i/8)
+			}
+		}
+
+		// Two calls, in place
+		dst := append([]byte(nil), src...)
+		half := size / 2 &^ 7
+		enc.CryptBlocks(dst[:half], dst[:half])
+		enc.CryptBlocks(dst[half:], dst[half:])
+		if !bytes.Equal(dst, want) {
+			t.Fatalf("ECB encrypter, %d bytes", size)
+		}
+
+		dec.CryptBlocks(dst, dst)
+		if !bytes.Equal(dst, src) || !bytes.Equal(g.DecryptBytesECB(want), src) {
+			t.Fatalf("ECB decrypter, %d bytes", size)
+		}
+	}
+
+	defer func() {
+		if recover() == nil {
+			t.Fatal("CryptBlocks took a partial block")
+		}
+	}()
+	enc.CryptBlocks(make([]byte, 16), make([]byte, 12))
+}
+
+func TestCTR(t *testing.T) {
+	g := testGost89()
+	counter := g.Encrypt(BytesToBlock64(benchIv))
+
+	for _, size := range append(testSizes, 3*parallelMinSize+5) {
+		src := testData(size)
+		want := refCTR(g, counter, src)
+
+		g.SetIvBytes(benchIv)
+		g.InitCTR()
+		if !bytes.Equal(g.EncryptBytesCTR(src), want) {
+			t.Fatalf("EncryptBytesCTR, %d bytes", size)
+		}
+
+		// EncryptBytesCTR calls continue each other at block boundaries
+		g.SetIvBytes(benchIv)
+		g.InitCTR()
+		half := size / 2 &^ 7
+		got := append(g.EncryptBytesCTR(src[:half]), g.EncryptBytesCTR(src[half:])...)
+		if !bytes.Equal(got, want) {
+			t.Fatalf("EncryptBytesCTR in two calls, %d bytes", size)
+		}
+
+		for _, workers := range []int{0, 1, 3} {
+			var s cipher.Stream
+			if workers == 0 {
+				s = NewCTR(g.Cipher(), benchIv)
+			} else {
+				s = NewParallelCTR(g.Cipher(), benchIv, workers)
+			}
+
+			dst := append([]byte(nil), src...)
+			xorSplit(s, dst, dst)
+			if !bytes.Equal(dst, want) {
+				t.Fatalf("CTR stream with %d workers, %d bytes", workers, size)
+			}
+		}
+	}
+}
+
+// The high counter word wraps about every 254 blocks; start the parallel runs right at a wrap
+func TestParallelCTRWrap(t *testing.T) {
+	g := testGost89()
+	src := testData(parallelMinSize*4 + 3)
+
+	for _, high := range []uint32{0, 1, 0xFFFFFFFF - 0x1010104, 0xFFFFFFFF - 0x1010104 + 1, 0xFFFFFFFF} {
+		counter := Block64{0xFFFFFF00, high}
+		want := refCTR(g, counter, src)
+
+		s := &ctrStream{gost89: g, counter: counter, used: 8, workers: 4}
+		dst := make([]byte, len(src))
+		s.XORKeyStream(dst, src)
+		if !bytes.Equal(dst, want) {
+			t.Fatalf("parallel CTR from %08x", high)
+		}
+	}
+}
+
+func TestCTRSeek(t *testing.T) {
+	starts := []Block64{
+		{0, 0},
+		{0xFFFFFFFF, 0xFFFFFFFF},
+		{0x12345678, 0xFFFFFFFF - 0x1010104},
+		{0x12345678, 0xFFFFFFFF - 0x1010103},
+		{0xDEADBEEF, 0x1010103},
+	}
+
+	for _, start := range starts {
+		c := start
+		for n := uint64(0); n < 1000; n++ {
+			if got := ctrSeek(start, n); got != c {
+				t.Fatalf("ctrSeek(%08x, %d) = %08x, want %08x", start, n, got, c)
+			}
+			ctrNext(&c)
+		}
+
+		// Steps past a whole period of the high word, modulo 2^32 - 1
+		c = start
+		for n := 0; n < 300000; n++ {
+			ctrNext(&c)
+		}
+		if got := ctrSeek(start, 300000); got != c {
+			t.Fatalf("ctrSeek(%08x, 300000) = %08x, want %08x", start, got, c)
+		}
+
+		// Seeks far beyond 2^32 blocks compose
+		for _, n := range []uint64{0xFFFFFFFE, 0xFFFFFFFF, 1 << 32, 1<<40 + 7} {
+			if ctrSeek(ctrSeek(start, n), 300000) != ctrSeek(c, n) {
+				t.Fatalf("ctrSeek(%08x, %d) does not compose", start, n)
+			}
+		}
+	}
+}
+
+func TestCFB(t *testing.T) {
+	g := testGost89()
+	iv := BytesToBlock64(benchIv)
+
+	for _, size := range append(testSizes, parallelMinSize+13) {
+		src := testData(size)
+		want := refCFB(g, iv, src, false)
+
+		g.SetIvBytes(benchIv)
+		if !bytes.Equal(g.EncryptBytesCFB(src), want) {
+			t.Fatalf("EncryptBytesCFB, %d bytes", size)
+		}
+
+		g.SetIvBytes(benchIv)
+		if !bytes.Equal(g.DecryptBytesCFB(want), src) {
+			t.Fatalf("DecryptBytesCFB, %d bytes", size)
+		}
+
+		// Block boundary splits of the byte functions continue each other
+		g.SetIvBytes(benchIv)
+		half := size / 2 &^ 7
+		got := append(g.EncryptBytesCFB(src[:half]), g.EncryptBytesCFB(src[half:])...)
+		if !bytes.Equal(got, want) {
+			t.Fatalf("EncryptBytesCFB in two calls, %d bytes", size)
+		}
+
+		dst := append([]byte(nil), src...)
+		xorSplit(NewCFBEncrypter(g.Cipher(), benchIv), dst, dst)
+		if !bytes.Equal(dst, want) {
+			t.Fatalf("CFB encrypter, %d bytes", size)
+		}
+
+		xorSplit(NewCFBDecrypter(g.Cipher(), benchIv), dst, dst)
+		if !bytes.Equal(dst, src) {
+			t.Fatalf("CFB decrypter, %d bytes", size)
+		}
+
+		dst = make([]byte, size)
+		xorSplit(NewCFBDecrypter(g.Cipher(), benchIv), dst, src)
+		if !bytes.Equal(dst, refCFB(g, iv, src, true)) {
+			t.Fatalf("CFB decrypter of plain data, %d bytes", size)
+		}
+	}
+}
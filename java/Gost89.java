@@ -1,3 +1,4 @@
+import java.nio.BufferOverflowException;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
 import java.util.Arrays;
@@ -81,8 +82,17 @@ public class Gost89 {
     }
 
     public int[] encrypt(int[] plain) {
-        int a = plain[0];
-        int b = plain[1];
+        long t = encrypt(pack(plain[0], plain[1]));
+        return new int[]{(int)t, (int)(t >>> 32)};
+    }
+
+    /**
+     * One block packed in a long as by setIv(long): word 0 in the low half.
+     * Unlike the int[] overload it allocates nothing.
+     */
+    public long encrypt(long plain) {
+        int a = (int)plain;
+        int b = (int)(plain >>> 32);
         int t;
 
         for (int i = 0; i < 3; i++) {
@@ -139,7 +149,7 @@ public class Gost89 {
             a ^= t << 11 | (t >> 21 & 0x7FF);
         }
 
-        return new int[]{b, a};
+        return pack(b, a);
     }
 
     public byte[] encrypt(byte[] plain) {
@@ -149,8 +159,13 @@ public class Gost89 {
     }
 
     public int[] decrypt(int[] encrypted) {
-        int a = encrypted[0];
-        int b = encrypted[1];
+        long t = decrypt(pack(encrypted[0], encrypted[1]));
+        return new int[]{(int)t, (int)(t >>> 32)};
+    }
+
+    public long decrypt(long encrypted) {
+        int a = (int)encrypted;
+        int b = (int)(encrypted >>> 32);
         int t;
 
         for (int j = 0; j < 8; j += 2) {
@@ -187,7 +202,7 @@ public class Gost89 {
             }
         }
 
-        return new int[]{b, a};
+        return pack(b, a);
     }
 
     public byte[] decrypt(byte[] encrypted) {
@@ -240,51 +255,111 @@ public class Gost89 {
         );
     }
 
+    /**
+     * The ByteBuffer methods transform the remaining bytes of src into dst,
+     * heap or direct buffers of any byte order, and advance both positions as
+     * a bulk put does. They allocate nothing. src and dst may be the same
+     * buffer, to work in place.
+     *
+     * ECB takes whole blocks only.
+     */
+    public void encryptECB(ByteBuffer src, ByteBuffer dst) {
+        int length = checkBlocks(src, dst);
+        int s = src.position(), d = dst.position();
+
+        for (int i = 0; i < length; i += 8) {
+            putBlock(dst, d + i, encrypt(getBlock(src, s + i)));
+        }
+
+        src.position(s + length);
+        dst.position(d + length);
+    }
+
+    public void decryptECB(ByteBuffer src, ByteBuffer dst) {
+        int length = checkBlocks(src, dst);
+        int s = src.position(), d = dst.position();
+
+        for (int i = 0; i < length; i += 8) {
+            putBlock(dst, d + i, decrypt(getBlock(src, s + i)));
+        }
+
+        src.position(s + length);
+        dst.position(d + length);
+    }
+
     public void initCTR() {
-        iv = encrypt(iv);
+        setIv(encrypt(pack(iv[0], iv[1])));
     }
 
     public int[] encryptCTR(int[] plain) {
         int length = plain.length;
         int[] encrypted = new int[length];
-        int[] t;
+        long counter = pack(iv[0], iv[1]);
+        long t;
 
         for (int i = 0; i < length; i += 2) {
-            iv[0] += 0x1010101;
-
-            if (iv[1] < 0 && iv[1] > 0xFFFFFFFF - 0x1010104) {
-                iv[1] += 0x1010104 + 1;
-            } else {
-                iv[1] += 0x1010104;
-            }
-
-            t = encrypt(iv);
+            counter = nextCounter(counter);
+            t = encrypt(counter);
 
-            encrypted[i] = plain[i] ^ t[0];
-            encrypted[i + 1] = plain[i + 1] ^ t[1];
+            encrypted[i] = plain[i] ^ (int)t;
+            encrypted[i + 1] = plain[i + 1] ^ (int)(t >>> 32);
         }
 
+        setIv(counter);
+
         return encrypted;
     }
 
     public byte[] encryptCTR(byte[] plain) {
-        return Arrays.copyOf(intArrayToByteArray(
-            encryptCTR(
-                byteArrayToIntArray(plain)
-            )
-        ), plain.length);
+        byte[] encrypted = new byte[plain.length];
+        encryptCTR(wrap(plain), wrap(encrypted));
+        return encrypted;
+    }
+
+    public void encryptCTR(ByteBuffer src, ByteBuffer dst) {
+        int length = checkBuffers(src, dst);
+        int s = src.position(), d = dst.position(), i;
+        long counter = pack(iv[0], iv[1]);
+
+        for (i = 0; i + 8 <= length; i += 8) {
+            counter = nextCounter(counter);
+            putBlock(dst, d + i, getBlock(src, s + i) ^ encrypt(counter));
+        }
+
+        if (i < length) {
+            counter = nextCounter(counter);
+            putTail(dst, d + i, length - i, getTail(src, s + i, length - i) ^ encrypt(counter));
+        }
+
+        setIv(counter);
+
+        src.position(s + length);
+        dst.position(d + length);
+    }
+
+    protected static long nextCounter(long counter) {
+        int n0 = (int)counter + 0x1010101;
+        int n1 = (int)(counter >>> 32);
+
+        if (Integer.compareUnsigned(n1, 0xFFFFFFFF - 0x1010104) > 0) {
+            n1 += 0x1010104 + 1;
+        } else {
+            n1 += 0x1010104;
+        }
+
+        return pack(n0, n1);
     }
 
     public int[] encryptCFB(int[] plain) {
         int length = plain.length;
         int[] encrypted = new int[length];
-        int[] t;
+        long t;
 
         for (int i = 0; i < length; i += 2) {
-            t = encrypt(iv);
+            t = encrypt(pack(iv[0], iv[1]));
 
-            encrypted[i] = plain[i] ^ t[0];
-            encrypted[i + 1] = plain[i + 1] ^ t[1];
+            encrypted[i] = plain[i] ^ (int)t;
+            encrypted[i + 1] = plain[i + 1] ^ (int)(t >>> 32);
 
             iv[0] = encrypted[i];
             iv[1] = encrypted[i + 1];
@@ -294,23 +369,43 @@ public class Gost89 {
     }
 
     public byte[] encryptCFB(byte[] plain) {
-        return Arrays.copyOf(intArrayToByteArray(
-            encryptCFB(
-                byteArrayToIntArray(plain)
-            )
-        ), plain.length);
+        byte[] encrypted = new byte[plain.length];
+        encryptCFB(wrap(plain), wrap(encrypted));
+        return encrypted;
+    }
+
+    /* A short last block is fed back padded with zeros, as the byte[] methods always did */
+    public void encryptCFB(ByteBuffer src, ByteBuffer dst) {
+        int length = checkBuffers(src, dst);
+        int s = src.position(), d = dst.position(), i;
+        long feedback = pack(iv[0], iv[1]);
+
+        for (i = 0; i + 8 <= length; i += 8) {
+            feedback = getBlock(src, s + i) ^ encrypt(feedback);
+            putBlock(dst, d + i, feedback);
+        }
+
+        if (i < length) {
+            feedback = getTail(src, s + i, length - i) ^ encrypt(feedback);
+            putTail(dst, d + i, length - i, feedback);
+        }
+
+        setIv(feedback);
+
+        src.position(s + length);
+        dst.position(d + length);
     }
 
     public int[] decryptCFB(int[] encrypted) {
         int length = encrypted.length;
         int[] plain = new int[length];
-        int[] t;
+        long t;
 
         for (int i = 0; i < length; i += 2) {
-            t = encrypt(iv);
+            t = encrypt(pack(iv[0], iv[1]));
 
-            plain[i] = encrypted[i] ^ t[0];
-            plain[i + 1] = encrypted[i + 1] ^ t[1];
+            plain[i] = encrypted[i] ^ (int)t;
+            plain[i + 1] = encrypted[i + 1] ^ (int)(t >>> 32);
 
             iv[0] = encrypted[i];
             iv[1] = encrypted[i + 1];
@@ -320,39 +415,81 @@ public class Gost89 {
     }
 
     public byte[] decryptCFB(byte[] encrypted) {
-        return Arrays.copyOf(intArrayToByteArray(
-            decryptCFB(
-                byteArrayToIntArray(encrypted)
-            )
-        ), encrypted.length);
+        byte[] plain = new byte[encrypted.length];
+        decryptCFB(wrap(encrypted), wrap(plain));
+        return plain;
+    }
+
+    public void decryptCFB(ByteBuffer src, ByteBuffer dst) {
+        int length = checkBuffers(src, dst);
+        int s = src.position(), d = dst.position(), i;
+        long feedback = pack(iv[0], iv[1]), block;
+
+        for (i = 0; i + 8 <= length; i += 8) {
+            block = getBlock(src, s + i);
+            putBlock(dst, d + i, block ^ encrypt(feedback));
+            feedback = block;
+        }
+
+        if (i < length) {
+            block = getTail(src, s + i, length - i);
+            putTail(dst, d + i, length - i, block ^ encrypt(feedback));
+            feedback = block;
+        }
+
+        setIv(feedback);
+
+        src.position(s + length);
+        dst.position(d + length);
     }
 
     public int computeMac(int[] plain) {
         int length = plain.length;
+        long t = pack(mac[0], mac[1]);
 
         for (int i = 0; i < length; i += 2) {
-            mac[0] ^= plain[i];
-            mac[1] ^= plain[i + 1];
-
-            mac = encrypt16(mac);
+            t = encrypt16(t ^ pack(plain[i], plain[i + 1]));
         }
 
+        mac[0] = (int)t;
+        mac[1] = (int)(t >>> 32);
+
         return mac[1];
     }
 
     public int computeMac(byte[] plain) {
-        return computeMac(
-            byteArrayToIntArray(plain)
-        );
+        return computeMac(wrap(plain));
+    }
+
+    /* A short last block is padded with zeros; the position is advanced over the whole input */
+    public int computeMac(ByteBuffer src) {
+        int length = src.remaining();
+        int s = src.position(), i;
+        long t = pack(mac[0], mac[1]);
+
+        for (i = 0; i + 8 <= length; i += 8) {
+            t = encrypt16(t ^ getBlock(src, s + i));
+        }
+
+        if (i < length) {
+            t = encrypt16(t ^ getTail(src, s + i, length - i));
+        }
+
+        mac[0] = (int)t;
+        mac[1] = (int)(t >>> 32);
+
+        src.position(s + length);
+
+        return mac[1];
     }
 
     public int getMac() {
         return mac[1];
     }
 
-    protected int[] encrypt16(int[] plain) {
-        int a = plain[0];
-        int b = plain[1];
+    protected long encrypt16(long plain) {
+        int a = (int)plain;
+        int b = (int)(plain >>> 32);
         int t;
 
         for (int i = 0; i < 2; i++) {
@@ -373,7 +510,60 @@ public class Gost89 {
             }
         }
 
-        return new int[]{a, b};
+        return pack(a, b);
+    }
+
+    protected static long pack(int low, int high) {
+        return (long)high << 32 | (low & 0xFFFFFFFFL);
+    }
+
+    protected static ByteBuffer wrap(byte[] array) {
+        return ByteBuffer.wrap(array).order(ByteOrder.LITTLE_ENDIAN);
+    }
+
+    protected static int checkBuffers(ByteBuffer src, ByteBuffer dst) {
+        int length = src.remaining();
+
+        if (dst.remaining() < length) {
+            throw new BufferOverflowException();
+        }
+
+        return length;
+    }
+
+    protected static int checkBlocks(ByteBuffer src, ByteBuffer dst) {
+        if (src.remaining() % 8 != 0) {
+            throw new IllegalArgumentException("Input must be a multiple of 8 bytes");
+        }
+
+        return checkBuffers(src, dst);
+    }
+
+    /* Eight bytes at index as a block, little-endian whatever the order of the buffer */
+    protected static long getBlock(ByteBuffer bb, int index) {
+        long v = bb.getLong(index);
+        return bb.order() == ByteOrder.LITTLE_ENDIAN ? v : Long.reverseBytes(v);
+    }
+
+    protected static void putBlock(ByteBuffer bb, int index, long v) {
+        bb.putLong(index, bb.order() == ByteOrder.LITTLE_ENDIAN ? v : Long.reverseBytes(v));
+    }
+
+    /* The 1 to 7 bytes of a short last block, zero-padded */
+    protected static long getTail(ByteBuffer bb, int index, int length) {
+        long v = 0;
+
+        for (int i = 0; i < length; i++) {
+            v |= (bb.get(index + i) & 0xFFL) << (i * 8);
+        }
+
+        return v;
+    }
+
+    protected static void putTail(ByteBuffer bb, int index, int length, long v) {
+        for (int i = 0; i < length; i++) {
+            bb.put(index + i, (byte)(v >>> (i * 8)));
+        }
     }
 
     protected byte[] intArrayToByteArray(int[] intArray) {
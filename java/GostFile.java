@@ -0,0 +1,251 @@
+import java.io.*;
+import java.util.Arrays;
+
+public class GostFile {
+    protected static final int IO_BUFSIZE = 65536;
+
+    protected static final int OPERATION_NONE = 0;
+    protected static final int OPERATION_ENCRYPT = 1;
+    protected static final int OPERATION_DECRYPT = 2;
+    protected static final int OPERATION_MAC = 3;
+
+    protected static int operation = OPERATION_NONE;
+    protected static String mode = "ctr";
+    protected static boolean computeMac = false;
+    protected static String sboxFile = null;
+    protected static String keyFile = null;
+    protected static String ivStr = null;
+    protected static String inFile = null;
+    protected static String outFile = null;
+
+    protected static Gost89 gost89;
+
+    public static void main(String[] args) {
+        if (!parseArgs(args)) {
+            printUsage();
+            System.exit(1);
+        }
+
+        gost89 = new Gost89();
+
+        try {
+            gost89.setSbox(readSbox(sboxFile));
+            gost89.setKey(readFile(keyFile, 32));
+        } catch (IOException e) {
+            System.err.println(e.getMessage());
+            System.exit(1);
+        }
+
+        if (ivStr != null) {
+            if (ivStr.startsWith("0x") || ivStr.startsWith("0X")) {
+                ivStr = ivStr.substring(2);
+            }
+            gost89.setIv(Long.parseUnsignedLong(ivStr, 16));
+        }
+
+        gost89.resetMac();
+
+        long t0 = System.currentTimeMillis();
+
+        try {
+            process();
+        } catch (IOException e) {
+            System.err.println(e.getMessage());
+            System.exit(1);
+        }
+
+        long t1 = System.currentTimeMillis();
+
+        System.out.printf("%d ms\n", t1 - t0);
+
+        if (computeMac) {
+            System.out.printf("\nMAC:\t%08x\n", gost89.getMac());
+        }
+    }
+
+    protected static void process() throws IOException {
+        InputStream in = new BufferedInputStream(new FileInputStream(inFile), IO_BUFSIZE);
+        OutputStream out = null;
+        byte[] buffer = new byte[IO_BUFSIZE];
+        byte[] chunk;
+        int length;
+
+        if (operation != OPERATION_MAC) {
+            out = new BufferedOutputStream(new FileOutputStream(outFile), IO_BUFSIZE);
+        }
+
+        if (operation != OPERATION_MAC && mode.equals("ctr")) {
+            gost89.initCTR();
+        }
+
+        while ((length = readChunk(in, buffer)) > 0) {
+            chunk = length == IO_BUFSIZE ? buffer : Arrays.copyOf(buffer, length);
+
+            if (operation == OPERATION_MAC) {
+                gost89.computeMac(chunk);
+                continue;
+            }
+
+            if (operation == OPERATION_ENCRYPT) {
+                if (computeMac) {
+                    gost89.computeMac(chunk);
+                }
+                chunk = encrypt(chunk);
+            } else {
+                chunk = decrypt(chunk);
+                if (computeMac) {
+                    gost89.computeMac(chunk);
+                }
+            }
+
+            out.write(chunk, 0, length);
+        }
+
+        in.close();
+
+        if (out != null) {
+            out.close();
+        }
+    }
+
+    protected static byte[] encrypt(byte[] plain) {
+        switch (mode) {
+            case "ecb":
+                return gost89.encryptECB(plain);
+            case "cfb":
+                return gost89.encryptCFB(plain);
+            default:
+                return gost89.encryptCTR(plain);
+        }
+    }
+
+    protected static byte[] decrypt(byte[] encrypted) {
+        switch (mode) {
+            case "ecb":
+                return gost89.decryptECB(encrypted);
+            case "cfb":
+                return gost89.decryptCFB(encrypted);
+            default:
+                return gost89.encryptCTR(encrypted);
+        }
+    }
+
+    protected static int readChunk(InputStream in, byte[] buffer) throws IOException {
+        int total = 0, n;
+
+        while (total < buffer.length && (n = in.read(buffer, total, buffer.length - total)) > 0) {
+            total += n;
+        }
+
+        return total;
+    }
+
+    protected static byte[] readFile(String filename, int size) throws IOException {
+        byte[] content = new byte[size];
+        InputStream in = new FileInputStream(filename);
+
+        int n = readChunk(in, content);
+        in.close();
+
+        if (n != size) {
+            throw new IOException("Invalid file: " + filename);
+        }
+
+        return content;
+    }
+
+    protected static int[][] readSbox(String filename) throws IOException {
+        byte[] content = readFile(filename, 128);
+        int[][] sbox = new int[8][16];
+
+        for (int i = 0; i < 128; i++) {
+            sbox[i / 16][i % 16] = (content[i] & 0xFF) % 16;
+        }
+
+        return sbox;
+    }
+
+    protected static boolean parseArgs(String[] args) {
+        int i;
+
+        for (i = 0; i < args.length && args[i].startsWith("-"); i++) {
+            switch (args[i]) {
+                case "-e":
+                case "--encrypt":
+                    operation = OPERATION_ENCRYPT;
+                    break;
+                case "-d":
+                case "--decrypt":
+                    operation = OPERATION_DECRYPT;
+                    break;
+                case "-a":
+                case "--mac":
+                    if (operation == OPERATION_NONE) {
+                        operation = OPERATION_MAC;
+                    }
+                    computeMac = true;
+                    break;
+                case "-m":
+                case "--mode":
+                    mode = args[++i].toLowerCase();
+                    break;
+                case "-s":
+                case "--sbox":
+                    sboxFile = args[++i];
+                    break;
+                case "-k":
+                case "--key":
+                    keyFile = args[++i];
+                    break;
+                case "-i":
+                case "--iv":
+                    ivStr = args[++i];
+                    break;
+                default:
+                    System.err.println("Unknown option: " + args[i]);
+                    return false;
+            }
+        }
+
+        if (operation == OPERATION_NONE) {
+            operation = OPERATION_ENCRYPT;
+        }
+
+        if (!mode.equals("ecb") && !mode.equals("ctr") && !mode.equals("cfb")) {
+            System.err.println("Unknown mode: " + mode);
+            return false;
+        }
+
+        if (sboxFile == null || keyFile == null) {
+            System.err.println("S-box and key files must be specified");
+            return false;
+        }
+
+        if (i >= args.length || (operation != OPERATION_MAC && i + 1 >= args.length)) {
+            System.err.println("No input or output file specified");
+            return false;
+        }
+
+        inFile = args[i];
+        if (operation != OPERATION_MAC) {
+            outFile = args[i + 1];
+        }
+
+        return true;
+    }
+
+    protected static void printUsage() {
+        System.out.print(
+            "\n" +
+            "Usage: java GostFile [options] <in_file> [out_file]\n\n" +
+            "Options:\n" +
+            "  -e, --encrypt      Encrypt\n" +
+            "  -d, --decrypt      Decrypt\n" +
+            "  -a, --mac          Compute a message authentication code\n" +
+            "  -m, --mode <mode>  Encryption mode: ecb | ctr | cfb\n" +
+            "  -s, --sbox <file>  S-box file\n" +
+            "  -k, --key <file>   Key file\n" +
+            "  -i, --iv <value>   Initial vector, up to 16 hexadecimal digits\n"
+        );
+    }
+}
@@ -1,4 +1,8 @@
 import java.io.*;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Arrays;
+import java.util.Random;
 
 public class Test {
     protected static int[][] defaultSbox = {
@@ -18,6 +22,12 @@ public class Test {
         "proident, sunt in culpa qui officia deserunt mollit anim id est laborum. OLOLO!!!11";
 
     protected static Gost89 gost89;
+    protected static boolean failed;
+
+    /* Message lengths for the ByteBuffer checks: empty, short tails, and several vector lane groups */
+    protected static final int[] lengths = {0, 1, 4, 7, 8, 9, 15, 16, 31, 63, 64, 65, 127, 128, 129, 255, 256, 263, 1000, 1029};
+    protected static final String[] modes = {"ecb", "ecb-decrypt", "ctr", "cfb", "cfb-decrypt", "mac"};
+    protected static final long testIv = 0x123456789ABCDEFL;
 
     public static void main(String[] args) {
         gost89 = new Gost89();
@@ -32,7 +42,12 @@ public class Test {
         testECB();
         testCTR();
         testCFB();
+        testBuffers();
         benchmark();
+
+        if (failed) {
+            System.exit(1);
+        }
     }
 
     protected static void test() {
@@ -102,6 +117,245 @@ public class Test {
         writeFile("cfb.2", decrypted);
     }
 
+    /**
+     * The byte[] and ByteBuffer methods of Gost89, and of Gost89Vector when
+     * it can be loaded, against the int[] methods on a zero-padded copy:
+     * heap and direct buffers, both byte orders, in place or not, at
+     * positions other than 0, in two calls split at a block boundary.
+     *
+     * The vector checks need the incubator module:
+     *
+     *     javac --add-modules jdk.incubator.vector Gost89.java Gost89Vector.java Test.java
+     *     java --add-modules jdk.incubator.vector Test
+     */
+    protected static void testBuffers() {
+        byte[] key = ("01234567890123456789012345678912").getBytes();
+        Gost89 base = new Gost89();
+        Gost89 vector = loadVector();
+
+        base.setSbox(defaultSbox);
+        base.setKey(key);
+        checkBuffers("buffers", base);
+
+        if (vector == null) {
+            System.out.println("vector: skipped, run with --add-modules jdk.incubator.vector");
+            return;
+        }
+
+        vector.setSbox(defaultSbox);
+        vector.setKey(key);
+        checkBuffers("vector", vector);
+    }
+
+    protected static Gost89 loadVector() {
+        try {
+            return (Gost89)Class.forName("Gost89Vector").getDeclaredConstructor().newInstance();
+        } catch (ReflectiveOperationException | LinkageError e) {
+            return null;
+        }
+    }
+
+    protected static void checkBuffers(String name, Gost89 engine) {
+        boolean ok = true;
+        ByteOrder[] orders = {ByteOrder.LITTLE_ENDIAN, ByteOrder.BIG_ENDIAN};
+
+        for (String mode : modes) {
+            for (int length : lengths) {
+                if (mode.startsWith("ecb") && length % 8 != 0) {
+                    continue;
+                }
+
+                byte[] data = new byte[length];
+                new Random(length).nextBytes(data);
+
+                byte[] expected = reference(mode, data);
+                int[] state = state(gost89);
+
+                /* byte[] ECB goes through int[] and cannot take an empty array */
+                if (!(mode.startsWith("ecb") && length == 0)) {
+                    ok &= compare(name, mode, "byte[]", length, expected, state, bytes(engine, mode, data), engine);
+                }
+
+                for (int direct = 0; direct < 2; direct++) {
+                    for (ByteOrder order : orders) {
+                        for (int inPlace = 0; inPlace < 2; inPlace++) {
+                            byte[] actual = buffers(engine, mode, data, direct == 1, order, inPlace == 1);
+                            String how = (direct == 1 ? "direct " : "heap ") + order + (inPlace == 1 ? " in place" : "");
+
+                            ok &= compare(name, mode, how, length, expected, state, actual, engine);
+                        }
+                    }
+                }
+            }
+        }
+
+        if (ok) {
+            System.out.println(name + ": ok");
+        } else {
+            failed = true;
+        }
+    }
+
+    protected static boolean compare(String name, String mode, String how, int length, byte[] expected, int[] state, byte[] actual, Gost89 engine) {
+        if (Arrays.equals(expected, actual) && Arrays.equals(state, state(engine))) {
+            return true;
+        }
+
+        System.out.printf("%s: %s %s, %d bytes: mismatch\n", name, mode, how, length);
+        return false;
+    }
+
+    protected static int[] state(Gost89 engine) {
+        return new int[]{engine.iv[0], engine.iv[1], engine.mac[0], engine.mac[1]};
+    }
+
+    protected static void prepare(Gost89 engine, String mode) {
+        engine.setIv(testIv);
+        engine.resetMac();
+
+        if (mode.equals("ctr")) {
+            engine.initCTR();
+        }
+    }
+
+    /* The int[] methods on the data padded with zeros to whole blocks, cut back to its length */
+    protected static byte[] reference(String mode, byte[] data) {
+        byte[] padded = Arrays.copyOf(data, (data.length + 7) / 8 * 8);
+        int[] in = padded.length > 0 ? gost89.byteArrayToIntArray(padded) : new int[0];
+        int[] out;
+
+        prepare(gost89, mode);
+
+        switch (mode) {
+            case "ecb":
+                out = gost89.encryptECB(in);
+                break;
+            case "ecb-decrypt":
+                out = gost89.decryptECB(in);
+                break;
+            case "ctr":
+                out = gost89.encryptCTR(in);
+                break;
+            case "cfb":
+                out = gost89.encryptCFB(in);
+                break;
+            case "cfb-decrypt":
+                out = gost89.decryptCFB(in);
+                break;
+            default:
+                gost89.computeMac(in);
+                return new byte[0];
+        }
+
+        return Arrays.copyOf(gost89.intArrayToByteArray(out), data.length);
+    }
+
+    protected static byte[] bytes(Gost89 engine, String mode, byte[] data) {
+        prepare(engine, mode);
+
+        switch (mode) {
+            case "ecb":
+                return engine.encryptECB(data);
+            case "ecb-decrypt":
+                return engine.decryptECB(data);
+            case "ctr":
+                return engine.encryptCTR(data);
+            case "cfb":
+                return engine.encryptCFB(data);
+            case "cfb-decrypt":
+                return engine.decryptCFB(data);
+            default:
+                engine.computeMac(data);
+                return new byte[0];
+        }
+    }
+
+    protected static void run(Gost89 engine, String mode, ByteBuffer src, ByteBuffer dst) {
+        switch (mode) {
+            case "ecb":
+                engine.encryptECB(src, dst);
+                break;
+            case "ecb-decrypt":
+                engine.decryptECB(src, dst);
+                break;
+            case "ctr":
+                engine.encryptCTR(src, dst);
+                break;
+            case "cfb":
+                engine.encryptCFB(src, dst);
+                break;
+            case "cfb-decrypt":
+                engine.decryptCFB(src, dst);
+                break;
+            default:
+                engine.computeMac(src);
+                break;
+        }
+    }
+
+    /*
+     * The data is placed at position 3 of src and written at position 5 of
+     * dst (3 in place) between zero guard bytes, and processed in two calls.
+     * Returns null if a position is not advanced or a guard byte changes.
+     */
+    protected static byte[] buffers(Gost89 engine, String mode, byte[] data, boolean direct, ByteOrder order, boolean inPlace) {
+        int length = data.length, split = length / 2 & ~7;
+        int s = 3, d = inPlace ? s : 5;
+        ByteBuffer src = allocate(direct, order, s + length + 8);
+        ByteBuffer dst = inPlace ? src : allocate(direct, order, d + length + 8);
+        boolean mac = mode.equals("mac");
+        int[] ends = {split, length};
+        int start = 0;
+
+        src.position(s);
+        src.put(data);
+
+        prepare(engine, mode);
+
+        for (int end : ends) {
+            src.limit(s + end);
+            src.position(s + start);
+            if (!inPlace) {
+                dst.position(d + start);
+            }
+
+            run(engine, mode, src, dst);
+
+            if (src.position() != s + end || (!mac && dst.position() != d + end)) {
+                return null;
+            }
+            start = end;
+        }
+
+        if (mac) {
+            return new byte[0];
+        }
+
+        /* Absolute reads are bounded by the limit, which is still at the end of the data in place */
+        dst.limit(dst.capacity());
+        for (int i = 0; i < d; i++) {
+            if (!inPlace && dst.get(i) != 0) {
+                return null;
+            }
+        }
+        for (int i = d + length; i < dst.capacity(); i++) {
+            if (dst.get(i) != 0) {
+                return null;
+            }
+        }
+
+        byte[] out = new byte[length];
+        for (int i = 0; i < length; i++) {
+            out[i] = dst.get(d + i);
+        }
+
+        return out;
+    }
+
+    protected static ByteBuffer allocate(boolean direct, ByteOrder order, int size) {
+        return (direct ? ByteBuffer.allocateDirect(size) : ByteBuffer.allocate(size)).order(order);
+    }
+
     protected static void benchmark() {
         int i;
         long t0, t1;
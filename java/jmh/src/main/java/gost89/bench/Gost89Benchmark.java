@@ -0,0 +1,131 @@
+package gost89.bench;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.concurrent.TimeUnit;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.Warmup;
+
+/**
+ * Throughput of the byte[] methods, the ByteBuffer methods on heap and
+ * direct buffers, and the Vector API kernel, in messages of size bytes per
+ * second (times size for bytes per second).
+ */
+@State(Scope.Thread)
+@BenchmarkMode(Mode.Throughput)
+@OutputTimeUnit(TimeUnit.SECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 5, time = 1)
+@Fork(value = 1, jvmArgsAppend = {"--add-modules", "jdk.incubator.vector"})
+public class Gost89Benchmark {
+    protected static final int[][] SBOX = {
+        {4, 10, 9, 2, 13, 8, 0, 14, 6, 11, 1, 12, 7, 15, 5, 3},
+        {14, 11, 4, 12, 6, 13, 15, 10, 2, 3, 8, 1, 0, 7, 5, 9},
+        {5, 8, 1, 13, 10, 3, 4, 2, 14, 15, 12, 7, 6, 0, 9, 11},
+        {7, 13, 10, 1, 0, 8, 9, 15, 14, 4, 6, 12, 11, 2, 5, 3},
+        {6, 12, 7, 1, 5, 15, 13, 8, 4, 10, 9, 14, 0, 3, 11, 2},
+        {4, 11, 10, 0, 7, 2, 1, 13, 3, 6, 8, 5, 9, 12, 15, 14},
+        {13, 11, 4, 1, 3, 15, 5, 9, 0, 10, 14, 7, 6, 8, 2, 12},
+        {1, 15, 13, 0, 5, 7, 10, 4, 9, 2, 3, 14, 6, 11, 8, 12}
+    };
+
+    @Param({"64", "4096", "1048576"})
+    public int size;
+
+    @Param({"heap", "direct"})
+    public String buffer;
+
+    protected Gost89 gost89;
+    protected Gost89Vector vector;
+    protected byte[] plain;
+    protected ByteBuffer src;
+    protected ByteBuffer dst;
+
+    @Setup
+    public void setup() {
+        byte[] key = "01234567890123456789012345678912".getBytes();
+
+        gost89 = new Gost89();
+        gost89.setSbox(SBOX);
+        gost89.setKey(key);
+        gost89.setIv(0xFF);
+        gost89.initCTR();
+
+        vector = new Gost89Vector();
+        vector.setSbox(SBOX);
+        vector.setKey(key);
+        vector.setIv(0xFF);
+        vector.initCTR();
+
+        plain = new byte[size];
+        for (int i = 0; i < size; i++) {
+            plain[i] = (byte)(i * 11);
+        }
+
+        src = allocate();
+        dst = allocate();
+        src.put(plain).flip();
+    }
+
+    protected ByteBuffer allocate() {
+        ByteBuffer bb = buffer.equals("direct") ? ByteBuffer.allocateDirect(size) : ByteBuffer.allocate(size);
+        return bb.order(ByteOrder.LITTLE_ENDIAN);
+    }
+
+    protected ByteBuffer rewind() {
+        src.rewind();
+        dst.clear();
+        return dst;
+    }
+
+    @Benchmark
+    public byte[] ctrBytes() {
+        return gost89.encryptCTR(plain);
+    }
+
+    @Benchmark
+    public ByteBuffer ctrBuffer() {
+        gost89.encryptCTR(src, rewind());
+        return dst;
+    }
+
+    @Benchmark
+    public ByteBuffer ctrVector() {
+        vector.encryptCTR(src, rewind());
+        return dst;
+    }
+
+    @Benchmark
+    public ByteBuffer ecbBuffer() {
+        gost89.encryptECB(src, rewind());
+        return dst;
+    }
+
+    @Benchmark
+    public ByteBuffer ecbVector() {
+        vector.encryptECB(src, rewind());
+        return dst;
+    }
+
+    @Benchmark
+    public ByteBuffer cfbBuffer() {
+        gost89.encryptCFB(src, rewind());
+        return dst;
+    }
+
+    @Benchmark
+    public int macBuffer() {
+        src.rewind();
+        return gost89.computeMac(src);
+    }
+}
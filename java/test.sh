@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+#
+# Compiles the Java port, Gost89Vector included, and runs Test, which checks
+# the byte[], ByteBuffer and Vector API methods against the int[] reference.
+# Needs a JDK with the jdk.incubator.vector module (16 or later).
+#
+# Usage: java/test.sh
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if ! command -v javac > /dev/null; then
+    echo "javac not found, the Java port cannot be tested" >&2
+    exit 2
+fi
+
+javac --add-modules jdk.incubator.vector -d "$WORK" \
+    "$DIR/Gost89.java" "$DIR/Gost89Vector.java" "$DIR/GostFile.java" "$DIR/Test.java" || exit 1
+
+# Test writes its sample files to the current directory
+cd "$WORK" || exit 1
+java --add-modules jdk.incubator.vector -cp "$WORK" Test > test.out
+status=$?
+grep ': ' test.out
+
+# Without the vector checks the port is not fully tested
+[ $status = 0 ] && grep -q '^buffers: ok' test.out && grep -q '^vector: ok' test.out